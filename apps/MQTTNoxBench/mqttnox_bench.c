@@ -0,0 +1,1461 @@
+/*****************************************************************************
+* Copyright (c) [2024] Argenox Technologies LLC
+* All rights reserved.
+*
+*
+*
+* NOTICE:  All information contained herein, source code, binaries and
+* derived works is, and remains the property of Argenox and its suppliers,
+* if any.  The intellectual and technical concepts contained
+* herein are proprietary to Argenox and its suppliers and may be covered
+* by U.S. and Foreign Patents, patents in process, and are protected by
+* trade secret or copyright law.
+*
+* Licensing of this software can be found in LICENSE
+*
+* THIS SOFTWARE IS PROVIDED BY ARGENOX "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ARGENOX LLC BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* CONTACT: info@argenox.com
+*
+* File:    mqttnox_bench.c
+* Summary: MQTTNox Codec Microbenchmarks
+*
+* Usage:   mqttnox_bench [filter]
+*
+*          Runs every benchmark whose name contains filter. Each benchmark
+*          is repeated with a doubling iteration count until it runs for at
+*          least BENCH_MIN_NS, then ns/op and MB/s are reported.
+*
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "mqttnox.h"
+#include "mqttnoxlib.h"
+#include "mqttnox_tal.h"
+#include "mqttnox_inflight.h"
+#include "mqttnox_ident.h"
+#include "mqttnox_offline.h"
+#include "mqttnox_timer.h"
+#include "mqttnox_router.h"
+#include "mqttnox_loopback.h"
+
+/* Minimum measured time per benchmark */
+#define BENCH_MIN_NS        200000000ULL
+
+/* Size of the synthetic receive stream */
+#define BENCH_STREAM_SIZE   (1024 * 1024)
+
+/* Session store files, created in the working directory and removed at exit */
+#define BENCH_SESSION_PATH  "mqttnox_bench_session.db"
+#define BENCH_RESTART_PATH  "mqttnox_bench_restart.db"
+
+/* Offline spill file, the library removes it once mapped */
+#define BENCH_OFFLINE_PATH  "mqttnox_bench_offline.spill"
+
+/* Returns the number of bytes processed by iters operations */
+typedef uint64_t (*bench_fn_t)(void* arg, uint64_t iters);
+
+typedef struct
+{
+    const char* name;
+    bench_fn_t fn;
+    void* arg;
+
+} bench_t;
+
+/* Results are folded in here so the compiler cannot drop the work */
+static volatile uint64_t bench_sink;
+
+static mqttnox_client_t bench_client;
+static mqttnox_client_t bench_ack_client;
+static mqttnox_client_t bench_restart_client;
+static uint64_t bench_evt_cnt;
+
+static uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void bench_run(const bench_t* b, uint64_t ops_per_iter)
+{
+    uint64_t iters = 1;
+    uint64_t start;
+    uint64_t elapsed;
+    uint64_t bytes;
+    uint64_t ops;
+
+    for (;;)
+    {
+        start = bench_now_ns();
+        bytes = b->fn(b->arg, iters);
+        elapsed = bench_now_ns() - start;
+
+        if (elapsed >= BENCH_MIN_NS) {
+            break;
+        }
+        iters *= 2;
+    }
+
+    ops = iters * ops_per_iter;
+
+    printf("%-34s %12llu ops %10.2f ns/op %8.2f Mops/s %10.2f MB/s\n",
+           b->name,
+           (unsigned long long)ops,
+           (double)elapsed / (double)ops,
+           (double)ops * 1000.0 / (double)elapsed,
+           (double)bytes * 1000.0 / (double)elapsed);
+}
+
+static void bench_callback(mqttnox_evt_data_t* evt_data)
+{
+    bench_evt_cnt++;
+
+    if (evt_data->evt_id == MQTTNOX_EVT_RECEIVED) {
+        bench_sink += evt_data->evt.received_evt.payload_len;
+    }
+}
+
+/**@brief Connects the benchmark client to a loopback broker that drops
+ *        everything it is sent
+ *
+ * @note The second client's broker acknowledges every QoS 1 and 2 PUBLISH,
+ *       it is connected by each publish_window benchmark
+ */
+static void bench_client_setup(void)
+{
+    mqttnox_client_conf_t conf;
+    mqttnox_loopback_conf_t lb_conf;
+
+    mqttnox_init(&bench_client, MQTTNOX_DEBUG_LVL_NONE);
+
+    memset(&lb_conf, 0, sizeof(lb_conf));
+    lb_conf.sink = 1;
+    mqttnox_loopback_configure(&bench_client, &lb_conf);
+
+    memset(&conf, 0, sizeof(conf));
+    conf.server.addr = "loopback";
+    conf.server.port = 1883;
+    conf.client_identifier = "bench";
+    conf.callback = bench_callback;
+    conf.max_inflight = MQTTNOX_INFLIGHT_WINDOW_MAX;
+
+    mqttnox_connect(&bench_client, &conf, 60);
+
+    mqttnox_init(&bench_ack_client, MQTTNOX_DEBUG_LVL_NONE);
+
+    memset(&lb_conf, 0, sizeof(lb_conf));
+    lb_conf.ack_publish = 1;
+    mqttnox_loopback_configure(&bench_ack_client, &lb_conf);
+}
+
+/**@brief Empties the benchmark client's in-flight window
+ *
+ * @note The sink broker never acknowledges, so publish loops call this when
+ *       the window fills. Once per MQTTNOX_INFLIGHT_WINDOW_MAX messages, the
+ *       cost per publish is negligible.
+ */
+static void bench_window_clear(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < MQTTNOX_INFLIGHT_SLOTS; i++) {
+        if (bench_client.inflight.entry[i].ident != 0) {
+            mqttnox_ident_release(&bench_client.packet_ident, bench_client.inflight.entry[i].ident);
+        }
+    }
+
+    mqttnox_inflight_init(&bench_client.inflight, MQTTNOX_INFLIGHT_WINDOW_MAX);
+}
+
+/*
+ * Remaining length
+ */
+
+typedef struct
+{
+    uint32_t value;
+    uint8_t encoded[4];
+    int encoded_len;
+
+} bench_remain_len_t;
+
+static uint64_t bench_set_remain_len(void* arg, uint64_t iters)
+{
+    bench_remain_len_t* r = (bench_remain_len_t*)arg;
+    uint8_t buf[4];
+    uint64_t bytes = 0;
+    uint64_t i;
+
+    for (i = 0; i < iters; i++) {
+        bytes += mqttnox_set_remain_len(buf, r->value + (uint32_t)(i & 1));
+        bench_sink += buf[3];
+    }
+
+    return bytes;
+}
+
+static uint64_t bench_decode_remain_len(void* arg, uint64_t iters)
+{
+    bench_remain_len_t* r = (bench_remain_len_t*)arg;
+    uint32_t len;
+    uint64_t bytes = 0;
+    uint64_t i;
+
+    for (i = 0; i < iters; i++) {
+        bytes += mqttnox_decode_remain_len(&r->encoded[4 - r->encoded_len], &len);
+        bench_sink += len;
+    }
+
+    return bytes;
+}
+
+/*
+ * UTF-8 string
+ */
+
+static uint64_t bench_wr_str(void* arg, uint64_t iters)
+{
+    const char* str = (const char*)arg;
+    uint8_t buf[MQTTNOX_TX_BUF_SIZE] = { 0 };
+    mqttnox_wr_t w;
+    uint64_t bytes = 0;
+    uint64_t i;
+
+    for (i = 0; i < iters; i++) {
+        mqttnox_wr_init(&w, buf, sizeof(buf));
+        mqttnox_wr_str(&w, mqttnox_str(str));
+        if (w.err) {
+            break;
+        }
+        bytes += w.pos - MQTTNOX_FIXED_HDR_MAX_LEN;
+        bench_sink += buf[MQTTNOX_FIXED_HDR_MAX_LEN + 2];
+    }
+
+    return bytes;
+}
+
+/*
+ * PUBLISH encode
+ */
+
+typedef struct
+{
+    mqttnox_qos_t qos;
+    char* topic;
+    char* msg;
+
+} bench_publish_t;
+
+static uint64_t bench_publish(void* arg, uint64_t iters)
+{
+    bench_publish_t* p = (bench_publish_t*)arg;
+    mqttnox_loopback_stats_t stats;
+    uint64_t i;
+
+    mqttnox_loopback_reset_stats(&bench_client);
+
+    for (i = 0; i < iters; i++) {
+        if (mqttnox_publish(&bench_client, p->qos, 0, 0, p->topic, p->msg) == MQTTNOX_RC_ERROR_INFLIGHT_FULL) {
+            bench_window_clear();
+            mqttnox_publish(&bench_client, p->qos, 0, 0, p->topic, p->msg);
+        }
+    }
+
+    mqttnox_loopback_get_stats(&bench_client, &stats);
+
+    return stats.rx_bytes;
+}
+
+/*
+ * PUBLISH of a binary payload
+ */
+
+static uint64_t bench_publish_bin(void* arg, uint64_t iters)
+{
+    bench_publish_t* p = (bench_publish_t*)arg;
+    mqttnox_loopback_stats_t stats;
+    uint32_t msg_len = (uint32_t)strlen(p->msg);
+    uint64_t i;
+
+    mqttnox_loopback_reset_stats(&bench_client);
+
+    for (i = 0; i < iters; i++) {
+        if (mqttnox_publish_bin(&bench_client, p->qos, 0, 0, p->topic, p->msg, msg_len) == MQTTNOX_RC_ERROR_INFLIGHT_FULL) {
+            bench_window_clear();
+            mqttnox_publish_bin(&bench_client, p->qos, 0, 0, p->topic, p->msg, msg_len);
+        }
+    }
+
+    mqttnox_loopback_get_stats(&bench_client, &stats);
+
+    return stats.rx_bytes;
+}
+
+/*
+ * PUBLISH to a topic handle
+ */
+
+static mqttnox_topic_handle_t bench_topic_handle;
+
+static uint64_t bench_publish_handle(void* arg, uint64_t iters)
+{
+    bench_publish_t* p = (bench_publish_t*)arg;
+    mqttnox_loopback_stats_t stats;
+    uint32_t msg_len = (uint32_t)strlen(p->msg);
+    uint64_t i;
+
+    mqttnox_loopback_reset_stats(&bench_client);
+
+    for (i = 0; i < iters; i++) {
+        if (mqttnox_publish_handle(&bench_client, p->qos, 0, 0, &bench_topic_handle, p->msg, msg_len) == MQTTNOX_RC_ERROR_INFLIGHT_FULL) {
+            bench_window_clear();
+            mqttnox_publish_handle(&bench_client, p->qos, 0, 0, &bench_topic_handle, p->msg, msg_len);
+        }
+    }
+
+    mqttnox_loopback_get_stats(&bench_client, &stats);
+
+    return stats.rx_bytes;
+}
+
+/*
+ * QoS 1 / 2 PUBLISH against a broker that acknowledges
+ */
+
+typedef struct
+{
+    mqttnox_qos_t qos;
+    uint16_t window;
+    uint64_t rtt_ns;    /* Simulated round trip per poll of the broker */
+    const char* session;            /* Session store file, NULL for none */
+    mqttnox_store_sync_t sync;
+
+} bench_window_t;
+
+static void bench_wait_ns(uint64_t ns)
+{
+    uint64_t start = bench_now_ns();
+
+    while (bench_now_ns() - start < ns) {
+    }
+}
+
+/**@brief Connects the client whose broker answers, \see bench_client_setup */
+static void bench_ack_connect(uint16_t window, const char* session, mqttnox_store_sync_t sync)
+{
+    mqttnox_client_conf_t conf;
+
+    memset(&conf, 0, sizeof(conf));
+    conf.server.addr = "loopback";
+    conf.server.port = 1883;
+    conf.client_identifier = "benchack";
+    conf.callback = bench_callback;
+    conf.clean_session = 1;
+    conf.max_inflight = window;
+    conf.session_path = session;
+    conf.session_sync = sync;
+
+    mqttnox_connect(&bench_ack_client, &conf, 60);
+    mqttnox_loopback_poll(&bench_ack_client);
+    mqttnox_loopback_reset_stats(&bench_ack_client);
+}
+
+/**@brief Publishes until the window is full, then lets the broker answer
+ *
+ * @note Each poll stands in for one round trip of rtt_ns; a window of 1 is
+ *       stop-and-wait, larger windows amortise the round trip over as
+ *       many messages.
+ */
+static uint64_t bench_publish_window(void* arg, uint64_t iters)
+{
+    bench_window_t* b = (bench_window_t*)arg;
+    mqttnox_loopback_stats_t stats;
+    uint64_t i = 0;
+    mqttnox_rc_t rc;
+
+    bench_ack_connect(b->window, b->session, b->sync);
+
+    while (i < iters)
+    {
+        rc = mqttnox_publish_handle(&bench_ack_client, b->qos, 0, 0, &bench_topic_handle,
+                                    "0123456789abcdef0123456789abcdef", 32);
+        if (rc == MQTTNOX_RC_ERROR_INFLIGHT_FULL) {
+            bench_wait_ns(b->rtt_ns);
+            mqttnox_loopback_poll(&bench_ack_client);
+            continue;
+        }
+        i++;
+    }
+
+    /* Completions are part of the cost */
+    while (mqttnox_loopback_poll(&bench_ack_client) > 0) {
+    }
+
+    mqttnox_loopback_get_stats(&bench_ack_client, &stats);
+
+    return stats.rx_bytes + stats.tx_bytes;
+}
+
+/*
+ * QoS 2 PUBLISH from the broker: PUBLISH, PUBREC, PUBREL, PUBCOMP
+ */
+
+typedef struct
+{
+    uint16_t burst;   /* Messages sent before the client is polled */
+    uint8_t dup;      /* Every message is sent a second time with DUP set */
+
+} bench_qos2_in_t;
+
+static uint64_t bench_qos2_inbound(void* arg, uint64_t iters)
+{
+    bench_qos2_in_t* b = (bench_qos2_in_t*)arg;
+    mqttnox_loopback_stats_t stats;
+    uint64_t i;
+    uint16_t n;
+
+    bench_ack_connect(0, NULL, MQTTNOX_STORE_SYNC_NONE);
+
+    for (i = 0; i < iters; i++)
+    {
+        for (n = 1; n <= b->burst; n++) {
+            mqttnox_loopback_publish(&bench_ack_client, MQTTNOX_QOS2_EXACTLY_ONCE_DELIV, 0, n,
+                                     "sensors/dev42/t", (const uint8_t*)"0123456789abcdef0123456789abcdef", 32);
+            if (b->dup) {
+                mqttnox_loopback_publish(&bench_ack_client, MQTTNOX_QOS2_EXACTLY_ONCE_DELIV, 1, n,
+                                         "sensors/dev42/t", (const uint8_t*)"0123456789abcdef0123456789abcdef", 32);
+            }
+        }
+
+        /* Runs until the PUBRELs are answered */
+        while (mqttnox_loopback_poll(&bench_ack_client) > 0) {
+        }
+    }
+
+    mqttnox_loopback_get_stats(&bench_ack_client, &stats);
+
+    return stats.rx_bytes + stats.tx_bytes;
+}
+
+/*
+ * Restart with a session store holding unacknowledged messages
+ */
+
+typedef struct
+{
+    uint16_t live;      /* Messages awaiting acknowledgement at the restart */
+
+} bench_restart_t;
+
+static void bench_restart_connect(uint8_t clean_session, uint8_t ack)
+{
+    mqttnox_client_conf_t conf;
+    mqttnox_loopback_conf_t lb_conf;
+
+    mqttnox_init(&bench_restart_client, MQTTNOX_DEBUG_LVL_NONE);
+
+    memset(&lb_conf, 0, sizeof(lb_conf));
+    lb_conf.ack_publish = ack;
+    lb_conf.sink = !ack;
+    mqttnox_loopback_configure(&bench_restart_client, &lb_conf);
+
+    memset(&conf, 0, sizeof(conf));
+    conf.server.addr = "loopback";
+    conf.server.port = 1883;
+    conf.client_identifier = "benchrestart";
+    conf.callback = bench_callback;
+    conf.clean_session = clean_session;
+    conf.max_inflight = MQTTNOX_INFLIGHT_WINDOW_MAX;
+    conf.session_path = BENCH_RESTART_PATH;
+    conf.session_sync = MQTTNOX_STORE_SYNC_NONE;
+
+    mqttnox_connect(&bench_restart_client, &conf, 60);
+}
+
+/**@brief Time from a restart to every stored message being acknowledged
+ *
+ * @note The store is saved once with live messages unacknowledged and its
+ *       records are written back before each restart. A restart opens and
+ *       scans the store, connects, resends the messages with DUP set and
+ *       polls until the broker has acknowledged them all.
+ */
+static uint64_t bench_session_restart(void* arg, uint64_t iters)
+{
+    bench_restart_t* b = (bench_restart_t*)arg;
+    mqttnox_loopback_stats_t stats;
+    uint8_t* snapshot;
+    uint32_t snapshot_len;
+    uint64_t bytes = 0;
+    uint64_t i;
+    uint16_t n;
+    int fd;
+
+    unlink(BENCH_RESTART_PATH);
+    bench_restart_connect(1, 0);
+
+    for (n = 0; n < b->live; n++) {
+        mqttnox_publish_handle(&bench_restart_client, MQTTNOX_QOS1_AT_LEAST_ONCE_DELIV, 0, 0,
+                               &bench_topic_handle, "0123456789abcdef0123456789abcdef", 32);
+    }
+
+    snapshot_len = bench_restart_client.store.tail;
+    snapshot = (uint8_t*)malloc(snapshot_len);
+    memcpy(snapshot, bench_restart_client.store.base, snapshot_len);
+    mqttnox_deinit(&bench_restart_client);
+
+    fd = open(BENCH_RESTART_PATH, O_WRONLY);
+
+    for (i = 0; i < iters; i++)
+    {
+        if (pwrite(fd, snapshot, snapshot_len, 0) != (ssize_t)snapshot_len) {
+            break;
+        }
+
+        bench_restart_connect(0, 1);
+
+        while (mqttnox_loopback_poll(&bench_restart_client) > 0) {
+        }
+
+        mqttnox_loopback_get_stats(&bench_restart_client, &stats);
+        bytes += stats.rx_bytes + stats.tx_bytes;
+        mqttnox_loopback_reset_stats(&bench_restart_client);
+
+        bench_sink += mqttnox_inflight_count(&bench_restart_client.inflight);
+        mqttnox_deinit(&bench_restart_client);
+    }
+
+    close(fd);
+    free(snapshot);
+
+    return bytes;
+}
+
+/*
+ * Offline queue drained on reconnect
+ */
+
+typedef struct
+{
+    mqttnox_qos_t qos;
+    uint16_t queued;    /* Messages published while disconnected */
+    const char* spill;  /* Spill file, NULL to hold them all in memory */
+
+} bench_offline_t;
+
+/**@brief Time to send the messages queued while offline, per message
+ *
+ * @note Each iteration disconnects, publishes queued messages, reconnects
+ *       and polls until the queue has drained and the broker has answered.
+ *       With a spill file only the first 4 KB of messages stay in memory.
+ */
+static uint64_t bench_offline_drain(void* arg, uint64_t iters)
+{
+    bench_offline_t* b = (bench_offline_t*)arg;
+    mqttnox_loopback_stats_t stats;
+    mqttnox_loopback_conf_t lb_conf;
+    mqttnox_client_conf_t conf;
+    uint64_t bytes = 0;
+    uint64_t i;
+    uint16_t n;
+
+    mqttnox_init(&bench_restart_client, MQTTNOX_DEBUG_LVL_NONE);
+
+    memset(&lb_conf, 0, sizeof(lb_conf));
+    lb_conf.ack_publish = 1;
+    mqttnox_loopback_configure(&bench_restart_client, &lb_conf);
+
+    memset(&conf, 0, sizeof(conf));
+    conf.server.addr = "loopback";
+    conf.server.port = 1883;
+    conf.client_identifier = "benchoffline";
+    conf.callback = bench_callback;
+    conf.clean_session = 1;
+    conf.max_inflight = MQTTNOX_INFLIGHT_WINDOW_MAX;
+    conf.offline_mem_size = (b->spill != NULL) ? 4096 : MQTTNOX_OFFLINE_MEM_SIZE;
+    conf.offline_spill_path = b->spill;
+    conf.offline_spill_size = 1024 * 1024;
+
+    mqttnox_connect(&bench_restart_client, &conf, 60);
+    mqttnox_loopback_poll(&bench_restart_client);
+
+    for (i = 0; i < iters; i++)
+    {
+        mqttnox_disconnect(&bench_restart_client);
+        mqttnox_loopback_reset_stats(&bench_restart_client);
+
+        for (n = 0; n < b->queued; n++) {
+            mqttnox_publish_handle(&bench_restart_client, b->qos, 0, 0, &bench_topic_handle,
+                                   "0123456789abcdef0123456789abcdef", 32);
+        }
+
+        mqttnox_connect(&bench_restart_client, &conf, 60);
+
+        while (mqttnox_loopback_poll(&bench_restart_client) > 0) {
+        }
+
+        mqttnox_loopback_get_stats(&bench_restart_client, &stats);
+        bytes += stats.rx_bytes + stats.tx_bytes;
+    }
+
+    bench_sink += mqttnox_offline_count(&bench_restart_client.offline);
+    mqttnox_deinit(&bench_restart_client);
+
+    return bytes;
+}
+
+/*
+ * Automatic reconnect after the broker drops the connection
+ */
+
+typedef struct
+{
+    uint8_t subs;       /* Filters subscribed to again after each reconnect */
+
+} bench_reconnect_t;
+
+/**@brief Cost of one reconnect, from the loss to the SUBACK
+ *
+ * @note The backoff delay is skipped by moving the loopback clock on, so
+ *       only the work done by the client is timed: the lost connection
+ *       handled, the cached CONNECT sent and the filters subscribed to
+ *       again once CONNACK arrives.
+ */
+static uint64_t bench_reconnect(void* arg, uint64_t iters)
+{
+    bench_reconnect_t* b = (bench_reconnect_t*)arg;
+    mqttnox_loopback_stats_t stats;
+    mqttnox_loopback_conf_t lb_conf;
+    mqttnox_client_conf_t conf;
+    mqttnox_topic_sub_t sub;
+    char topics[MQTTNOX_RESUB_MAX][32];
+    uint64_t bytes = 0;
+    uint32_t wait;
+    uint64_t i;
+    uint8_t n;
+
+    mqttnox_init(&bench_restart_client, MQTTNOX_DEBUG_LVL_NONE);
+
+    memset(&lb_conf, 0, sizeof(lb_conf));
+    lb_conf.ack_publish = 1;
+    mqttnox_loopback_configure(&bench_restart_client, &lb_conf);
+
+    memset(&conf, 0, sizeof(conf));
+    conf.server.addr = "loopback";
+    conf.server.port = 1883;
+    conf.client_identifier = "benchreconnect";
+    conf.callback = bench_callback;
+    conf.clean_session = 1;
+    conf.reconnect = 1;
+
+    mqttnox_connect(&bench_restart_client, &conf, 60);
+    mqttnox_loopback_poll(&bench_restart_client);
+
+    for (n = 0; n < b->subs; n++)
+    {
+        snprintf(topics[n], sizeof(topics[n]), "sensors/dev%u/+/cmd", (unsigned)n);
+        sub.topic = topics[n];
+        sub.qos = MQTTNOX_QOS1_AT_LEAST_ONCE_DELIV;
+        mqttnox_subscribe(&bench_restart_client, &sub, 1);
+    }
+    mqttnox_loopback_poll(&bench_restart_client);
+
+    for (i = 0; i < iters; i++)
+    {
+        mqttnox_loopback_reset_stats(&bench_restart_client);
+        mqttnox_loopback_drop(&bench_restart_client);
+
+        while (!mqttnox_is_connected(&bench_restart_client))
+        {
+            wait = mqttnox_process(&bench_restart_client);
+            if (wait == MQTTNOX_PROCESS_IDLE) {
+                break;
+            }
+            mqttnox_loopback_advance_time(wait);
+
+            while (mqttnox_loopback_poll(&bench_restart_client) > 0) {
+            }
+        }
+
+        mqttnox_loopback_get_stats(&bench_restart_client, &stats);
+        bytes += stats.rx_bytes + stats.tx_bytes;
+    }
+
+    bench_sink += bench_restart_client.reconnect.stats.reconnects;
+    mqttnox_deinit(&bench_restart_client);
+
+    return bytes;
+}
+
+/*
+ * Keepalive
+ */
+
+typedef struct
+{
+    uint8_t ping;       /* Let the interval pass so every call sends PINGREQ */
+
+} bench_keepalive_t;
+
+/**@brief Cost of mqttnox_process on a connection with a keepalive
+ *
+ * @note Without ping each call finds nothing due, as in an event loop
+ *       woken by other work. With ping the loopback clock is moved past
+ *       the interval first, so each op is a PINGREQ and its PINGRESP.
+ */
+static uint64_t bench_keepalive(void* arg, uint64_t iters)
+{
+    bench_keepalive_t* b = (bench_keepalive_t*)arg;
+    mqttnox_loopback_conf_t lb_conf;
+    mqttnox_client_conf_t conf;
+    uint32_t wait;
+    uint64_t i;
+
+    mqttnox_init(&bench_restart_client, MQTTNOX_DEBUG_LVL_NONE);
+
+    memset(&lb_conf, 0, sizeof(lb_conf));
+    mqttnox_loopback_configure(&bench_restart_client, &lb_conf);
+
+    memset(&conf, 0, sizeof(conf));
+    conf.server.addr = "loopback";
+    conf.server.port = 1883;
+    conf.client_identifier = "benchkeepalive";
+    conf.callback = bench_callback;
+    conf.clean_session = 1;
+
+    mqttnox_connect(&bench_restart_client, &conf, 60);
+    mqttnox_loopback_poll(&bench_restart_client);
+
+    for (i = 0; i < iters; i++)
+    {
+        if (b->ping) {
+            mqttnox_loopback_advance_time(60000);
+        }
+
+        wait = mqttnox_process(&bench_restart_client);
+
+        if (b->ping) {
+            mqttnox_loopback_poll(&bench_restart_client);
+        }
+
+        bench_sink += wait;
+    }
+
+    bench_sink += bench_restart_client.ping.pings;
+    mqttnox_deinit(&bench_restart_client);
+
+    return 0;
+}
+
+/*
+ * Timer wheel
+ */
+
+#define BENCH_TIMER_RESTART   0  /* Move a random armed timer, as a keepalive does */
+#define BENCH_TIMER_TICK      1  /* Run the wheel every millisecond */
+#define BENCH_TIMER_TICKLESS  2  /* Run the wheel when it asks to be */
+
+typedef struct
+{
+    uint32_t timers;    /* Kept armed on the wheel */
+    uint8_t mode;
+
+} bench_timer_t;
+
+static mqttnox_timer_wheel_t bench_wheel;
+static mqttnox_timer_t* bench_timers;
+static uint32_t bench_timer_cnt;
+static uint32_t bench_timer_clock;
+static uint32_t bench_timer_rand = 1;
+static uint64_t bench_timer_fired;
+
+/**@brief Random delay of up to a minute, xorshift32 */
+static uint32_t bench_timer_delay(void)
+{
+    uint32_t x = bench_timer_rand;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    bench_timer_rand = x;
+
+    return 1 + (x & 0xFFFF);
+}
+
+/**@brief Arms the timer again, so the number armed stays the same */
+static void bench_timer_expired(mqttnox_timer_t* t, void* arg)
+{
+    (void)arg;
+
+    bench_timer_fired++;
+    mqttnox_timer_start(&bench_wheel, t, bench_timer_delay());
+}
+
+/**@brief Arms cnt timers, kept across runs of the same size */
+static void bench_timer_setup(uint32_t cnt)
+{
+    uint32_t i;
+
+    if (bench_timer_cnt == cnt) {
+        return;
+    }
+
+    free(bench_timers);
+    bench_timers = (mqttnox_timer_t*)malloc(sizeof(mqttnox_timer_t) * cnt);
+    bench_timer_cnt = cnt;
+
+    mqttnox_timer_wheel_init(&bench_wheel, bench_timer_clock);
+
+    for (i = 0; i < cnt; i++) {
+        mqttnox_timer_init(&bench_timers[i], bench_timer_expired, NULL);
+        mqttnox_timer_start(&bench_wheel, &bench_timers[i], bench_timer_delay());
+    }
+}
+
+/**@brief Timer churn with many timers armed
+ *
+ * @note An op is a timer moved, or a timer expired and armed again. With
+ *       delays spread over a minute, 1M timers expire about 16 per tick;
+ *       with 1k most ticks have nothing to expire, which a tickless run
+ *       skips.
+ */
+static uint64_t bench_timer(void* arg, uint64_t iters)
+{
+    bench_timer_t* b = (bench_timer_t*)arg;
+    uint64_t end;
+    uint32_t wait;
+    uint64_t i;
+
+    bench_timer_setup(b->timers);
+
+    if (b->mode == BENCH_TIMER_RESTART)
+    {
+        for (i = 0; i < iters; i++) {
+            mqttnox_timer_start(&bench_wheel, &bench_timers[bench_timer_rand % b->timers], bench_timer_delay());
+        }
+
+        return 0;
+    }
+
+    end = bench_timer_fired + iters;
+    wait = 1;
+
+    while (bench_timer_fired < end)
+    {
+        bench_timer_clock += (b->mode == BENCH_TIMER_TICK) ? 1 : wait;
+        wait = mqttnox_timer_wheel_run(&bench_wheel, bench_timer_clock);
+    }
+
+    bench_sink += bench_wheel.count;
+
+    return 0;
+}
+
+/*
+ * Topic router
+ */
+
+#define BENCH_ROUTE_FAN     1000  /* Devices per site, filters are site/<n>/dev/<m> */
+#define BENCH_ROUTE_TOPICS  4096  /* Topics cycled through per run */
+
+typedef struct
+{
+    uint32_t filters;   /* Routes registered */
+
+} bench_router_t;
+
+static mqttnox_router_t bench_route_table;
+static void* bench_router_mem;
+static mqttnox_route_t* bench_routes;
+static uint32_t bench_route_cnt;
+static char* bench_route_topics;
+static uint16_t bench_route_len[BENCH_ROUTE_TOPICS];
+static uint64_t bench_route_hits;
+
+static void bench_route_handler(mqttnox_client_t* c, const received_evt_t* msg, void* arg)
+{
+    (void)c;
+    (void)msg;
+    (void)arg;
+
+    bench_route_hits++;
+}
+
+/**@brief Registers cnt filters, kept across runs of the same size
+ *
+ * @note One filter in 16 ends in '#', one in 16 has '+' for the site, the
+ *       rest are exact. No two filters are the same.
+ */
+static void bench_router_setup(uint32_t cnt)
+{
+    char filter[48];
+    uint32_t sites;
+    uint32_t size;
+    uint32_t i;
+
+    if (bench_route_cnt == cnt) {
+        return;
+    }
+
+    free(bench_router_mem);
+    free(bench_routes);
+
+    /* Every filter ends in its own node, the site and dev levels are shared */
+    sites = (cnt + BENCH_ROUTE_FAN - 1) / BENCH_ROUTE_FAN;
+    size = (uint32_t)MQTTNOX_ROUTER_MEM_SIZE(cnt + 2 * sites + 8);
+    bench_router_mem = malloc(size);
+    bench_routes = (mqttnox_route_t*)calloc(cnt, sizeof(mqttnox_route_t));
+    bench_route_cnt = cnt;
+
+    mqttnox_router_init(&bench_route_table, bench_router_mem, size);
+
+    for (i = 0; i < cnt; i++)
+    {
+        switch (i & 15)
+        {
+        case 14:
+            snprintf(filter, sizeof(filter), "site/+/dev/%u", (unsigned)i);
+            break;
+        case 15:
+            snprintf(filter, sizeof(filter), "site/%u/dev/%u/#", (unsigned)(i / BENCH_ROUTE_FAN), (unsigned)(i % BENCH_ROUTE_FAN));
+            break;
+        default:
+            snprintf(filter, sizeof(filter), "site/%u/dev/%u", (unsigned)(i / BENCH_ROUTE_FAN), (unsigned)(i % BENCH_ROUTE_FAN));
+            break;
+        }
+
+        mqttnox_router_add(&bench_route_table, &bench_routes[i], filter, bench_route_handler, NULL);
+    }
+
+    /* Topics are packed end to end, as they sit in the receive buffer */
+    free(bench_route_topics);
+    bench_route_topics = (char*)malloc(BENCH_ROUTE_TOPICS * 32);
+
+    for (i = 0; i < BENCH_ROUTE_TOPICS; i++)
+    {
+        uint32_t n = (uint32_t)(((uint64_t)i * 2654435761u) % cnt);
+
+        bench_route_len[i] = (uint16_t)snprintf(&bench_route_topics[i * 32], 32, "site/%u/dev/%u%s",
+                                                (unsigned)(n / BENCH_ROUTE_FAN), (unsigned)(n % BENCH_ROUTE_FAN),
+                                                (i & 1) ? "/temp" : "");
+    }
+}
+
+/**@brief Dispatch of received topics against many registered filters
+ *
+ * @note Topics are slices that are not NUL-terminated, and half of them are
+ *       one level deeper than the filters, so only wildcard routes take them.
+ */
+static uint64_t bench_router(void* arg, uint64_t iters)
+{
+    bench_router_t* b = (bench_router_t*)arg;
+    received_evt_t msg;
+    uint64_t i;
+
+    bench_router_setup(b->filters);
+
+    memset(&msg, 0, sizeof(msg));
+
+    for (i = 0; i < iters; i++)
+    {
+        uint32_t t = (uint32_t)(i & (BENCH_ROUTE_TOPICS - 1));
+
+        msg.topic = &bench_route_topics[t * 32];
+        msg.topic_len = bench_route_len[t];
+        bench_sink += mqttnox_router_dispatch(&bench_route_table, NULL, &msg);
+    }
+
+    return 0;
+}
+
+/*
+ * Batched PUBLISH
+ */
+
+typedef struct
+{
+    uint16_t cnt;
+    mqttnox_publish_item_t items[256];
+
+} bench_batch_t;
+
+static uint64_t bench_publish_batch(void* arg, uint64_t iters)
+{
+    bench_batch_t* b = (bench_batch_t*)arg;
+    mqttnox_loopback_stats_t stats;
+    uint64_t i;
+
+    mqttnox_loopback_reset_stats(&bench_client);
+
+    for (i = 0; i < iters; i++) {
+        if (mqttnox_publish_batch(&bench_client, b->items, b->cnt) == MQTTNOX_RC_ERROR_INFLIGHT_FULL) {
+            bench_window_clear();
+            mqttnox_publish_batch(&bench_client, b->items, b->cnt);
+        }
+    }
+
+    mqttnox_loopback_get_stats(&bench_client, &stats);
+
+    return stats.rx_bytes;
+}
+
+/**@brief Fills a batch with telemetry sized readings, every fourth one QoS 1 */
+static void bench_batch_build(bench_batch_t* b, uint16_t cnt, const char* payload)
+{
+    uint16_t i;
+
+    b->cnt = cnt;
+    for (i = 0; i < cnt; i++) {
+        b->items[i].topic = "sensors/dev42/t";
+        b->items[i].payload = payload;
+        b->items[i].payload_len = 32;
+        b->items[i].qos = ((i & 3) == 3) ? MQTTNOX_QOS1_AT_LEAST_ONCE_DELIV : MQTTNOX_QOS0_AT_MOST_ONCE_DELIV;
+        b->items[i].retain = 0;
+    }
+}
+
+/*
+ * PUBLISH from several threads into one client
+ */
+
+typedef struct
+{
+    uint32_t threads;
+    uint64_t iters;
+
+} bench_contend_t;
+
+static void* bench_contend_thread(void* arg)
+{
+    bench_contend_t* t = (bench_contend_t*)arg;
+    uint64_t i;
+
+    for (i = 0; i < t->iters; i++) {
+        mqttnox_publish_handle(&bench_client, MQTTNOX_QOS0_AT_MOST_ONCE_DELIV, 0, 0,
+                               &bench_topic_handle, "0123456789abcdef0123456789abcdef", 32);
+    }
+
+    return NULL;
+}
+
+static uint64_t bench_publish_contend(void* arg, uint64_t iters)
+{
+    bench_contend_t* b = (bench_contend_t*)arg;
+    bench_contend_t per_thread[32];
+    pthread_t threads[32];
+    mqttnox_loopback_stats_t stats;
+    uint32_t i;
+
+    mqttnox_loopback_reset_stats(&bench_client);
+
+    for (i = 0; i < b->threads; i++) {
+        per_thread[i].threads = b->threads;
+        per_thread[i].iters = iters / b->threads + ((i < iters % b->threads) ? 1 : 0);
+        pthread_create(&threads[i], NULL, bench_contend_thread, &per_thread[i]);
+    }
+
+    for (i = 0; i < b->threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    mqttnox_loopback_get_stats(&bench_client, &stats);
+
+    return stats.rx_bytes;
+}
+
+/*
+ * SUBSCRIBE encode
+ */
+
+static uint64_t bench_subscribe(void* arg, uint64_t iters)
+{
+    mqttnox_topic_sub_t* topics = (mqttnox_topic_sub_t*)arg;
+    mqttnox_loopback_stats_t stats;
+    uint64_t i;
+
+    mqttnox_loopback_reset_stats(&bench_client);
+
+    for (i = 0; i < iters; i++) {
+        /* Never acknowledged either, every identifier is freed once they run out */
+        if (mqttnox_subscribe(&bench_client, topics, 4) != MQTTNOX_SUCCESS) {
+            mqttnox_ident_init(&bench_client.packet_ident);
+            bench_window_clear();
+            mqttnox_subscribe(&bench_client, topics, 4);
+        }
+    }
+
+    mqttnox_loopback_get_stats(&bench_client, &stats);
+
+    return stats.rx_bytes;
+}
+
+/*
+ * Receive decoder
+ */
+
+typedef struct
+{
+    uint8_t* data;
+    uint32_t len;
+    uint32_t pkt_cnt;
+    uint32_t chunk;
+
+} bench_stream_t;
+
+static bench_stream_t bench_stream;
+static bench_stream_t bench_qos1_stream;
+
+static uint32_t bench_put_packet(uint8_t* buf, uint8_t type_byte, const uint8_t* body, uint32_t body_len)
+{
+    uint32_t len = 0;
+    uint32_t remain = body_len;
+
+    buf[len++] = type_byte;
+    do
+    {
+        buf[len] = remain & 0x7F;
+        remain >>= 7;
+        if (remain > 0) {
+            buf[len] |= 0x80;
+        }
+        len++;
+    } while (remain > 0);
+
+    memcpy(&buf[len], body, body_len);
+
+    return len + body_len;
+}
+
+static uint32_t bench_put_publish(uint8_t* buf, uint8_t qos, uint16_t ident, uint32_t payload_len)
+{
+    uint8_t body[2 + 16 + 2 + 1024];
+    const char* topic = "sensors/dev42/t";
+    uint32_t topic_len = (uint32_t)strlen(topic);
+    uint32_t len = 0;
+
+    body[len++] = 0;
+    body[len++] = (uint8_t)topic_len;
+    memcpy(&body[len], topic, topic_len);
+    len += topic_len;
+
+    if (qos > 0) {
+        body[len++] = MSB(ident);
+        body[len++] = LSB(ident);
+    }
+
+    memset(&body[len], 'p', payload_len);
+    len += payload_len;
+
+    return bench_put_packet(buf, (uint8_t)((MQTTNOX_CTRL_PKT_TYPE_PUBLISH << 4) | (qos << 1)), body, len);
+}
+
+/**@brief Builds a stream of mixed packet types as a broker would send them */
+static void bench_stream_build(void)
+{
+    uint8_t ack[3];
+    uint32_t len = 0;
+    uint16_t ident = 1;
+
+    bench_stream.data = (uint8_t*)malloc(BENCH_STREAM_SIZE);
+    bench_stream.pkt_cnt = 0;
+
+    while (len + 2048 < BENCH_STREAM_SIZE)
+    {
+        ack[0] = MSB(ident);
+        ack[1] = LSB(ident);
+        ack[2] = 0;
+
+        len += bench_put_publish(&bench_stream.data[len], 0, 0, 32);
+        len += bench_put_publish(&bench_stream.data[len], 1, ident, 128);
+        len += bench_put_publish(&bench_stream.data[len], 0, 0, 1024);
+        len += bench_put_publish(&bench_stream.data[len], 2, ident, 64);
+        len += bench_put_packet(&bench_stream.data[len], MQTTNOX_CTRL_PKT_TYPE_PUBACK << 4, ack, 2);
+        len += bench_put_packet(&bench_stream.data[len], MQTTNOX_CTRL_PKT_TYPE_PUBREC << 4, ack, 2);
+        len += bench_put_packet(&bench_stream.data[len], MQTTNOX_CTRL_PKT_TYPE_PUBCOMP << 4, ack, 2);
+        len += bench_put_packet(&bench_stream.data[len], MQTTNOX_CTRL_PKT_TYPE_SUBACK << 4, ack, 3);
+        len += bench_put_packet(&bench_stream.data[len], MQTTNOX_CTRL_PKT_TYPE_PINGRESP << 4, ack, 0);
+        bench_stream.pkt_cnt += 9;
+        ident++;
+    }
+
+    bench_stream.len = len;
+}
+
+/**@brief Builds a burst of QoS 1 PUBLISH packets, each needing a PUBACK */
+static void bench_qos1_stream_build(void)
+{
+    uint32_t len = 0;
+    uint16_t ident = 1;
+
+    bench_qos1_stream.data = (uint8_t*)malloc(BENCH_STREAM_SIZE);
+    bench_qos1_stream.pkt_cnt = 0;
+
+    while (len + 2048 < BENCH_STREAM_SIZE)
+    {
+        len += bench_put_publish(&bench_qos1_stream.data[len], 1, ident++, 32);
+        bench_qos1_stream.pkt_cnt++;
+    }
+
+    bench_qos1_stream.len = len;
+    bench_qos1_stream.chunk = 1460;
+}
+
+static uint64_t bench_rcv_func(void* arg, uint64_t iters)
+{
+    bench_stream_t* s = (bench_stream_t*)arg;
+    uint32_t off;
+    uint32_t n;
+    uint64_t i;
+
+    for (i = 0; i < iters; i++)
+    {
+        for (off = 0; off < s->len; off += n)
+        {
+            n = s->len - off;
+            if (n > s->chunk) {
+                n = s->chunk;
+            }
+            mqttnox_tcp_rcv_func(&bench_client, &s->data[off], n);
+        }
+    }
+
+    return iters * s->len;
+}
+
+int main(int argc, char** argv)
+{
+    const char* filter = (argc > 1) ? argv[1] : NULL;
+    static char msg_small[33];
+    static char msg_large[1025];
+    static bench_remain_len_t remain[4] =
+    {
+        { 100,       { 0, 0, 0, 0x64 },          1 },
+        { 10000,     { 0, 0, 0x90, 0x4E },       2 },
+        { 1000000,   { 0, 0xC0, 0x84, 0x3D },    3 },
+        { 100000000, { 0x80, 0xC2, 0xD7, 0x2F }, 4 },
+    };
+    static bench_window_t window[6] =
+    {
+        { MQTTNOX_QOS1_AT_LEAST_ONCE_DELIV, 32,  0,     NULL, MQTTNOX_STORE_SYNC_NONE },
+        { MQTTNOX_QOS2_EXACTLY_ONCE_DELIV,  32,  0,     NULL, MQTTNOX_STORE_SYNC_NONE },
+        { MQTTNOX_QOS1_AT_LEAST_ONCE_DELIV, 1,   10000, NULL, MQTTNOX_STORE_SYNC_NONE },
+        { MQTTNOX_QOS1_AT_LEAST_ONCE_DELIV, 8,   10000, NULL, MQTTNOX_STORE_SYNC_NONE },
+        { MQTTNOX_QOS1_AT_LEAST_ONCE_DELIV, 32,  10000, NULL, MQTTNOX_STORE_SYNC_NONE },
+        { MQTTNOX_QOS1_AT_LEAST_ONCE_DELIV, 128, 10000, NULL, MQTTNOX_STORE_SYNC_NONE },
+    };
+    static bench_window_t session[4] =
+    {
+        { MQTTNOX_QOS1_AT_LEAST_ONCE_DELIV, 32,  0,     BENCH_SESSION_PATH, MQTTNOX_STORE_SYNC_NONE },
+        { MQTTNOX_QOS1_AT_LEAST_ONCE_DELIV, 32,  0,     BENCH_SESSION_PATH, MQTTNOX_STORE_SYNC_INTERVAL },
+        { MQTTNOX_QOS1_AT_LEAST_ONCE_DELIV, 32,  0,     BENCH_SESSION_PATH, MQTTNOX_STORE_SYNC_ALWAYS },
+        { MQTTNOX_QOS2_EXACTLY_ONCE_DELIV,  32,  0,     BENCH_SESSION_PATH, MQTTNOX_STORE_SYNC_NONE },
+    };
+    static bench_restart_t restart[3] = { { 0 }, { 16 }, { 128 } };
+    static bench_timer_t timer[6] =
+    {
+        { 1000,    BENCH_TIMER_RESTART  },
+        { 1000000, BENCH_TIMER_RESTART  },
+        { 1000,    BENCH_TIMER_TICK     },
+        { 1000,    BENCH_TIMER_TICKLESS },
+        { 1000000, BENCH_TIMER_TICK     },
+        { 1000000, BENCH_TIMER_TICKLESS },
+    };
+    static bench_router_t router[2] = { { 10000 }, { 1000000 } };
+    static bench_keepalive_t keepalive[2] = { { 0 }, { 1 } };
+    static bench_reconnect_t reconnect[2] = { { 0 }, { MQTTNOX_RESUB_MAX } };
+    static bench_offline_t offline[3] =
+    {
+        { MQTTNOX_QOS0_AT_MOST_ONCE_DELIV,  128,  NULL },
+        { MQTTNOX_QOS1_AT_LEAST_ONCE_DELIV, 128,  NULL },
+        { MQTTNOX_QOS1_AT_LEAST_ONCE_DELIV, 4096, BENCH_OFFLINE_PATH },
+    };
+    static bench_qos2_in_t qos2_in[3] =
+    {
+        { 1,  0 },
+        { 64, 0 },
+        { 64, 1 },
+    };
+    static bench_publish_t publish[4] =
+    {
+        { MQTTNOX_QOS0_AT_MOST_ONCE_DELIV,  "sensors/dev42/t", msg_small },
+        { MQTTNOX_QOS1_AT_LEAST_ONCE_DELIV, "sensors/dev42/t", msg_small },
+        { MQTTNOX_QOS2_EXACTLY_ONCE_DELIV,  "sensors/dev42/t", msg_small },
+        { MQTTNOX_QOS1_AT_LEAST_ONCE_DELIV, "sensors/dev42/t", msg_large },
+    };
+    static mqttnox_topic_sub_t subscribe[4] =
+    {
+        { "sensors/+/temperature",  MQTTNOX_QOS1_AT_LEAST_ONCE_DELIV },
+        { "sensors/+/humidity",     MQTTNOX_QOS1_AT_LEAST_ONCE_DELIV },
+        { "devices/dev42/cmd/#",    MQTTNOX_QOS2_EXACTLY_ONCE_DELIV },
+        { "broadcast",              MQTTNOX_QOS0_AT_MOST_ONCE_DELIV },
+    };
+    static bench_batch_t batch[5];
+    static const uint16_t batch_cnts[5] = { 1, 4, 16, 64, 256 };
+    static bench_contend_t contend[6] = { { 1, 0 }, { 2, 0 }, { 4, 0 }, { 8, 0 }, { 16, 0 }, { 32, 0 } };
+    static bench_stream_t streams[4];
+    static const uint32_t chunks[4] = { 65536, 1460, 100, 7 };
+    const bench_t benches[] =
+    {
+        { "set_remain_len/1B",          bench_set_remain_len,     &remain[0] },
+        { "set_remain_len/2B",          bench_set_remain_len,     &remain[1] },
+        { "set_remain_len/3B",          bench_set_remain_len,     &remain[2] },
+        { "set_remain_len/4B",          bench_set_remain_len,     &remain[3] },
+        { "decode_remain_len/1B",       bench_decode_remain_len,  &remain[0] },
+        { "decode_remain_len/2B",       bench_decode_remain_len,  &remain[1] },
+        { "decode_remain_len/3B",       bench_decode_remain_len,  &remain[2] },
+        { "decode_remain_len/4B",       bench_decode_remain_len,  &remain[3] },
+        { "wr_str/16",                  bench_wr_str,             "sensors/dev42/t" },
+        { "wr_str/64",                  bench_wr_str,             "building/7/floor/3/room/12/sensor/temperature/celsius/raw/value1" },
+        { "publish_encode/qos0/32",     bench_publish,            &publish[0] },
+        { "publish_encode/qos1/32",     bench_publish,            &publish[1] },
+        { "publish_encode/qos2/32",     bench_publish,            &publish[2] },
+        { "publish_encode/qos1/1024",   bench_publish,            &publish[3] },
+        { "publish_bin/qos1/32",        bench_publish_bin,        &publish[1] },
+        { "publish_bin/qos1/1024",      bench_publish_bin,        &publish[3] },
+        { "publish_handle/qos0/32",     bench_publish_handle,     &publish[0] },
+        { "publish_handle/qos1/32",     bench_publish_handle,     &publish[1] },
+        { "publish_handle/qos1/1024",   bench_publish_handle,     &publish[3] },
+        { "publish_batch/1",            bench_publish_batch,      &batch[0] },
+        { "publish_batch/4",            bench_publish_batch,      &batch[1] },
+        { "publish_batch/16",           bench_publish_batch,      &batch[2] },
+        { "publish_batch/64",           bench_publish_batch,      &batch[3] },
+        { "publish_batch/256",          bench_publish_batch,      &batch[4] },
+        { "publish_contend/threads1",   bench_publish_contend,    &contend[0] },
+        { "publish_contend/threads2",   bench_publish_contend,    &contend[1] },
+        { "publish_contend/threads4",   bench_publish_contend,    &contend[2] },
+        { "publish_contend/threads8",   bench_publish_contend,    &contend[3] },
+        { "publish_contend/threads16",  bench_publish_contend,    &contend[4] },
+        { "publish_contend/threads32",  bench_publish_contend,    &contend[5] },
+        { "subscribe_encode/4",         bench_subscribe,          subscribe },
+        { "rcv_func/mixed/chunk65536",  bench_rcv_func,           &streams[0] },
+        { "rcv_func/mixed/chunk1460",   bench_rcv_func,           &streams[1] },
+        { "rcv_func/mixed/chunk100",    bench_rcv_func,           &streams[2] },
+        { "rcv_func/mixed/chunk7",      bench_rcv_func,           &streams[3] },
+        { "rcv_func/qos1/chunk1460",    bench_rcv_func,           &bench_qos1_stream },
+        { "publish_window/qos1/32",     bench_publish_window,     &window[0] },
+        { "publish_window/qos2/32",     bench_publish_window,     &window[1] },
+        { "publish_window/rtt10us/1",   bench_publish_window,     &window[2] },
+        { "publish_window/rtt10us/8",   bench_publish_window,     &window[3] },
+        { "publish_window/rtt10us/32",  bench_publish_window,     &window[4] },
+        { "publish_window/rtt10us/128", bench_publish_window,     &window[5] },
+        { "qos2_inbound/burst1",        bench_qos2_inbound,       &qos2_in[0] },
+        { "qos2_inbound/burst64",       bench_qos2_inbound,       &qos2_in[1] },
+        { "qos2_inbound/burst64/dup",   bench_qos2_inbound,       &qos2_in[2] },
+        { "session_publish/qos1/none",  bench_publish_window,     &session[0] },
+        { "session_publish/qos1/interval", bench_publish_window,  &session[1] },
+        { "session_publish/qos1/always", bench_publish_window,    &session[2] },
+        { "session_publish/qos2/none",  bench_publish_window,     &session[3] },
+        { "session_restart/live0",      bench_session_restart,    &restart[0] },
+        { "session_restart/live16",     bench_session_restart,    &restart[1] },
+        { "session_restart/live128",    bench_session_restart,    &restart[2] },
+        { "offline_drain/qos0/mem",     bench_offline_drain,      &offline[0] },
+        { "offline_drain/qos1/mem",     bench_offline_drain,      &offline[1] },
+        { "offline_drain/qos1/spill",   bench_offline_drain,      &offline[2] },
+        { "reconnect/subs0",            bench_reconnect,          &reconnect[0] },
+        { "reconnect/subs16",           bench_reconnect,          &reconnect[1] },
+        { "keepalive/process",          bench_keepalive,          &keepalive[0] },
+        { "keepalive/ping",             bench_keepalive,          &keepalive[1] },
+        { "timer/restart/1k",           bench_timer,              &timer[0] },
+        { "timer/restart/1M",           bench_timer,              &timer[1] },
+        { "timer/expire/1k/tick",       bench_timer,              &timer[2] },
+        { "timer/expire/1k/tickless",   bench_timer,              &timer[3] },
+        { "timer/expire/1M/tick",       bench_timer,              &timer[4] },
+        { "timer/expire/1M/tickless",   bench_timer,              &timer[5] },
+        { "router/dispatch/10k",        bench_router,             &router[0] },
+        { "router/dispatch/1M",         bench_router,             &router[1] },
+    };
+    uint64_t ops;
+    size_t i;
+
+    memset(msg_small, 'm', sizeof(msg_small) - 1);
+    memset(msg_large, 'm', sizeof(msg_large) - 1);
+
+    bench_client_setup();
+    bench_stream_build();
+    bench_qos1_stream_build();
+
+    mqttnox_topic_handle_init(&bench_topic_handle, "sensors/dev42/t");
+
+    for (i = 0; i < 5; i++) {
+        bench_batch_build(&batch[i], batch_cnts[i], msg_small);
+    }
+
+    for (i = 0; i < 4; i++) {
+        streams[i] = bench_stream;
+        streams[i].chunk = chunks[i];
+    }
+
+    printf("MQTTNox %s benchmarks, stream of %u packets in %u bytes\n",
+           MQTTNOX_VERSION, bench_stream.pkt_cnt, bench_stream.len);
+
+    /* What each client costs, the same for every client in a process */
+    printf("Per client: mqttnox_client_t %u bytes, receive ring %u bytes (%u of address space)\n\n",
+           (uint32_t)sizeof(mqttnox_client_t),
+           MQTTNOX_RX_RING_ENABLE ? MQTTNOX_RX_RING_SIZE : 0,
+           MQTTNOX_RX_RING_ENABLE ? 2 * MQTTNOX_RX_RING_SIZE : 0);
+
+    for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+    {
+        if (filter != NULL && strstr(benches[i].name, filter) == NULL) {
+            continue;
+        }
+
+        /* Receive, batch and inbound benchmarks report per packet or message, the rest per call */
+        if (benches[i].fn == bench_rcv_func) {
+            ops = ((bench_stream_t*)benches[i].arg)->pkt_cnt;
+        }
+        else if (benches[i].fn == bench_publish_batch) {
+            ops = ((bench_batch_t*)benches[i].arg)->cnt;
+        }
+        else if (benches[i].fn == bench_qos2_inbound) {
+            ops = ((bench_qos2_in_t*)benches[i].arg)->burst;
+        }
+        else if (benches[i].fn == bench_offline_drain) {
+            ops = ((bench_offline_t*)benches[i].arg)->queued;
+        }
+        else {
+            ops = 1;
+        }
+
+        /* Registering a million filters takes longer than a run, keep it out of the timing */
+        if (benches[i].fn == bench_router) {
+            bench_router_setup(((bench_router_t*)benches[i].arg)->filters);
+        }
+
+        bench_run(&benches[i], ops);
+    }
+
+    mqttnox_deinit(&bench_client);
+    mqttnox_deinit(&bench_ack_client);
+    unlink(BENCH_SESSION_PATH);
+    unlink(BENCH_RESTART_PATH);
+    free(bench_stream.data);
+    free(bench_qos1_stream.data);
+    free(bench_router_mem);
+    free(bench_routes);
+    free(bench_route_topics);
+
+    return (int)(bench_sink & 0);
+}
@@ -0,0 +1,102 @@
+/*****************************************************************************
+* Copyright (c) [2024] Argenox Technologies LLC
+* All rights reserved.
+*
+*
+*
+* NOTICE:  All information contained herein, source code, binaries and
+* derived works is, and remains the property of Argenox and its suppliers,
+* if any.  The intellectual and technical concepts contained
+* herein are proprietary to Argenox and its suppliers and may be covered
+* by U.S. and Foreign Patents, patents in process, and are protected by
+* trade secret or copyright law.
+*
+* Licensing of this software can be found in LICENSE
+*
+* THIS SOFTWARE IS PROVIDED BY ARGENOX "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ARGENOX LLC BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* CONTACT: info@argenox.com
+*
+* File:    mqttnox_loopback.h
+* Summary: MQTTNox In-Memory Loopback TAL and Scripted Broker
+*
+* Note: The loopback TAL implements mqttnox_tal.h over two in-process ring
+*       buffers. Everything the client sends is consumed immediately by a
+*       scripted broker which queues the matching replies. Replies reach
+*       the client only from mqttnox_loopback_poll (or mqttnox_wait_thread),
+*       so library callbacks never re-enter from inside a send.
+*
+*       The loopback is single threaded: poll from the thread that
+*       publishes.
+*
+*/
+
+#ifndef _MQTTNOX_LOOPBACK_H_
+#define _MQTTNOX_LOOPBACK_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "mqttnox.h"
+
+/* Size of each direction's ring - must be a power of two */
+#define MQTTNOX_LOOPBACK_RING_SIZE  65536
+
+/** Scripted broker behaviour */
+typedef struct
+{
+    uint8_t connack_rc;       /* CONNACK return code, \see mqttnox_connect_rc_t */
+    uint8_t session_present;  /* CONNACK session present flag */
+    uint8_t ack_publish;      /* Answer PUBLISH with PUBACK / PUBREC */
+    uint8_t echo_publish;     /* Send every PUBLISH back as if subscribed */
+    uint8_t sink;             /* Count client traffic and drop it without replying */
+    uint32_t rx_chunk;        /* Max bytes per receive callback, 0 = no limit */
+    uint32_t refuse_connects; /* Connects that fail before one succeeds */
+
+} mqttnox_loopback_conf_t;
+
+/** Traffic seen by the scripted broker, indexed by packet type */
+typedef struct
+{
+    uint32_t rx_packets[16];  /* Packets received from the client */
+    uint32_t tx_packets[16];  /* Packets sent to the client */
+    uint64_t rx_bytes;
+    uint64_t tx_bytes;
+    uint64_t sends;           /* Send calls made by the client */
+    uint32_t overflows;       /* Replies refused because the client ring was full */
+
+} mqttnox_loopback_stats_t;
+
+
+extern void mqttnox_loopback_configure(mqttnox_client_t* c, const mqttnox_loopback_conf_t* conf);
+extern int mqttnox_loopback_poll(mqttnox_client_t* c);
+extern int mqttnox_loopback_inject(mqttnox_client_t* c, const uint8_t* data, uint32_t len);
+extern int mqttnox_loopback_publish(mqttnox_client_t* c,
+                                    mqttnox_qos_t qos,
+                                    uint8_t dup,
+                                    uint16_t packet_ident,
+                                    const char* topic,
+                                    const uint8_t* payload,
+                                    uint32_t payload_len);
+extern void mqttnox_loopback_get_stats(mqttnox_client_t* c, mqttnox_loopback_stats_t* stats);
+extern void mqttnox_loopback_reset_stats(mqttnox_client_t* c);
+extern void mqttnox_loopback_advance_time(uint32_t ms);
+extern void mqttnox_loopback_drop(mqttnox_client_t* c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _MQTTNOX_LOOPBACK_H_ */
@@ -0,0 +1,732 @@
+/*****************************************************************************
+* Copyright (c) [2024] Argenox Technologies LLC
+* All rights reserved.
+*
+*
+*
+* NOTICE:  All information contained herein, source code, binaries and
+* derived works is, and remains the property of Argenox and its suppliers,
+* if any.  The intellectual and technical concepts contained
+* herein are proprietary to Argenox and its suppliers and may be covered
+* by U.S. and Foreign Patents, patents in process, and are protected by
+* trade secret or copyright law.
+*
+* Licensing of this software can be found in LICENSE
+*
+* THIS SOFTWARE IS PROVIDED BY ARGENOX "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ARGENOX LLC BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* CONTACT: info@argenox.com
+*
+* File:    mqttnox_tal_loopback.c
+* Summary: MQTTNox In-Memory Loopback TAL and Scripted Broker
+*
+* Note: Do not call the TAL functions in this file directly. Use mqttnox.h
+*       and the helpers in mqttnox_loopback.h
+*
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* System Includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "mqttnox.h"
+#include "mqttnoxlib.h"
+#include "common.h"
+#include "mqttnox_debug.h"
+#include "mqttnox_tal.h"
+#include "mqttnox_loopback.h"
+
+#if MQTTNOX_TAL_API_VERSION != 9
+#error "mqttnox_tal_loopback.c implements TAL API version 9"
+#endif
+
+#define LB_RING_MASK (MQTTNOX_LOOPBACK_RING_SIZE - 1)
+
+/* Largest SUBSCRIBE the scripted broker acknowledges in one SUBACK */
+#define LB_MAX_SUBACK_TOPICS 64
+
+typedef struct
+{
+    uint8_t buf[MQTTNOX_LOOPBACK_RING_SIZE];
+    uint32_t head; /* Next byte to read */
+    uint32_t tail; /* Next byte to write */
+
+} lb_ring_t;
+
+/* Per-connection state, kept in c->tal_ctx */
+typedef struct
+{
+    mqttnox_client_t* client;
+    mqttnox_tcp_rcv_t rcv_cback;
+    uint8_t connected;
+
+    lb_ring_t to_broker;
+    lb_ring_t to_client;
+
+    mqttnox_loopback_conf_t conf;
+    mqttnox_loopback_stats_t stats;
+
+} loopback_t;
+
+static const mqttnox_loopback_conf_t lb_default_conf =
+{
+    MQTTNOX_CONNECTION_RC_ACCEPTED, /* connack_rc */
+    0,                              /* session_present */
+    1,                              /* ack_publish */
+    0,                              /* echo_publish */
+    0,                              /* sink */
+    0,                              /* rx_chunk */
+    0,                              /* refuse_connects */
+};
+
+
+static uint32_t lb_ring_used(const lb_ring_t* r)
+{
+    return r->tail - r->head;
+}
+
+static uint32_t lb_ring_free(const lb_ring_t* r)
+{
+    return MQTTNOX_LOOPBACK_RING_SIZE - (r->tail - r->head);
+}
+
+static uint8_t lb_ring_peek(const lb_ring_t* r, uint32_t offset)
+{
+    return r->buf[(r->head + offset) & LB_RING_MASK];
+}
+
+static void lb_ring_write(lb_ring_t* r, const uint8_t* data, uint32_t len)
+{
+    uint32_t off = r->tail & LB_RING_MASK;
+    uint32_t first = MQTTNOX_LOOPBACK_RING_SIZE - off;
+
+    if (first > len) {
+        first = len;
+    }
+
+    memcpy(&r->buf[off], data, first);
+    memcpy(r->buf, &data[first], len - first);
+    r->tail += len;
+}
+
+static void lb_ring_read(lb_ring_t* r, uint8_t* data, uint32_t len)
+{
+    uint32_t off = r->head & LB_RING_MASK;
+    uint32_t first = MQTTNOX_LOOPBACK_RING_SIZE - off;
+
+    if (first > len) {
+        first = len;
+    }
+
+    memcpy(data, &r->buf[off], first);
+    memcpy(&data[first], r->buf, len - first);
+    r->head += len;
+}
+
+/**@brief Moves bytes from one ring to another without a scratch buffer */
+static void lb_ring_transfer(lb_ring_t* dst, lb_ring_t* src, uint32_t len)
+{
+    uint32_t off;
+    uint32_t chunk;
+
+    while (len > 0)
+    {
+        off = src->head & LB_RING_MASK;
+        chunk = MQTTNOX_LOOPBACK_RING_SIZE - off;
+        if (chunk > len) {
+            chunk = len;
+        }
+
+        lb_ring_write(dst, &src->buf[off], chunk);
+        src->head += chunk;
+        len -= chunk;
+    }
+}
+
+/**@brief Encodes an MQTT remaining length
+ *
+ * @return     number of bytes written
+ */
+static uint8_t lb_encode_remain_len(uint8_t* buf, uint32_t len)
+{
+    uint8_t cnt = 0;
+
+    do
+    {
+        buf[cnt] = len & 0x7F;
+        len >>= 7;
+        if (len > 0) {
+            buf[cnt] |= 0x80;
+        }
+        cnt++;
+    } while (len > 0 && cnt < 4);
+
+    return cnt;
+}
+
+/**@brief Queues bytes for the client
+ *
+ * @return     0 on success, -1 if the client ring is full
+ */
+static int lb_to_client(loopback_t* lb, const uint8_t* data, uint32_t len)
+{
+    if (lb_ring_free(&lb->to_client) < len) {
+        lb->stats.overflows++;
+        return -1;
+    }
+
+    lb_ring_write(&lb->to_client, data, len);
+    lb->stats.tx_packets[data[0] >> 4]++;
+    lb->stats.tx_bytes += len;
+
+    return 0;
+}
+
+static int lb_send_ack(loopback_t* lb, uint8_t type, uint8_t flags, uint8_t msb, uint8_t lsb)
+{
+    uint8_t frame[4];
+
+    frame[0] = (uint8_t)((type << 4) | flags);
+    frame[1] = 2;
+    frame[2] = msb;
+    frame[3] = lsb;
+
+    return lb_to_client(lb, frame, sizeof(frame));
+}
+
+/**@brief Scripted reply to one complete frame at the head of to_broker
+ *
+ * @param[in]   lb        loopback connection
+ * @param[in]   hdr_len   fixed header length (type byte + remaining length)
+ * @param[in]   remain    remaining length
+ *
+ * @return     0 on success, -1 if a reply did not fit
+ */
+static int lb_broker_handle(loopback_t* lb, uint32_t hdr_len, uint32_t remain)
+{
+    lb_ring_t* r = &lb->to_broker;
+    uint8_t type_byte = lb_ring_peek(r, 0);
+    uint8_t type = type_byte >> 4;
+    uint8_t qos = (type_byte >> 1) & 0x03;
+    uint8_t suback[1 + 4 + 2 + LB_MAX_SUBACK_TOPICS];
+    uint8_t rl[4];
+    uint32_t topic_len;
+    uint32_t off;
+    uint32_t cnt;
+    uint8_t rl_len;
+    int rc = 0;
+
+    lb->stats.rx_packets[type]++;
+    lb->stats.rx_bytes += hdr_len + remain;
+
+    switch (type)
+    {
+        case MQTTNOX_CTRL_PKT_TYPE_CONNECT:
+            rc = lb_send_ack(lb, MQTTNOX_CTRL_PKT_TYPE_CONNACK, 0,
+                             lb->conf.session_present & 0x01, lb->conf.connack_rc);
+            break;
+
+        case MQTTNOX_CTRL_PKT_TYPE_PUBLISH:
+            topic_len = ((uint32_t)lb_ring_peek(r, hdr_len) << 8) | lb_ring_peek(r, hdr_len + 1);
+            off = hdr_len + MQTTNOX_LENGTH_BYTE_LEN + topic_len;
+
+            if (lb->conf.ack_publish && qos == MQTTNOX_QOS1_AT_LEAST_ONCE_DELIV) {
+                rc = lb_send_ack(lb, MQTTNOX_CTRL_PKT_TYPE_PUBACK, 0, lb_ring_peek(r, off), lb_ring_peek(r, off + 1));
+            }
+            else if (lb->conf.ack_publish && qos == MQTTNOX_QOS2_EXACTLY_ONCE_DELIV) {
+                rc = lb_send_ack(lb, MQTTNOX_CTRL_PKT_TYPE_PUBREC, 0, lb_ring_peek(r, off), lb_ring_peek(r, off + 1));
+            }
+
+            if (rc == 0 && lb->conf.echo_publish) {
+                if (lb_ring_free(&lb->to_client) < hdr_len + remain) {
+                    lb->stats.overflows++;
+                    rc = -1;
+                }
+                else {
+                    lb->stats.tx_packets[type]++;
+                    lb->stats.tx_bytes += hdr_len + remain;
+                    lb_ring_transfer(&lb->to_client, r, hdr_len + remain);
+                    return 0;
+                }
+            }
+            break;
+
+        case MQTTNOX_CTRL_PKT_TYPE_PUBREC:
+            /* Client received our QoS 2 publish */
+            rc = lb_send_ack(lb, MQTTNOX_CTRL_PKT_TYPE_PUBREL, 0x2, lb_ring_peek(r, hdr_len), lb_ring_peek(r, hdr_len + 1));
+            break;
+
+        case MQTTNOX_CTRL_PKT_TYPE_PUBREL:
+            rc = lb_send_ack(lb, MQTTNOX_CTRL_PKT_TYPE_PUBCOMP, 0, lb_ring_peek(r, hdr_len), lb_ring_peek(r, hdr_len + 1));
+            break;
+
+        case MQTTNOX_CTRL_PKT_TYPE_SUBSCRIBE:
+            /* Grant every requested QoS */
+            cnt = 0;
+            off = hdr_len + MQTTNOX_PACKET_IDENT_BYTE_LEN;
+            while (off < hdr_len + remain && cnt < LB_MAX_SUBACK_TOPICS)
+            {
+                topic_len = ((uint32_t)lb_ring_peek(r, off) << 8) | lb_ring_peek(r, off + 1);
+                off += MQTTNOX_LENGTH_BYTE_LEN + topic_len;
+                suback[7 + cnt] = lb_ring_peek(r, off) & 0x03;
+                off++;
+                cnt++;
+            }
+
+            rl_len = lb_encode_remain_len(rl, MQTTNOX_PACKET_IDENT_BYTE_LEN + cnt);
+
+            /* Build right to left so the frame starts behind the length */
+            suback[5] = lb_ring_peek(r, hdr_len);
+            suback[6] = lb_ring_peek(r, hdr_len + 1);
+            memcpy(&suback[5 - rl_len], rl, rl_len);
+            suback[4 - rl_len] = MQTTNOX_CTRL_PKT_TYPE_SUBACK << 4;
+
+            rc = lb_to_client(lb, &suback[4 - rl_len], 1 + rl_len + MQTTNOX_PACKET_IDENT_BYTE_LEN + cnt);
+            break;
+
+        case MQTTNOX_CTRL_PKT_TYPE_UNSUBSCRIBE:
+            rc = lb_send_ack(lb, MQTTNOX_CTRL_PKT_TYPE_UNSUBACK, 0, lb_ring_peek(r, hdr_len), lb_ring_peek(r, hdr_len + 1));
+            break;
+
+        case MQTTNOX_CTRL_PKT_TYPE_PINGREQ:
+            suback[0] = MQTTNOX_CTRL_PKT_TYPE_PINGRESP << 4;
+            suback[1] = 0;
+            rc = lb_to_client(lb, suback, 2);
+            break;
+
+        case MQTTNOX_CTRL_PKT_TYPE_DISCONNECT:
+            lb->connected = 0;
+            break;
+
+        default:
+            /* PUBACK and PUBCOMP from the client need no reply */
+            break;
+    }
+
+    r->head += hdr_len + remain;
+
+    return rc;
+}
+
+/**@brief Runs the scripted broker over everything the client has sent
+ *
+ * @return     0 on success, -1 if a reply did not fit
+ */
+static int lb_broker_process(loopback_t* lb)
+{
+    lb_ring_t* r = &lb->to_broker;
+    uint32_t used;
+    uint32_t remain;
+    uint32_t mult;
+    uint32_t hdr_len;
+    uint8_t byte;
+    int rc = 0;
+
+    while (rc == 0 && lb->connected)
+    {
+        used = lb_ring_used(r);
+        if (used < 2) {
+            break;
+        }
+
+        /* Decode remaining length */
+        remain = 0;
+        mult = 1;
+        hdr_len = 1;
+        do
+        {
+            if (hdr_len >= used || hdr_len > 4) {
+                return 0;
+            }
+            byte = lb_ring_peek(r, hdr_len++);
+            remain += (byte & 0x7F) * mult;
+            mult <<= 7;
+        } while (byte & 0x80);
+
+        if (used < hdr_len + remain) {
+            /* Wait for the rest of the frame */
+            break;
+        }
+
+        rc = lb_broker_handle(lb, hdr_len, remain);
+    }
+
+    return rc;
+}
+
+/**@brief TCP Initialization
+ *
+ * @note Allocates the loopback connection kept in c->tal_ctx
+ *
+ * @param[in]   c    mqttnox object \see mqttnox_client_t
+ * @param[in]   rcv_cback functio pointer to the receiver function
+ *
+ */
+int mqttnox_tcp_init(mqttnox_client_t* c, mqttnox_tcp_rcv_t rcv_cback)
+{
+    loopback_t* lb;
+
+    if (c == NULL) {
+        return -1;
+    }
+
+    lb = (loopback_t*)c->tal_ctx;
+    if (lb == NULL) {
+        lb = (loopback_t*)calloc(1, sizeof(loopback_t));
+        if (lb == NULL) {
+            return -1;
+        }
+        lb->conf = lb_default_conf;
+        c->tal_ctx = lb;
+    }
+
+    lb->client = c;
+
+    if (rcv_cback != NULL) {
+        lb->rcv_cback = rcv_cback;
+    }
+
+    return 0;
+}
+
+/**@brief TCP Deinitialization
+ *
+ * @note Frees the loopback connection, with its statistics
+ */
+void mqttnox_tcp_deinit(mqttnox_client_t* c)
+{
+    free(c->tal_ctx);
+    c->tal_ctx = NULL;
+}
+
+/**@brief TCP Connect
+ *
+ * @note No network is involved - address and port are ignored
+ */
+int mqttnox_tcp_connect(mqttnox_client_t* c, char * addr, int port)
+{
+    loopback_t* lb = (loopback_t*)c->tal_ctx;
+
+    (void)addr;
+    (void)port;
+
+    if (lb == NULL) {
+        return -1;
+    }
+
+    /* Broker down */
+    if (lb->conf.refuse_connects > 0) {
+        lb->conf.refuse_connects--;
+        return -1;
+    }
+
+    lb->to_broker.head = lb->to_broker.tail = 0;
+    lb->to_client.head = lb->to_client.tail = 0;
+    lb->connected = 1;
+
+    return 0;
+}
+
+/**@brief TCP Connect for a reconnect
+ *
+ * @note Connects straight away, as mqttnox_tcp_connect does
+ */
+int mqttnox_tcp_connect_async(mqttnox_client_t* c, char * addr, int port)
+{
+    return (mqttnox_tcp_connect(c, addr, port) == 0) ? 0 : -1;
+}
+
+int mqttnox_tcp_send(mqttnox_client_t* c, uint8_t * data, uint32_t len)
+{
+    mqttnox_iovec_t iov;
+
+    iov.data = data;
+    iov.len = len;
+
+    return mqttnox_tcp_sendv(c, &iov, 1);
+}
+
+/**@brief TCP Scatter-Gather Send
+ *
+ * @note The broker consumes the data before this returns. Fails when the
+ *       replies no longer fit, i.e. the application has stopped polling.
+ */
+int mqttnox_tcp_sendv(mqttnox_client_t* c, const mqttnox_iovec_t* iov, uint8_t iov_cnt)
+{
+    loopback_t* lb = (loopback_t*)c->tal_ctx;
+    uint32_t total = 0;
+    uint8_t i;
+
+    if (lb == NULL || !lb->connected) {
+        return 1;
+    }
+
+    for (i = 0; i < iov_cnt; i++) {
+        total += iov[i].len;
+    }
+
+    lb->stats.sends++;
+
+    if (lb->conf.sink) {
+        lb->stats.rx_bytes += total;
+        return 0;
+    }
+
+    if (lb_ring_free(&lb->to_broker) < total) {
+        return 1;
+    }
+
+    for (i = 0; i < iov_cnt; i++) {
+        lb_ring_write(&lb->to_broker, iov[i].data, iov[i].len);
+    }
+
+    return (lb_broker_process(lb) == 0) ? 0 : 1;
+}
+
+int mqttnox_tcp_disconnect(mqttnox_client_t* c)
+{
+    loopback_t* lb = (loopback_t*)c->tal_ctx;
+
+    if (lb != NULL) {
+        lb->connected = 0;
+    }
+
+    return 0;
+}
+
+/**@brief Delivers queued broker traffic to the client
+ *
+ * @note Replies generated by the client while handling the data (acks)
+ *       are answered straight away and delivered in the same call.
+ *
+ * @param[in]   c    mqttnox object \see mqttnox_client_t
+ *
+ * @return     bytes delivered, or -1 on error
+ */
+int mqttnox_loopback_poll(mqttnox_client_t* c)
+{
+    loopback_t* lb = (loopback_t*)c->tal_ctx;
+    uint32_t len;
+    uint32_t space;
+    int total = 0;
+
+    if (lb == NULL) {
+        return -1;
+    }
+
+    while (lb->connected && lb_ring_used(&lb->to_client) > 0)
+    {
+        space = c->rcv_buf_size - c->rcv_offset;
+        if (space == 0) {
+            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "Receive buffer full\n");
+            return -1;
+        }
+
+        len = lb_ring_used(&lb->to_client);
+        if (len > space) {
+            len = space;
+        }
+        if (lb->conf.rx_chunk > 0 && len > lb->conf.rx_chunk) {
+            len = lb->conf.rx_chunk;
+        }
+
+        lb_ring_read(&lb->to_client, &c->rcv_buf[c->rcv_offset], len);
+        total += (int)len;
+
+        if (lb->rcv_cback != NULL) {
+            lb->rcv_cback(c, &c->rcv_buf[c->rcv_offset], len);
+        }
+    }
+
+    return total;
+}
+
+int mqttnox_tcp_receive_thread(void * ptr)
+{
+    loopback_t* lb = (loopback_t*)ptr;
+
+    while (lb != NULL && lb->connected) {
+        if (mqttnox_loopback_poll(lb->client) <= 0) {
+            break;
+        }
+    }
+
+    return 0;
+}
+
+/**@brief Runs the loopback until there is nothing left to deliver
+ *
+ * @param[in]   c    mqttnox object \see mqttnox_client_t
+ */
+void mqttnox_wait_thread(mqttnox_client_t* c)
+{
+    mqttnox_tcp_receive_thread(c->tal_ctx);
+}
+
+void mqttnox_hal_debug_printf(const char* str)
+{
+    printf("%s", str);
+}
+
+/* Added to the clock by mqttnox_loopback_advance_time */
+static uint32_t lb_time_offset_ms;
+
+uint32_t mqttnox_hal_time_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000) + lb_time_offset_ms;
+}
+
+/**@brief Moves the TAL clock forward, so timeouts can be tested without
+ *        waiting for them
+ */
+void mqttnox_loopback_advance_time(uint32_t ms)
+{
+    lb_time_offset_ms += ms;
+}
+
+/**@brief Closes the connection from the broker side
+ *
+ * @note Reported to the library as a connection closed by the peer
+ */
+void mqttnox_loopback_drop(mqttnox_client_t* c)
+{
+    loopback_t* lb = (loopback_t*)c->tal_ctx;
+
+    if (lb != NULL && lb->connected) {
+        lb->connected = 0;
+        mqttnox_tcp_closed(c);
+    }
+}
+
+/**@brief Sets the scripted broker behaviour
+ *
+ * @note May be called before mqttnox_connect
+ *
+ * @param[in]   c     mqttnox object \see mqttnox_client_t
+ * @param[in]   conf  broker behaviour, NULL restores the defaults
+ */
+void mqttnox_loopback_configure(mqttnox_client_t* c, const mqttnox_loopback_conf_t* conf)
+{
+    loopback_t* lb;
+
+    if (mqttnox_tcp_init(c, NULL) != 0) {
+        return;
+    }
+
+    lb = (loopback_t*)c->tal_ctx;
+    lb->conf = (conf != NULL) ? *conf : lb_default_conf;
+}
+
+/**@brief Queues raw bytes from the broker to the client
+ *
+ * @return     0 on success, -1 if they do not fit
+ */
+int mqttnox_loopback_inject(mqttnox_client_t* c, const uint8_t* data, uint32_t len)
+{
+    loopback_t* lb = (loopback_t*)c->tal_ctx;
+
+    if (lb == NULL || len == 0 || lb_ring_free(&lb->to_client) < len) {
+        return -1;
+    }
+
+    return lb_to_client(lb, data, len);
+}
+
+/**@brief Queues a PUBLISH from the broker to the client
+ *
+ * @return     0 on success, -1 if it does not fit
+ */
+int mqttnox_loopback_publish(mqttnox_client_t* c,
+                             mqttnox_qos_t qos,
+                             uint8_t dup,
+                             uint16_t packet_ident,
+                             const char* topic,
+                             const uint8_t* payload,
+                             uint32_t payload_len)
+{
+    loopback_t* lb = (loopback_t*)c->tal_ctx;
+    uint8_t hdr[1 + 4 + MQTTNOX_LENGTH_BYTE_LEN];
+    uint8_t ident[MQTTNOX_PACKET_IDENT_BYTE_LEN];
+    uint32_t topic_len = (uint32_t)strlen(topic);
+    uint32_t remain;
+    uint32_t hdr_len;
+
+    if (lb == NULL) {
+        return -1;
+    }
+
+    remain = MQTTNOX_LENGTH_BYTE_LEN + topic_len + payload_len;
+    if (qos != MQTTNOX_QOS0_AT_MOST_ONCE_DELIV) {
+        remain += MQTTNOX_PACKET_IDENT_BYTE_LEN;
+    }
+
+    hdr[0] = (uint8_t)((MQTTNOX_CTRL_PKT_TYPE_PUBLISH << 4) | ((dup & 1) << 3) | ((qos & 0x03) << 1));
+    hdr_len = 1 + lb_encode_remain_len(&hdr[1], remain);
+    hdr[hdr_len++] = MSB(topic_len);
+    hdr[hdr_len++] = LSB(topic_len);
+
+    if (lb_ring_free(&lb->to_client) < hdr_len - MQTTNOX_LENGTH_BYTE_LEN + remain) {
+        lb->stats.overflows++;
+        return -1;
+    }
+
+    lb_ring_write(&lb->to_client, hdr, hdr_len);
+    lb_ring_write(&lb->to_client, (const uint8_t*)topic, topic_len);
+
+    if (qos != MQTTNOX_QOS0_AT_MOST_ONCE_DELIV) {
+        ident[0] = MSB(packet_ident);
+        ident[1] = LSB(packet_ident);
+        lb_ring_write(&lb->to_client, ident, sizeof(ident));
+    }
+
+    lb_ring_write(&lb->to_client, payload, payload_len);
+
+    lb->stats.tx_packets[MQTTNOX_CTRL_PKT_TYPE_PUBLISH]++;
+    lb->stats.tx_bytes += hdr_len - MQTTNOX_LENGTH_BYTE_LEN + remain;
+
+    return 0;
+}
+
+void mqttnox_loopback_get_stats(mqttnox_client_t* c, mqttnox_loopback_stats_t* stats)
+{
+    loopback_t* lb = (loopback_t*)c->tal_ctx;
+
+    if (lb != NULL && stats != NULL) {
+        *stats = lb->stats;
+    }
+}
+
+void mqttnox_loopback_reset_stats(mqttnox_client_t* c)
+{
+    loopback_t* lb = (loopback_t*)c->tal_ctx;
+
+    if (lb != NULL) {
+        memset(&lb->stats, 0, sizeof(lb->stats));
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
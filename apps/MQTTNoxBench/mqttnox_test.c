@@ -0,0 +1,676 @@
+/*****************************************************************************
+* Copyright (c) [2024] Argenox Technologies LLC
+* All rights reserved.
+*
+*
+*
+* NOTICE:  All information contained herein, source code, binaries and
+* derived works is, and remains the property of Argenox and its suppliers,
+* if any.  The intellectual and technical concepts contained
+* herein are proprietary to Argenox and its suppliers and may be covered
+* by U.S. and Foreign Patents, patents in process, and are protected by
+* trade secret or copyright law.
+*
+* Licensing of this software can be found in LICENSE
+*
+* THIS SOFTWARE IS PROVIDED BY ARGENOX "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ARGENOX LLC BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* CONTACT: info@argenox.com
+*
+* File:    mqttnox_test.c
+* Summary: MQTTNox Behaviour Tests
+*
+* Usage:   mqttnox_test [filter]
+*
+*          Runs every test whose name contains filter against the loopback
+*          TAL and its scripted broker. A failed check prints its location
+*          and ends that test; the exit code is the number of failed tests.
+*
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mqttnox.h"
+#include "mqttnoxlib.h"
+#include "mqttnox_tal.h"
+#include "mqttnox_router.h"
+#include "mqttnox_offline.h"
+#include "mqttnox_inflight.h"
+#include "mqttnox_store.h"
+#include "mqttnox_loopback.h"
+
+/* Offline spill file, the library removes it once mapped */
+#define TEST_OFFLINE_PATH   "mqttnox_test_offline.spill"
+
+/* Session store */
+#define TEST_SESSION_PATH   "mqttnox_test_session.store"
+
+/* Ends the running test when cond does not hold */
+#define TEST_ASSERT(cond)                                                   \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            printf("  %s:%d: %s\n", __FILE__, __LINE__, #cond);             \
+            test_failed = 1;                                                \
+            return;                                                         \
+        }                                                                   \
+    } while (0)
+
+typedef struct
+{
+    const char* name;
+    void (*fn)(void);
+
+} test_t;
+
+static int test_failed;
+
+static mqttnox_client_t test_client;
+static mqttnox_client_conf_t test_conf;
+static mqttnox_loopback_conf_t test_lb;
+
+/* Events seen by test_callback since test_connect */
+static uint32_t test_received;
+static uint32_t test_connects;
+static uint32_t test_failed_evts;
+static uintptr_t test_failed_ctx;
+static uint32_t test_published;
+static uintptr_t test_published_last;
+static uint8_t test_published_order = 1;
+static char test_last_topic[128];
+
+static void test_callback(mqttnox_evt_data_t* evt)
+{
+    received_evt_t* r;
+    uintptr_t ctx;
+
+    switch (evt->evt_id)
+    {
+        case MQTTNOX_EVT_CONNECT:
+            test_connects++;
+            break;
+
+        case MQTTNOX_EVT_RECEIVED:
+            r = &evt->evt.received_evt;
+            if (r->chunk == MQTTNOX_CHUNK_COMPLETE || r->chunk == MQTTNOX_CHUNK_LAST) {
+                test_received++;
+            }
+            if (r->topic_len < sizeof(test_last_topic)) {
+                memcpy(test_last_topic, r->topic, r->topic_len);
+                test_last_topic[r->topic_len] = '\0';
+            }
+            break;
+
+        case MQTTNOX_EVT_PUBLISHED:
+            ctx = (uintptr_t)evt->evt.published_evt.user_ctx;
+            if (ctx != 0) {
+                if (ctx != test_published_last + 1) {
+                    test_published_order = 0;
+                }
+                test_published_last = ctx;
+            }
+            test_published++;
+            break;
+
+        case MQTTNOX_EVT_PUBLISH_FAILED:
+            test_failed_evts++;
+            test_failed_ctx += (uintptr_t)evt->evt.published_evt.user_ctx;
+            break;
+
+        default:
+            break;
+    }
+}
+
+/**@brief Connects test_client to the scripted broker and takes the CONNACK
+*
+* @note test_conf and test_lb are set up by the caller on top of the defaults
+*/
+static mqttnox_rc_t test_connect(void)
+{
+    mqttnox_rc_t rc;
+
+    test_received = 0;
+    test_connects = 0;
+    test_failed_evts = 0;
+    test_failed_ctx = 0;
+    test_published = 0;
+    test_published_last = 0;
+    test_published_order = 1;
+
+    mqttnox_loopback_configure(&test_client, &test_lb);
+
+    test_conf.server.addr = "loopback";
+    test_conf.client_identifier = "mqttnoxtest";
+    test_conf.callback = test_callback;
+
+    rc = mqttnox_connect(&test_client, &test_conf, 60);
+    mqttnox_loopback_poll(&test_client);
+
+    return rc;
+}
+
+/**@brief Starts a test on a fresh client */
+static void test_reset(void)
+{
+    mqttnox_init(&test_client, MQTTNOX_DEBUG_LVL_NONE);
+    memset(&test_conf, 0, sizeof(test_conf));
+    memset(&test_lb, 0, sizeof(test_lb));
+    test_conf.clean_session = 1;
+}
+
+/**@brief Runs the client's timers until it is connected again
+*/
+static void test_run_until_connected(void)
+{
+    uint32_t wait;
+    int i;
+
+    for (i = 0; i < 32 && !mqttnox_is_connected(&test_client); i++)
+    {
+        wait = mqttnox_process(&test_client);
+        if (wait == MQTTNOX_PROCESS_IDLE) {
+            break;
+        }
+
+        mqttnox_loopback_advance_time(wait);
+        mqttnox_loopback_poll(&test_client);
+    }
+}
+
+/*
+ * Topic router
+ */
+
+#define TEST_ROUTE_CNT  9
+
+static mqttnox_router_t test_router;
+static uint8_t test_router_mem[MQTTNOX_ROUTER_MEM_SIZE(256)];
+static mqttnox_route_t test_routes[TEST_ROUTE_CNT];
+static uint32_t test_route_hits;
+
+static void test_route_handler(mqttnox_client_t* c, const received_evt_t* msg, void* arg)
+{
+    (void)c;
+    (void)msg;
+
+    test_route_hits |= 1UL << (uintptr_t)arg;
+}
+
+/**@brief Publishes topic from the broker and returns the routes it reached
+*/
+static uint32_t test_route(const char* topic)
+{
+    test_route_hits = 0;
+
+    mqttnox_loopback_publish(&test_client, MQTTNOX_QOS0_AT_MOST_ONCE_DELIV, 0, 0,
+                             topic, (const uint8_t*)"x", 1);
+    mqttnox_loopback_poll(&test_client);
+
+    return test_route_hits;
+}
+
+static void test_router_setup(const char* const* filters, uint32_t cnt)
+{
+    uint32_t i;
+
+    test_reset();
+
+    mqttnox_router_init(&test_router, test_router_mem, sizeof(test_router_mem));
+    memset(test_routes, 0, sizeof(test_routes));
+
+    for (i = 0; i < cnt; i++) {
+        mqttnox_router_add(&test_router, &test_routes[i], filters[i], test_route_handler, (void*)(uintptr_t)i);
+    }
+
+    test_conf.router = &test_router;
+    test_connect();
+}
+
+#define R(i) (1UL << (i))
+
+/* '+' matches one whole level, '#' the rest of the topic and the level
+   before it, and neither matches a topic starting with '$' [MQTT-4.7] */
+static void test_router_wildcards(void)
+{
+    static const char* const filters[TEST_ROUTE_CNT] =
+    {
+        "sport/#", "#", "+/+", "+", "/+", "sport/+/player1", "$SYS/#", "a/+/#", "sport/tennis/+",
+    };
+
+    test_router_setup(filters, TEST_ROUTE_CNT);
+    TEST_ASSERT(mqttnox_is_connected(&test_client));
+
+    TEST_ASSERT(test_route("sport") == (R(0) | R(1) | R(3)));
+    TEST_ASSERT(test_route("sport/tennis/player1") == (R(0) | R(1) | R(5) | R(8)));
+    TEST_ASSERT(test_route("sport/tennis") == (R(0) | R(1) | R(2)));
+    TEST_ASSERT(test_route("sport/tennis/player1/ranking") == (R(0) | R(1)));
+    TEST_ASSERT(test_route("/finance") == (R(1) | R(2) | R(4)));
+    TEST_ASSERT(test_route("a") == (R(1) | R(3)));
+    TEST_ASSERT(test_route("a/b") == (R(1) | R(2) | R(7)));
+    TEST_ASSERT(test_route("a/b/c/d") == (R(1) | R(7)));
+    TEST_ASSERT(test_route("sport//player1") == (R(0) | R(1) | R(5)));
+    TEST_ASSERT(test_route("$SYS/broker/load") == R(6));
+    TEST_ASSERT(test_route("$SYS") == R(6));
+
+    /* Nothing matches, the message goes to the callback */
+    test_received = 0;
+    TEST_ASSERT(test_route("$other/x") == 0);
+    TEST_ASSERT(test_received == 1);
+    TEST_ASSERT(strcmp(test_last_topic, "$other/x") == 0);
+
+    /* A removed route is no longer reached, the others are */
+    mqttnox_router_remove(&test_router, &test_routes[1]);
+    TEST_ASSERT(test_route("a/b") == (R(2) | R(7)));
+    TEST_ASSERT(test_route("$other/x") == 0);
+
+    /* Filters the specification does not allow */
+    TEST_ASSERT(mqttnox_router_add(&test_router, &test_routes[1], "a/#/b", test_route_handler, NULL) == MQTTNOX_RC_ERROR_BAD_TOPIC);
+    TEST_ASSERT(mqttnox_router_add(&test_router, &test_routes[1], "a+", test_route_handler, NULL) == MQTTNOX_RC_ERROR_BAD_TOPIC);
+    TEST_ASSERT(mqttnox_router_add(&test_router, &test_routes[1], "a/b#", test_route_handler, NULL) == MQTTNOX_RC_ERROR_BAD_TOPIC);
+}
+
+/* Filter levels longer than MQTTNOX_ROUTE_LEVEL_MAX are refused. Topic
+   levels that long can still match '+' and '#' */
+static void test_router_long_levels(void)
+{
+    static char filters[4][MQTTNOX_ROUTE_LEVEL_MAX + 16];
+    static const char* const routes[3] = { filters[0], "dev/+/t", "dev/#" };
+    char level[MQTTNOX_ROUTE_LEVEL_MAX + 2];
+    char topic[MQTTNOX_ROUTE_LEVEL_MAX + 16];
+    mqttnox_route_t route;
+
+    /* Longest level allowed */
+    memset(level, 'L', MQTTNOX_ROUTE_LEVEL_MAX);
+    level[MQTTNOX_ROUTE_LEVEL_MAX] = '\0';
+    snprintf(filters[0], sizeof(filters[0]), "dev/%s/t", level);
+
+    test_router_setup(routes, 3);
+    TEST_ASSERT(mqttnox_is_connected(&test_client));
+
+    TEST_ASSERT(test_route(filters[0]) == (R(0) | R(1) | R(2)));
+
+    /* One byte longer */
+    level[MQTTNOX_ROUTE_LEVEL_MAX] = 'L';
+    level[MQTTNOX_ROUTE_LEVEL_MAX + 1] = '\0';
+    snprintf(filters[1], sizeof(filters[1]), "dev/%s/t", level);
+    snprintf(filters[2], sizeof(filters[2]), "%s/#", level);
+    snprintf(filters[3], sizeof(filters[3]), "+/%s", level);
+
+    memset(&route, 0, sizeof(route));
+    TEST_ASSERT(mqttnox_router_add(&test_router, &route, filters[1], test_route_handler, NULL) == MQTTNOX_RC_ERROR_BAD_TOPIC);
+    TEST_ASSERT(mqttnox_router_add(&test_router, &route, filters[2], test_route_handler, NULL) == MQTTNOX_RC_ERROR_BAD_TOPIC);
+    TEST_ASSERT(mqttnox_router_add(&test_router, &route, filters[3], test_route_handler, NULL) == MQTTNOX_RC_ERROR_BAD_TOPIC);
+
+    /* The longer topic level only matches the wildcards */
+    snprintf(topic, sizeof(topic), "dev/%s/t", level);
+    TEST_ASSERT(test_route(topic) == (R(1) | R(2)));
+
+    snprintf(topic, sizeof(topic), "dev/%s", level);
+    TEST_ASSERT(test_route(topic) == R(2));
+}
+
+/*
+ * Inbound QoS 2
+ */
+
+/* A QoS 2 PUBLISH resent before PUBREL is delivered once, and the same
+   identifier is a new message once PUBREL has released it */
+static void test_qos2_duplicate_run(uint32_t stream_threshold)
+{
+    static uint8_t payload[3000];
+    mqttnox_loopback_stats_t stats;
+
+    test_reset();
+    test_lb.rx_chunk = stream_threshold ? 512 : 0;
+    test_conf.stream_threshold = stream_threshold;
+    TEST_ASSERT(test_connect() == MQTTNOX_SUCCESS);
+    mqttnox_loopback_reset_stats(&test_client);
+
+    mqttnox_loopback_publish(&test_client, MQTTNOX_QOS2_EXACTLY_ONCE_DELIV, 0, 5, "t", payload, sizeof(payload));
+    mqttnox_loopback_publish(&test_client, MQTTNOX_QOS2_EXACTLY_ONCE_DELIV, 1, 5, "t", payload, sizeof(payload));
+    mqttnox_loopback_publish(&test_client, MQTTNOX_QOS1_AT_LEAST_ONCE_DELIV, 0, 6, "t", payload, sizeof(payload));
+    mqttnox_loopback_poll(&test_client);
+
+    TEST_ASSERT(test_received == 2);
+
+    /* The broker's PUBREL for the first copy went out with the replies */
+    mqttnox_loopback_poll(&test_client);
+    mqttnox_loopback_publish(&test_client, MQTTNOX_QOS2_EXACTLY_ONCE_DELIV, 0, 5, "t", payload, sizeof(payload));
+    mqttnox_loopback_poll(&test_client);
+
+    TEST_ASSERT(test_received == 3);
+
+    /* Every copy is acknowledged, each delivery is completed */
+    mqttnox_loopback_get_stats(&test_client, &stats);
+    TEST_ASSERT(stats.rx_packets[MQTTNOX_CTRL_PKT_TYPE_PUBREC] == 3);
+    TEST_ASSERT(stats.rx_packets[MQTTNOX_CTRL_PKT_TYPE_PUBACK] == 1);
+    TEST_ASSERT(stats.rx_packets[MQTTNOX_CTRL_PKT_TYPE_PUBCOMP] == 3);
+}
+
+static void test_qos2_duplicate(void)
+{
+    test_qos2_duplicate_run(0);
+}
+
+static void test_qos2_duplicate_streamed(void)
+{
+    test_qos2_duplicate_run(256);
+}
+
+/*
+ * Offline queue
+ */
+
+/* Messages queued while disconnected go out in order, through enough
+   rounds that the spill file wraps around more than once */
+static void test_offline_spill_wrap(void)
+{
+    uint8_t payload[100];
+    mqttnox_publish_item_t item;
+    uint32_t queued = 0;
+    uint32_t wraps = 0;
+    uint32_t tail;
+    uint32_t round;
+    uint32_t i;
+
+    memset(payload, 'p', sizeof(payload));
+
+    test_reset();
+    test_lb.ack_publish = 1;
+    test_conf.offline_mem_size = 512;
+    test_conf.offline_spill_path = TEST_OFFLINE_PATH;
+    test_conf.offline_spill_size = 4096;
+    TEST_ASSERT(test_connect() == MQTTNOX_SUCCESS);
+    TEST_ASSERT(test_client.offline.spill.base != NULL);
+
+    for (round = 0; round < 8; round++)
+    {
+        TEST_ASSERT(mqttnox_disconnect(&test_client) == MQTTNOX_SUCCESS);
+
+        for (i = 0; i < 25; i++)
+        {
+            memset(&item, 0, sizeof(item));
+            item.topic = "t/spill";
+            item.payload = payload;
+            item.payload_len = sizeof(payload) - round;
+            item.qos = MQTTNOX_QOS1_AT_LEAST_ONCE_DELIV;
+            item.user_ctx = (void*)(uintptr_t)(++queued);
+
+            tail = test_client.offline.spill.tail;
+            TEST_ASSERT(mqttnox_publish_batch(&test_client, &item, 1) == MQTTNOX_SUCCESS);
+            if (test_client.offline.spill.tail < tail) {
+                wraps++;
+            }
+        }
+
+        TEST_ASSERT(mqttnox_offline_count(&test_client.offline) == 25);
+        TEST_ASSERT(mqttnox_connect(&test_client, &test_conf, 60) == MQTTNOX_SUCCESS);
+
+        for (i = 0; i < 64 && mqttnox_offline_count(&test_client.offline) != 0; i++) {
+            mqttnox_loopback_poll(&test_client);
+        }
+        mqttnox_loopback_poll(&test_client);
+
+        TEST_ASSERT(mqttnox_offline_count(&test_client.offline) == 0);
+        TEST_ASSERT(test_published_last == queued);
+    }
+
+    TEST_ASSERT(test_published_order);
+    TEST_ASSERT(wraps >= 2);
+}
+
+/*
+ * Reconnect
+ */
+
+/* Subscriptions are made again on a reconnect unless the broker kept the
+   session, and unsubscribed filters are not */
+static void test_resubscribe(void)
+{
+    mqttnox_topic_sub_t subs[3] = { { "a/+", 1 }, { "b/#", 2 }, { "c", 0 } };
+    mqttnox_topic_sub_t unsub[1] = { { "c", 0 } };
+    mqttnox_loopback_stats_t stats;
+
+    test_reset();
+    test_conf.reconnect = 1;
+    test_conf.reconnect_min_ms = 100;
+    test_conf.reconnect_max_ms = 1000;
+    TEST_ASSERT(test_connect() == MQTTNOX_SUCCESS);
+
+    TEST_ASSERT(mqttnox_subscribe(&test_client, subs, 3) == MQTTNOX_SUCCESS);
+    TEST_ASSERT(mqttnox_unsubscribe(&test_client, unsub, 1) == MQTTNOX_SUCCESS);
+    mqttnox_loopback_poll(&test_client);
+
+    /* Lost connection, the broker has no session */
+    mqttnox_loopback_reset_stats(&test_client);
+    mqttnox_loopback_drop(&test_client);
+    TEST_ASSERT(!mqttnox_is_connected(&test_client));
+
+    test_run_until_connected();
+    TEST_ASSERT(mqttnox_is_connected(&test_client));
+    mqttnox_loopback_poll(&test_client);
+
+    mqttnox_loopback_get_stats(&test_client, &stats);
+    TEST_ASSERT(stats.rx_packets[MQTTNOX_CTRL_PKT_TYPE_CONNECT] == 1);
+    TEST_ASSERT(stats.rx_packets[MQTTNOX_CTRL_PKT_TYPE_SUBSCRIBE] == 1);
+
+    /* Messages on the filters kept reach the client again */
+    test_received = 0;
+    mqttnox_loopback_publish(&test_client, MQTTNOX_QOS0_AT_MOST_ONCE_DELIV, 0, 0, "a/x", (const uint8_t*)"x", 1);
+    mqttnox_loopback_poll(&test_client);
+    TEST_ASSERT(test_received == 1);
+
+    /* The broker kept the session, nothing to subscribe to */
+    test_lb.session_present = 1;
+    mqttnox_loopback_configure(&test_client, &test_lb);
+    mqttnox_loopback_reset_stats(&test_client);
+    mqttnox_loopback_drop(&test_client);
+
+    test_run_until_connected();
+    TEST_ASSERT(mqttnox_is_connected(&test_client));
+    mqttnox_loopback_poll(&test_client);
+
+    mqttnox_loopback_get_stats(&test_client, &stats);
+    TEST_ASSERT(stats.rx_packets[MQTTNOX_CTRL_PKT_TYPE_SUBSCRIBE] == 0);
+}
+
+/* Without a session store, messages in flight when the connection is lost
+   are reported failed, each with its user_ctx */
+static void test_publish_failed(void)
+{
+    mqttnox_publish_item_t item;
+    uintptr_t ctx_sum = 0;
+    uint32_t i;
+
+    test_reset();
+    test_conf.reconnect = 1;
+    TEST_ASSERT(test_connect() == MQTTNOX_SUCCESS);
+
+    for (i = 1; i <= 5; i++)
+    {
+        memset(&item, 0, sizeof(item));
+        item.topic = "t/failed";
+        item.payload = "x";
+        item.payload_len = 1;
+        item.qos = (i & 1) ? MQTTNOX_QOS1_AT_LEAST_ONCE_DELIV : MQTTNOX_QOS2_EXACTLY_ONCE_DELIV;
+        item.user_ctx = (void*)(uintptr_t)i;
+        ctx_sum += i;
+
+        TEST_ASSERT(mqttnox_publish_batch(&test_client, &item, 1) == MQTTNOX_SUCCESS);
+    }
+
+    mqttnox_loopback_poll(&test_client);
+    TEST_ASSERT(mqttnox_inflight_count(&test_client.inflight) == 5);
+
+    mqttnox_loopback_drop(&test_client);
+    test_run_until_connected();
+    TEST_ASSERT(mqttnox_is_connected(&test_client));
+
+    TEST_ASSERT(test_failed_evts == 5);
+    TEST_ASSERT(test_failed_ctx == ctx_sum);
+    TEST_ASSERT(test_published == 0);
+    TEST_ASSERT(mqttnox_inflight_count(&test_client.inflight) == 0);
+}
+
+/* A SUBACK or UNSUBACK the client sent nothing for leaves the identifier
+   to the message holding it, acks it did ask for release theirs */
+static void test_stray_suback(void)
+{
+    mqttnox_topic_sub_t subs[1] = { { "s/+", 1 } };
+    uint8_t pkt[5];
+    uint16_t ident = 0;
+    uint32_t i;
+
+    test_reset();
+    TEST_ASSERT(test_connect() == MQTTNOX_SUCCESS);
+
+    TEST_ASSERT(mqttnox_publish(&test_client, MQTTNOX_QOS1_AT_LEAST_ONCE_DELIV, 0, 0,
+                                "t/stray", "x") == MQTTNOX_SUCCESS);
+    mqttnox_loopback_poll(&test_client);
+
+    for (i = 0; i < MQTTNOX_INFLIGHT_SLOTS && ident == 0; i++) {
+        ident = test_client.inflight.entry[i].ident;
+    }
+    TEST_ASSERT(ident != 0);
+
+    /* SUBACK, then UNSUBACK, echoing the PUBLISH's identifier */
+    pkt[0] = MQTTNOX_HDR_BYTE(MQTTNOX_CTRL_PKT_TYPE_SUBACK, 0);
+    pkt[1] = 3;
+    pkt[2] = (uint8_t)(ident >> 8);
+    pkt[3] = (uint8_t)ident;
+    pkt[4] = 0;
+    TEST_ASSERT(mqttnox_loopback_inject(&test_client, pkt, 5) == 0);
+    pkt[0] = MQTTNOX_HDR_BYTE(MQTTNOX_CTRL_PKT_TYPE_UNSUBACK, 0);
+    pkt[1] = 2;
+    TEST_ASSERT(mqttnox_loopback_inject(&test_client, pkt, 4) == 0);
+    mqttnox_loopback_poll(&test_client);
+
+    TEST_ASSERT(test_client.packet_ident.used[ident >> 5] & (1UL << (ident & 31)));
+    TEST_ASSERT(mqttnox_inflight_count(&test_client.inflight) == 1);
+
+    /* The SUBSCRIBE gets an identifier of its own, released by its SUBACK */
+    TEST_ASSERT(mqttnox_subscribe(&test_client, subs, 1) == MQTTNOX_SUCCESS);
+    TEST_ASSERT(mqttnox_unsubscribe(&test_client, subs, 1) == MQTTNOX_SUCCESS);
+    mqttnox_loopback_poll(&test_client);
+
+    for (i = 0; i < MQTTNOX_SUB_PENDING_MAX; i++) {
+        TEST_ASSERT(test_client.sub_pending.ident[i] == 0);
+    }
+    TEST_ASSERT(test_client.packet_ident.used[ident >> 5] & (1UL << (ident & 31)));
+
+    /* The PUBACK still completes the message */
+    pkt[0] = MQTTNOX_HDR_BYTE(MQTTNOX_CTRL_PKT_TYPE_PUBACK, 0);
+    TEST_ASSERT(mqttnox_loopback_inject(&test_client, pkt, 4) == 0);
+    mqttnox_loopback_poll(&test_client);
+
+    TEST_ASSERT(test_published == 1);
+    TEST_ASSERT(mqttnox_inflight_count(&test_client.inflight) == 0);
+}
+
+/* Unacknowledged messages go out again with DUP set after a reconnect,
+   the stored packets are left as they were */
+static void test_session_replay(void)
+{
+    mqttnox_loopback_stats_t stats;
+    mqttnox_store_rec_t rec;
+    uint32_t pos;
+    uint32_t i;
+
+    unlink(TEST_SESSION_PATH);
+
+    test_reset();
+    test_conf.reconnect = 1;
+    test_conf.clean_session = 0;
+    test_conf.session_path = TEST_SESSION_PATH;
+    TEST_ASSERT(test_connect() == MQTTNOX_SUCCESS);
+
+    for (i = 0; i < 3; i++) {
+        TEST_ASSERT(mqttnox_publish(&test_client, MQTTNOX_QOS1_AT_LEAST_ONCE_DELIV, 0, 0,
+                                    "t/replay", "x") == MQTTNOX_SUCCESS);
+    }
+    mqttnox_loopback_poll(&test_client);
+    TEST_ASSERT(mqttnox_inflight_count(&test_client.inflight) == 3);
+
+    test_lb.session_present = 1;
+    test_lb.ack_publish = 1;
+    mqttnox_loopback_configure(&test_client, &test_lb);
+    mqttnox_loopback_reset_stats(&test_client);
+    mqttnox_loopback_drop(&test_client);
+
+    test_run_until_connected();
+    TEST_ASSERT(mqttnox_is_connected(&test_client));
+    mqttnox_loopback_poll(&test_client);
+
+    mqttnox_loopback_get_stats(&test_client, &stats);
+    TEST_ASSERT(stats.rx_packets[MQTTNOX_CTRL_PKT_TYPE_PUBLISH] == 3);
+    TEST_ASSERT(test_published == 3);
+    TEST_ASSERT(test_client.store.pinned == 0);
+
+    /* Acknowledged, the records are gone */
+    TEST_ASSERT(mqttnox_store_next(&test_client.store, 0, &rec) == 0);
+
+    /* A record kept through a replay still has the packet as first sent */
+    TEST_ASSERT(mqttnox_publish(&test_client, MQTTNOX_QOS1_AT_LEAST_ONCE_DELIV, 0, 0,
+                                "t/replay", "x") == MQTTNOX_SUCCESS);
+    test_lb.ack_publish = 0;
+    mqttnox_loopback_configure(&test_client, &test_lb);
+    mqttnox_loopback_drop(&test_client);
+    test_run_until_connected();
+    TEST_ASSERT(mqttnox_is_connected(&test_client));
+
+    pos = mqttnox_store_next(&test_client.store, 0, &rec);
+    TEST_ASSERT(pos != 0);
+    TEST_ASSERT((rec.pkt[0] & 0x08) == 0);
+}
+
+int main(int argc, char** argv)
+{
+    const char* filter = (argc > 1) ? argv[1] : NULL;
+    static const test_t tests[] =
+    {
+        { "router_wildcards",        test_router_wildcards },
+        { "router_long_levels",      test_router_long_levels },
+        { "qos2_duplicate",          test_qos2_duplicate },
+        { "qos2_duplicate_streamed", test_qos2_duplicate_streamed },
+        { "offline_spill_wrap",      test_offline_spill_wrap },
+        { "resubscribe",             test_resubscribe },
+        { "publish_failed",          test_publish_failed },
+        { "stray_suback",            test_stray_suback },
+        { "session_replay",          test_session_replay },
+    };
+    int failures = 0;
+    uint32_t i;
+
+    for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+    {
+        if (filter != NULL && strstr(tests[i].name, filter) == NULL) {
+            continue;
+        }
+
+        test_failed = 0;
+        tests[i].fn();
+        mqttnox_deinit(&test_client);
+
+        printf("%-26s %s\n", tests[i].name, test_failed ? "FAILED" : "ok");
+        failures += test_failed;
+    }
+
+    unlink(TEST_OFFLINE_PATH);
+    unlink(TEST_SESSION_PATH);
+
+    return failures;
+}
@@ -36,6 +36,7 @@
 
 #include "mqttnox.h"
 #include "mqttnox_tal.h"
+#include "mqttnox_router.h"
 #include "mqttnox_commandline.h"
 
 mqttnox_client_t client = { 0 };
@@ -53,6 +54,20 @@ mqttnox_topic_sub_t topics_sub[] =
 uint8_t topic[256];
 uint8_t payload[256];
 
+/* Routes messages to handlers by topic filter, unmatched ones go to the callback */
+void* router_mem[MQTTNOX_ROUTER_MEM_SIZE(32) / sizeof(void*)];
+mqttnox_router_t router;
+mqttnox_route_t upgrade_route;
+
+/**@brief Handler for messages on the upgrade topic
+*
+* @note Called in the context of the mqttnox thread, like the callback
+*/
+void upgrade_handler(mqttnox_client_t* c, const received_evt_t* msg, void* arg)
+{
+	printf("[App] Upgrade requested, payload of %u bytes\n", (unsigned)msg->payload_len);
+}
+
 /**@brief MQTTNox App Callback handler
 *
 * @note Callback used for async MQTT event handling. Note that this callback is called in the context
@@ -65,6 +80,8 @@ uint8_t payload[256];
 */
 void mqttnox_callback(mqttnox_evt_data_t * data)
 {
+	uint32_t len;
+
 	switch (data->evt_id)
 	{
 		case MQTTNOX_EVT_CONNECT:
@@ -91,14 +108,21 @@ void mqttnox_callback(mqttnox_evt_data_t * data)
 		case MQTTNOX_EVT_PUBLISHED:
 			printf("[App] MQTT Published\n");
 			break;
+		case MQTTNOX_EVT_PUBLISH_FAILED:
+			printf("[App] MQTT Publish %u dropped, session lost\n", data->evt.published_evt.packet_ident);
+			break;
 		case MQTTNOX_EVT_RECEIVED:
 			printf("[App] MQTT Received\n");
 
 			MEMZERO(topic);
-			MEMZERO(data);
+			MEMZERO(payload);
 
-			memcpy(topic, data->evt.received_evt.topic, data->evt.received_evt.topic_len);
-			memcpy(payload, data->evt.received_evt.payload, data->evt.received_evt.payload_len);
+			/* Payloads may be large or arrive in chunks - only show what fits */
+			len = data->evt.received_evt.topic_len;
+			memcpy(topic, data->evt.received_evt.topic, (len < sizeof(topic)) ? len : sizeof(topic) - 1);
+
+			len = data->evt.received_evt.payload_len;
+			memcpy(payload, data->evt.received_evt.payload, (len < sizeof(payload)) ? len : sizeof(payload) - 1);
 
 			printf("Topic: %s\n", topic);
 			printf("Payload: %s\n", payload);
@@ -150,6 +174,10 @@ int main(void)
 	client_conf.clean_session = 1;
 	client_conf.callback = mqttnox_callback;
 
+	mqttnox_router_init(&router, router_mem, sizeof(router_mem));
+	mqttnox_router_add(&router, &upgrade_route, "/topic/device/version/upgrade", upgrade_handler, NULL);
+	client_conf.router = &router;
+
 	mqttnox_init(&client, MQTTNOX_DEBUG_LVL_ALL);
 
 	mqttnox_commandline_init(&client);
@@ -157,7 +185,7 @@ int main(void)
 	mqttnox_connect(&client, &client_conf, 0);
 
 
-	mqttnox_wait_thread();
+	mqttnox_wait_thread(&client);
 
 
 	printf("MQTTNox Client Done");
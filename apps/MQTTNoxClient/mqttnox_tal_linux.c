@@ -0,0 +1,1069 @@
+/*****************************************************************************
+* Copyright (c) [2024] Argenox Technologies LLC
+* All rights reserved.
+*
+*
+*
+* NOTICE:  All information contained herein, source code, binaries and
+* derived works is, and remains the property of Argenox and its suppliers,
+* if any.  The intellectual and technical concepts contained
+* herein are proprietary to Argenox and its suppliers and may be covered
+* by U.S. and Foreign Patents, patents in process, and are protected by
+* trade secret or copyright law.
+*
+* Licensing of this software can be found in LICENSE
+*
+* THIS SOFTWARE IS PROVIDED BY ARGENOX "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ARGENOX LLC BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* CONTACT: info@argenox.com
+*
+* File:    mqttnox_tal_linux.c
+* Summary: MQTTNox TCP Linux Implementation (epoll)
+*
+* Note: Do not call the functions in this file directly. Use mqttnox.h
+*
+*       All sockets are non-blocking and registered edge-triggered with a
+*       single epoll instance. One event thread services every connection,
+*       reading straight into the client's receive buffer until the socket
+*       would block. Sends never wait on a socket: bytes the kernel does not
+*       take are kept with the connection and written by the event thread
+*       once the socket is writable again.
+*
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+/* System Includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "mqttnox.h"
+#include "mqttnox_debug.h"
+#include "mqttnox_tal.h"
+
+/* Maximum events handled per epoll_wait call */
+#define MQTTNOX_TAL_EPOLL_MAX_EVENTS   64
+
+/* Time allowed for the TCP handshake */
+#define MQTTNOX_TAL_CONNECT_TIMEOUT_MS 10000
+
+/* Unsent bytes kept for a connection whose peer is not reading. Past this
+   the connection is shut down, and the library reconnects */
+#define MQTTNOX_TAL_SEND_PENDING_MAX   (4 * 1024 * 1024)
+
+#if MQTTNOX_TAL_API_VERSION != 9
+#error "mqttnox_tal_linux.c implements TAL API version 9"
+#endif
+
+/* Per-connection state, kept in c->tal_ctx */
+typedef struct
+{
+    int sock;
+    uint8_t closing;   /* Shut down by mqttnox_tcp_disconnect, the event thread closes it */
+    uint8_t connecting;  /* Started by mqttnox_tcp_connect_async, the event thread finishes it */
+    mqttnox_client_t* client;
+    mqttnox_tcp_rcv_t rcv_cback;
+
+    /* Bytes accepted by mqttnox_tcp_sendv but not yet taken by the socket */
+    pthread_mutex_t tx_lock;
+    uint8_t* tx_pend;
+    uint32_t tx_pend_off;
+    uint32_t tx_pend_len;
+    uint32_t tx_pend_size;
+
+    /* Broker addresses resolved by mqttnox_tcp_connect, for reconnects */
+    struct addrinfo* ai_list;
+    struct addrinfo* ai_next;   /* Next one mqttnox_tcp_start tries */
+
+} connection_t;
+
+/* Event loop shared by all connections */
+static int epoll_fd = -1;
+static int wake_fd = -1;
+static int conn_cnt = 0;
+static uint8_t thread_running = 0;
+static pthread_t receive_thread;
+static pthread_mutex_t loop_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Signalled whenever a connection closes, see mqttnox_wait_thread */
+static pthread_cond_t close_cond = PTHREAD_COND_INITIALIZER;
+
+static void* mqttnox_tcp_thread_entry(void* ptr);
+static void mqttnox_tcp_close(connection_t* conn);
+
+
+/**@brief TCP Initialization
+ *
+ * @note Allocates the per-connection context kept in c->tal_ctx
+ *
+ * @param[in]   c    mqttnox object \see mqttnox_client_t
+ * @param[in]   rcv_cback functio pointer to the receiver function
+ *
+ */
+int mqttnox_tcp_init(mqttnox_client_t* c, mqttnox_tcp_rcv_t rcv_cback)
+{
+    connection_t* conn;
+
+    if (c == NULL) {
+        return -1;
+    }
+
+    conn = (connection_t*)c->tal_ctx;
+    if (conn == NULL) {
+        conn = (connection_t*)calloc(1, sizeof(connection_t));
+        if (conn == NULL) {
+            return -1;
+        }
+        conn->sock = -1;
+        pthread_mutex_init(&conn->tx_lock, NULL);
+        c->tal_ctx = conn;
+    }
+
+    conn->client = c;
+
+    if (rcv_cback != NULL) {
+        conn->rcv_cback = rcv_cback;
+    }
+
+    return 0;
+}
+
+/**@brief Creates the shared epoll instance and its event thread
+ *
+ * @note must be called with loop_lock held
+ *
+ * @return     0 on success, -1 otherwise
+ */
+static int mqttnox_tcp_loop_start(void)
+{
+    struct epoll_event ev;
+
+    if (epoll_fd < 0) {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd < 0) {
+            return -1;
+        }
+
+        /* Used to kick the event thread out of epoll_wait */
+        wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wake_fd < 0) {
+            close(epoll_fd);
+            epoll_fd = -1;
+            return -1;
+        }
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = NULL;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev);
+    }
+
+    if (!thread_running) {
+        if (pthread_create(&receive_thread, NULL, mqttnox_tcp_thread_entry, NULL) != 0) {
+            return -1;
+        }
+        pthread_detach(receive_thread);
+        thread_running = 1;
+    }
+
+    return 0;
+}
+
+/**@brief Waits until a non-blocking socket becomes ready
+ *
+ * @param[in]   sock        socket descriptor
+ * @param[in]   events      poll events to wait for
+ * @param[in]   timeout_ms  maximum time to wait
+ *
+ * @return     0 when ready, -1 on timeout or error
+ */
+static int mqttnox_tcp_wait_ready(int sock, short events, int timeout_ms)
+{
+    struct pollfd pfd;
+    int rc;
+
+    pfd.fd = sock;
+    pfd.events = events;
+    pfd.revents = 0;
+
+    do {
+        rc = poll(&pfd, 1, timeout_ms);
+    } while (rc < 0 && errno == EINTR);
+
+    if (rc <= 0 || (pfd.revents & (POLLERR | POLLNVAL))) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**@brief Waits for a close handed to the event thread by mqttnox_tcp_disconnect
+ *
+ * @note The event thread cannot wait for itself, a connection still
+ *       closing there is reported as busy
+ *
+ * @param[in]   conn  connection about to connect
+ *
+ * @return     0 once the connection is closed, -1 if it is still open
+ */
+static int mqttnox_tcp_wait_closed(connection_t* conn)
+{
+    int rc = 0;
+
+    pthread_mutex_lock(&loop_lock);
+
+    if (!thread_running || !pthread_equal(pthread_self(), receive_thread)) {
+        while (conn->sock >= 0 && conn->closing) {
+            pthread_cond_wait(&close_cond, &loop_lock);
+        }
+    }
+
+    if (conn->sock >= 0) {
+        rc = -1;
+    }
+
+    pthread_mutex_unlock(&loop_lock);
+
+    return rc;
+}
+
+/**@brief TCP Connect
+ *
+ * @note this function provides TCP connection to the Address and Port
+ *       specified
+ *
+ * @param[in]   c     mqttnox object \see mqttnox_client_t
+ * @param[in]   addr
+ * @param[in]   port  TCP port number used in mQTT
+ *
+ */
+int mqttnox_tcp_connect(mqttnox_client_t* c, char * addr, int port)
+{
+    connection_t* conn = (connection_t*)c->tal_ctx;
+    struct addrinfo hints;
+    struct addrinfo* result = NULL;
+    struct addrinfo* ai;
+    struct epoll_event ev;
+    char port_str[32];
+    int sock = -1;
+    int rc;
+    int err = 0;
+    int one = 1;
+    socklen_t err_len = sizeof(err);
+
+    if (conn == NULL || mqttnox_tcp_wait_closed(conn) != 0) {
+        return -1;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+
+    snprintf(port_str, sizeof(port_str), "%d", port);
+
+    /* Resolve the server address and port */
+    rc = getaddrinfo(addr, port_str, &hints, &result);
+    if (rc != 0) {
+        mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "getaddrinfo failed with error: %s\n", gai_strerror(rc));
+        return -1;
+    }
+
+    for (ai = result; ai != NULL; ai = ai->ai_next)
+    {
+        sock = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+        if (sock < 0) {
+            continue;
+        }
+
+        rc = connect(sock, ai->ai_addr, ai->ai_addrlen);
+        if (rc < 0 && errno == EINPROGRESS) {
+            rc = mqttnox_tcp_wait_ready(sock, POLLOUT, MQTTNOX_TAL_CONNECT_TIMEOUT_MS);
+            if (rc == 0 && (getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0 || err != 0)) {
+                rc = -1;
+            }
+        }
+
+        if (rc == 0) {
+            break;
+        }
+
+        close(sock);
+        sock = -1;
+    }
+
+    if (sock < 0) {
+        freeaddrinfo(result);
+        mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "connect error\n");
+        return -1;
+    }
+
+    /* MQTT packets are small and latency sensitive */
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    pthread_mutex_lock(&conn->tx_lock);
+    pthread_mutex_lock(&loop_lock);
+
+    /* Kept for reconnects, which must not wait on the resolver */
+    if (conn->ai_list != NULL) {
+        freeaddrinfo(conn->ai_list);
+    }
+    conn->ai_list = result;
+
+    conn->sock = sock;
+    conn->connecting = 0;
+    conn->tx_pend_off = 0;
+    conn->tx_pend_len = 0;
+
+    rc = mqttnox_tcp_loop_start();
+    if (rc == 0) {
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = conn;
+        rc = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock, &ev);
+    }
+
+    if (rc == 0) {
+        conn_cnt++;
+    }
+    else {
+        close(sock);
+        conn->sock = -1;
+    }
+
+    pthread_mutex_unlock(&loop_lock);
+    pthread_mutex_unlock(&conn->tx_lock);
+
+    if (rc != 0) {
+        mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "epoll registration error\n");
+        return -1;
+    }
+
+    mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_INFO, "Ready and listening\n");
+
+    return 0;
+}
+
+/**@brief Starts a non-blocking connect to the next broker address
+ *
+ * @note must be called with tx_lock and loop_lock held, and the event
+ *       thread running. The connection is registered for the event thread
+ *       to finish, \see mqttnox_tcp_connect_done
+ *
+ * @param[in]   conn  closed connection, ai_next set
+ *
+ * @return     0 once a connect is underway, -1 when no address is left
+ */
+static int mqttnox_tcp_start(connection_t* conn)
+{
+    struct epoll_event ev;
+    struct addrinfo* ai;
+    int sock;
+    int one = 1;
+
+    while ((ai = conn->ai_next) != NULL)
+    {
+        conn->ai_next = ai->ai_next;
+
+        sock = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+        if (sock < 0) {
+            continue;
+        }
+
+        if (connect(sock, ai->ai_addr, ai->ai_addrlen) == 0 || errno == EINPROGRESS)
+        {
+            setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+            /* Set first: the event thread may see the socket as soon as it is added */
+            conn->sock = sock;
+            conn->connecting = 1;
+            conn->tx_pend_off = 0;
+            conn->tx_pend_len = 0;
+
+            /* Writable once connected, with an error if it failed */
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            ev.data.ptr = conn;
+
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock, &ev) == 0) {
+                conn_cnt++;
+                return 0;
+            }
+
+            conn->sock = -1;
+            conn->connecting = 0;
+        }
+
+        close(sock);
+    }
+
+    return -1;
+}
+
+/**@brief TCP Connect for a reconnect
+ *
+ * @note Never waits on the network: the connect is finished by the event
+ *       thread, which reports it with mqttnox_tcp_connected. The addresses
+ *       are those mqttnox_tcp_connect resolved, tried in turn; only a
+ *       client that never connected resolves here.
+ *
+ * @param[in]   c     mqttnox object \see mqttnox_client_t
+ * @param[in]   addr
+ * @param[in]   port  TCP port number used in mQTT
+ *
+ * @return     MQTTNOX_TCP_CONNECT_PENDING, MQTTNOX_TCP_CONNECT_BUSY while
+ *             the last connection is closing, -1 on failure
+ */
+int mqttnox_tcp_connect_async(mqttnox_client_t* c, char * addr, int port)
+{
+    connection_t* conn = (connection_t*)c->tal_ctx;
+    struct addrinfo hints;
+    struct addrinfo* result = NULL;
+    char port_str[32];
+    int rc;
+
+    if (conn == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&loop_lock);
+    rc = (conn->sock < 0) ? 0 : (conn->closing ? MQTTNOX_TCP_CONNECT_BUSY : -1);
+    pthread_mutex_unlock(&loop_lock);
+
+    if (rc != 0) {
+        return rc;
+    }
+
+    if (conn->ai_list == NULL)
+    {
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_protocol = IPPROTO_TCP;
+
+        snprintf(port_str, sizeof(port_str), "%d", port);
+
+        rc = getaddrinfo(addr, port_str, &hints, &result);
+        if (rc != 0) {
+            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "getaddrinfo failed with error: %s\n", gai_strerror(rc));
+            return -1;
+        }
+        conn->ai_list = result;
+    }
+
+    pthread_mutex_lock(&conn->tx_lock);
+    pthread_mutex_lock(&loop_lock);
+
+    conn->ai_next = conn->ai_list;
+
+    rc = mqttnox_tcp_loop_start();
+    if (rc == 0) {
+        rc = mqttnox_tcp_start(conn);
+    }
+
+    pthread_mutex_unlock(&loop_lock);
+    pthread_mutex_unlock(&conn->tx_lock);
+
+    if (rc != 0) {
+        mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "connect error\n");
+        return -1;
+    }
+
+    return MQTTNOX_TCP_CONNECT_PENDING;
+}
+
+int mqttnox_tcp_send(mqttnox_client_t* c, uint8_t * data, uint32_t len)
+{
+    mqttnox_iovec_t iov;
+
+    iov.data = data;
+    iov.len = len;
+
+    return mqttnox_tcp_sendv(c, &iov, 1);
+}
+
+/**@brief Arms or disarms the writable notification of a connection
+ *
+ * @note must be called with tx_lock held
+ */
+static void mqttnox_tcp_want_write(connection_t* conn, uint8_t on)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET | (on ? EPOLLOUT : 0);
+    ev.data.ptr = conn;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->sock, &ev);
+}
+
+/**@brief Keeps bytes the socket did not take, to be written by the event thread
+ *
+ * @note must be called with tx_lock held
+ *
+ * @return     0 on success, -1 if the limit is reached or memory runs out
+ */
+static int mqttnox_tcp_pend(connection_t* conn, const struct iovec* vec, int cnt)
+{
+    uint32_t need = conn->tx_pend_len;
+    uint32_t size;
+    uint8_t* buf;
+    int i;
+
+    for (i = 0; i < cnt; i++) {
+        need += (uint32_t)vec[i].iov_len;
+    }
+
+    if (need > MQTTNOX_TAL_SEND_PENDING_MAX) {
+        return -1;
+    }
+
+    /* Move what is left to the front before growing */
+    if (conn->tx_pend_off > 0) {
+        memmove(conn->tx_pend, &conn->tx_pend[conn->tx_pend_off], conn->tx_pend_len);
+        conn->tx_pend_off = 0;
+    }
+
+    if (need > conn->tx_pend_size) {
+        size = (conn->tx_pend_size > 0) ? conn->tx_pend_size : 4096;
+        while (size < need) {
+            size *= 2;
+        }
+
+        buf = (uint8_t*)realloc(conn->tx_pend, size);
+        if (buf == NULL) {
+            return -1;
+        }
+        conn->tx_pend = buf;
+        conn->tx_pend_size = size;
+    }
+
+    for (i = 0; i < cnt; i++) {
+        memcpy(&conn->tx_pend[conn->tx_pend_len], vec[i].iov_base, vec[i].iov_len);
+        conn->tx_pend_len += (uint32_t)vec[i].iov_len;
+    }
+
+    return 0;
+}
+
+/**@brief Writes pending bytes until the socket would block
+ *
+ * @note must be called with tx_lock held
+ *
+ * @return     0 if the connection remains usable, -1 on a send error
+ */
+static int mqttnox_tcp_write_pending(connection_t* conn)
+{
+    ssize_t ret;
+
+    while (conn->tx_pend_len > 0)
+    {
+        ret = send(conn->sock, &conn->tx_pend[conn->tx_pend_off], conn->tx_pend_len, MSG_NOSIGNAL);
+
+        if (ret > 0) {
+            conn->tx_pend_off += (uint32_t)ret;
+            conn->tx_pend_len -= (uint32_t)ret;
+        }
+        else if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        else if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        else {
+            mqttnox_debug_printf(conn->client, MQTTNOX_DEBUG_LVL_ERROR, "send failed with error: %d\n", errno);
+            return -1;
+        }
+    }
+
+    conn->tx_pend_off = 0;
+    mqttnox_tcp_want_write(conn, 0);
+
+    return 0;
+}
+
+/**@brief TCP Scatter-Gather Send
+ *
+ * @note all segments go out with sendmsg, so the caller's buffers are
+ *       written directly without being gathered into one buffer first.
+ *       Never waits for the socket: what the kernel does not take is
+ *       copied and sent by the event thread, so acks sent from the receive
+ *       callback cannot stall the other connections on the loop.
+ *
+ * @param[in]   c        mqttnox object \see mqttnox_client_t
+ * @param[in]   iov      segments to send in order
+ * @param[in]   iov_cnt  number of segments, at most MQTTNOX_TCP_IOV_MAX
+ *
+ * @return     0 on success, non-zero otherwise
+ */
+int mqttnox_tcp_sendv(mqttnox_client_t* c, const mqttnox_iovec_t* iov, uint8_t iov_cnt)
+{
+    connection_t* conn = (connection_t*)c->tal_ctx;
+    struct iovec vec[MQTTNOX_TCP_IOV_MAX];
+    struct msghdr msg;
+    uint8_t cnt = 0;
+    uint8_t idx = 0;
+    uint8_t i;
+    ssize_t ret;
+    int rc = 0;
+
+    if (conn == NULL || iov_cnt > MQTTNOX_TCP_IOV_MAX) {
+        return 1;
+    }
+
+    for (i = 0; i < iov_cnt; i++)
+    {
+        if (iov[i].len > 0) {
+            vec[cnt].iov_base = (void*)iov[i].data;
+            vec[cnt].iov_len = iov[i].len;
+            cnt++;
+        }
+    }
+
+    pthread_mutex_lock(&conn->tx_lock);
+
+    if (conn->sock < 0 || conn->connecting) {
+        pthread_mutex_unlock(&conn->tx_lock);
+        return 1;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+
+    /* Bytes already pending go first, these queue behind them */
+    while (idx < cnt && conn->tx_pend_len == 0)
+    {
+        msg.msg_iov = &vec[idx];
+        msg.msg_iovlen = cnt - idx;
+
+        ret = sendmsg(conn->sock, &msg, MSG_NOSIGNAL);
+
+        if (ret > 0) {
+            /* Skip what was written, possibly part way into a segment */
+            while (idx < cnt && (size_t)ret >= vec[idx].iov_len) {
+                ret -= vec[idx].iov_len;
+                idx++;
+            }
+            if (idx < cnt) {
+                vec[idx].iov_base = (uint8_t*)vec[idx].iov_base + ret;
+                vec[idx].iov_len -= ret;
+            }
+        }
+        else if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        else if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        else {
+            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "send failed with error: %d\n", errno);
+            rc = 1;
+            break;
+        }
+    }
+
+    if (rc == 0 && idx < cnt)
+    {
+        if (mqttnox_tcp_pend(conn, &vec[idx], cnt - idx) == 0) {
+            mqttnox_tcp_want_write(conn, 1);
+        }
+        else {
+            /* The peer stopped reading, let the event thread report the loss */
+            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "send backlog full, dropping connection\n");
+            shutdown(conn->sock, SHUT_RDWR);
+            rc = 1;
+        }
+    }
+
+    pthread_mutex_unlock(&conn->tx_lock);
+
+    return rc;
+}
+
+/**@brief Removes a connection from the event loop and closes it
+ *
+ * @param[in]   conn  connection to close
+ */
+static void mqttnox_tcp_close(connection_t* conn)
+{
+    uint64_t one = 1;
+    ssize_t ret;
+
+    pthread_mutex_lock(&conn->tx_lock);
+    pthread_mutex_lock(&loop_lock);
+
+    if (conn->sock >= 0) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->sock, NULL);
+        close(conn->sock);
+        conn->sock = -1;
+        conn->closing = 0;
+        conn_cnt--;
+
+        /* Let the event thread notice there is nothing left to service */
+        ret = write(wake_fd, &one, sizeof(one));
+        (void)ret;
+
+        pthread_cond_broadcast(&close_cond);
+    }
+
+    /* Unsent bytes belong to the connection just closed */
+    conn->tx_pend_off = 0;
+    conn->tx_pend_len = 0;
+
+    pthread_mutex_unlock(&loop_lock);
+    pthread_mutex_unlock(&conn->tx_lock);
+}
+
+/**@brief TCP Disconnect
+ *
+ * @note On the event thread the socket is closed straight away. From any
+ *       other thread it is only shut down: the event thread may be reading
+ *       it, so it sees the end of the stream and closes it itself, without
+ *       reporting the close to the library.
+ *
+ * @param[in]   c    mqttnox object \see mqttnox_client_t
+ */
+int mqttnox_tcp_disconnect(mqttnox_client_t* c)
+{
+    connection_t* conn = (connection_t*)c->tal_ctx;
+    int on_loop;
+
+    if (conn == NULL) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&loop_lock);
+
+    on_loop = thread_running && pthread_equal(pthread_self(), receive_thread);
+    if (!on_loop && conn->sock >= 0 && !conn->closing) {
+        conn->closing = 1;
+        shutdown(conn->sock, SHUT_RDWR);
+    }
+
+    pthread_mutex_unlock(&loop_lock);
+
+    if (on_loop) {
+        mqttnox_tcp_close(conn);
+    }
+
+    return 0;
+}
+
+/**@brief TCP Deinitialization
+ *
+ * @note Not on the event thread: waits for it to close the connection
+ *
+ * @param[in]   c    mqttnox object \see mqttnox_client_t
+ */
+void mqttnox_tcp_deinit(mqttnox_client_t* c)
+{
+    connection_t* conn = (connection_t*)c->tal_ctx;
+
+    if (conn == NULL) {
+        return;
+    }
+
+    mqttnox_tcp_disconnect(c);
+    mqttnox_wait_thread(c);
+
+    /* The event thread may still be leaving mqttnox_tcp_close */
+    pthread_mutex_lock(&conn->tx_lock);
+    pthread_mutex_unlock(&conn->tx_lock);
+    pthread_mutex_destroy(&conn->tx_lock);
+
+    if (conn->ai_list != NULL) {
+        freeaddrinfo(conn->ai_list);
+    }
+    free(conn->tx_pend);
+    free(conn);
+    c->tal_ctx = NULL;
+}
+
+/**@brief Closes a connection the event thread found ended
+ *
+ * @note Reported to the library unless mqttnox_tcp_disconnect asked for it
+ */
+static void mqttnox_tcp_ended(connection_t* conn)
+{
+    mqttnox_client_t* c = conn->client;
+    int peer;
+
+    pthread_mutex_lock(&loop_lock);
+    peer = !conn->closing;
+    pthread_mutex_unlock(&loop_lock);
+
+    mqttnox_tcp_close(conn);
+
+    /* Once closed, the connection may be freed by mqttnox_tcp_deinit */
+    if (peer) {
+        mqttnox_tcp_closed(c);
+    }
+}
+
+/**@brief Finishes a connect started by mqttnox_tcp_connect_async
+ *
+ * @note A failed address gives way to the next one. The result is
+ *       reported unless mqttnox_tcp_disconnect abandoned the connect. The
+ *       socket is polled rather than trusting the epoll events, which may
+ *       be left over from the connection closed before it.
+ *
+ * @param[in]   conn    connecting connection
+ */
+static void mqttnox_tcp_connect_done(connection_t* conn)
+{
+    mqttnox_client_t* c = conn->client;
+    socklen_t err_len = sizeof(int);
+    struct pollfd pfd;
+    int report = -1;
+    int err = 0;
+
+    pthread_mutex_lock(&conn->tx_lock);
+    pthread_mutex_lock(&loop_lock);
+
+    pfd.fd = conn->sock;
+    pfd.events = POLLOUT;
+    pfd.revents = 0;
+
+    if (poll(&pfd, 1, 0) == 0 && !conn->closing)
+    {
+        /* Still in progress, its own event follows */
+        pthread_mutex_unlock(&loop_lock);
+        pthread_mutex_unlock(&conn->tx_lock);
+        return;
+    }
+
+    if (!conn->closing && (pfd.revents & POLLOUT) && !(pfd.revents & (POLLERR | POLLHUP)) &&
+        getsockopt(conn->sock, SOL_SOCKET, SO_ERROR, &err, &err_len) == 0 && err == 0)
+    {
+        conn->connecting = 0;
+        mqttnox_tcp_want_write(conn, 0);
+        report = 1;
+    }
+    else
+    {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->sock, NULL);
+        close(conn->sock);
+        conn->sock = -1;
+        conn_cnt--;
+
+        if (conn->closing || mqttnox_tcp_start(conn) != 0) {
+            report = conn->closing ? -1 : 0;
+            conn->connecting = 0;
+            conn->closing = 0;
+            pthread_cond_broadcast(&close_cond);
+        }
+    }
+
+    pthread_mutex_unlock(&loop_lock);
+    pthread_mutex_unlock(&conn->tx_lock);
+
+    if (report >= 0) {
+        mqttnox_tcp_connected(c, report);
+    }
+}
+
+/**@brief Drains a readable socket
+ *
+ * @note Edge-triggered: keep reading until the socket would block, otherwise
+ *       no further notification arrives for data already queued.
+ *
+ * @param[in]   conn  readable connection
+ *
+ * @return     0 if the connection remains open, -1 if it was closed
+ */
+static int mqttnox_tcp_read(connection_t* conn)
+{
+    mqttnox_client_t* c = conn->client;
+    ssize_t len;
+    uint32_t space;
+
+    while (conn->sock >= 0)
+    {
+        space = c->rcv_buf_size - c->rcv_offset;
+        if (space == 0) {
+            /* A packet larger than the receive buffer can never complete */
+            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "Receive buffer full, dropping connection\n");
+            return -1;
+        }
+
+        len = recv(conn->sock, &c->rcv_buf[c->rcv_offset], space, 0);
+
+        if (len > 0)
+        {
+            if (conn->rcv_cback != NULL) {
+                conn->rcv_cback(c, &c->rcv_buf[c->rcv_offset], (uint32_t)len);
+            }
+        }
+        else if (len == 0)
+        {
+            /* Connection has been closed */
+            return -1;
+        }
+        else if (errno == EINTR)
+        {
+            continue;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            break;
+        }
+        else
+        {
+            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "recv failed with error: %d\n", errno);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int mqttnox_tcp_receive_thread(void * ptr)
+{
+    struct epoll_event events[MQTTNOX_TAL_EPOLL_MAX_EVENTS];
+    connection_t* conn;
+    uint64_t wake;
+    ssize_t ret;
+    int run = 1;
+    int cnt;
+    int rc;
+    int i;
+
+    (void)ptr;
+
+    while (run)
+    {
+        cnt = epoll_wait(epoll_fd, events, MQTTNOX_TAL_EPOLL_MAX_EVENTS, -1);
+        if (cnt < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        for (i = 0; i < cnt; i++)
+        {
+            conn = (connection_t*)events[i].data.ptr;
+
+            if (conn == NULL) {
+                /* Wakeup from mqttnox_tcp_close */
+                ret = read(wake_fd, &wake, sizeof(wake));
+                (void)ret;
+                continue;
+            }
+
+            if (conn->sock < 0) {
+                continue;
+            }
+
+            if (conn->connecting) {
+                mqttnox_tcp_connect_done(conn);
+                continue;
+            }
+
+            if ((events[i].events & EPOLLIN) && mqttnox_tcp_read(conn) != 0) {
+                mqttnox_tcp_ended(conn);
+                continue;
+            }
+
+            if (events[i].events & EPOLLOUT)
+            {
+                pthread_mutex_lock(&conn->tx_lock);
+                rc = (conn->sock >= 0) ? mqttnox_tcp_write_pending(conn) : 0;
+                pthread_mutex_unlock(&conn->tx_lock);
+
+                if (rc != 0) {
+                    mqttnox_tcp_ended(conn);
+                    continue;
+                }
+            }
+
+            if (events[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+                mqttnox_tcp_ended(conn);
+            }
+        }
+
+        /* Thread ends once the last connection is gone */
+        pthread_mutex_lock(&loop_lock);
+        if (conn_cnt == 0) {
+            thread_running = 0;
+            run = 0;
+        }
+        pthread_mutex_unlock(&loop_lock);
+    }
+
+    return 0;
+}
+
+static void* mqttnox_tcp_thread_entry(void* ptr)
+{
+    mqttnox_tcp_receive_thread(ptr);
+
+    return NULL;
+}
+
+/**@brief Waits until the client's connection has closed
+ *
+ * @param[in]   c    mqttnox object \see mqttnox_client_t
+ */
+void mqttnox_wait_thread(mqttnox_client_t* c)
+{
+    connection_t* conn = (connection_t*)c->tal_ctx;
+
+    if (conn == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&loop_lock);
+    while (conn->sock >= 0) {
+        pthread_cond_wait(&close_cond, &loop_lock);
+    }
+    pthread_mutex_unlock(&loop_lock);
+}
+
+
+void mqttnox_hal_debug_printf(const char* str)
+{
+    printf("%s", str);
+}
+
+uint32_t mqttnox_hal_time_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000);
+}
+
+#ifdef __cplusplus
+}
+#endif
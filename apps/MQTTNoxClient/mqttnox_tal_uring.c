@@ -0,0 +1,1266 @@
+/*****************************************************************************
+* Copyright (c) [2024] Argenox Technologies LLC
+* All rights reserved.
+*
+*
+*
+* NOTICE:  All information contained herein, source code, binaries and
+* derived works is, and remains the property of Argenox and its suppliers,
+* if any.  The intellectual and technical concepts contained
+* herein are proprietary to Argenox and its suppliers and may be covered
+* by U.S. and Foreign Patents, patents in process, and are protected by
+* trade secret or copyright law.
+*
+* Licensing of this software can be found in LICENSE
+*
+* THIS SOFTWARE IS PROVIDED BY ARGENOX "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ARGENOX LLC BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* CONTACT: info@argenox.com
+*
+* File:    mqttnox_tal_uring.c
+* Summary: MQTTNox TCP Linux Implementation (io_uring)
+*
+* Note: Do not call the functions in this file directly. Use mqttnox.h
+*
+*       Uses the raw kernel interface so no liburing dependency is needed.
+*       Receive uses a single multishot recv per socket that picks buffers
+*       from a provided buffer ring, so one io_uring_enter can return many
+*       packets. Sends are staged in a registered (fixed) buffer and written
+*       with IORING_OP_WRITE_FIXED; only one write is in flight per socket
+*       and anything queued meanwhile is coalesced into the next write.
+*       Sends never wait for the kernel: bytes that do not fit the staging
+*       buffer are kept with the connection and staged as writes complete,
+*       so the event thread never waits on a completion only it can reap.
+*
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+/* System Includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/io_uring.h>
+
+#include "mqttnox.h"
+#include "mqttnox_debug.h"
+#include "mqttnox_tal.h"
+
+/* Submission queue depth */
+#define MQTTNOX_TAL_URING_ENTRIES       64
+
+/* Provided receive buffers - count must be a power of two */
+#define MQTTNOX_TAL_URING_RX_BUF_CNT    16
+#define MQTTNOX_TAL_URING_RX_BUF_SIZE   4096
+#define MQTTNOX_TAL_URING_RX_BGID       0
+
+/* Per-connection send staging buffer - must be a power of two */
+#define MQTTNOX_TAL_URING_TX_BUF_SIZE   16384
+
+/* Unsent bytes kept beyond the staging buffer for a peer that is not
+   reading. Past this the connection is shut down, and the library reconnects */
+#define MQTTNOX_TAL_SEND_PENDING_MAX    (4 * 1024 * 1024)
+
+/* Connections serviced by the shared ring */
+#define MQTTNOX_TAL_URING_MAX_CONN      64
+
+/* Set to 1 to let a kernel thread poll the submission queue. Sends then
+   need no system call at all while the poller is awake */
+#define MQTTNOX_TAL_URING_SQPOLL        0
+#define MQTTNOX_TAL_URING_SQPOLL_IDLE   1000
+
+#define MQTTNOX_TAL_CONNECT_TIMEOUT_MS  10000
+
+/* Operation tag stored in the low bits of the SQE user data */
+#define URING_OP_RECV  0x1
+#define URING_OP_SEND  0x2
+#define URING_OP_CONN  0x3   /* Poll for the end of a non-blocking connect */
+#define URING_OP_MASK  0x3
+
+#if MQTTNOX_TAL_API_VERSION != 9
+#error "mqttnox_tal_uring.c implements TAL API version 9"
+#endif
+
+/* Per-connection state, kept in c->tal_ctx */
+typedef struct
+{
+    int sock;
+    mqttnox_client_t* client;
+    mqttnox_tcp_rcv_t rcv_cback;
+
+    uint16_t buf_index;  /* Registered buffer used for sending */
+    uint8_t* tx_buf;     /* Slice of the registered staging arena */
+    uint32_t tx_head;    /* Bytes completed */
+    uint32_t tx_tail;    /* Bytes queued */
+    uint32_t tx_inflight;
+    uint8_t* tx_pend;    /* Bytes waiting for room in the staging buffer */
+    uint32_t tx_pend_off;
+    uint32_t tx_pend_len;
+    uint32_t tx_pend_size;
+    uint8_t  closing;
+    uint8_t  rx_ended;   /* Receive terminated, released once no write is in flight */
+    uint8_t  connecting; /* Started by mqttnox_tcp_connect_async, the event thread finishes it */
+
+    /* Broker addresses resolved by mqttnox_tcp_connect, for reconnects */
+    struct addrinfo* ai_list;
+    struct addrinfo* ai_next;   /* Next one uring_start tries */
+
+} connection_t;
+
+typedef struct
+{
+    int fd;
+    uint32_t features;
+
+    uint32_t* sq_head;
+    uint32_t* sq_tail;
+    uint32_t* sq_mask;
+    uint32_t* sq_flags;
+    uint32_t* sq_array;
+    struct io_uring_sqe* sqes;
+
+    uint32_t* cq_head;
+    uint32_t* cq_tail;
+    uint32_t* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    struct io_uring_buf_ring* buf_ring;
+    uint16_t buf_ring_tail;
+
+    /* Mappings, released if setup fails part way */
+    void* sq_map;
+    size_t sq_map_sz;
+    void* cq_map;
+    size_t cq_map_sz;
+    size_t sqes_sz;
+
+} uring_t;
+
+static uring_t ring = { .fd = -1 };
+
+static uint8_t rx_bufs[MQTTNOX_TAL_URING_RX_BUF_CNT][MQTTNOX_TAL_URING_RX_BUF_SIZE] __attribute__((aligned(4096)));
+static uint8_t tx_bufs[MQTTNOX_TAL_URING_MAX_CONN][MQTTNOX_TAL_URING_TX_BUF_SIZE] __attribute__((aligned(4096)));
+
+static connection_t connections[MQTTNOX_TAL_URING_MAX_CONN];
+
+static int conn_cnt = 0;
+static uint8_t thread_running = 0;
+static pthread_t receive_thread;
+
+/* Serializes submission queue and send state between the event thread
+   and application threads calling mqttnox_tcp_send */
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Signalled whenever a connection closes, see mqttnox_wait_thread */
+static pthread_cond_t close_cond = PTHREAD_COND_INITIALIZER;
+
+static void* mqttnox_tcp_thread_entry(void* ptr);
+
+
+static int uring_setup(uint32_t entries, struct io_uring_params* p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int uring_register(int fd, uint32_t opcode, void* arg, uint32_t nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/**@brief Hands a receive buffer back to the kernel
+ *
+ * @note only called from the event thread, which owns the buffer ring tail
+ *
+ * @param[in]   bid  buffer id
+ */
+static void uring_recycle_buf(uint16_t bid)
+{
+    struct io_uring_buf* buf;
+    uint16_t mask = MQTTNOX_TAL_URING_RX_BUF_CNT - 1;
+
+    buf = &ring.buf_ring->bufs[ring.buf_ring_tail & mask];
+    buf->addr = (uint64_t)(uintptr_t)rx_bufs[bid];
+    buf->len = MQTTNOX_TAL_URING_RX_BUF_SIZE;
+    buf->bid = bid;
+
+    ring.buf_ring_tail++;
+    __atomic_store_n(&ring.buf_ring->tail, ring.buf_ring_tail, __ATOMIC_RELEASE);
+}
+
+/**@brief Creates the ring, registers buffers and starts the event thread
+ *
+ * @note must be called with ring_lock held
+ *
+ * @return     0 on success, -1 otherwise
+ */
+static int mqttnox_tcp_loop_start(void)
+{
+    struct io_uring_params p;
+    struct io_uring_buf_reg reg;
+    struct iovec iov;
+    size_t sq_sz;
+    size_t cq_sz;
+    uint8_t* sq_ptr;
+    uint8_t* cq_ptr;
+    uint16_t i;
+
+    if (ring.fd < 0)
+    {
+        memset(&p, 0, sizeof(p));
+#if MQTTNOX_TAL_URING_SQPOLL
+        p.flags |= IORING_SETUP_SQPOLL;
+        p.sq_thread_idle = MQTTNOX_TAL_URING_SQPOLL_IDLE;
+#endif
+
+        ring.fd = uring_setup(MQTTNOX_TAL_URING_ENTRIES, &p);
+        if (ring.fd < 0) {
+            return -1;
+        }
+        ring.features = p.features;
+
+        sq_sz = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+        cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+        if (p.features & IORING_FEAT_SINGLE_MMAP) {
+            if (cq_sz > sq_sz) {
+                sq_sz = cq_sz;
+            }
+        }
+
+        sq_ptr = mmap(NULL, sq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+        if (sq_ptr == MAP_FAILED) {
+            goto fail;
+        }
+        ring.sq_map = sq_ptr;
+        ring.sq_map_sz = sq_sz;
+
+        if (p.features & IORING_FEAT_SINGLE_MMAP) {
+            cq_ptr = sq_ptr;
+        }
+        else {
+            cq_ptr = mmap(NULL, cq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+            if (cq_ptr == MAP_FAILED) {
+                goto fail;
+            }
+            ring.cq_map = cq_ptr;
+            ring.cq_map_sz = cq_sz;
+        }
+
+        ring.sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+        ring.sqes = mmap(NULL, ring.sqes_sz, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+        if (ring.sqes == MAP_FAILED) {
+            ring.sqes = NULL;
+            goto fail;
+        }
+
+        ring.sq_head = (uint32_t*)(sq_ptr + p.sq_off.head);
+        ring.sq_tail = (uint32_t*)(sq_ptr + p.sq_off.tail);
+        ring.sq_mask = (uint32_t*)(sq_ptr + p.sq_off.ring_mask);
+        ring.sq_flags = (uint32_t*)(sq_ptr + p.sq_off.flags);
+        ring.sq_array = (uint32_t*)(sq_ptr + p.sq_off.array);
+
+        ring.cq_head = (uint32_t*)(cq_ptr + p.cq_off.head);
+        ring.cq_tail = (uint32_t*)(cq_ptr + p.cq_off.tail);
+        ring.cq_mask = (uint32_t*)(cq_ptr + p.cq_off.ring_mask);
+        ring.cqes = (struct io_uring_cqe*)(cq_ptr + p.cq_off.cqes);
+
+        /* Provided buffer ring for multishot receive */
+        ring.buf_ring = mmap(NULL, MQTTNOX_TAL_URING_RX_BUF_CNT * sizeof(struct io_uring_buf),
+                             PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ring.buf_ring == MAP_FAILED) {
+            ring.buf_ring = NULL;
+            goto fail;
+        }
+
+        memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = (uint64_t)(uintptr_t)ring.buf_ring;
+        reg.ring_entries = MQTTNOX_TAL_URING_RX_BUF_CNT;
+        reg.bgid = MQTTNOX_TAL_URING_RX_BGID;
+        if (uring_register(ring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+            goto fail;
+        }
+
+        ring.buf_ring_tail = 0;
+        for (i = 0; i < MQTTNOX_TAL_URING_RX_BUF_CNT; i++) {
+            uring_recycle_buf(i);
+        }
+
+        /* Pin every connection's send staging once instead of on every
+           write - one registered buffer covers the whole arena */
+        iov.iov_base = tx_bufs;
+        iov.iov_len = sizeof(tx_bufs);
+        if (uring_register(ring.fd, IORING_REGISTER_BUFFERS, &iov, 1) < 0) {
+            goto fail;
+        }
+    }
+
+    if (!thread_running) {
+        if (pthread_create(&receive_thread, NULL, mqttnox_tcp_thread_entry, NULL) != 0) {
+            return -1;
+        }
+        pthread_detach(receive_thread);
+        thread_running = 1;
+    }
+
+    return 0;
+
+fail:
+    if (ring.buf_ring != NULL) {
+        munmap(ring.buf_ring, MQTTNOX_TAL_URING_RX_BUF_CNT * sizeof(struct io_uring_buf));
+    }
+    if (ring.sqes != NULL) {
+        munmap(ring.sqes, ring.sqes_sz);
+    }
+    if (ring.cq_map != NULL) {
+        munmap(ring.cq_map, ring.cq_map_sz);
+    }
+    if (ring.sq_map != NULL) {
+        munmap(ring.sq_map, ring.sq_map_sz);
+    }
+    close(ring.fd);
+
+    memset(&ring, 0, sizeof(ring));
+    ring.fd = -1;
+    return -1;
+}
+
+/**@brief Gets a free submission queue entry
+ *
+ * @note must be called with ring_lock held, and the entry filled in and
+ *       passed to uring_submit before it is released. The tail is not
+ *       advanced here: with SQPOLL the kernel would take the entry as soon
+ *       as it is, before it is filled in.
+ *
+ * @return     SQE or NULL if the submission queue is full
+ */
+static struct io_uring_sqe* uring_get_sqe(void)
+{
+    uint32_t head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+    uint32_t tail = *ring.sq_tail;
+    uint32_t idx;
+    struct io_uring_sqe* sqe;
+
+    if (tail - head >= MQTTNOX_TAL_URING_ENTRIES) {
+        return NULL;
+    }
+
+    idx = tail & *ring.sq_mask;
+    sqe = &ring.sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    ring.sq_array[idx] = idx;
+
+    return sqe;
+}
+
+/**@brief Hands the entry from uring_get_sqe to the kernel
+ *
+ * @note must be called with ring_lock held
+ */
+static int uring_submit(void)
+{
+    /* Publishes the filled in entry */
+    __atomic_store_n(ring.sq_tail, *ring.sq_tail + 1, __ATOMIC_RELEASE);
+
+#if MQTTNOX_TAL_URING_SQPOLL
+    if (__atomic_load_n(ring.sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_NEED_WAKEUP) {
+        return uring_enter(ring.fd, 0, 0, IORING_ENTER_SQ_WAKEUP);
+    }
+    return 0;
+#else
+    return uring_enter(ring.fd, 1, 0, 0);
+#endif
+}
+
+/**@brief Arms the multishot receive for a connection
+ *
+ * @note must be called with ring_lock held
+ */
+static int uring_arm_recv(connection_t* conn)
+{
+    struct io_uring_sqe* sqe = uring_get_sqe();
+
+    if (sqe == NULL) {
+        return -1;
+    }
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->sock;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = MQTTNOX_TAL_URING_RX_BGID;
+    sqe->user_data = (uint64_t)(uintptr_t)conn | URING_OP_RECV;
+
+    return uring_submit() < 0 ? -1 : 0;
+}
+
+/**@brief Writes the next contiguous run of staged bytes
+ *
+ * @note must be called with ring_lock held and no write in flight
+ */
+static int uring_arm_send(connection_t* conn)
+{
+    struct io_uring_sqe* sqe;
+    uint32_t mask = MQTTNOX_TAL_URING_TX_BUF_SIZE - 1;
+    uint32_t off = conn->tx_head & mask;
+    uint32_t len = conn->tx_tail - conn->tx_head;
+
+    if (len == 0) {
+        return 0;
+    }
+
+    /* Staging wraps - the remainder goes in the next write */
+    if (len > MQTTNOX_TAL_URING_TX_BUF_SIZE - off) {
+        len = MQTTNOX_TAL_URING_TX_BUF_SIZE - off;
+    }
+
+    sqe = uring_get_sqe();
+    if (sqe == NULL) {
+        return -1;
+    }
+
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->fd = conn->sock;
+    sqe->addr = (uint64_t)(uintptr_t)&conn->tx_buf[off];
+    sqe->len = len;
+    sqe->off = 0;
+    sqe->buf_index = conn->buf_index;
+    sqe->user_data = (uint64_t)(uintptr_t)conn | URING_OP_SEND;
+
+    conn->tx_inflight = len;
+
+    return uring_submit() < 0 ? -1 : 0;
+}
+
+/**@brief Copies bytes into the free part of the staging buffer
+ *
+ * @note must be called with ring_lock held
+ *
+ * @return     number of bytes staged, less than len once the buffer is full
+ */
+static uint32_t uring_stage(connection_t* conn, const uint8_t* data, uint32_t len)
+{
+    uint32_t mask = MQTTNOX_TAL_URING_TX_BUF_SIZE - 1;
+    uint32_t space = MQTTNOX_TAL_URING_TX_BUF_SIZE - (conn->tx_tail - conn->tx_head);
+    uint32_t done = 0;
+    uint32_t off;
+    uint32_t chunk;
+
+    while (done < len && space > 0)
+    {
+        off = conn->tx_tail & mask;
+        chunk = len - done;
+        if (chunk > space) {
+            chunk = space;
+        }
+        if (chunk > MQTTNOX_TAL_URING_TX_BUF_SIZE - off) {
+            chunk = MQTTNOX_TAL_URING_TX_BUF_SIZE - off;
+        }
+
+        memcpy(&conn->tx_buf[off], &data[done], chunk);
+        conn->tx_tail += chunk;
+        space -= chunk;
+        done += chunk;
+    }
+
+    return done;
+}
+
+/**@brief Keeps bytes that did not fit the staging buffer
+ *
+ * @note must be called with ring_lock held
+ *
+ * @return     0 on success, -1 if the limit is reached or memory runs out
+ */
+static int uring_pend(connection_t* conn, const uint8_t* data, uint32_t len)
+{
+    uint32_t need = conn->tx_pend_len + len;
+    uint32_t size;
+    uint8_t* buf;
+
+    if (need > MQTTNOX_TAL_SEND_PENDING_MAX) {
+        return -1;
+    }
+
+    if (conn->tx_pend_off > 0) {
+        memmove(conn->tx_pend, &conn->tx_pend[conn->tx_pend_off], conn->tx_pend_len);
+        conn->tx_pend_off = 0;
+    }
+
+    if (need > conn->tx_pend_size) {
+        size = (conn->tx_pend_size > 0) ? conn->tx_pend_size : MQTTNOX_TAL_URING_TX_BUF_SIZE;
+        while (size < need) {
+            size *= 2;
+        }
+
+        buf = (uint8_t*)realloc(conn->tx_pend, size);
+        if (buf == NULL) {
+            return -1;
+        }
+        conn->tx_pend = buf;
+        conn->tx_pend_size = size;
+    }
+
+    memcpy(&conn->tx_pend[conn->tx_pend_len], data, len);
+    conn->tx_pend_len += len;
+
+    return 0;
+}
+
+/**@brief Moves pending bytes into the room a completed write left
+ *
+ * @note must be called with ring_lock held
+ */
+static void uring_refill(connection_t* conn)
+{
+    uint32_t done;
+
+    if (conn->tx_pend_len == 0) {
+        return;
+    }
+
+    done = uring_stage(conn, &conn->tx_pend[conn->tx_pend_off], conn->tx_pend_len);
+    conn->tx_pend_off += done;
+    conn->tx_pend_len -= done;
+
+    if (conn->tx_pend_len == 0) {
+        conn->tx_pend_off = 0;
+    }
+}
+
+/**@brief TCP Initialization
+ *
+ * @note Claims a connection slot and keeps it in c->tal_ctx
+ *
+ * @param[in]   c    mqttnox object \see mqttnox_client_t
+ * @param[in]   rcv_cback functio pointer to the receiver function
+ *
+ */
+int mqttnox_tcp_init(mqttnox_client_t* c, mqttnox_tcp_rcv_t rcv_cback)
+{
+    connection_t* conn;
+    uint16_t i;
+
+    if (c == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&ring_lock);
+
+    conn = (connection_t*)c->tal_ctx;
+    for (i = 0; conn == NULL && i < MQTTNOX_TAL_URING_MAX_CONN; i++)
+    {
+        if (connections[i].client == NULL) {
+            conn = &connections[i];
+            conn->sock = -1;
+            conn->buf_index = 0;
+            conn->tx_buf = tx_bufs[i];
+            conn->client = c;
+            c->tal_ctx = conn;
+        }
+    }
+
+    if (conn != NULL && rcv_cback != NULL) {
+        conn->rcv_cback = rcv_cback;
+    }
+
+    pthread_mutex_unlock(&ring_lock);
+
+    return (conn != NULL) ? 0 : -1;
+}
+
+/**@brief Waits for a close handed to the event thread by mqttnox_tcp_disconnect
+ *
+ * @note The event thread cannot wait for itself, a connection still
+ *       closing there is reported as busy
+ *
+ * @param[in]   conn  connection about to connect
+ *
+ * @return     0 once the connection is closed, -1 if it is still open
+ */
+static int uring_wait_closed(connection_t* conn)
+{
+    int rc = 0;
+
+    pthread_mutex_lock(&ring_lock);
+
+    if (!thread_running || !pthread_equal(pthread_self(), receive_thread)) {
+        while (conn->sock >= 0 && conn->closing) {
+            pthread_cond_wait(&close_cond, &ring_lock);
+        }
+    }
+
+    if (conn->sock >= 0) {
+        rc = -1;
+    }
+
+    pthread_mutex_unlock(&ring_lock);
+
+    return rc;
+}
+
+/**@brief TCP Connect
+ *
+ * @note this function provides TCP connection to the Address and Port
+ *       specified
+ *
+ * @param[in]   c     mqttnox object \see mqttnox_client_t
+ * @param[in]   addr
+ * @param[in]   port  TCP port number used in mQTT
+ *
+ */
+int mqttnox_tcp_connect(mqttnox_client_t* c, char * addr, int port)
+{
+    connection_t* conn = (connection_t*)c->tal_ctx;
+    struct addrinfo hints;
+    struct addrinfo* result = NULL;
+    struct addrinfo* ai;
+    struct pollfd pfd;
+    char port_str[32];
+    int sock = -1;
+    int rc;
+    int err = 0;
+    int one = 1;
+    socklen_t err_len = sizeof(err);
+
+    if (conn == NULL || uring_wait_closed(conn) != 0) {
+        return -1;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+
+    snprintf(port_str, sizeof(port_str), "%d", port);
+
+    /* Resolve the server address and port */
+    rc = getaddrinfo(addr, port_str, &hints, &result);
+    if (rc != 0) {
+        mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "getaddrinfo failed with error: %s\n", gai_strerror(rc));
+        return -1;
+    }
+
+    for (ai = result; ai != NULL; ai = ai->ai_next)
+    {
+        sock = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+        if (sock < 0) {
+            continue;
+        }
+
+        rc = connect(sock, ai->ai_addr, ai->ai_addrlen);
+        if (rc < 0 && errno == EINPROGRESS) {
+            pfd.fd = sock;
+            pfd.events = POLLOUT;
+            rc = (poll(&pfd, 1, MQTTNOX_TAL_CONNECT_TIMEOUT_MS) == 1) ? 0 : -1;
+            if (rc == 0 && (getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0 || err != 0)) {
+                rc = -1;
+            }
+        }
+
+        if (rc == 0) {
+            break;
+        }
+
+        close(sock);
+        sock = -1;
+    }
+
+    if (sock < 0) {
+        freeaddrinfo(result);
+        mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "connect error\n");
+        return -1;
+    }
+
+    /* MQTT packets are small and latency sensitive */
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    pthread_mutex_lock(&ring_lock);
+
+    /* Kept for reconnects, which must not wait on the resolver */
+    if (conn->ai_list != NULL) {
+        freeaddrinfo(conn->ai_list);
+    }
+    conn->ai_list = result;
+
+    conn->sock = sock;
+    conn->connecting = 0;
+    conn->tx_head = 0;
+    conn->tx_tail = 0;
+    conn->tx_inflight = 0;
+    conn->tx_pend_off = 0;
+    conn->tx_pend_len = 0;
+    conn->closing = 0;
+    conn->rx_ended = 0;
+
+    rc = mqttnox_tcp_loop_start();
+    if (rc == 0) {
+        rc = uring_arm_recv(conn);
+    }
+
+    if (rc == 0) {
+        conn_cnt++;
+    }
+    else {
+        close(sock);
+        conn->sock = -1;
+    }
+
+    pthread_mutex_unlock(&ring_lock);
+
+    if (rc != 0) {
+        mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "io_uring setup error\n");
+        return -1;
+    }
+
+    mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_INFO, "Ready and listening\n");
+
+    return 0;
+}
+
+/**@brief Starts a non-blocking connect to the next broker address
+ *
+ * @note must be called with ring_lock held and the event thread running.
+ *       A poll for the socket becoming writable completes it, \see
+ *       uring_connect_done
+ *
+ * @param[in]   conn  closed connection, ai_next set
+ *
+ * @return     0 once a connect is underway, -1 when no address is left
+ */
+static int uring_start(connection_t* conn)
+{
+    struct io_uring_sqe* sqe;
+    struct addrinfo* ai;
+    int sock;
+    int one = 1;
+
+    while ((ai = conn->ai_next) != NULL)
+    {
+        conn->ai_next = ai->ai_next;
+
+        sock = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+        if (sock < 0) {
+            continue;
+        }
+
+        if ((connect(sock, ai->ai_addr, ai->ai_addrlen) == 0 || errno == EINPROGRESS) &&
+            (sqe = uring_get_sqe()) != NULL)
+        {
+            setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = sock;
+            sqe->poll32_events = POLLOUT;
+            sqe->user_data = (uint64_t)(uintptr_t)conn | URING_OP_CONN;
+
+            conn->sock = sock;
+            conn->connecting = 1;
+            conn->tx_head = 0;
+            conn->tx_tail = 0;
+            conn->tx_inflight = 0;
+            conn->tx_pend_off = 0;
+            conn->tx_pend_len = 0;
+            conn->rx_ended = 0;
+            conn_cnt++;
+
+            uring_submit();
+            return 0;
+        }
+
+        close(sock);
+    }
+
+    return -1;
+}
+
+/**@brief TCP Connect for a reconnect
+ *
+ * @note Never waits on the network: the connect is finished by the event
+ *       thread, which reports it with mqttnox_tcp_connected. The addresses
+ *       are those mqttnox_tcp_connect resolved, tried in turn; only a
+ *       client that never connected resolves here.
+ *
+ * @param[in]   c     mqttnox object \see mqttnox_client_t
+ * @param[in]   addr
+ * @param[in]   port  TCP port number used in mQTT
+ *
+ * @return     MQTTNOX_TCP_CONNECT_PENDING, MQTTNOX_TCP_CONNECT_BUSY while
+ *             the last connection is closing, -1 on failure
+ */
+int mqttnox_tcp_connect_async(mqttnox_client_t* c, char * addr, int port)
+{
+    connection_t* conn = (connection_t*)c->tal_ctx;
+    struct addrinfo hints;
+    struct addrinfo* result = NULL;
+    char port_str[32];
+    int rc;
+
+    if (conn == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&ring_lock);
+    rc = (conn->sock < 0) ? 0 : (conn->closing ? MQTTNOX_TCP_CONNECT_BUSY : -1);
+    pthread_mutex_unlock(&ring_lock);
+
+    if (rc != 0) {
+        return rc;
+    }
+
+    if (conn->ai_list == NULL)
+    {
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_protocol = IPPROTO_TCP;
+
+        snprintf(port_str, sizeof(port_str), "%d", port);
+
+        rc = getaddrinfo(addr, port_str, &hints, &result);
+        if (rc != 0) {
+            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "getaddrinfo failed with error: %s\n", gai_strerror(rc));
+            return -1;
+        }
+        conn->ai_list = result;
+    }
+
+    pthread_mutex_lock(&ring_lock);
+
+    conn->ai_next = conn->ai_list;
+
+    rc = mqttnox_tcp_loop_start();
+    if (rc == 0) {
+        rc = uring_start(conn);
+    }
+
+    pthread_mutex_unlock(&ring_lock);
+
+    if (rc != 0) {
+        mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "connect error\n");
+        return -1;
+    }
+
+    return MQTTNOX_TCP_CONNECT_PENDING;
+}
+
+/**@brief TCP Send
+ *
+ * @note data is copied into the registered staging buffer and written
+ *       asynchronously. Never blocks, see mqttnox_tcp_sendv.
+ */
+int mqttnox_tcp_send(mqttnox_client_t* c, uint8_t * data, uint32_t len)
+{
+    mqttnox_iovec_t iov;
+
+    iov.data = data;
+    iov.len = len;
+
+    return mqttnox_tcp_sendv(c, &iov, 1);
+}
+
+/**@brief TCP Scatter-Gather Send
+ *
+ * @note segments are gathered straight into the registered staging buffer,
+ *       which is the one copy this TAL needs anyway, and go out together in
+ *       the next write.
+ *
+ * @param[in]   c        mqttnox object \see mqttnox_client_t
+ * @param[in]   iov      segments to send in order
+ * @param[in]   iov_cnt  number of segments, at most MQTTNOX_TCP_IOV_MAX
+ *
+ * @return     0 on success, non-zero otherwise
+ */
+int mqttnox_tcp_sendv(mqttnox_client_t* c, const mqttnox_iovec_t* iov, uint8_t iov_cnt)
+{
+    connection_t* conn = (connection_t*)c->tal_ctx;
+    uint32_t done;
+    uint8_t i;
+    int rc = 0;
+
+    if (conn == NULL || iov_cnt > MQTTNOX_TCP_IOV_MAX) {
+        return 1;
+    }
+
+    pthread_mutex_lock(&ring_lock);
+
+    if (conn->sock < 0 || conn->closing || conn->rx_ended || conn->connecting) {
+        rc = 1;
+    }
+
+    /* Frames are copied whole under the lock, so they never interleave.
+       Once bytes are pending, later ones queue behind them to keep order */
+    for (i = 0; i < iov_cnt && rc == 0; i++)
+    {
+        done = (conn->tx_pend_len == 0) ? uring_stage(conn, iov[i].data, iov[i].len) : 0;
+
+        if (done < iov[i].len && uring_pend(conn, &iov[i].data[done], iov[i].len - done) != 0) {
+            /* The peer stopped reading, the receive side reports the loss */
+            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "send backlog full, dropping connection\n");
+            conn->closing = 1;
+            shutdown(conn->sock, SHUT_RDWR);
+            rc = 1;
+        }
+    }
+
+    /* Otherwise the completion of the current write picks it up */
+    if (rc == 0 && conn->tx_inflight == 0 && uring_arm_send(conn) != 0) {
+        rc = 1;
+    }
+
+    pthread_mutex_unlock(&ring_lock);
+
+    if (rc != 0) {
+        mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "send failed\n");
+    }
+
+    return rc;
+}
+
+int mqttnox_tcp_disconnect(mqttnox_client_t* c)
+{
+    connection_t* conn = (connection_t*)c->tal_ctx;
+
+    if (conn == NULL) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&ring_lock);
+
+    /* The multishot receive completes with EOF and the event thread
+       releases the socket once the kernel is done with it */
+    if (conn->sock >= 0 && !conn->closing) {
+        conn->closing = 1;
+        shutdown(conn->sock, SHUT_RDWR);
+    }
+
+    pthread_mutex_unlock(&ring_lock);
+
+    return 0;
+}
+
+/**@brief TCP Deinitialization
+ *
+ * @note Not on the event thread: waits for it to close the connection,
+ *       then gives the slot back
+ *
+ * @param[in]   c    mqttnox object \see mqttnox_client_t
+ */
+void mqttnox_tcp_deinit(mqttnox_client_t* c)
+{
+    connection_t* conn = (connection_t*)c->tal_ctx;
+
+    if (conn == NULL) {
+        return;
+    }
+
+    mqttnox_tcp_disconnect(c);
+    mqttnox_wait_thread(c);
+
+    pthread_mutex_lock(&ring_lock);
+
+    if (conn->ai_list != NULL) {
+        freeaddrinfo(conn->ai_list);
+        conn->ai_list = NULL;
+    }
+    free(conn->tx_pend);
+    conn->tx_pend = NULL;
+    conn->tx_pend_size = 0;
+    conn->rcv_cback = NULL;
+    conn->client = NULL;
+
+    pthread_mutex_unlock(&ring_lock);
+
+    c->tal_ctx = NULL;
+}
+
+/**@brief Delivers received bytes to the client
+ *
+ * @note Hands over the provided buffer directly. The library dispatches
+ *       complete packets from it in place and keeps any partial packet.
+ */
+static void uring_deliver(connection_t* conn, uint8_t* data, uint32_t len)
+{
+    if (len > 0 && conn->rcv_cback != NULL) {
+        conn->rcv_cback(conn->client, data, len);
+    }
+}
+
+/**@brief Releases a connection once the kernel holds nothing of it
+ *
+ * @note The slot is reused by the next connection, so both the multishot
+ *       receive and the write in flight must have completed first: a late
+ *       completion would otherwise be taken for the new connection's.
+ *       Reported to the library unless mqttnox_tcp_disconnect asked for it.
+ */
+static void uring_close(connection_t* conn)
+{
+    mqttnox_client_t* client = NULL;
+    uint8_t peer = 0;
+
+    pthread_mutex_lock(&ring_lock);
+
+    if (conn->sock >= 0 && conn->rx_ended && conn->tx_inflight == 0) {
+        client = conn->client;
+        peer = !conn->closing;
+
+        close(conn->sock);
+        conn->sock = -1;
+        conn->closing = 0;
+        conn->rx_ended = 0;
+        conn_cnt--;
+
+        /* Unsent bytes belong to the connection just closed */
+        conn->tx_pend_off = 0;
+        conn->tx_pend_len = 0;
+
+        pthread_cond_broadcast(&close_cond);
+    }
+
+    pthread_mutex_unlock(&ring_lock);
+
+    /* Once closed, the slot may be released by mqttnox_tcp_deinit */
+    if (peer) {
+        mqttnox_tcp_closed(client);
+    }
+}
+
+/**@brief Finishes a connect started by mqttnox_tcp_connect_async
+ *
+ * @note A failed address gives way to the next one. The result is
+ *       reported unless mqttnox_tcp_disconnect abandoned the connect.
+ *
+ * @param[in]   conn  connecting connection
+ * @param[in]   res   poll completion, the events seen or an error
+ */
+static void uring_connect_done(connection_t* conn, int32_t res)
+{
+    mqttnox_client_t* c = conn->client;
+    socklen_t err_len = sizeof(int);
+    int report = -1;
+    int err = 0;
+
+    pthread_mutex_lock(&ring_lock);
+
+    if (!conn->closing && res > 0 && (res & POLLOUT) && !(res & (POLLERR | POLLHUP)) &&
+        getsockopt(conn->sock, SOL_SOCKET, SO_ERROR, &err, &err_len) == 0 && err == 0 &&
+        uring_arm_recv(conn) == 0)
+    {
+        conn->connecting = 0;
+        report = 1;
+    }
+    else
+    {
+        close(conn->sock);
+        conn->sock = -1;
+        conn_cnt--;
+
+        if (conn->closing || uring_start(conn) != 0) {
+            report = conn->closing ? -1 : 0;
+            conn->connecting = 0;
+            conn->closing = 0;
+            pthread_cond_broadcast(&close_cond);
+        }
+    }
+
+    pthread_mutex_unlock(&ring_lock);
+
+    if (report >= 0) {
+        mqttnox_tcp_connected(c, report);
+    }
+}
+
+static void uring_handle_cqe(uint64_t user_data, int32_t res, uint32_t flags)
+{
+    connection_t* conn = (connection_t*)(uintptr_t)(user_data & ~(uint64_t)URING_OP_MASK);
+    uint16_t bid;
+
+    switch (user_data & URING_OP_MASK)
+    {
+        case URING_OP_RECV:
+            if (res > 0 && (flags & IORING_CQE_F_BUFFER)) {
+                bid = (uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT);
+                uring_deliver(conn, rx_bufs[bid], (uint32_t)res);
+                uring_recycle_buf(bid);
+            }
+
+            if (res == 0 || (res < 0 && res != -ENOBUFS)) {
+                /* Connection has been closed */
+                if (!(flags & IORING_CQE_F_MORE)) {
+                    pthread_mutex_lock(&ring_lock);
+                    conn->rx_ended = 1;
+                    if (conn->tx_inflight != 0) {
+                        /* Fails the write rather than wait for the peer to read it */
+                        shutdown(conn->sock, SHUT_RDWR);
+                    }
+                    pthread_mutex_unlock(&ring_lock);
+
+                    uring_close(conn);
+                }
+            }
+            else if (!(flags & IORING_CQE_F_MORE)) {
+                /* Kernel dropped the multishot (e.g. out of buffers) */
+                pthread_mutex_lock(&ring_lock);
+                if (conn->sock >= 0 && !conn->closing) {
+                    uring_arm_recv(conn);
+                }
+                pthread_mutex_unlock(&ring_lock);
+            }
+            break;
+
+        case URING_OP_CONN:
+            uring_connect_done(conn, res);
+            break;
+
+        case URING_OP_SEND:
+            pthread_mutex_lock(&ring_lock);
+            conn->tx_inflight = 0;
+            if (res > 0) {
+                conn->tx_head += (uint32_t)res;
+                if (conn->sock >= 0 && !conn->closing && !conn->rx_ended) {
+                    uring_refill(conn);
+                    uring_arm_send(conn);
+                }
+            }
+            else {
+                /* Drop whatever is staged - the receive side reports the close */
+                conn->tx_head = conn->tx_tail;
+                conn->tx_pend_off = 0;
+                conn->tx_pend_len = 0;
+            }
+            pthread_mutex_unlock(&ring_lock);
+
+            /* The receive may have ended while this write was in flight */
+            uring_close(conn);
+            break;
+
+        default:
+            break;
+    }
+}
+
+int mqttnox_tcp_receive_thread(void * ptr)
+{
+    struct io_uring_cqe* cqe;
+    uint32_t head;
+    uint32_t tail;
+    uint64_t user_data;
+    int32_t res;
+    uint32_t flags;
+    int run = 1;
+
+    (void)ptr;
+
+    while (run)
+    {
+        if (uring_enter(ring.fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+            break;
+        }
+
+        head = *ring.cq_head;
+        tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+
+        while (head != tail)
+        {
+            cqe = &ring.cqes[head & *ring.cq_mask];
+            user_data = cqe->user_data;
+            res = cqe->res;
+            flags = cqe->flags;
+
+            /* Release the slot before running callbacks which may submit */
+            head++;
+            __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+
+            uring_handle_cqe(user_data, res, flags);
+        }
+
+        /* Thread ends once the last connection is gone */
+        pthread_mutex_lock(&ring_lock);
+        if (conn_cnt == 0) {
+            thread_running = 0;
+            run = 0;
+        }
+        pthread_mutex_unlock(&ring_lock);
+    }
+
+    return 0;
+}
+
+static void* mqttnox_tcp_thread_entry(void* ptr)
+{
+    mqttnox_tcp_receive_thread(ptr);
+
+    return NULL;
+}
+
+/**@brief Waits until the client's connection has closed
+ *
+ * @param[in]   c    mqttnox object \see mqttnox_client_t
+ */
+void mqttnox_wait_thread(mqttnox_client_t* c)
+{
+    connection_t* conn = (connection_t*)c->tal_ctx;
+
+    if (conn == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&ring_lock);
+    while (conn->sock >= 0) {
+        pthread_cond_wait(&close_cond, &ring_lock);
+    }
+    pthread_mutex_unlock(&ring_lock);
+}
+
+
+void mqttnox_hal_debug_printf(const char* str)
+{
+    printf("%s", str);
+}
+
+uint32_t mqttnox_hal_time_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000);
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -70,41 +70,23 @@ extern "C" {
 #include "mqttnox_debug.h"
 #include "mqttnox_tal.h"
 
-struct hostent* host;
-
-uintptr_t receive_thread;
-HANDLE mqttnox_tcp_receive_thread_obj;
-
-uint8_t server_ready = 0;
-
-static uint8_t main_buffer[1024];
-
-static mqttnox_tcp_rcv_t mqttnox_tcp_rcv_cback;
-static mqttnox_client_t* client = NULL;
-
-mqttnox_tcp_rcv_t data_callback = NULL;
-
-SOCKET ClientSocket = INVALID_SOCKET;
-WSADATA wsaData;
-
+#if MQTTNOX_TAL_API_VERSION != 9
+#error "mqttnox_tal_windows.c implements TAL API version 9"
+#endif
 
 typedef struct
 {
-    int sock;
-    struct sockaddr address;
-
-#if defined(__linux__)
-    socklen_t  addr_len;
-#else
-    int addr_len;
-#endif
-    SOCKET ClientSocket;
+    SOCKET sock;
+    mqttnox_client_t* client;
+    mqttnox_tcp_rcv_t rcv_cback;
+    HANDLE receive_thread_obj;
 
 } connection_t;
 
 
 /**@brief TCP Initialization
  * 
+ * @note Allocates the per-connection context kept in c->tal_ctx
  * 
  * @param[in]   c    mqttnox object \see mqttnox_client_t
  * @param[in]   rcv_cback functio pointer to the receiver function
@@ -112,12 +94,26 @@ typedef struct
  */
 int mqttnox_tcp_init(mqttnox_client_t* c, mqttnox_tcp_rcv_t rcv_cback)
 {
-    if(rcv_cback != NULL) {
-        mqttnox_tcp_rcv_cback = rcv_cback;
+    connection_t* conn;
+
+    if (c == NULL) {
+        return -1;
     }
 
-    if (c != NULL) {
-        client = c;
+    conn = (connection_t*)c->tal_ctx;
+    if (conn == NULL) {
+        conn = (connection_t*)calloc(1, sizeof(connection_t));
+        if (conn == NULL) {
+            return -1;
+        }
+        conn->sock = INVALID_SOCKET;
+        c->tal_ctx = conn;
+    }
+
+    conn->client = c;
+
+    if(rcv_cback != NULL) {
+        conn->rcv_cback = rcv_cback;
     }
 
     return 0;
@@ -128,26 +124,28 @@ int mqttnox_tcp_init(mqttnox_client_t* c, mqttnox_tcp_rcv_t rcv_cback)
  * @note this function provides TCP connection to the Address and Port
  *       specified
  * 
+ * @param[in]   c     mqttnox object \see mqttnox_client_t
  * @param[in]   addr  
  * @param[in]   port  TCP port number used in mQTT
  *
  */
-int mqttnox_tcp_connect(char * addr, int port)
+int mqttnox_tcp_connect(mqttnox_client_t* c, char * addr, int port)
 {
     int rc;
-    connection_t * connection;
+    connection_t * conn = (connection_t*)c->tal_ctx;
     struct sockaddr_in server;
     void* ptr = NULL;
     char addrstr[32];
-
-    int sock = -1;
-
-    data_callback = mqttnox_tcp_rcv_cback;
+    WSADATA wsaData;
 
     struct addrinfo* result = NULL;
     struct addrinfo hints;
 
-    /* Initialize Winsock */
+    if (conn == NULL) {
+        return -1;
+    }
+
+    /* Initialize Winsock - reference counted, balanced in disconnect */
     rc = WSAStartup(MAKEWORD(2, 2), &wsaData);
     if (rc != 0) {
         printf("WSAStartup failed with error: %d\n", rc);
@@ -172,8 +170,8 @@ int mqttnox_tcp_connect(char * addr, int port)
     }
 
     /* Create a SOCKET for connecting to server */
-    ClientSocket = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
-    if (ClientSocket == INVALID_SOCKET) {
+    conn->sock = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+    if (conn->sock == INVALID_SOCKET) {
         printf("socket failed with error: %ld\n", WSAGetLastError());
         freeaddrinfo(result);
         WSACleanup();
@@ -191,7 +189,7 @@ int mqttnox_tcp_connect(char * addr, int port)
 	server.sin_port = htons( port );
 
 	/* Connect to remote server */
-	if (connect(ClientSocket , (struct sockaddr *)&server , sizeof(server)) < 0)
+	if (connect(conn->sock , (struct sockaddr *)&server , sizeof(server)) < 0)
 	{
 		puts("connect error");
 		return -1;
@@ -199,27 +197,37 @@ int mqttnox_tcp_connect(char * addr, int port)
 
     printf("Ready and listening\n");
 
-    connection = (connection_t*)malloc(sizeof(connection_t));
-    if (connection == NULL) {
-        return -1;
-    }
-
     /* Create listening thread */
-    mqttnox_tcp_receive_thread_obj = (HANDLE)_beginthread(&mqttnox_tcp_receive_thread, 0, (void*)connection);
+    conn->receive_thread_obj = (HANDLE)_beginthread(&mqttnox_tcp_receive_thread, 0, (void*)conn);
 
     return 0;
 }
 
-int mqttnox_tcp_send(uint8_t * data, uint16_t len)
+/**@brief TCP Connect for a reconnect
+ *
+ * @note Blocks as mqttnox_tcp_connect does, there is no event thread to
+ *       finish the connect
+ */
+int mqttnox_tcp_connect_async(mqttnox_client_t* c, char * addr, int port)
+{
+    return (mqttnox_tcp_connect(c, addr, port) == 0) ? 0 : -1;
+}
+
+int mqttnox_tcp_send(mqttnox_client_t* c, uint8_t * data, uint32_t len)
 {
+    connection_t* conn = (connection_t*)c->tal_ctx;
     int ret = 1;
 
+    if (conn == NULL || conn->sock == INVALID_SOCKET) {
+        return 1;
+    }
+
      if (len > 0) {
-        // Echo the buffer back to the sender
-        ret = send(ClientSocket, data, len, 0);
+        ret = send(conn->sock, (const char*)data, (int)len, 0);
         if (ret == SOCKET_ERROR) {
             printf("send failed with error: %d\n", WSAGetLastError());
-            closesocket(ClientSocket);
+            closesocket(conn->sock);
+            conn->sock = INVALID_SOCKET;
             WSACleanup();
             return 1;
         }
@@ -229,46 +237,116 @@ int mqttnox_tcp_send(uint8_t * data, uint16_t len)
     return 0;
 }
 
-int mqttnox_tcp_disconnect(void)
+/**@brief TCP Scatter-Gather Send
+ *
+ * @note all segments go out in one WSASend without being gathered first
+ *
+ * @param[in]   c        mqttnox object \see mqttnox_client_t
+ * @param[in]   iov      segments to send in order
+ * @param[in]   iov_cnt  number of segments, at most MQTTNOX_TCP_IOV_MAX
+ */
+int mqttnox_tcp_sendv(mqttnox_client_t* c, const mqttnox_iovec_t* iov, uint8_t iov_cnt)
+{
+    connection_t* conn = (connection_t*)c->tal_ctx;
+    WSABUF bufs[MQTTNOX_TCP_IOV_MAX];
+    DWORD sent = 0;
+    uint8_t i;
+    int ret;
+
+    if (conn == NULL || conn->sock == INVALID_SOCKET || iov_cnt > MQTTNOX_TCP_IOV_MAX) {
+        return 1;
+    }
+
+    for (i = 0; i < iov_cnt; i++) {
+        bufs[i].buf = (CHAR*)iov[i].data;
+        bufs[i].len = iov[i].len;
+    }
+
+    /* Blocking socket - WSASend returns once everything is queued */
+    ret = WSASend(conn->sock, bufs, iov_cnt, &sent, 0, NULL, NULL);
+    if (ret == SOCKET_ERROR) {
+        printf("send failed with error: %d\n", WSAGetLastError());
+        closesocket(conn->sock);
+        conn->sock = INVALID_SOCKET;
+        WSACleanup();
+        return 1;
+    }
+    printf("Bytes sent: %lu\n", sent);
+
+    return 0;
+}
+
+int mqttnox_tcp_disconnect(mqttnox_client_t* c)
 {
-    closesocket(ClientSocket);
-    WSACleanup();
+    connection_t* conn = (connection_t*)c->tal_ctx;
+
+    if (conn != NULL && conn->sock != INVALID_SOCKET) {
+        closesocket(conn->sock);
+        conn->sock = INVALID_SOCKET;
+        WSACleanup();
+    }
 
     return 0;
 }
 
 
+/**@brief TCP Deinitialization
+ *
+ * @note Waits for the receive thread, then frees the connection context
+ *
+ * @param[in]   c    mqttnox object \see mqttnox_client_t
+ */
+void mqttnox_tcp_deinit(mqttnox_client_t* c)
+{
+    connection_t* conn = (connection_t*)c->tal_ctx;
+
+    if (conn == NULL) {
+        return;
+    }
+
+    mqttnox_tcp_disconnect(c);
+    if (conn->receive_thread_obj != NULL) {
+        WaitForSingleObject(conn->receive_thread_obj, INFINITE);
+    }
+
+    free(conn);
+    c->tal_ctx = NULL;
+}
+
+
 int mqttnox_tcp_receive_thread(void * ptr)
 {    
     int len = 0;
     connection_t * conn;    
+    mqttnox_client_t* client;
     int run = 1;
-    int i = 0;
 
-    if (!ptr) run = 0;
+    if (!ptr) return 0;
 
     conn = (connection_t *)ptr;
+    client = conn->client;
 
     while(run)
     {
         mqttnox_debug_printf(client, MQTTNOX_DEBUG_LVL_DEBUG, "Starting receive at offset: %u, reading only %u\n", client->rcv_offset, (client->rcv_buf_size - client->rcv_offset));
 
-        len = recv(ClientSocket, &client->rcv_buf[client->rcv_offset], (client->rcv_buf_size - client->rcv_offset), 0);
+        len = recv(conn->sock, &client->rcv_buf[client->rcv_offset], (int)(client->rcv_buf_size - client->rcv_offset), 0);
 
         if (len > 0)
         {
-            print_buffer(client->rcv_buf, len + client->rcv_offset);
-
-            if(mqttnox_tcp_rcv_cback != NULL) {
-                data_callback(client, client->rcv_buf, len + client->rcv_offset);
+            if(conn->rcv_cback != NULL) {
+                conn->rcv_cback(client, &client->rcv_buf[client->rcv_offset], (uint32_t)len);
             }
 
             len = 0;            
         }
-        else if (len == 0)
+        else
         {
-            /* Connection has been closed */
-            closesocket(ClientSocket);
+            /* Connection has been closed, by the peer if the socket is still set */
+            if (conn->sock != INVALID_SOCKET) {
+                mqttnox_tcp_disconnect(client);
+                mqttnox_tcp_closed(client);
+            }
             run = 0;
         }
     }
@@ -276,9 +354,13 @@ int mqttnox_tcp_receive_thread(void * ptr)
     return 0;
 }
 
-void mqttnox_wait_thread(void)
+void mqttnox_wait_thread(mqttnox_client_t* c)
 {
-    WaitForSingleObject(mqttnox_tcp_receive_thread_obj, INFINITE);
+    connection_t* conn = (connection_t*)c->tal_ctx;
+
+    if (conn != NULL) {
+        WaitForSingleObject(conn->receive_thread_obj, INFINITE);
+    }
 }
 
 
@@ -287,6 +369,11 @@ void mqttnox_hal_debug_printf(const char* str)
     printf("%s", str);    
 }
 
+uint32_t mqttnox_hal_time_ms(void)
+{
+    return (uint32_t)GetTickCount64();
+}
+
 #ifdef __cplusplus
 }
 #endif
\ No newline at end of file
@@ -47,696 +47,2673 @@ extern "C" {
 #include "mqttnox_tal.h"
 #include "mqttnox_config.h"
 #include "mqttnox_debug.h"
+#include "mqttnox_txq.h"
+#include "mqttnox_inflight.h"
+#include "mqttnox_ident.h"
+#include "mqttnox_store.h"
+#include "mqttnox_offline.h"
+#include "mqttnox_reconnect.h"
+#include "mqttnox_keepalive.h"
+#include "mqttnox_timer.h"
+#include "mqttnox_router.h"
+
+#if MQTTNOX_TX_BUF_SIZE > MQTTNOX_TXQ_FRAME_MAX
+#error "MQTTNOX_TX_BUF_SIZE must fit in half of the outbound queue"
+#endif
 
-
-static uint8_t mqttnox_tx_buf[MQTTNOX_TX_BUF_SIZE];
-static uint8_t mqttnox_rx_buf[4096];
+#define MAX_REMAIN_LEN_BYTES (4)
 
 /* Intrnal Helper Functions */
-static int mqttnox_append_utf8_string(uint8_t* buffer, const char* str, uint8_t add_len);
 static void mqttnox_send_event(mqttnox_client_t* c, mqttnox_evt_data_t* data);
 
 /* MQTT Response Handlers */
-static void mqttnox_handler_connack(mqttnox_client_t* c, uint8_t * data, uint16_t len);
-static void mqttnox_handler_publish(mqttnox_client_t* c, uint8_t* data, uint16_t len);
-static void mqttnox_handler_puback(mqttnox_client_t* c, uint8_t * data, uint16_t len);
-static void mqttnox_handler_pubrec(mqttnox_client_t* c, uint8_t * data, uint16_t len);
-static void mqttnox_handler_pubrel(mqttnox_client_t* c, uint8_t * data, uint16_t len);
-static void mqttnox_handler_pubcomp(mqttnox_client_t* c, uint8_t * data, uint16_t len);
-static void mqttnox_handler_suback(mqttnox_client_t* c, uint8_t * data, uint16_t len);
-static void mqttnox_handler_unsuback(mqttnox_client_t* c, uint8_t * data, uint16_t len);
-static void mqttnox_handler_pingresp(mqttnox_client_t* c, uint8_t * data, uint16_t len);
+static void mqttnox_handler_connack(mqttnox_client_t* c, mqttnox_hdr_t* hdr, uint8_t* data, uint32_t len);
+static void mqttnox_handler_publish(mqttnox_client_t* c, mqttnox_hdr_t* hdr, uint8_t* data, uint32_t len);
+static void mqttnox_handler_puback(mqttnox_client_t* c, mqttnox_hdr_t* hdr, uint8_t* data, uint32_t len);
+static void mqttnox_handler_pubrec(mqttnox_client_t* c, mqttnox_hdr_t* hdr, uint8_t* data, uint32_t len);
+static void mqttnox_handler_pubrel(mqttnox_client_t* c, mqttnox_hdr_t* hdr, uint8_t* data, uint32_t len);
+static void mqttnox_handler_pubcomp(mqttnox_client_t* c, mqttnox_hdr_t* hdr, uint8_t* data, uint32_t len);
+static void mqttnox_handler_suback(mqttnox_client_t* c, mqttnox_hdr_t* hdr, uint8_t* data, uint32_t len);
+static void mqttnox_handler_unsuback(mqttnox_client_t* c, mqttnox_hdr_t* hdr, uint8_t* data, uint32_t len);
+static void mqttnox_handler_pingresp(mqttnox_client_t* c, mqttnox_hdr_t* hdr, uint8_t* data, uint32_t len);
 static mqttnox_rc_t mqttnox_puback(mqttnox_client_t* c, uint16_t identifier);
 
 static mqttnox_rc_t mqttnox_pubrec(mqttnox_client_t* c, uint16_t identifier);
 static mqttnox_rc_t mqttnox_pubcomp(mqttnox_client_t* c, uint16_t identifier);
 static mqttnox_rc_t mqttnox_pubrel(mqttnox_client_t* c, uint16_t identifier);
+static mqttnox_rc_t mqttnox_ack_flush(mqttnox_client_t* c);
+static mqttnox_rc_t mqttnox_publish_batch_send(mqttnox_client_t* c, mqttnox_publish_item_t* items, uint16_t item_cnt);
+static void mqttnox_offline_drain(mqttnox_client_t* c);
+static void mqttnox_connection_lost(mqttnox_client_t* c, mqttnox_disconnect_reason_t reason);
+static void mqttnox_resubscribe(mqttnox_client_t* c);
+static mqttnox_rc_t mqttnox_subscribe_send(mqttnox_client_t* c, mqttnox_topic_sub_t* topics, uint8_t topic_cnt);
+static mqttnox_rc_t mqttnox_pingreq(mqttnox_client_t* c);
+static void mqttnox_wheel_kick(mqttnox_client_t* c);
 
-int mqttnox_set_remain_len(uint8_t* buffer, uint32_t len);
-int mqttnox_decode_remain_len(uint8_t* buffer, uint32_t* len);
 
 /**@brief Initialization of the MQTT Client
 *
-* @note This should be called only once and must be called prior to any
-*       other library functions being used.
+* @note Must be called prior to any other library functions being used.
+*       Calling it again on an initialized client, once its connection is
+*       closed, releases what the client held first.
 *
 * @param[in]   c   mqttnox object \see mqttnox_client_t
 */
 mqttnox_rc_t mqttnox_init(mqttnox_client_t* c, mqttnox_debug_lvl_t lvl)
 {
+    if (c->flag_initialized == MQTTNOX_INIT_FLAG) {
+        mqttnox_deinit(c);
+    }
+
     memset((void*)c, 0, sizeof(mqttnox_client_t));
 
-    c->packet_ident = 17;
+    mqttnox_ident_init(&c->packet_ident);
+    mqttnox_txq_init(&c->txq);
+    mqttnox_inflight_init(&c->inflight, MQTTNOX_MAX_INFLIGHT);
+    mqttnox_atomic_store(&c->tx_paused, 0);
+    c->ack_len = 0;
+    c->ack_defer = 0;
+    c->tx_high_watermark = MQTTNOX_TX_HIGH_WATERMARK;
+    c->tx_low_watermark = MQTTNOX_TX_LOW_WATERMARK;
     c->debug_lvl = lvl;
     c->keepalive = MQTT_CONN_DEFAULT_KEEPALIVE;
 
     /* Set to initialized */
     c->flag_initialized = MQTTNOX_INIT_FLAG;
 
-    c->rcv_buf = mqttnox_rx_buf;
-    c->rcv_buf_size = sizeof(mqttnox_rx_buf);
+    c->rcv_buf = c->rx_buf;
+    c->rcv_buf_size = sizeof(c->rx_buf);
     c->rcv_offset = 0;
 
+#if MQTTNOX_RX_RING_ENABLE
+    c->rcv_ring = mqttnoxlib_rx_ring_create(MQTTNOX_RX_RING_SIZE);
+    if (c->rcv_ring != NULL) {
+        c->rcv_buf = c->rcv_ring;
+        c->rcv_buf_size = MQTTNOX_RX_RING_SIZE;
+    }
+#endif
+
     return MQTTNOX_SUCCESS;
 }
 
-/**@brief TCP callback for data reception
-*
+/**@brief Releases resources held by the MQTT Client
 *
-* @param[in]   c    mqttnox object \see mqttnox_client_t
-* @param[in]   data pointer to buffer with the incoming data from the server
-* @param[in]   len  length of the data from the server
+* @note Call once the connection is closed and the receive thread has
+*       finished. The TAL frees its connection context, \see
+*       mqttnox_tcp_deinit. The client must be initialized again before reuse.
 *
+* @param[in]   c   mqttnox object \see mqttnox_client_t
 */
-void mqttnox_tcp_rcv_func(mqttnox_client_t* c, uint8_t* data, uint16_t len)
+mqttnox_rc_t mqttnox_deinit(mqttnox_client_t* c)
 {
-    mqttnox_hdr_t* hdr = NULL;
-    uint32_t remain_length = 0;
-    int remain_len_byte = 0;
-    size_t left = len;
-    size_t offset = 0;
+    if (c == NULL || c->flag_initialized != MQTTNOX_INIT_FLAG) {
+        return MQTTNOX_RC_ERROR_NOT_INIT;
+    }
+
+    mqttnox_tcp_deinit(c);
+    c->tal_ctx = NULL;
 
-    uint8_t* ptr = data;
+    if (c->rcv_ring != NULL) {
+        mqttnoxlib_rx_ring_release(c->rcv_ring, c->rcv_buf_size);
+        c->rcv_ring = NULL;
+    }
 
-    mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "TCP Receive Function length %u\n", len);
+    mqttnox_store_close(&c->store);
+    mqttnox_offline_close(&c->offline);
 
-    do
-    {
-        do
-        {
-            if (c == NULL) {
-                mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "Client NULL %s Line %d\n", __FILE__, __LINE__);
-                break;
-            }
+    c->rcv_buf = c->rx_buf;
+    c->rcv_buf_size = sizeof(c->rx_buf);
+    c->rcv_offset = 0;
+    c->flag_initialized = 0;
 
-            if (c->flag_initialized != MQTTNOX_INIT_FLAG) {
-                mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "Not initialized\n");
-                break;
-            }
+    return MQTTNOX_SUCCESS;
+}
 
-            if (data == NULL || len == 0) {
-                mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "Data NULL or zero length %s Line %d\n", __FILE__, __LINE__);
-                break;
-            }
+/**@brief Assigns a packet identifier to a QoS 1 or 2 message and records it
+*
+* @param[in]   reserved  non-zero if the caller holds room from
+*                        mqttnox_inflight_reserve
+*
+* @return      the identifier, 0 if the window is full or every identifier
+*              is held
+*/
+static uint16_t mqttnox_inflight_ident(mqttnox_client_t* c, uint8_t qos, void* user_ctx, uint8_t reserved)
+{
+    uint16_t ident = mqttnox_ident_alloc(&c->packet_ident);
 
-            hdr = (mqttnox_hdr_t*)ptr;
-            remain_len_byte = mqttnox_decode_remain_len(&data[sizeof(mqttnox_hdr_t) + offset], &remain_length);
+    if (ident == 0) {
+        return 0;
+    }
 
-            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "Packet with %u   %p \n", remain_length, ptr);
-            print_buffer(ptr, remain_length);
+    if (mqttnox_inflight_insert(&c->inflight, ident, qos, user_ctx, reserved) <= 0) {
+        mqttnox_ident_release(&c->packet_ident, ident);
+        return 0;
+    }
 
-            if (left < remain_length)
-            {
-                /* Packet incomplete */
+    return ident;
+}
 
-            }
+/**@brief Forgets a message that could not be sent
+*/
+static void mqttnox_inflight_drop(mqttnox_client_t* c, uint16_t ident)
+{
+    mqttnox_store_complete(&c->store, ident);
+    mqttnox_inflight_remove(&c->inflight, ident, 0, NULL);
+    mqttnox_ident_release(&c->packet_ident, ident);
+}
+
+static void mqttnox_sub_lock(mqttnox_sub_pending_t* p)
+{
+    while (!mqttnox_atomic_cas(&p->lock, 0, 1)) {
+        mqttnox_atomic_relax();
+    }
+}
 
+static void mqttnox_sub_unlock(mqttnox_sub_pending_t* p)
+{
+    mqttnox_atomic_store(&p->lock, 0);
+}
 
-            switch (hdr->type) {
+/**@brief Assigns a packet identifier to a SUBSCRIBE or UNSUBSCRIBE and
+*        records it until the SUBACK or UNSUBACK
+*
+* @return      the identifier, 0 if too many are awaiting their ack or every
+*              identifier is held
+*/
+static uint16_t mqttnox_sub_ident(mqttnox_client_t* c)
+{
+    mqttnox_sub_pending_t* p = &c->sub_pending;
+    uint16_t ident = mqttnox_ident_alloc(&c->packet_ident);
+    uint32_t i;
 
-                case MQTTNOX_CTRL_PKT_TYPE_CONNACK:
-                    c->status.connected = 1;
-                    mqttnox_handler_connack(c, ptr, len);
-                    break;
-                case MQTTNOX_CTRL_PKT_TYPE_PUBLISH:
-                    mqttnox_handler_publish(c, ptr, len);
-                    break;
-                case MQTTNOX_CTRL_PKT_TYPE_PUBACK:
-                    mqttnox_handler_puback(c, ptr, len);
-                    break;
-                case MQTTNOX_CTRL_PKT_TYPE_PUBREC:
-                    mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "MQTTNOX_CTRL_PKT_TYPE_PUBREC\n");
-                    mqttnox_handler_pubrec(c, ptr, len);
-                    break;
-                case MQTTNOX_CTRL_PKT_TYPE_PUBREL:
-                    mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "MQTTNOX_CTRL_PKT_TYPE_PUBREL\n");
-                    mqttnox_handler_pubrel(c, ptr, len);
-                    break;
-                case MQTTNOX_CTRL_PKT_TYPE_PUBCOMP:
-                    mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "MQTTNOX_CTRL_PKT_TYPE_PUBCOMP\n");
-                    mqttnox_handler_pubcomp(c, ptr, len);
-                    break;
-                case MQTTNOX_CTRL_PKT_TYPE_SUBACK:
-                    mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "MQTTNOX_CTRL_PKT_TYPE_SUBACK\n");
-                    mqttnox_handler_suback(c, ptr, len);
-                    break;
-                case MQTTNOX_CTRL_PKT_TYPE_UNSUBACK:
-                    mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "MQTTNOX_CTRL_PKT_TYPE_UNSUBACK\n");
-                    mqttnox_handler_unsuback(c, ptr, len);
-                    break;
-                case MQTTNOX_CTRL_PKT_TYPE_PINGRESP:
-                    mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "MQTTNOX_CTRL_PKT_TYPE_PINGRESP\n");
-                    mqttnox_handler_pingresp(c, ptr, len);
-                    break;
-                default:
-                    mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "Packet Type Error\n");
-                    break;
-            }
+    if (ident == 0) {
+        return 0;
+    }
 
-            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "Incrementing by %u \n", remain_length + sizeof(mqttnox_hdr_t) + remain_len_byte);
+    mqttnox_sub_lock(p);
+    for (i = 0; i < MQTTNOX_SUB_PENDING_MAX && p->ident[i] != 0; i++) {
+    }
+    if (i < MQTTNOX_SUB_PENDING_MAX) {
+        p->ident[i] = ident;
+    }
+    mqttnox_sub_unlock(p);
 
-            ptr += remain_length + sizeof(mqttnox_hdr_t) + remain_len_byte;
+    if (i == MQTTNOX_SUB_PENDING_MAX) {
+        mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "Too many subscriptions awaiting their ack\n");
+        mqttnox_ident_release(&c->packet_ident, ident);
+        return 0;
+    }
 
-            offset += remain_length + sizeof(mqttnox_hdr_t) + remain_len_byte;
-                        
-            left -= remain_length + sizeof(mqttnox_hdr_t) + remain_len_byte;
+    return ident;
+}
 
-            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "Bytes left: %u \n", left);
-            if (left > 4294964020) {
-                mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "Error left %u \n", left);
-            }
+/**@brief Gives back the identifier of an acknowledged or unsent SUBSCRIBE
+*        or UNSUBSCRIBE
+*
+* @note An identifier the client is not waiting on is left alone: it may be
+*       held by a message in flight
+*
+* @return      non-zero if the identifier was awaiting its ack
+*/
+static int mqttnox_sub_release(mqttnox_client_t* c, uint16_t ident)
+{
+    mqttnox_sub_pending_t* p = &c->sub_pending;
+    uint32_t i;
+
+    if (ident == 0) {
+        return 0;
+    }
+
+    mqttnox_sub_lock(p);
+    for (i = 0; i < MQTTNOX_SUB_PENDING_MAX && p->ident[i] != ident; i++) {
+    }
+    if (i < MQTTNOX_SUB_PENDING_MAX) {
+        p->ident[i] = 0;
+    }
+    mqttnox_sub_unlock(p);
 
-        } while (left >= remain_length);
+    if (i == MQTTNOX_SUB_PENDING_MAX) {
+        return 0;
+    }
 
-        if (((data + len) - ptr) > 0)
-        {            
-            /* Data Left */            
+    mqttnox_ident_release(&c->packet_ident, ident);
 
-            c->rcv_offset = (uint16_t)((data + len) - ptr);
-            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "Copying from offset %u \n", c->rcv_offset);
+    return 1;
+}
 
-            memcpy(c->rcv_buf, &c->rcv_buf[c->rcv_offset], left);
-            memset(&c->rcv_buf[c->rcv_offset], 0, c->rcv_buf_size - left);
-            
-            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "memsetting starting at %u length %u \n", c->rcv_offset, c->rcv_buf_size - left);
+/**@brief Gives back every identifier awaiting its ack, the connection they
+*        were sent on is gone and the ack never comes
+*/
+static void mqttnox_sub_drop(mqttnox_client_t* c)
+{
+    mqttnox_sub_pending_t* p = &c->sub_pending;
+    uint16_t ident;
+    uint32_t i;
 
-            print_buffer(c->rcv_buf, c->rcv_buf_size);
+    for (i = 0; i < MQTTNOX_SUB_PENDING_MAX; i++)
+    {
+        mqttnox_sub_lock(p);
+        ident = p->ident[i];
+        p->ident[i] = 0;
+        mqttnox_sub_unlock(p);
 
-            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "Buffer offset: %u \n", c->rcv_offset);
+        if (ident != 0) {
+            mqttnox_ident_release(&c->packet_ident, ident);
         }
-        else
-        {
-            c->rcv_offset = 0;
-        }
-
-    } while (0);    
+    }
 }
 
-/**@brief MQTT ConnACK Handler
-*
-* @note Connection Acknowledgement Handler
+/**@brief Records a QoS 1 or 2 message in the session store before it is sent
 *
-* @param[in]   c    mqttnox object \see mqttnox_client_t
-* @param[in]   data pointer to buffer with the incoming data from the server
-* @param[in]   len  length of the data from the server
+* @return MQTTNOX_SUCCESS, also when the client has no store
+*/
+static mqttnox_rc_t mqttnox_session_append(mqttnox_client_t* c, uint16_t ident, uint8_t qos,
+                                           const mqttnox_iovec_t* iov, uint8_t iov_cnt)
+{
+    if (c->store.base != NULL && !mqttnox_store_append(&c->store, ident, qos, iov, iov_cnt)) {
+        mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "Session store full\n");
+        return MQTTNOX_RC_ERROR_STORE;
+    }
+
+    return MQTTNOX_SUCCESS;
+}
+
+/**@brief Reports a completed or dropped QoS 1 or 2 message to the application
 *
-* @return     None
+* @param[in]   evt_id  MQTTNOX_EVT_PUBLISHED or MQTTNOX_EVT_PUBLISH_FAILED
 */
-static void mqttnox_handler_connack(mqttnox_client_t* c, uint8_t * data, uint16_t len)
-{    
-    uint8_t data_buffer[64];
-    mqttnox_evt_data_t* evt_data = (mqttnox_evt_data_t*)data_buffer;
-    mqttnox_response_var_hdr_t* var_hdr = (mqttnox_response_var_hdr_t*)(data + sizeof(mqttnox_hdr_t) + 2);
+static void mqttnox_publish_complete(mqttnox_client_t* c, const mqttnox_inflight_entry_t* entry, mqttnox_evt_id_t evt_id)
+{
+    mqttnox_evt_data_t evt_data;
 
-    mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "MQTTNOX_CTRL_PKT_TYPE_CONNACK\n");
-    mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "Return Code %x\n", var_hdr->conn_ack.conn_return_code);
-    mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "Session Present %u\n", var_hdr->conn_ack.flag_session_present);
+    evt_data.evt_id = evt_id;
+    evt_data.evt.published_evt.packet_identified_msb = MSB(entry->ident);
+    evt_data.evt.published_evt.packet_identified_lsb = LSB(entry->ident);
+    evt_data.evt.published_evt.packet_ident = entry->ident;
+    evt_data.evt.published_evt.qos = (mqttnox_qos_t)entry->qos;
+    evt_data.evt.published_evt.user_ctx = entry->user_ctx;
 
-    switch (var_hdr->conn_ack.conn_return_code)
-    {
-        case MQTTNOX_CONNECTION_RC_ACCEPTED:
-            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "Connection Successful\n");        
-            evt_data->evt_id = MQTTNOX_EVT_CONNECT;
-            evt_data->evt.connect_evt.session_present = var_hdr->conn_ack.flag_session_present;
-            mqttnox_send_event(c, evt_data);
+    mqttnox_send_event(c, &evt_data);
+}
 
-            break;
-        case MQTTNOX_CONNECTION_RC_REFUSED_UNACCP_PROT_VER:
-            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "Connection Refused, unacceptable protocol version\n");
-            evt_data->evt_id = MQTTNOX_EVT_CONNECT_ERROR;
-            evt_data->evt.conn_err_evt.reason = MQTTNOX_CONN_ERR_REFUSED_UNACCP_PROT_VER;
-            mqttnox_send_event(c, evt_data);            
-            break;
-        case MQTTNOX_CONNECTION_RC_REFUSED_IDENT_REJECTED:
-            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "Connection Refused, identifier rejected\n");
-            evt_data->evt_id = MQTTNOX_EVT_CONNECT_ERROR;
-            evt_data->evt.conn_err_evt.reason = MQTTNOX_CONN_ERR_REFUSED_IDENT_REJECTED;
-            mqttnox_send_event(c, evt_data);            
-            break;
-        case MQTTNOX_CONNECTION_RC_REFUSED_SERVER_UNAVAIL:
-            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "Connection Refused, Server Unavailable\n");
-            evt_data->evt_id = MQTTNOX_EVT_CONNECT_ERROR;
-            evt_data->evt.conn_err_evt.reason = MQTTNOX_CONN_ERR_REFUSED_SERVER_UNAVAIL;
-            mqttnox_send_event(c, evt_data);            
-            break;
-        case MQTTNOX_CONNECTION_RC_REFUSED_BAD_USER_PASS:
-            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "Connection Refused, Bad Username or Password\n");
-            evt_data->evt_id = MQTTNOX_EVT_CONNECT_ERROR;
-            evt_data->evt.conn_err_evt.reason = MQTTNOX_CONN_ERR_REFUSED_BAD_USER_PASS;
-            mqttnox_send_event(c, evt_data);            
-            break;
-        case MQTTNOX_CONNECTION_RC_REFUSED_NOT_AUTH:
-            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "Connection Refused, Not authorized\n");
-            evt_data->evt_id = MQTTNOX_EVT_CONNECT_ERROR;
-            evt_data->evt.conn_err_evt.reason = MQTTNOX_CONN_ERR_REFUSED_NOT_AUTH;
-            mqttnox_send_event(c, evt_data);            
-            break;
-        default:
-            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, 
-                                "Unknown error - invalid connection code 0x%x\n", 
-                                var_hdr->conn_ack.conn_return_code);
+/**@brief Restarts the keepalive interval after packets went out
+*
+* @note The clock is only read while the keepalive runs, and once per
+*       write to the TAL however many packets it carried
+*/
+static void mqttnox_tx_sent(mqttnox_client_t* c)
+{
+    if (mqttnox_atomic_load(&c->ping.active)) {
+        mqttnox_keepalive_sent(&c->ping, mqttnox_hal_time_ms());
     }
 }
 
-/**@brief MQTT Publish Handler
-*
-* @note Publish Ack Handler
+/**@brief Sends every committed frame
 *
-* @param[in]   c    mqttnox object \see mqttnox_client_t
-* @param[in]   data pointer to buffer with the incoming data from the server
-* @param[in]   len  length of the data from the server
+* @note Caller must hold the writer role. Frames that fail to send are
+*       dropped, the TAL has lost the connection at that point.
 *
-* @return     None
+* @param[in]   c   mqttnox object \see mqttnox_client_t
 */
-static void mqttnox_handler_publish(mqttnox_client_t* c, uint8_t* data, uint16_t len)
+static mqttnox_rc_t mqttnox_tx_send_queued(mqttnox_client_t* c)
 {
-    
-    mqttnox_rc_t rc;
-    mqttnox_hdr_t* hdr = (mqttnox_hdr_t*)data;    
-    mqttnox_evt_data_t  evt_data;    
-    uint32_t remain_length = 0;
-    int remain_len_byte = 0;
-    size_t offset = 0;
+    mqttnox_rc_t rc = MQTTNOX_SUCCESS;
+    mqttnox_iovec_t iov[MQTTNOX_TCP_IOV_MAX];
+    uint32_t slots;
+    uint8_t iov_cnt;
+    uint8_t sent = 0;
 
-    do
+    for (;;)
     {
-
-        remain_len_byte = mqttnox_decode_remain_len(&data[sizeof(mqttnox_hdr_t)], &remain_length);
-        if (remain_len_byte < 0 || remain_len_byte > 4) {
-            /* Remain length is wrong */
-            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "Remain Length is wrong: %u bytes \n", remain_len_byte);
+        iov_cnt = mqttnox_txq_peek(&c->txq, iov, MQTTNOX_TCP_IOV_MAX, &slots);
+        if (slots == 0) {
             break;
         }
 
-        mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "MQTTNOX_CTRL_PKT_TYPE_PUBLISH with QoS: %u\n", hdr->qos);
-
-
-        /* Decode Topic Length */
-        uint16_t topic_len = (data[sizeof(mqttnox_hdr_t) + remain_len_byte] << 8) | data[sizeof(mqttnox_hdr_t) + remain_len_byte + 1];
-#if 0
-        if (topic_len < sizeof(data_buffer)) {
-            //memcpy(data_buffer, data[1], topic_len);
-            evt_data.evt.received_evt.topic = data
+        if (iov_cnt > 0) {
+            if (mqttnox_tcp_sendv(c, iov, iov_cnt) != 0) {
+                rc = MQTTNOX_RC_ERROR;
+            }
+            sent = 1;
         }
-#endif
 
-        offset = sizeof(mqttnox_hdr_t) + remain_len_byte + 2;
+        mqttnox_txq_release(&c->txq, slots);
+    }
 
-        evt_data.evt_id = MQTTNOX_EVT_RECEIVED;
-        evt_data.evt.received_evt.topic = (char *)&data[offset];
-        evt_data.evt.received_evt.topic_len = topic_len;
-        
-        offset += topic_len;
+    if (sent) {
+        mqttnox_tx_sent(c);
+    }
 
-        /* Packet identifier only present in packets with QoS of 1 or 2 */
-        if (hdr->qos != MQTTNOX_QOS0_AT_MOST_ONCE_DELIV) {
-            evt_data.evt.received_evt.packet_identifier = (data[offset] << 8) | data[offset + 1];
-            offset += 2;
-        }
-        evt_data.evt.received_evt.payload = (char *)&data[offset];
-        evt_data.evt.received_evt.payload_len = remain_length - MQTTNOX_PACKET_IDENT_BYTE_LEN - MQTTNOX_LENGTH_BYTE_LEN - topic_len;
+    return rc;
+}
 
-        switch (hdr->qos)
-        {
-            case MQTTNOX_QOS0_AT_MOST_ONCE_DELIV:
-                /* Nothing to do for QoS 0*/
-                break;
-            case MQTTNOX_QOS1_AT_LEAST_ONCE_DELIV:
-                /* Send Puback */
-                rc = mqttnox_puback(c, evt_data.evt.received_evt.packet_identifier);
+/**@brief Reports an outbound flow control change to the application
+*/
+static void mqttnox_tx_flow_event(mqttnox_client_t* c, mqttnox_evt_id_t evt_id, uint32_t queued)
+{
+    mqttnox_evt_data_t evt_data;
 
-                break;
-            case MQTTNOX_QOS2_EXACTLY_ONCE_DELIV:
-                /* Send PubRec */
-                rc = mqttnox_pubrec(c, evt_data.evt.received_evt.packet_identifier);
-                break;
-        }
+    evt_data.evt_id = evt_id;
+    evt_data.evt.tx_flow_evt.queued = queued;
 
-    } while (0);
-    
     mqttnox_send_event(c, &evt_data);
 }
 
-/**@brief MQTT Pub Ack Handler
-*
-* @note Publish Ack Handler
-*
-* @param[in]   c    mqttnox object \see mqttnox_client_t
-* @param[in]   data pointer to buffer with the incoming data from the server
-* @param[in]   len  length of the data from the server
+/**@brief Resumes publishers once the queue is down to the low watermark
 *
-* @return     None
+* @note Runs on whichever thread drained the queue, so MQTTNOX_EVT_TX_RESUME
+*       may come from a publishing thread as well as the receive thread
 */
-static void mqttnox_handler_puback(mqttnox_client_t* c, uint8_t * data, uint16_t len)
+static void mqttnox_tx_resume_check(mqttnox_client_t* c)
 {
-    mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "MQTTNOX_CTRL_PKT_TYPE_PUBACK\n");
+    uint32_t used;
 
-    uint8_t data_buffer[64];
-    mqttnox_evt_data_t* evt_data = (mqttnox_evt_data_t*)data_buffer;
+    if (!mqttnox_atomic_load(&c->tx_paused)) {
+        return;
+    }
 
-    mqttnox_response_var_hdr_t* var_hdr = (mqttnox_response_var_hdr_t*)(data + sizeof(mqttnox_hdr_t) + 1);
+    used = mqttnox_txq_used(&c->txq);
+    if (used <= c->tx_low_watermark && mqttnox_atomic_cas(&c->tx_paused, 1, 0)) {
+        mqttnox_tx_flow_event(c, MQTTNOX_EVT_TX_RESUME, used);
+        mqttnox_offline_drain(c);
+    }
+}
 
-    evt_data->evt_id = MQTTNOX_EVT_PUBLISHED;
-    evt_data->evt.published_evt.packet_identified_msb = var_hdr->unsub_ack.msb;
-    evt_data->evt.published_evt.packet_identified_lsb = var_hdr->unsub_ack.lsb;
+/**@brief Gives up the writer role
+*
+* @note The fence in mqttnox_txq_writer_release orders the slots just
+*       freed before the paused check, pairing with mqttnox_tx_admit
+*/
+static void mqttnox_tx_writer_release(mqttnox_client_t* c)
+{
+    mqttnox_txq_writer_release(&c->txq);
 
-    mqttnox_send_event(c, evt_data);
+    mqttnox_tx_resume_check(c);
 }
 
-/**@brief MQTT Pub Rec Handler
-*
-* @note Publish Rec Handler
+/**@brief Checks the outbound queue against the high watermark
 *
-* @param[in]   c    mqttnox object \see mqttnox_client_t
-* @param[in]   data pointer to buffer with the incoming data from the server
-* @param[in]   len  length of the data from the server
+* @note Called before every publish. Crossing the high watermark sends
+*       MQTTNOX_EVT_TX_PAUSE once, publishes then fail until the queue
+*       drains to the low watermark and MQTTNOX_EVT_TX_RESUME is sent.
 *
-* @return     None
+* @return      MQTTNOX_SUCCESS, or MQTTNOX_RC_ERROR_WOULD_BLOCK while paused
 */
-static void mqttnox_handler_pubrec(mqttnox_client_t* c, uint8_t * data, uint16_t len)
+static mqttnox_rc_t mqttnox_tx_admit(mqttnox_client_t* c)
 {
-    mqttnox_rc_t rc;
+    uint32_t used;
 
-    do
-    {
-        uint16_t packet_identifier = (data[sizeof(mqttnox_hdr_t)] << 8) | data[sizeof(mqttnox_hdr_t) + 1];
+    if (mqttnox_atomic_load(&c->tx_paused)) {
+        return MQTTNOX_RC_ERROR_WOULD_BLOCK;
+    }
 
-        rc = mqttnox_pubrel(c, packet_identifier);
-        if(rc != MQTTNOX_SUCCESS) {
-            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "Sending PubRel Failed\n");
-        }
+    used = mqttnox_txq_used(&c->txq);
+    if (used < c->tx_high_watermark) {
+        return MQTTNOX_SUCCESS;
+    }
 
-    } while (0);
+    if (mqttnox_atomic_cas(&c->tx_paused, 0, 1)) {
+        mqttnox_tx_flow_event(c, MQTTNOX_EVT_TX_PAUSE, used);
+
+        /* The writer may have drained the queue before the flag was set */
+        mqttnox_tx_resume_check(c);
+    }
+
+    return MQTTNOX_RC_ERROR_WOULD_BLOCK;
 }
 
-/**@brief MQTT Pub Rel Handler
-*
-* @note Publish Rec Handler
+/**@brief Drops everything queued, as when a new connection starts
+*/
+static void mqttnox_tx_reset(mqttnox_client_t* c)
+{
+    mqttnox_txq_init(&c->txq);
+
+    /* Publishers waiting for the queue to drain can go again */
+    if (mqttnox_atomic_cas(&c->tx_paused, 1, 0)) {
+        mqttnox_tx_flow_event(c, MQTTNOX_EVT_TX_RESUME, 0);
+    }
+}
+
+/**@brief Sends queued frames unless another thread is already doing so
 *
-* @param[in]   c    mqttnox object \see mqttnox_client_t
-* @param[in]   data pointer to buffer with the incoming data from the server
-* @param[in]   len  length of the data from the server
+* @note Whichever thread gets the writer role sends for all producers, the
+*       others return straight away and their frames go out with it.
 *
-* @return     None
+* @param[in]   c   mqttnox object \see mqttnox_client_t
 */
-static void mqttnox_handler_pubrel(mqttnox_client_t* c, uint8_t * data, uint16_t len)
-{    
-    mqttnox_rc_t rc;
-    
-    do
+static mqttnox_rc_t mqttnox_tx_flush(mqttnox_client_t* c)
+{
+    mqttnox_rc_t rc = MQTTNOX_SUCCESS;
+
+    while (mqttnox_txq_writer_try(&c->txq))
     {
-        uint16_t packet_identifier = (data[sizeof(mqttnox_hdr_t)] << 8) | data[sizeof(mqttnox_hdr_t) + 1];
+        if (mqttnox_tx_send_queued(c) != MQTTNOX_SUCCESS) {
+            rc = MQTTNOX_RC_ERROR;
+        }
 
-        rc = mqttnox_pubcomp(c, packet_identifier);
-        if(rc != MQTTNOX_SUCCESS) {
-            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "Sending PubComp Failed\n");
+        mqttnox_tx_writer_release(c);
+
+        /* A frame committed while we were sending found no writer */
+        if (!mqttnox_txq_ready(&c->txq)) {
+            break;
         }
+    }
 
-    } while (0);
+    return rc;
 }
 
-/**@brief MQTT Pub Comp Handler
+/**@brief Sends every frame reserved so far
 *
-* @note Publish Rec Handler
+* @note Caller must hold the writer role. Waits for frames still being
+*       encoded by other threads, so a packet sent next by the caller
+*       cannot overtake one queued before it.
+*
+* @param[in]   c   mqttnox object \see mqttnox_client_t
+*/
+static mqttnox_rc_t mqttnox_tx_drain(mqttnox_client_t* c)
+{
+    mqttnox_rc_t rc = MQTTNOX_SUCCESS;
+    uint32_t tail = mqttnox_txq_tail(&c->txq);
+
+    while (!mqttnox_txq_sent(&c->txq, tail))
+    {
+        if (!mqttnox_txq_ready(&c->txq)) {
+            mqttnox_atomic_relax();
+            continue;
+        }
+
+        if (mqttnox_tx_send_queued(c) != MQTTNOX_SUCCESS) {
+            rc = MQTTNOX_RC_ERROR;
+        }
+    }
+
+    return rc;
+}
+
+/**@brief Waits for the writer role
+*/
+static void mqttnox_tx_writer_acquire(mqttnox_client_t* c)
+{
+    while (!mqttnox_txq_writer_try(&c->txq)) {
+        mqttnox_atomic_relax();
+    }
+}
+
+/**@brief Reserves space in the outbound queue, waiting while it is full
+*
+* @param[in]   c     mqttnox object \see mqttnox_client_t
+* @param[in]   size  bytes needed
+* @param[out]  res   reservation to commit
+*
+* @return      reserved space, NULL if size exceeds MQTTNOX_TXQ_FRAME_MAX
+*/
+static uint8_t* mqttnox_tx_reserve(mqttnox_client_t* c, uint32_t size, mqttnox_txq_res_t* res)
+{
+    uint8_t* data;
+
+    if (size > MQTTNOX_TXQ_FRAME_MAX) {
+        return NULL;
+    }
+
+    while ((data = mqttnox_txq_reserve(&c->txq, size, res)) == NULL)
+    {
+        /* Full - send what is queued, or let the current writer do it */
+        mqttnox_tx_flush(c);
+        mqttnox_atomic_relax();
+    }
+
+    return data;
+}
+
+/**@brief Queues a frame and sends it unless another thread is sending
+*
+* @param[in]   c      mqttnox object \see mqttnox_client_t
+* @param[in]   res    reservation from mqttnox_tx_reserve
+* @param[in]   start  first byte of the frame inside the reservation
+* @param[in]   len    frame length, 0 to drop the reservation
+*/
+static mqttnox_rc_t mqttnox_tx_commit(mqttnox_client_t* c, const mqttnox_txq_res_t* res, const uint8_t* start, uint32_t len)
+{
+    mqttnox_txq_commit(&c->txq, res, start, len);
+
+    return mqttnox_tx_flush(c);
+}
+
+/**@brief Sends a packet in place and gives up the writer role
+*
+* @note Caller must hold the writer role with nothing queued ahead of the
+*       packet
+*/
+static mqttnox_rc_t mqttnox_tx_send_direct(mqttnox_client_t* c, const mqttnox_iovec_t* iov, uint8_t iov_cnt, mqttnox_rc_t rc)
+{
+    if (mqttnox_tcp_sendv(c, iov, iov_cnt) != 0) {
+        rc = MQTTNOX_RC_ERROR;
+    }
+    mqttnox_tx_sent(c);
+
+    mqttnox_tx_writer_release(c);
+
+    /* Frames committed meanwhile found the writer role taken */
+    if (mqttnox_txq_ready(&c->txq) && mqttnox_tx_flush(c) != MQTTNOX_SUCCESS) {
+        rc = MQTTNOX_RC_ERROR;
+    }
+
+    return rc;
+}
+
+/**@brief Sends a packet given as segments, from any thread
+*
+* @note When no other thread is sending and nothing is queued the packet
+*       is sent straight from the segments. Otherwise packets up to
+*       MQTTNOX_TXQ_FRAME_MAX are copied into the outbound queue, and
+*       larger ones wait for the writer role and are sent in place after
+*       the frames queued before them.
+*
+* @param[in]   c        mqttnox object \see mqttnox_client_t
+* @param[in]   iov      segments of the packet
+* @param[in]   iov_cnt  number of segments, at most MQTTNOX_TCP_IOV_MAX
+*/
+static mqttnox_rc_t mqttnox_tx_sendv(mqttnox_client_t* c, const mqttnox_iovec_t* iov, uint8_t iov_cnt)
+{
+    mqttnox_txq_res_t res;
+    uint8_t* data;
+    uint32_t total = 0;
+    uint32_t pos = 0;
+    uint8_t i;
+
+    for (i = 0; i < iov_cnt; i++) {
+        total += iov[i].len;
+    }
+
+    if (total > MQTTNOX_TXQ_FRAME_MAX) {
+        mqttnox_tx_writer_acquire(c);
+
+        return mqttnox_tx_send_direct(c, iov, iov_cnt, mqttnox_tx_drain(c));
+    }
+
+    if (mqttnox_txq_writer_try(&c->txq)) {
+        if (mqttnox_txq_sent(&c->txq, mqttnox_txq_tail(&c->txq))) {
+            return mqttnox_tx_send_direct(c, iov, iov_cnt, MQTTNOX_SUCCESS);
+        }
+
+        /* Frames are queued ahead, this one goes behind them */
+        mqttnox_txq_writer_release(&c->txq);
+    }
+
+    data = mqttnox_tx_reserve(c, total, &res);
+
+    for (i = 0; i < iov_cnt; i++) {
+        memcpy(&data[pos], iov[i].data, iov[i].len);
+        pos += iov[i].len;
+    }
+
+    return mqttnox_tx_commit(c, &res, data, total);
+}
+
+/**@brief Stages bytes of a packet that continues in a later delivery
+*
+* @note The copy is skipped when the TAL received straight into
+*       rcv_buf + rcv_offset. With the mirrored ring a partial packet left
+*       behind complete ones is never moved either: the receive window is
+*       rebased onto it, and stays contiguous across the wrap.
 *
 * @param[in]   c    mqttnox object \see mqttnox_client_t
-* @param[in]   data pointer to buffer with the incoming data from the server
-* @param[in]   len  length of the data from the server
+* @param[in]   data packet bytes to append
+* @param[in]   len  number of bytes
+*/
+static void mqttnox_rx_stage(mqttnox_client_t* c, uint8_t* data, uint32_t len)
+{
+    uint8_t* dst = &c->rcv_buf[c->rcv_offset];
+
+    if (c->rcv_offset == 0 && c->rcv_ring != NULL &&
+        data >= c->rcv_ring && data < c->rcv_ring + 2 * (size_t)c->rcv_buf_size) {
+        c->rcv_buf = c->rcv_ring + ((uint32_t)(data - c->rcv_ring) & (c->rcv_buf_size - 1u));
+    }
+    else if (dst != data) {
+        memmove(dst, data, len);
+    }
+
+    c->rcv_offset += len;
+}
+
+/**@brief Dispatches one complete packet to its handler
 *
-* @return     None
+* @param[in]   c       mqttnox object \see mqttnox_client_t
+* @param[in]   pkt     start of the packet (fixed header)
+* @param[in]   pkt_len total length of the packet
+* @param[in]   remain_len length of the variable header and payload
+*/
+static void mqttnox_rx_dispatch(mqttnox_client_t* c, uint8_t* pkt, uint32_t pkt_len, uint32_t remain_len)
+{
+    mqttnox_hdr_t* hdr = (mqttnox_hdr_t*)pkt;
+    uint8_t* data = pkt + (pkt_len - remain_len);
+
+    switch (hdr->type) {
+
+        case MQTTNOX_CTRL_PKT_TYPE_CONNACK:
+            mqttnox_handler_connack(c, hdr, data, remain_len);
+            break;
+        case MQTTNOX_CTRL_PKT_TYPE_PUBLISH:
+            mqttnox_handler_publish(c, hdr, data, remain_len);
+            break;
+        case MQTTNOX_CTRL_PKT_TYPE_PUBACK:
+            mqttnox_handler_puback(c, hdr, data, remain_len);
+            break;
+        case MQTTNOX_CTRL_PKT_TYPE_PUBREC:
+            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "MQTTNOX_CTRL_PKT_TYPE_PUBREC\n");
+            mqttnox_handler_pubrec(c, hdr, data, remain_len);
+            break;
+        case MQTTNOX_CTRL_PKT_TYPE_PUBREL:
+            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "MQTTNOX_CTRL_PKT_TYPE_PUBREL\n");
+            mqttnox_handler_pubrel(c, hdr, data, remain_len);
+            break;
+        case MQTTNOX_CTRL_PKT_TYPE_PUBCOMP:
+            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "MQTTNOX_CTRL_PKT_TYPE_PUBCOMP\n");
+            mqttnox_handler_pubcomp(c, hdr, data, remain_len);
+            break;
+        case MQTTNOX_CTRL_PKT_TYPE_SUBACK:
+            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "MQTTNOX_CTRL_PKT_TYPE_SUBACK\n");
+            mqttnox_handler_suback(c, hdr, data, remain_len);
+            break;
+        case MQTTNOX_CTRL_PKT_TYPE_UNSUBACK:
+            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "MQTTNOX_CTRL_PKT_TYPE_UNSUBACK\n");
+            mqttnox_handler_unsuback(c, hdr, data, remain_len);
+            break;
+        case MQTTNOX_CTRL_PKT_TYPE_PINGRESP:
+            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "MQTTNOX_CTRL_PKT_TYPE_PINGRESP\n");
+            mqttnox_handler_pingresp(c, hdr, data, remain_len);
+            break;
+        default:
+            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "Packet Type Error\n");
+            break;
+    }
+}
+
+/**@brief Acknowledges a received PUBLISH according to its QoS
+*
+* @param[in]   c          mqttnox object \see mqttnox_client_t
+* @param[in]   qos        QoS of the received PUBLISH
+* @param[in]   identifier packet identifier of the PUBLISH
 */
-static void mqttnox_handler_pubcomp(mqttnox_client_t* c, uint8_t * data, uint16_t len)
+static void mqttnox_ack_publish(mqttnox_client_t* c, uint8_t qos, uint16_t identifier)
 {
-    /* Not implemented yet */
+    mqttnox_rc_t rc = MQTTNOX_SUCCESS;
+
+    switch (qos)
+    {
+        case MQTTNOX_QOS0_AT_MOST_ONCE_DELIV:
+            /* Nothing to do for QoS 0*/
+            break;
+        case MQTTNOX_QOS1_AT_LEAST_ONCE_DELIV:
+            /* Send Puback */
+            rc = mqttnox_puback(c, identifier);
+            break;
+        case MQTTNOX_QOS2_EXACTLY_ONCE_DELIV:
+            /* Send PubRec */
+            rc = mqttnox_pubrec(c, identifier);
+            break;
+    }
+
+    if (rc != MQTTNOX_SUCCESS) {
+        mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "Sending PUBLISH acknowledgement failed\n");
+    }
 }
 
-/**@brief MQTT Sub ACK Handler
+/**@brief Records a received QoS 2 PUBLISH until its PUBREL
 *
-* @note Publish Subscription ACK Handler
+* @note Only the receive thread touches the set. A PUBLISH whose identifier
+*       is already set is a retransmission of a message that was delivered
+*       [MQTT-4.3.3-2], it is acknowledged again but not delivered.
+*
+* @return      non-zero if the message is new and must be delivered
+*/
+static int mqttnox_qos2_rcvd_mark(mqttnox_client_t* c, uint16_t identifier)
+{
+    uint32_t* word = &c->qos2_rcvd[identifier >> 5];
+    uint32_t bit = 1UL << (identifier & 31);
+
+    if (*word & bit) {
+        return 0;
+    }
+
+    *word |= bit;
+    return 1;
+}
+
+/**@brief Delivers one chunk of a streamed PUBLISH payload
+*
+* @note The variable header stays staged at the start of rcv_buf for the
+*       whole packet, so every chunk carries the topic. The payload points
+*       straight into the received data. The PUBLISH is acknowledged after
+*       the last chunk.
+*
+* @param[in]   c       mqttnox object \see mqttnox_client_t
+* @param[in]   payload payload bytes of this chunk
+* @param[in]   len     number of payload bytes
+*/
+static void mqttnox_rx_stream_deliver(mqttnox_client_t* c, uint8_t* payload, uint32_t len)
+{
+    mqttnox_rx_decoder_t* rx = &c->rx;
+    mqttnox_hdr_t* hdr = (mqttnox_hdr_t*)&rx->hdr;
+    mqttnox_evt_data_t evt_data;
+    received_evt_t* evt = &evt_data.evt.received_evt;
+    uint32_t total = rx->remain_len - rx->vh_len;
+    uint8_t last = (rx->payload_off + len == total);
+
+    evt_data.evt_id = MQTTNOX_EVT_RECEIVED;
+    evt->topic = (char*)&c->rcv_buf[MQTTNOX_LENGTH_BYTE_LEN];
+    evt->topic_len = (uint16_t)((c->rcv_buf[0] << 8) | c->rcv_buf[1]);
+    evt->packet_identifier = 0;
+
+    if (hdr->qos != MQTTNOX_QOS0_AT_MOST_ONCE_DELIV) {
+        evt->packet_identifier = (c->rcv_buf[rx->vh_len - 2] << 8) | c->rcv_buf[rx->vh_len - 1];
+    }
+
+    evt->payload = (char*)payload;
+    evt->payload_len = len;
+    evt->payload_offset = rx->payload_off;
+    evt->payload_total = total;
+
+    if (rx->payload_off == 0) {
+        evt->chunk = last ? MQTTNOX_CHUNK_COMPLETE : MQTTNOX_CHUNK_FIRST;
+
+        if (hdr->qos == MQTTNOX_QOS2_EXACTLY_ONCE_DELIV) {
+            rx->dup = !mqttnox_qos2_rcvd_mark(c, evt->packet_identifier);
+        }
+    }
+    else {
+        evt->chunk = last ? MQTTNOX_CHUNK_LAST : MQTTNOX_CHUNK_MIDDLE;
+    }
+
+    rx->payload_off += len;
+
+    if (!rx->dup) {
+        mqttnox_send_event(c, &evt_data);
+    }
+
+    if (last) {
+        mqttnox_ack_publish(c, hdr->qos, evt->packet_identifier);
+    }
+}
+
+/**@brief TCP callback for data reception
+*
+* @note Resumable decoder: data may arrive in chunks of any size. The fixed
+*       header and remaining length are decoded a byte at a time and the
+*       body is skipped over in bulk, so every byte is examined once.
+*       Packets complete within the chunk are dispatched in place. Only
+*       the start of a packet that continues in a later chunk is staged in
+*       rcv_buf, and a TAL that receives into rcv_buf + rcv_offset makes
+*       that copy a no-op. Acks for every packet in the chunk are sent
+*       together before returning.
 *
 * @param[in]   c    mqttnox object \see mqttnox_client_t
-* @param[in]   data pointer to buffer with the incoming data from the server
-* @param[in]   len  length of the data from the server
+* @param[in]   data pointer to the newly received bytes
+* @param[in]   len  number of newly received bytes
 *
-* @return     None
 */
-static void mqttnox_handler_suback(mqttnox_client_t* c, uint8_t * data, uint16_t len)
+void mqttnox_tcp_rcv_func(mqttnox_client_t* c, uint8_t* data, uint32_t len)
 {
+    mqttnox_rx_decoder_t* rx;
+    uint8_t* end = data + len;
+    uint8_t* pkt = data;   /* Start of the current packet's bytes within this chunk */
+    uint32_t take;
+    uint32_t need;
+    uint8_t byte;
+    int gated = 0;
+
+    do
+    {
+        if (c == NULL) {
+            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "Client NULL %s Line %d\n", __FILE__, __LINE__);
+            break;
+        }
+
+        if (c->flag_initialized != MQTTNOX_INIT_FLAG) {
+            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "Not initialized\n");
+            break;
+        }
+
+        if (data == NULL || len == 0) {
+            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "Data NULL or zero length %s Line %d\n", __FILE__, __LINE__);
+            break;
+        }
+
+        /* Closed while a reconnect resets the decoder, the bytes belong to
+           the connection it replaces */
+        if (!mqttnox_atomic_cas(&c->rx_gate, MQTTNOX_RX_GATE_OPEN, MQTTNOX_RX_GATE_BUSY)) {
+            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "Dropped %u bytes received during a reconnect\n", len);
+            return;
+        }
+        gated = 1;
+
+        rx = &c->rx;
+
+        /* Acks for the packets in this chunk go out in one send at the end */
+        c->ack_defer = 1;
+
+        while (data < end)
+        {
+            switch (rx->state)
+            {
+                case MQTTNOX_RX_STATE_FIXED_HDR:
+                    pkt = data;
+                    rx->hdr = *data++;
+                    rx->pkt_fill = 1;
+                    rx->remain_len = 0;
+                    rx->remain_shift = 0;
+                    rx->state = MQTTNOX_RX_STATE_REMAIN_LEN;
+                    break;
+
+                case MQTTNOX_RX_STATE_REMAIN_LEN:
+                    byte = *data++;
+                    rx->pkt_fill++;
+                    rx->remain_len |= (uint32_t)(byte & 0x7F) << rx->remain_shift;
+                    rx->remain_shift += 7;
+
+                    if (byte & 0x80) {
+                        if (rx->remain_shift >= 7 * MAX_REMAIN_LEN_BYTES) {
+                            /* Malformed packet - the stream cannot be resynchronized */
+                            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "Malformed remaining length\n");
+                            rx->state = MQTTNOX_RX_STATE_FIXED_HDR;
+                            c->rcv_offset = 0;
+                            c->ack_defer = 0;
+                            mqttnox_ack_flush(c);
+                            mqttnox_tcp_disconnect(c);
+                            mqttnox_connection_lost(c, MQTTNOX_DISCONNECT_PROTOCOL);
+                            mqttnox_atomic_store(&c->rx_gate, MQTTNOX_RX_GATE_OPEN);
+                            return;
+                        }
+                        break;
+                    }
+
+                    rx->pkt_len = rx->pkt_fill + rx->remain_len;
+                    rx->state = MQTTNOX_RX_STATE_BODY;
+
+                    if (c->stream_threshold != 0 &&
+                        ((mqttnox_hdr_t*)&rx->hdr)->type == MQTTNOX_CTRL_PKT_TYPE_PUBLISH &&
+                        (rx->remain_len > c->stream_threshold || rx->pkt_len > c->rcv_buf_size)) {
+                        /* Stream the payload, only the variable header is kept */
+                        rx->state = MQTTNOX_RX_STATE_STREAM_HDR;
+                        rx->vh_len = 0;
+                        rx->payload_off = 0;
+                        rx->dup = 0;
+                        c->rcv_offset = 0;
+                    }
+                    else if (c->rcv_offset > 0 && rx->pkt_len > c->rcv_buf_size) {
+                        /* Header was staged but the packet can never fit */
+                        mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "Packet of %u bytes exceeds receive buffer\n", rx->pkt_len);
+                        rx->state = MQTTNOX_RX_STATE_DISCARD;
+                        c->rcv_offset = 0;
+                    }
+                    break;
+
+                case MQTTNOX_RX_STATE_STREAM_HDR:
+                    /* Topic length first, then the rest of the variable header */
+                    need = (rx->vh_len ? rx->vh_len : MQTTNOX_LENGTH_BYTE_LEN) - c->rcv_offset;
+                    take = (need > (uint32_t)(end - data)) ? (uint32_t)(end - data) : need;
+
+                    mqttnox_rx_stage(c, data, take);
+                    data += take;
+                    rx->pkt_fill += take;
+
+                    if (take < need) {
+                        break;
+                    }
+
+                    if (rx->vh_len == 0) {
+                        rx->vh_len = MQTTNOX_LENGTH_BYTE_LEN + ((c->rcv_buf[0] << 8) | c->rcv_buf[1]);
+                        if (((mqttnox_hdr_t*)&rx->hdr)->qos != MQTTNOX_QOS0_AT_MOST_ONCE_DELIV) {
+                            rx->vh_len += MQTTNOX_PACKET_IDENT_BYTE_LEN;
+                        }
+
+                        if (rx->vh_len > rx->remain_len || rx->vh_len >= c->rcv_buf_size) {
+                            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "PUBLISH topic of %u bytes cannot be streamed\n", rx->vh_len);
+                            rx->state = MQTTNOX_RX_STATE_DISCARD;
+                            c->rcv_offset = 0;
+                            break;
+                        }
+
+                        if (c->rcv_offset < rx->vh_len) {
+                            break;
+                        }
+                    }
+
+                    rx->state = MQTTNOX_RX_STATE_STREAM_PAYLOAD;
+
+                    if (rx->pkt_fill == rx->pkt_len) {
+                        /* No payload */
+                        mqttnox_rx_stream_deliver(c, data, 0);
+                    }
+                    break;
+
+                case MQTTNOX_RX_STATE_STREAM_PAYLOAD:
+                    /* Hand out the payload straight from the received data */
+                    take = rx->pkt_len - rx->pkt_fill;
+                    if (take > (uint32_t)(end - data)) {
+                        take = (uint32_t)(end - data);
+                    }
+                    rx->pkt_fill += take;
+                    mqttnox_rx_stream_deliver(c, data, take);
+                    data += take;
+                    break;
+
+                default:
+                    /* Body or discard: take as much of the packet as this chunk holds */
+                    take = rx->pkt_len - rx->pkt_fill;
+                    if (take > (uint32_t)(end - data)) {
+                        take = (uint32_t)(end - data);
+                    }
+                    data += take;
+                    rx->pkt_fill += take;
+                    break;
+            }
+
+            if (rx->state >= MQTTNOX_RX_STATE_BODY && rx->pkt_fill == rx->pkt_len)
+            {
+                if (rx->state == MQTTNOX_RX_STATE_BODY)
+                {
+                    if (c->rcv_offset > 0) {
+                        /* Completes a packet started in an earlier chunk */
+                        mqttnox_rx_stage(c, pkt, (uint32_t)(data - pkt));
+                        mqttnox_rx_dispatch(c, c->rcv_buf, rx->pkt_len, rx->remain_len);
+                    }
+                    else {
+                        mqttnox_rx_dispatch(c, pkt, rx->pkt_len, rx->remain_len);
+                    }
+                }
+
+                c->rcv_offset = 0;
+                rx->state = MQTTNOX_RX_STATE_FIXED_HDR;
+                pkt = data;
+            }
+        }
+
+        if (pkt == end || rx->state >= MQTTNOX_RX_STATE_DISCARD) {
+            /* Nothing left, or a streamed / skipped packet still in progress */
+            break;
+        }
+
+        /* Packet continues in the next chunk */
+        if (rx->state == MQTTNOX_RX_STATE_BODY && rx->pkt_len > c->rcv_buf_size) {
+            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "Packet of %u bytes exceeds receive buffer\n", rx->pkt_len);
+            rx->state = MQTTNOX_RX_STATE_DISCARD;
+            c->rcv_offset = 0;
+            break;
+        }
+
+        mqttnox_rx_stage(c, pkt, (uint32_t)(end - pkt));
+
+    } while (0);
+
+    if (c != NULL && c->ack_defer) {
+        c->ack_defer = 0;
+        mqttnox_ack_flush(c);
+    }
+
+    /* Room may have opened in the window, or CONNACK arrived */
+    if (c != NULL) {
+        mqttnox_offline_drain(c);
+    }
+
+    if (gated) {
+        mqttnox_atomic_store(&c->rx_gate, MQTTNOX_RX_GATE_OPEN);
+    }
+}
+
+/**@brief MQTT ConnACK Handler
+*
+* @note Connection Acknowledgement Handler
+*
+* @param[in]   c    mqttnox object \see mqttnox_client_t
+* @param[in]   hdr  fixed header of the packet
+* @param[in]   data pointer to the variable header
+* @param[in]   len  remaining length of the packet
+*
+* @return     None
+*/
+static void mqttnox_handler_connack(mqttnox_client_t* c, mqttnox_hdr_t* hdr, uint8_t * data, uint32_t len)
+{    
     uint8_t data_buffer[64];
     mqttnox_evt_data_t* evt_data = (mqttnox_evt_data_t*)data_buffer;
+    mqttnox_response_var_hdr_t* var_hdr = (mqttnox_response_var_hdr_t*)data;
+    uint8_t refused = 1;
 
-    evt_data->evt_id = MQTTNOX_EVT_SUBSCRIBED;
-    evt_data->evt.subscribed_evt.return_code = *(mqttnox_suback_return_t *)(data + sizeof(mqttnox_hdr_t) + 2);
+    (void)hdr;
+
+    if (len < sizeof(mqttnox_connack_var_hdr_t)) {
+        mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "CONNACK too short\n");
+        return;
+    }
+
+    mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "MQTTNOX_CTRL_PKT_TYPE_CONNACK\n");
+    mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "Return Code %x\n", var_hdr->conn_ack.conn_return_code);
+    mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "Session Present %u\n", var_hdr->conn_ack.flag_session_present);
+
+    switch (var_hdr->conn_ack.conn_return_code)
+    {
+        case MQTTNOX_CONNECTION_RC_ACCEPTED:
+            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "Connection Successful\n");        
+            c->status.connected = 1;
+            refused = 0;
+
+            mqttnox_keepalive_start(&c->ping, c->keepalive, mqttnox_hal_time_ms());
+            mqttnox_wheel_kick(c);
+
+            /* Subscriptions are gone unless the broker kept the session */
+            if (mqttnox_reconnect_done(&c->reconnect, mqttnox_hal_time_ms()) &&
+                !var_hdr->conn_ack.flag_session_present) {
+                mqttnox_resubscribe(c);
+            }
+
+            evt_data->evt_id = MQTTNOX_EVT_CONNECT;
+            evt_data->evt.connect_evt.session_present = var_hdr->conn_ack.flag_session_present;
+            mqttnox_send_event(c, evt_data);
+
+            break;
+        case MQTTNOX_CONNECTION_RC_REFUSED_UNACCP_PROT_VER:
+            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "Connection Refused, unacceptable protocol version\n");
+            evt_data->evt_id = MQTTNOX_EVT_CONNECT_ERROR;
+            evt_data->evt.conn_err_evt.reason = MQTTNOX_CONN_ERR_REFUSED_UNACCP_PROT_VER;
+            mqttnox_send_event(c, evt_data);            
+            break;
+        case MQTTNOX_CONNECTION_RC_REFUSED_IDENT_REJECTED:
+            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "Connection Refused, identifier rejected\n");
+            evt_data->evt_id = MQTTNOX_EVT_CONNECT_ERROR;
+            evt_data->evt.conn_err_evt.reason = MQTTNOX_CONN_ERR_REFUSED_IDENT_REJECTED;
+            mqttnox_send_event(c, evt_data);            
+            break;
+        case MQTTNOX_CONNECTION_RC_REFUSED_SERVER_UNAVAIL:
+            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "Connection Refused, Server Unavailable\n");
+            evt_data->evt_id = MQTTNOX_EVT_CONNECT_ERROR;
+            evt_data->evt.conn_err_evt.reason = MQTTNOX_CONN_ERR_REFUSED_SERVER_UNAVAIL;
+            mqttnox_send_event(c, evt_data);            
+            break;
+        case MQTTNOX_CONNECTION_RC_REFUSED_BAD_USER_PASS:
+            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "Connection Refused, Bad Username or Password\n");
+            evt_data->evt_id = MQTTNOX_EVT_CONNECT_ERROR;
+            evt_data->evt.conn_err_evt.reason = MQTTNOX_CONN_ERR_REFUSED_BAD_USER_PASS;
+            mqttnox_send_event(c, evt_data);            
+            break;
+        case MQTTNOX_CONNECTION_RC_REFUSED_NOT_AUTH:
+            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "Connection Refused, Not authorized\n");
+            evt_data->evt_id = MQTTNOX_EVT_CONNECT_ERROR;
+            evt_data->evt.conn_err_evt.reason = MQTTNOX_CONN_ERR_REFUSED_NOT_AUTH;
+            mqttnox_send_event(c, evt_data);            
+            break;
+        default:
+            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, 
+                                "Unknown error - invalid connection code 0x%x\n", 
+                                var_hdr->conn_ack.conn_return_code);
+    }
+
+    /* The broker closes a refused connection [MQTT-3.2.2-5] */
+    if (refused) {
+        mqttnox_tcp_disconnect(c);
+        mqttnox_connection_lost(c, MQTTNOX_DISCONNECT_REFUSED);
+    }
+}
+
+/**@brief MQTT Publish Handler
+*
+* @note Publish Ack Handler
+*
+* @param[in]   c    mqttnox object \see mqttnox_client_t
+* @param[in]   hdr  fixed header of the packet
+* @param[in]   data pointer to the variable header
+* @param[in]   len  remaining length of the packet
+*
+* @return     None
+*/
+static void mqttnox_handler_publish(mqttnox_client_t* c, mqttnox_hdr_t* hdr, uint8_t* data, uint32_t len)
+{
+    mqttnox_evt_data_t  evt_data;    
+    uint32_t offset = 0;
+    uint16_t topic_len;
+
+    do
+    {
+        mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "MQTTNOX_CTRL_PKT_TYPE_PUBLISH with QoS: %u\n", hdr->qos);
+
+        if (len < MQTTNOX_LENGTH_BYTE_LEN) {
+            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "PUBLISH too short\n");
+            break;
+        }
+
+        /* Decode Topic Length */
+        topic_len = (data[0] << 8) | data[1];
+        offset = MQTTNOX_LENGTH_BYTE_LEN;
+
+        evt_data.evt_id = MQTTNOX_EVT_RECEIVED;
+        evt_data.evt.received_evt.topic = (char *)&data[offset];
+        evt_data.evt.received_evt.topic_len = topic_len;
+        evt_data.evt.received_evt.packet_identifier = 0;
+        
+        offset += topic_len;
+
+        /* Packet identifier only present in packets with QoS of 1 or 2 */
+        if (hdr->qos != MQTTNOX_QOS0_AT_MOST_ONCE_DELIV) {
+            if (offset + MQTTNOX_PACKET_IDENT_BYTE_LEN > len) {
+                mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "PUBLISH too short\n");
+                break;
+            }
+            evt_data.evt.received_evt.packet_identifier = (data[offset] << 8) | data[offset + 1];
+            offset += MQTTNOX_PACKET_IDENT_BYTE_LEN;
+        }
+        else if (offset > len) {
+            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "PUBLISH too short\n");
+            break;
+        }
+
+        evt_data.evt.received_evt.payload = (char *)&data[offset];
+        evt_data.evt.received_evt.payload_len = len - offset;
+        evt_data.evt.received_evt.payload_offset = 0;
+        evt_data.evt.received_evt.payload_total = len - offset;
+        evt_data.evt.received_evt.chunk = MQTTNOX_CHUNK_COMPLETE;
+
+        mqttnox_ack_publish(c, hdr->qos, evt_data.evt.received_evt.packet_identifier);
+
+        if (hdr->qos == MQTTNOX_QOS2_EXACTLY_ONCE_DELIV &&
+            !mqttnox_qos2_rcvd_mark(c, evt_data.evt.received_evt.packet_identifier)) {
+            break;
+        }
+
+        mqttnox_send_event(c, &evt_data);
+
+    } while (0);
+}
+
+/**@brief MQTT Pub Ack Handler
+*
+* @note Publish Ack Handler
+*
+* @param[in]   c    mqttnox object \see mqttnox_client_t
+* @param[in]   hdr  fixed header of the packet
+* @param[in]   data pointer to the variable header
+* @param[in]   len  remaining length of the packet
+*
+* @return     None
+*/
+static void mqttnox_handler_puback(mqttnox_client_t* c, mqttnox_hdr_t* hdr, uint8_t * data, uint32_t len)
+{
+    mqttnox_inflight_entry_t entry;
+    uint16_t packet_identifier;
+
+    mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "MQTTNOX_CTRL_PKT_TYPE_PUBACK\n");
+
+    (void)hdr;
+
+    if (len < MQTTNOX_PACKET_IDENT_BYTE_LEN) {
+        return;
+    }
+
+    packet_identifier = (data[0] << 8) | data[1];
+
+    /* Acks for messages not in flight are duplicates and ignored */
+    if (mqttnox_inflight_remove(&c->inflight, packet_identifier, MQTTNOX_QOS1_AT_LEAST_ONCE_DELIV, &entry)) {
+        mqttnox_store_complete(&c->store, packet_identifier);
+        mqttnox_ident_release(&c->packet_ident, packet_identifier);
+        mqttnox_publish_complete(c, &entry, MQTTNOX_EVT_PUBLISHED);
+    }
+}
+
+/**@brief MQTT Pub Rec Handler
+*
+* @note Publish Rec Handler
+*
+* @param[in]   c    mqttnox object \see mqttnox_client_t
+* @param[in]   hdr  fixed header of the packet
+* @param[in]   data pointer to the variable header
+* @param[in]   len  remaining length of the packet
+*
+* @return     None
+*/
+static void mqttnox_handler_pubrec(mqttnox_client_t* c, mqttnox_hdr_t* hdr, uint8_t * data, uint32_t len)
+{
+    mqttnox_rc_t rc;
+
+    (void)hdr;
+
+    do
+    {
+        if (len < MQTTNOX_PACKET_IDENT_BYTE_LEN) {
+            break;
+        }
+
+        uint16_t packet_identifier = (data[0] << 8) | data[1];
+
+        /* PUBREL is sent even for an unknown identifier, the broker may
+           have kept the message from an earlier connection */
+        if (mqttnox_inflight_release(&c->inflight, packet_identifier)) {
+            /* Stored first, a restart must resend PUBREL and not the PUBLISH */
+            mqttnox_store_release(&c->store, packet_identifier);
+        }
+
+        rc = mqttnox_pubrel(c, packet_identifier);
+        if(rc != MQTTNOX_SUCCESS) {
+            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "Sending PubRel Failed\n");
+        }
+
+    } while (0);
+}
+
+/**@brief MQTT Pub Rel Handler
+*
+* @note Publish Rec Handler
+*
+* @param[in]   c    mqttnox object \see mqttnox_client_t
+* @param[in]   hdr  fixed header of the packet
+* @param[in]   data pointer to the variable header
+* @param[in]   len  remaining length of the packet
+*
+* @return     None
+*/
+static void mqttnox_handler_pubrel(mqttnox_client_t* c, mqttnox_hdr_t* hdr, uint8_t * data, uint32_t len)
+{    
+    mqttnox_rc_t rc;
+
+    (void)hdr;
+    
+    do
+    {
+        if (len < MQTTNOX_PACKET_IDENT_BYTE_LEN) {
+            break;
+        }
+
+        uint16_t packet_identifier = (data[0] << 8) | data[1];
+
+        /* The identifier may now carry a new message */
+        c->qos2_rcvd[packet_identifier >> 5] &= ~(1UL << (packet_identifier & 31));
+
+        rc = mqttnox_pubcomp(c, packet_identifier);
+        if(rc != MQTTNOX_SUCCESS) {
+            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "Sending PubComp Failed\n");
+        }
+
+    } while (0);
+}
+
+/**@brief MQTT Pub Comp Handler
+*
+* @note Publish Rec Handler
+*
+* @param[in]   c    mqttnox object \see mqttnox_client_t
+* @param[in]   hdr  fixed header of the packet
+* @param[in]   data pointer to the variable header
+* @param[in]   len  remaining length of the packet
+*
+* @return     None
+*/
+static void mqttnox_handler_pubcomp(mqttnox_client_t* c, mqttnox_hdr_t* hdr, uint8_t * data, uint32_t len)
+{
+    mqttnox_inflight_entry_t entry;
+    uint16_t packet_identifier;
+
+    (void)hdr;
+
+    if (len < MQTTNOX_PACKET_IDENT_BYTE_LEN) {
+        return;
+    }
+
+    packet_identifier = (data[0] << 8) | data[1];
+
+    if (mqttnox_inflight_remove(&c->inflight, packet_identifier, MQTTNOX_QOS2_EXACTLY_ONCE_DELIV, &entry)) {
+        mqttnox_store_complete(&c->store, packet_identifier);
+        mqttnox_ident_release(&c->packet_ident, packet_identifier);
+        mqttnox_publish_complete(c, &entry, MQTTNOX_EVT_PUBLISHED);
+    }
+}
+
+/**@brief MQTT Sub ACK Handler
+*
+* @note Publish Subscription ACK Handler
+*
+* @param[in]   c    mqttnox object \see mqttnox_client_t
+* @param[in]   hdr  fixed header of the packet
+* @param[in]   data pointer to the variable header
+* @param[in]   len  remaining length of the packet
+*
+* @return     None
+*/
+static void mqttnox_handler_suback(mqttnox_client_t* c, mqttnox_hdr_t* hdr, uint8_t * data, uint32_t len)
+{
+    uint8_t data_buffer[64];
+    mqttnox_evt_data_t* evt_data = (mqttnox_evt_data_t*)data_buffer;
+
+    (void)hdr;
+
+    if (len < MQTTNOX_PACKET_IDENT_BYTE_LEN + 1) {
+        return;
+    }
+
+    if (!mqttnox_sub_release(c, (uint16_t)((data[0] << 8) | data[1]))) {
+        mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "SUBACK for no pending SUBSCRIBE\n");
+        return;
+    }
+
+    evt_data->evt_id = MQTTNOX_EVT_SUBSCRIBED;
+    evt_data->evt.subscribed_evt.return_code = (mqttnox_suback_return_t)data[MQTTNOX_PACKET_IDENT_BYTE_LEN];
+
+    mqttnox_send_event(c, evt_data);
+}
+
+/**@brief MQTT Unsub ACK Handler
+*
+* @note Unsubscribe ACK Handler
+*
+* @param[in]   c    mqttnox object \see mqttnox_client_t
+* @param[in]   hdr  fixed header of the packet
+* @param[in]   data pointer to the variable header
+* @param[in]   len  remaining length of the packet
+*
+* @return     None
+*/
+static void mqttnox_handler_unsuback(mqttnox_client_t* c, mqttnox_hdr_t* hdr, uint8_t * data, uint32_t len)
+{
+    uint8_t data_buffer[64];
+    mqttnox_evt_data_t* evt_data = (mqttnox_evt_data_t*)data_buffer;
+
+    mqttnox_response_var_hdr_t* var_hdr = (mqttnox_response_var_hdr_t*)data;
+
+    (void)hdr;
+
+    if (len < MQTTNOX_PACKET_IDENT_BYTE_LEN) {
+        return;
+    }
+
+    if (!mqttnox_sub_release(c, (uint16_t)((data[0] << 8) | data[1]))) {
+        mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "UNSUBACK for no pending UNSUBSCRIBE\n");
+        return;
+    }
+
+    evt_data->evt_id = MQTTNOX_EVT_UNSUBSCRIBED;
+    evt_data->evt.unsubscribed_evt.packet_identified_msb = var_hdr->unsub_ack.msb;
+    evt_data->evt.unsubscribed_evt.packet_identified_lsb = var_hdr->unsub_ack.lsb;
+
+    mqttnox_send_event(c, evt_data);
+}
+
+/**@brief MQTT Ping Response Handler
+*
+* @note Publish Rec Handler
+*
+* @param[in]   c    mqttnox object \see mqttnox_client_t
+* @param[in]   hdr  fixed header of the packet
+* @param[in]   data pointer to the variable header
+* @param[in]   len  remaining length of the packet
+*
+* @return     None
+*/
+static void mqttnox_handler_pingresp(mqttnox_client_t* c, mqttnox_hdr_t* hdr, uint8_t * data, uint32_t len)
+{
+    uint8_t data_buffer[64];
+    mqttnox_evt_data_t* evt_data = (mqttnox_evt_data_t*)data_buffer;
+
+    (void)hdr;
+    (void)data;
+    (void)len;
+
+    mqttnox_keepalive_pong(&c->ping, mqttnox_hal_time_ms());
+
+    evt_data->evt_id = MQTTNOX_EVT_PINGRESP;
+
+    mqttnox_send_event(c, evt_data);
+}
+
+/**@brief Send Event to callback
+*
+* @note Internal function. Received messages matching a route of the
+*       client's router go to the route handlers instead.
+*
+* @param[in]   c    mqttnox object \see mqttnox_client_t
+* @param[in]   data pointer to buffer with the incoming data from the server
+* @param[in]   len  length of the data from the server
+*
+* @return     None
+*/
+static void mqttnox_send_event(mqttnox_client_t* c, mqttnox_evt_data_t * data)
+{
+    if (c != NULL && c->router != NULL && data->evt_id == MQTTNOX_EVT_RECEIVED &&
+        mqttnox_router_dispatch(c->router, c, &data->evt.received_evt) != 0) {
+        return;
+    }
+
+    /* Ensure callback is valid */
+    if (c != NULL && c->callback != NULL) {
+        c->callback(data);
+    }
+}
+
+
+
+
+/**@brief Reports every message in flight as failed before the session is dropped
+*
+* @note The application gets each user_ctx back with
+*       MQTTNOX_EVT_PUBLISH_FAILED and may publish the message again
+*/
+static void mqttnox_session_drop(mqttnox_client_t* c)
+{
+    mqttnox_inflight_entry_t entry;
+
+    while (mqttnox_inflight_pop(&c->inflight, &entry)) {
+        mqttnox_publish_complete(c, &entry, MQTTNOX_EVT_PUBLISH_FAILED);
+    }
+}
+
+/**@brief Sets up the messages in flight for a new connection
+*
+* @note Without a store, or with a clean session, messages in flight on a
+*       previous connection are not resent and their acknowledgements will
+*       not come, so the tables start empty. With clean_session 0 a store
+*       opened now restores its messages; one kept open from the previous
+*       connection already matches the tables, whose messages keep their
+*       user_ctx.
+*
+* @return MQTTNOX_RC_ERROR_STORE if conf->session_path cannot be opened
+*/
+static mqttnox_rc_t mqttnox_session_restore(mqttnox_client_t* c, const mqttnox_client_conf_t* conf)
+{
+    mqttnox_store_rec_t rec;
+    uint16_t window = (conf->max_inflight != 0) ? conf->max_inflight : MQTTNOX_MAX_INFLIGHT;
+    uint32_t sync_interval = (conf->session_sync_interval != 0) ? conf->session_sync_interval : MQTTNOX_STORE_SYNC_EVERY;
+    uint8_t opened = 0;
+    uint32_t pos;
+
+    if (c->store.base != NULL &&
+        (conf->session_path == NULL || strcmp(conf->session_path, c->store.path) != 0)) {
+        mqttnox_store_close(&c->store);
+    }
+
+    if (conf->session_path != NULL && c->store.base == NULL)
+    {
+        if (!mqttnox_store_open(&c->store, conf->session_path,
+                                (conf->session_size != 0) ? conf->session_size : MQTTNOX_STORE_SIZE,
+                                conf->session_sync, sync_interval)) {
+            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "Session store %s cannot be opened\n", conf->session_path);
+            return MQTTNOX_RC_ERROR_STORE;
+        }
+        opened = 1;
+    }
+    else if (c->store.base != NULL) {
+        mqttnox_store_set_sync(&c->store, conf->session_sync, sync_interval);
+    }
+
+    mqttnox_sub_drop(c);
+
+    if (c->store.base == NULL || conf->clean_session) {
+        mqttnox_session_drop(c);
+        mqttnox_store_reset(&c->store);
+        mqttnox_inflight_init(&c->inflight, window);
+        mqttnox_ident_init(&c->packet_ident);
+        return MQTTNOX_SUCCESS;
+    }
+
+    if (opened) {
+        /* Restored whatever the window, new messages wait for room */
+        mqttnox_inflight_init(&c->inflight, MQTTNOX_INFLIGHT_WINDOW_MAX);
+        mqttnox_ident_init(&c->packet_ident);
+
+        for (pos = mqttnox_store_next(&c->store, 0, &rec); pos != 0; pos = mqttnox_store_next(&c->store, pos, &rec))
+        {
+            mqttnox_ident_take(&c->packet_ident, rec.ident);
+            mqttnox_inflight_insert(&c->inflight, rec.ident, rec.qos, NULL, 0);
+
+            if (rec.state == MQTTNOX_INFLIGHT_RELEASED) {
+                mqttnox_inflight_release(&c->inflight, rec.ident);
+            }
+        }
+    }
+
+    mqttnox_inflight_set_window(&c->inflight, window);
+
+    return MQTTNOX_SUCCESS;
+}
+
+/**@brief Resends the unacknowledged messages of the session store
+*
+* @note PUBLISH packets go out again with DUP set, QoS 2 messages whose
+*       PUBREC arrived get their PUBREL instead [MQTT-4.4.0-1]. They are
+*       sent in their original order.
+*/
+static mqttnox_rc_t mqttnox_session_replay(mqttnox_client_t* c)
+{
+    mqttnox_store_rec_t rec;
+    mqttnox_iovec_t iov[2];
+    mqttnox_rc_t rc = MQTTNOX_SUCCESS;
+    uint8_t hdr;
+    uint32_t pos;
+
+    /* CONNACK may already be in, letting other threads publish: the
+     * records must not move under the walk */
+    mqttnox_store_pin(&c->store);
+
+    for (pos = mqttnox_store_next(&c->store, 0, &rec); pos != 0; pos = mqttnox_store_next(&c->store, pos, &rec))
+    {
+        if (rec.state == MQTTNOX_INFLIGHT_RELEASED) {
+            rc = mqttnox_pubrel(c, rec.ident);
+        }
+        else {
+            /* DUP flag of the fixed header, set in a copy of its first byte */
+            hdr = rec.pkt[0] | 0x08;
+
+            iov[0].data = &hdr;
+            iov[0].len = 1;
+            iov[1].data = &rec.pkt[1];
+            iov[1].len = rec.len - 1;
+            rc = mqttnox_tx_sendv(c, iov, 2);
+        }
+
+        if (rc != MQTTNOX_SUCCESS) {
+            break;
+        }
+    }
+
+    mqttnox_store_unpin(&c->store);
+
+    return rc;
+}
+
+/**@brief Connects to an MQTT Broker
+*
+* @note This macro will delay concatenation until the expressions have been resolved
+*
+* @param[in]   c     MQTTNox Client
+* @param[in]   conf  MQTT Client Configuration
+*/
+mqttnox_rc_t mqttnox_connect(mqttnox_client_t * c, mqttnox_client_conf_t * conf, uint16_t keepalive)
+{
+    mqttnox_rc_t rc = MQTTNOX_RC_ERROR;
+    mqttnox_connect_var_hdr_t var_hdr;
+    mqttnox_wr_t w;
+    mqttnox_str_t client_id;
+    mqttnox_str_t will_topic;
+    mqttnox_str_t will_msg;
+    mqttnox_str_t username;
+    mqttnox_str_t password;
+    mqttnox_txq_res_t res;
+    uint8_t* data;
+    uint8_t* pkt;
+    uint32_t pkt_len = 0;
+
+    do
+    {
+        if(c->flag_initialized != MQTTNOX_INIT_FLAG) {
+            rc = MQTTNOX_RC_ERROR_NOT_INIT;
+            break;
+        }
+
+        MEMZERO_S(var_hdr);
+
+        if (conf->callback != NULL) {
+            c->callback = conf->callback;
+        }
+        c->router = conf->router;
+
+        /* Measure every string once, the encoder works on the views */
+        client_id = mqttnox_str(conf->client_identifier);
+        will_topic = mqttnox_str(conf->will_topic.topic);
+        will_msg = mqttnox_str(conf->will_topic.msg);
+        username = mqttnox_str(conf->auth.username);
+        password = mqttnox_str(conf->auth.password);
+
+        /* Initialize variable header */
+
+        var_hdr.name_len_msb = MSB(MQTT_CONN_PROTOCOL_NAME_LEN);
+        var_hdr.name_len_lsb = LSB(MQTT_CONN_PROTOCOL_NAME_LEN);
+        memcpy(var_hdr.name_val, MQTT_CONN_PROTOCOL_NAME, MQTT_CONN_PROTOCOL_NAME_LEN);
+
+        /* Support for v3.1.1 Version of protocol ONLY */
+        var_hdr.level_val = MQTT_PROTO_LVL_VERSION_V3_1_1;
+
+        c->keepalive = keepalive;
+        var_hdr.keepalive_msb = MSB(keepalive);
+        var_hdr.keepalive_lsb = LSB(keepalive);
+
+        /* Password flag must be set to 0 if user is not present in payload*/
+        var_hdr.flag_user_name = 0;
+        var_hdr.flag_password = 0;
+
+        if (username.len > 0) {
+            var_hdr.flag_user_name = 1;
+
+            if (password.len > 0) {
+                var_hdr.flag_password = 1;
+            }
+        }
+
+        var_hdr.flag_clean_session = 0;
+        if (conf->clean_session) {
+            var_hdr.flag_clean_session = 1;
+        }
+
+        /* If either msg or topic are specified, then we need both msg and topic */
+        if (conf->will_topic.msg == NULL && conf->will_topic.topic == NULL) {
+            var_hdr.flag_will = 0;
+            var_hdr.flag_will_retain = 0;
+            var_hdr.flag_will_qos = 0;
+        }
+        else
+        {
+            if (will_msg.len > 0 || will_topic.len > 0) {
+
+                var_hdr.flag_will = 1;
+                var_hdr.flag_will_qos = (conf->will_topic.qos & 0x03);
+                var_hdr.flag_will_retain = (conf->will_topic.retain & 0x01);                
+            }
+        }
+
+        /* While the specification allows zero length client id, we don't to reduce conflicts */
+        if (mqttnoxlib_validate_device_id(conf->client_identifier) != 0)
+        {
+            rc = MQTTNOX_RC_ERROR_BAD_CLIENT_IDENT;
+            break;
+        }
+
+        c->tx_high_watermark = (conf->tx_high_watermark != 0) ? conf->tx_high_watermark : MQTTNOX_TX_HIGH_WATERMARK;
+        c->tx_low_watermark = (conf->tx_low_watermark != 0) ? conf->tx_low_watermark : MQTTNOX_TX_LOW_WATERMARK;
+        if (c->tx_low_watermark > c->tx_high_watermark) {
+            c->tx_low_watermark = c->tx_high_watermark;
+        }
+
+        /* Nothing from a previous connection is sent on this one */
+        mqttnox_tx_reset(c);
+
+        rc = mqttnox_session_restore(c, conf);
+        if (rc != MQTTNOX_SUCCESS) {
+            break;
+        }
+        rc = MQTTNOX_RC_ERROR;
+
+        if (!mqttnox_offline_configure(&c->offline, conf->offline_mem_size, conf->offline_spill_path,
+                                       conf->offline_spill_size, conf->offline_ttl_ms)) {
+            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_ERROR, "Offline spill file %s cannot be mapped\n", conf->offline_spill_path);
+            rc = MQTTNOX_RC_ERROR_STORE;
+            break;
+        }
+
+        /* QoS 2 messages awaiting PUBREL are session state [MQTT-4.1.0-1] */
+        if (conf->clean_session) {
+            MEMZERO_S(c->qos2_rcvd);
+        }
+
+        data = mqttnox_tx_reserve(c, MQTTNOX_TX_BUF_SIZE, &res);
+        mqttnox_wr_init(&w, data, MQTTNOX_TX_BUF_SIZE);
+
+        mqttnox_wr_bytes(&w, &var_hdr, sizeof(var_hdr));
+        mqttnox_wr_str(&w, client_id);
+
+        if (var_hdr.flag_will) {
+            mqttnox_wr_str(&w, will_topic);
+            mqttnox_wr_str(&w, will_msg);
+        }
+
+        if (var_hdr.flag_user_name) {
+            mqttnox_wr_str(&w, username);
+
+            if (var_hdr.flag_password) {
+                mqttnox_wr_str(&w, password);
+            }
+        }
+
+        pkt = mqttnox_wr_finish(&w, MQTTNOX_HDR_BYTE(MQTTNOX_CTRL_PKT_TYPE_CONNECT, 0), &pkt_len);
+        if (pkt == NULL) {
+            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "CONNECT does not fit the TX buffer\n");
+            mqttnox_tx_reset(c);
+            break;
+        }
+
+        /* Kept to reconnect with, without encoding it again */
+        memcpy(c->reconnect.connect_pkt, pkt, pkt_len);
+        c->reconnect.connect_len = (uint16_t)pkt_len;
+        c->reconnect.addr = conf->server.addr;
+        c->reconnect.port = conf->server.port;
+        c->reconnect.clean_session = conf->clean_session;
+        mqttnox_reconnect_configure(&c->reconnect, conf->reconnect, conf->reconnect_min_ms,
+                                    conf->reconnect_max_ms, conf->client_identifier, mqttnox_hal_time_ms());
+
+        /* The broker starts without subscriptions */
+        if (conf->clean_session) {
+            mqttnox_reconnect_sub_clear(&c->reconnect);
+        }
+
+        /* Queued now, sent once the TCP connection is up */
+        mqttnox_txq_commit(&c->txq, &res, pkt, pkt_len);
+
+        /* Start the receive decoder on a packet boundary */
+        MEMZERO_S(c->rx);
+        c->rcv_offset = 0;
+        c->stream_threshold = conf->stream_threshold;
+
+        int rc_i = mqttnox_tcp_init(c, mqttnox_tcp_rcv_func);
+        rc_i = mqttnox_tcp_connect(c, conf->server.addr, conf->server.port);
+
+        if (rc_i != 0) {
+            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "Connect failed");
+            mqttnox_tx_reset(c);
+            break;
+        }
+
+        /* From now on a loss is reported and reconnected from */
+        mqttnox_reconnect_linked(&c->reconnect);
+
+        /* Send the connect packet, response is received async */
+        if (mqttnox_tx_flush(c) != MQTTNOX_SUCCESS) {
+            break;
+        }
+
+        /* The stored messages follow without waiting for CONNACK */
+        if (!conf->clean_session && mqttnox_session_replay(c) != MQTTNOX_SUCCESS) {
+            break;
+        }
+
+        rc = MQTTNOX_SUCCESS;
+    } while(0);
+
+    return rc;
+}
+
+/**@brief Sets up the messages in flight for a reconnect
+*
+* @note Same as mqttnox_session_restore with the store kept open: its
+*       messages are resent, without a store or with a clean session the
+*       tables start empty. Every message dropped that way is reported with
+*       MQTTNOX_EVT_PUBLISH_FAILED, so its user_ctx can be freed or the
+*       message published again.
+*/
+static void mqttnox_session_resume(mqttnox_client_t* c)
+{
+    mqttnox_sub_drop(c);
+
+    if (c->store.base == NULL || c->reconnect.clean_session) {
+        mqttnox_session_drop(c);
+        mqttnox_store_reset(&c->store);
+        mqttnox_inflight_init(&c->inflight, c->inflight.window);
+        mqttnox_ident_init(&c->packet_ident);
+    }
+
+    if (c->reconnect.clean_session) {
+        MEMZERO_S(c->qos2_rcvd);
+    }
+}
+
+/**@brief Handles the end of a connection the application did not close
+*
+* @note Sends MQTTNOX_EVT_DISCONNECT once per connection and, with
+*       automatic reconnect, schedules the next attempt. A failed attempt
+*       only schedules the one after it.
+*/
+static void mqttnox_connection_lost(mqttnox_client_t* c, mqttnox_disconnect_reason_t reason)
+{
+    uint8_t data_buffer[64];
+    mqttnox_evt_data_t* evt_data = (mqttnox_evt_data_t*)data_buffer;
+    uint32_t delay;
+    int linked;
+
+    mqttnox_keepalive_stop(&c->ping);
+
+    linked = mqttnox_reconnect_lost(&c->reconnect, mqttnox_hal_time_ms(), &delay);
+    if (delay != 0) {
+        mqttnox_wheel_kick(c);
+    }
+
+    if (!linked) {
+        return;
+    }
+
+    c->status.connected = 0;
+
+    mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "Connection lost (%u), reconnecting in %u ms\n", reason, delay);
+
+    evt_data->evt_id = MQTTNOX_EVT_DISCONNECT;
+    evt_data->evt.disconnect_evt.reason = reason;
+    evt_data->evt.disconnect_evt.reconnect_ms = delay;
+    mqttnox_send_event(c, evt_data);
+}
+
+/**@brief Connection closed by the peer or the network
+*
+* @note Called by the TAL, not after mqttnox_tcp_disconnect
+*
+* @param[in]   c    mqttnox object \see mqttnox_client_t
+*/
+void mqttnox_tcp_closed(mqttnox_client_t* c)
+{
+    if (c == NULL || c->flag_initialized != MQTTNOX_INIT_FLAG) {
+        return;
+    }
+
+    mqttnox_connection_lost(c, MQTTNOX_DISCONNECT_PEER);
+}
+
+/**@brief Sends the CONNECT, then the session store, once the link of a
+*        reconnect attempt is up
+*/
+static void mqttnox_reconnect_up(mqttnox_client_t* c)
+{
+    mqttnox_reconnect_linked(&c->reconnect);
+
+    if (mqttnox_tx_flush(c) != MQTTNOX_SUCCESS ||
+        (!c->reconnect.clean_session && mqttnox_session_replay(c) != MQTTNOX_SUCCESS)) {
+        mqttnox_tcp_disconnect(c);
+        mqttnox_connection_lost(c, MQTTNOX_DISCONNECT_PEER);
+    }
+}
+
+/**@brief Ends a reconnect attempt that got no link
+*
+* @note Nothing was up, only the next attempt is scheduled
+*/
+static void mqttnox_reconnect_failed(mqttnox_client_t* c)
+{
+    mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "Reconnect failed\n");
+    mqttnox_tx_reset(c);
+    mqttnox_connection_lost(c, MQTTNOX_DISCONNECT_PEER);
+}
+
+/**@brief Makes a reconnect attempt
+*
+* @note The cached CONNECT goes out first, then the session store is
+*       resent without waiting for CONNACK, as mqttnox_connect does. The
+*       subscriptions follow the CONNACK, \see mqttnox_handler_connack.
+*       Runs on the timer thread: the receive gate is closed while the
+*       decoder and session are reset, so the TAL receive thread never
+*       decodes into them meanwhile. Bytes it delivers then are from the
+*       lost connection and are dropped. The connect itself does not wait
+*       on the network, \see mqttnox_tcp_connect_async: the TAL finishes
+*       it on its own thread with mqttnox_tcp_connected.
+*
+* @return      0 if the attempt was made, non-zero if the receive thread
+*              was still decoding or the TAL still closing the last
+*              connection, and it must be tried again
+*/
+static int mqttnox_reconnect_attempt(mqttnox_client_t* c)
+{
+    mqttnox_txq_res_t res;
+    uint8_t* data;
+    int rc_i;
+
+    if (!mqttnox_atomic_cas(&c->rx_gate, MQTTNOX_RX_GATE_OPEN, MQTTNOX_RX_GATE_CLOSED)) {
+        return 1;
+    }
+
+    /* Nothing from the lost connection is sent on this one */
+    mqttnox_tx_reset(c);
+    mqttnox_session_resume(c);
+
+    data = mqttnox_tx_reserve(c, c->reconnect.connect_len, &res);
+    memcpy(data, c->reconnect.connect_pkt, c->reconnect.connect_len);
+    mqttnox_txq_commit(&c->txq, &res, data, c->reconnect.connect_len);
+
+    /* Start the receive decoder on a packet boundary */
+    MEMZERO_S(c->rx);
+    c->rcv_offset = 0;
+    c->ack_len = 0;
+
+    /* Whatever arrives from here on is for the new connection */
+    mqttnox_atomic_store(&c->rx_gate, MQTTNOX_RX_GATE_OPEN);
+
+    rc_i = mqttnox_tcp_init(c, mqttnox_tcp_rcv_func);
+    if (rc_i == 0) {
+        rc_i = mqttnox_tcp_connect_async(c, c->reconnect.addr, c->reconnect.port);
+    }
+
+    switch (rc_i)
+    {
+        case 0:
+            mqttnox_reconnect_up(c);
+            break;
+
+        case MQTTNOX_TCP_CONNECT_PENDING:
+            break;
+
+        case MQTTNOX_TCP_CONNECT_BUSY:
+            return 1;
+
+        default:
+            mqttnox_reconnect_failed(c);
+            break;
+    }
+
+    return 0;
+}
+
+/**@brief A connect started by mqttnox_tcp_connect_async has completed
+*
+* @note Called by the TAL on its own thread, not after mqttnox_tcp_disconnect
+*
+* @param[in]   c    mqttnox object \see mqttnox_client_t
+* @param[in]   ok   non-zero if the connection is up
+*/
+void mqttnox_tcp_connected(mqttnox_client_t* c, int ok)
+{
+    if (c == NULL || c->flag_initialized != MQTTNOX_INIT_FLAG) {
+        return;
+    }
+
+    if (ok) {
+        mqttnox_reconnect_up(c);
+    }
+    else {
+        mqttnox_reconnect_failed(c);
+    }
+}
+
+/**@brief Subscribes again to the kept filters, as few SUBSCRIBEs as fit */
+static void mqttnox_resubscribe(mqttnox_client_t* c)
+{
+    mqttnox_topic_sub_t topics[MQTTNOX_RESUB_MAX];
+    char buf[MQTTNOX_TX_BUF_SIZE];
+    uint8_t pos = 0;
+    uint8_t n;
+
+    while ((n = mqttnox_reconnect_sub_copy(&c->reconnect, &pos, topics, buf)) != 0)
+    {
+        if (mqttnox_subscribe_send(c, topics, n) != MQTTNOX_SUCCESS) {
+            break;
+        }
+    }
+}
+
+/**@brief Encodes the start of a PUBLISH: fixed header, remaining length and
+*        topic length
+*
+* @param[out]  buf        at least MQTTNOX_FIXED_HDR_MAX_LEN + MQTTNOX_LENGTH_BYTE_LEN bytes
+* @param[in]   remain_len remaining length of the PUBLISH
+*
+* @return      number of bytes written, 0 if remain_len is too large
+*/
+static uint32_t mqttnox_publish_hdr(uint8_t* buf,
+                                    mqttnox_qos_t qos,
+                                    uint8_t retain,
+                                    uint8_t dup,
+                                    uint32_t remain_len,
+                                    uint16_t topic_len)
+{
+    int remain_bytes;
+
+    buf[0] = MQTTNOX_HDR_BYTE(MQTTNOX_CTRL_PKT_TYPE_PUBLISH,
+                              ((dup & 1) << 3) | ((qos & 0x03) << 1) | (retain & 1));
+
+    remain_bytes = mqttnox_encode_remain_len(&buf[1], remain_len);
+    if (remain_bytes <= 0) {
+        return 0;
+    }
+
+    buf[1 + remain_bytes] = MSB(topic_len);
+    buf[2 + remain_bytes] = LSB(topic_len);
+
+    return 1 + remain_bytes + MQTTNOX_LENGTH_BYTE_LEN;
+}
+
+/**@brief Sends one PUBLISH as a scatter-gather write
+*
+* @note Only the fixed header, topic length and packet identifier are
+*       encoded here; topic and payload are gathered from caller memory
+*       into the outbound queue, or sent from it when too large to queue.
+*
+*       QoS 1 and 2 messages take room in the in-flight window, or use the
+*       caller's reservation, which is handed back on error.
+*
+* @param[in]   c           MQTTNox Client object
+* @param[in]   topic       topic, already validated
+* @param[in]   payload     payload, may be NULL when payload_len is 0
+* @param[in]   user_ctx    returned with the completion of a QoS 1 or 2 message
+* @param[in]   reserved    non-zero if room in the window is already reserved
+* @param[out]  packet_ident identifier assigned for QoS 1 and 2, may be NULL
+*/
+static mqttnox_rc_t mqttnox_publish_sendv(mqttnox_client_t* c,
+                                          mqttnox_qos_t qos,
+                                          uint8_t retain,
+                                          uint8_t dup,
+                                          mqttnox_str_t topic,
+                                          const uint8_t* payload,
+                                          uint32_t payload_len,
+                                          void* user_ctx,
+                                          uint8_t reserved,
+                                          uint16_t* packet_ident)
+{
+    mqttnox_iovec_t iov[4];
+    uint8_t iov_cnt = 0;
+    uint8_t hdr_buf[MQTTNOX_FIXED_HDR_MAX_LEN + MQTTNOX_LENGTH_BYTE_LEN];
+    uint8_t ident_buf[MQTTNOX_PACKET_IDENT_BYTE_LEN];
+    uint32_t remain_len;
+    uint32_t hdr_len;
+    uint16_t ident = 0;
+    mqttnox_rc_t rc;
+
+    remain_len = MQTTNOX_LENGTH_BYTE_LEN + topic.len + payload_len;
+
+    if (qos == MQTTNOX_QOS1_AT_LEAST_ONCE_DELIV || qos == MQTTNOX_QOS2_EXACTLY_ONCE_DELIV) {
+        remain_len += MQTTNOX_PACKET_IDENT_BYTE_LEN;
+    }
+
+    hdr_len = mqttnox_publish_hdr(hdr_buf, qos, retain, dup, remain_len, (uint16_t)topic.len);
+    if (hdr_len == 0) {
+        if (reserved) {
+            mqttnox_inflight_unreserve(&c->inflight, 1);
+        }
+        return MQTTNOX_RC_ERROR;
+    }
+
+    iov[iov_cnt].data = hdr_buf;
+    iov[iov_cnt].len = hdr_len;
+    iov_cnt++;
+
+    iov[iov_cnt].data = (const uint8_t*)topic.data;
+    iov[iov_cnt].len = topic.len;
+    iov_cnt++;
+
+    if (qos == MQTTNOX_QOS1_AT_LEAST_ONCE_DELIV || qos == MQTTNOX_QOS2_EXACTLY_ONCE_DELIV) {
+        /* Add packet identifier */
+        ident = mqttnox_inflight_ident(c, qos, user_ctx, reserved);
+        if (ident == 0) {
+            if (reserved) {
+                mqttnox_inflight_unreserve(&c->inflight, 1);
+            }
+            return MQTTNOX_RC_ERROR_INFLIGHT_FULL;
+        }
+
+        ident_buf[0] = MSB(ident);
+        ident_buf[1] = LSB(ident);
+        if (packet_ident != NULL) {
+            *packet_ident = ident;
+        }
+
+        iov[iov_cnt].data = ident_buf;
+        iov[iov_cnt].len = MQTTNOX_PACKET_IDENT_BYTE_LEN;
+        iov_cnt++;
+    }
+
+    /* Payload does not have length */
+    if (payload_len > 0) {
+        iov[iov_cnt].data = payload;
+        iov[iov_cnt].len = payload_len;
+        iov_cnt++;
+    }
+
+    if (ident != 0) {
+        rc = mqttnox_session_append(c, ident, qos, iov, iov_cnt);
+        if (rc != MQTTNOX_SUCCESS) {
+            mqttnox_inflight_drop(c, ident);
+            return rc;
+        }
+    }
+
+    /* Send the publish packet, response is received async */
+    rc = mqttnox_tx_sendv(c, iov, iov_cnt);
+    if (rc != MQTTNOX_SUCCESS && ident != 0) {
+        mqttnox_inflight_drop(c, ident);
+    }
+
+    return rc;
+}
+
+/**@brief Returns whether publishes go to the offline queue
+*
+* @note They do while the client is not connected, and while older
+*       messages are still queued so the order is kept
+*/
+static int mqttnox_offline_active(mqttnox_client_t* c)
+{
+    return c->offline.mem.base != NULL &&
+           (!c->status.connected || mqttnox_offline_count(&c->offline) != 0);
+}
+
+/**@brief Queues a message while the client is offline
+*
+* @return MQTTNOX_RC_ERROR_QUEUE_FULL when the queue has no room
+*/
+static mqttnox_rc_t mqttnox_offline_queue(mqttnox_client_t* c, const mqttnox_publish_item_t* item, uint32_t topic_len)
+{
+    if (!mqttnox_offline_push(&c->offline, item, topic_len, mqttnox_hal_time_ms())) {
+        return MQTTNOX_RC_ERROR_QUEUE_FULL;
+    }
+
+    return MQTTNOX_SUCCESS;
+}
+
+/**@brief Sends queued messages while the connection allows
+*
+* @note Any thread may call it, one drains at a time. Messages go out in
+*       batches of MQTTNOX_OFFLINE_DRAIN_BATCH, taking only the room left in
+*       the in-flight window, so many are in flight at once. Draining stops
+*       at the high watermark or a full window and carries on from the
+*       next receive, publish or MQTTNOX_EVT_TX_RESUME.
+*/
+static void mqttnox_offline_drain(mqttnox_client_t* c)
+{
+    mqttnox_publish_item_t items[MQTTNOX_OFFLINE_DRAIN_BATCH];
+    uint16_t inflight;
+    uint16_t room = 0;
+    uint16_t n = 0;
+
+    while (c->status.connected && mqttnox_offline_count(&c->offline) != 0 &&
+           mqttnox_atomic_cas(&c->offline.draining, 0, 1))
+    {
+        for (;;)
+        {
+            inflight = mqttnox_inflight_count(&c->inflight);
+            room = (inflight < c->inflight.window) ? (uint16_t)(c->inflight.window - inflight) : 0;
+
+            n = mqttnox_offline_peek(&c->offline, items, MQTTNOX_OFFLINE_DRAIN_BATCH, room, mqttnox_hal_time_ms());
+            if (n == 0) {
+                break;
+            }
+
+            /* Messages stay queued if the batch fails, some may go out twice */
+            if (mqttnox_publish_batch_send(c, items, n) != MQTTNOX_SUCCESS) {
+                break;
+            }
+
+            mqttnox_offline_pop(&c->offline, n);
+        }
+
+        mqttnox_atomic_store(&c->offline.draining, 0);
+
+        /* Only an empty queue is looked at again, for messages pushed meanwhile */
+        if (n != 0 || room == 0) {
+            break;
+        }
+    }
+}
+
+/**@brief MQTT Publish
+*
+* @note This must be called when client has successfully connected.
+*       The message size is not limited by MQTTNOX_TX_BUF_SIZE.
+*       Safe to call from several threads at once. Returns
+*       MQTTNOX_RC_ERROR_WOULD_BLOCK without queuing anything while the
+*       outbound queue is over its high watermark, and QoS 1 and 2
+*       messages get MQTTNOX_RC_ERROR_INFLIGHT_FULL while the in-flight
+*       window is full. Their completion is reported by MQTTNOX_EVT_PUBLISHED.
+*       With a session store they are recorded before being sent, and
+*       MQTTNOX_RC_ERROR_STORE is returned when the store has no room.
+*       With an offline queue, messages published while the connection is
+*       down are queued and sent after the next accepted CONNACK, or get
+*       MQTTNOX_RC_ERROR_QUEUE_FULL when it has no room.
+*
+* @param[in]   c      MQTTNox Client object
+* @param[in]   qos    Quality of Service for Delivery \see mqttnox_qos_t
+* @param[in]   retain retain to send to future subscribers
+* @param[in]   dup    Indicates this is the first sending of data (0) or a duplicate (1)
+* @param[in]   topic  null terminated topic name
+* @param[in]   msg    null terminated message, \see mqttnox_publish_bin for binary payloads
+*/
+mqttnox_rc_t mqttnox_publish(mqttnox_client_t * c, 
+                             mqttnox_qos_t qos, 
+                             uint8_t retain, 
+                             uint8_t dup, 
+                             char * topic,
+                             char * msg)
+{
+    mqttnox_str_t msg_str = mqttnox_str(msg);
 
-    mqttnox_send_event(c, evt_data);
+    return mqttnox_publish_bin(c, qos, retain, dup, topic, msg_str.data, msg_str.len);
 }
 
-/**@brief MQTT Unsub ACK Handler
-*
-* @note Unsubscribe ACK Handler
+/**@brief MQTT Publish of a binary payload
 *
-* @param[in]   c    mqttnox object \see mqttnox_client_t
-* @param[in]   data pointer to buffer with the incoming data from the server
-* @param[in]   len  length of the data from the server
+* @note Same as mqttnox_publish, but the payload length is given so it may
+*       contain zero bytes. The payload is sent from caller memory.
 *
-* @return     None
+* @param[in]   c           MQTTNox Client object
+* @param[in]   qos         Quality of Service for Delivery \see mqttnox_qos_t
+* @param[in]   retain      retain to send to future subscribers
+* @param[in]   dup         Indicates this is the first sending of data (0) or a duplicate (1)
+* @param[in]   topic       null terminated topic name
+* @param[in]   payload     payload, may be NULL when payload_len is 0
+* @param[in]   payload_len payload length
 */
-static void mqttnox_handler_unsuback(mqttnox_client_t* c, uint8_t * data, uint16_t len)
+mqttnox_rc_t mqttnox_publish_bin(mqttnox_client_t* c,
+                                 mqttnox_qos_t qos,
+                                 uint8_t retain,
+                                 uint8_t dup,
+                                 const char* topic,
+                                 const void* payload,
+                                 uint32_t payload_len)
 {
-    uint8_t data_buffer[64];
-    mqttnox_evt_data_t* evt_data = (mqttnox_evt_data_t*)data_buffer;
+    mqttnox_rc_t rc = MQTTNOX_RC_ERROR;
+    mqttnox_publish_item_t item;
+    mqttnox_str_t topic_str;
 
-    mqttnox_response_var_hdr_t* var_hdr = (mqttnox_response_var_hdr_t*)(data + sizeof(mqttnox_hdr_t) + 1);
+    do
+    {
+        if (c->flag_initialized != MQTTNOX_INIT_FLAG) {
+            rc = MQTTNOX_RC_ERROR_NOT_INIT;
+            break;
+        }
 
-    evt_data->evt_id = MQTTNOX_EVT_UNSUBSCRIBED;
-    evt_data->evt.unsubscribed_evt.packet_identified_msb = var_hdr->unsub_ack.msb;
-    evt_data->evt.unsubscribed_evt.packet_identified_lsb = var_hdr->unsub_ack.lsb;
+        topic_str = mqttnox_str(topic);
+        if (topic_str.len == 0 || topic_str.len > 0xFFFF) {
+            break;
+        }
 
-    mqttnox_send_event(c, evt_data);
-}
+        if (payload == NULL && payload_len > 0) {
+            break;
+        }
 
-/**@brief MQTT Ping Response Handler
-*
-* @note Publish Rec Handler
-*
-* @param[in]   c    mqttnox object \see mqttnox_client_t
-* @param[in]   data pointer to buffer with the incoming data from the server
-* @param[in]   len  length of the data from the server
-*
-* @return     None
-*/
-static void mqttnox_handler_pingresp(mqttnox_client_t* c, uint8_t * data, uint16_t len)
-{
-    uint8_t data_buffer[64];
-    mqttnox_evt_data_t* evt_data = (mqttnox_evt_data_t*)data_buffer;
-    evt_data->evt_id = MQTTNOX_EVT_PINGRESP;
+        if (payload_len > MQTTNOX_REMAIN_LEN_MAX) {
+            break;
+        }
 
-    mqttnox_send_event(c, evt_data);
+        if (mqttnox_offline_active(c)) {
+            MEMZERO_S(item);
+            item.topic = topic_str.data;
+            item.payload = payload;
+            item.payload_len = payload_len;
+            item.qos = qos;
+            item.retain = retain;
+
+            rc = mqttnox_offline_queue(c, &item, topic_str.len);
+            mqttnox_offline_drain(c);
+            break;
+        }
+
+        rc = mqttnox_tx_admit(c);
+        if (rc != MQTTNOX_SUCCESS) {
+            break;
+        }
+
+        rc = mqttnox_publish_sendv(c, qos, retain, dup, topic_str,
+                                   (const uint8_t*)payload, payload_len, NULL, 0, NULL);
+    } while (0);
+
+    return rc;
 }
 
-/**@brief Send Event to callback
+/**@brief Prepares a topic handle
 *
-* @note Internal function
+* @note The topic is validated and stored with its length prefix, ready to
+*       be sent by mqttnox_publish_handle. The handle does not reference
+*       topic afterwards and can be shared by any number of clients.
 *
-* @param[in]   c    mqttnox object \see mqttnox_client_t
-* @param[in]   data pointer to buffer with the incoming data from the server
-* @param[in]   len  length of the data from the server
+* @param[out]  h      handle to initialize
+* @param[in]   topic  null terminated topic name, no wildcards [MQTT-3.3.2-2]
 *
-* @return     None
+* @return MQTTNOX_RC_ERROR_BAD_TOPIC if the topic is empty, longer than
+*         MQTTNOX_TOPIC_HANDLE_MAX_LEN or contains a wildcard
 */
-static void mqttnox_send_event(mqttnox_client_t* c, mqttnox_evt_data_t * data)
+mqttnox_rc_t mqttnox_topic_handle_init(mqttnox_topic_handle_t* h, const char* topic)
 {
-    /* Ensure callback is valid */
-    if (c != NULL && c->callback != NULL) {
-        c->callback(data);
+    uint32_t i;
+
+    if (h == NULL || topic == NULL) {
+        return MQTTNOX_RC_ERROR;
     }
-}
 
+    for (i = 0; topic[i] != '\0'; i++)
+    {
+        if (i == MQTTNOX_TOPIC_HANDLE_MAX_LEN || topic[i] == '+' || topic[i] == '#') {
+            return MQTTNOX_RC_ERROR_BAD_TOPIC;
+        }
+
+        h->encoded[MQTTNOX_LENGTH_BYTE_LEN + i] = (uint8_t)topic[i];
+    }
 
+    if (i == 0) {
+        return MQTTNOX_RC_ERROR_BAD_TOPIC;
+    }
 
+    h->encoded[0] = MSB(i);
+    h->encoded[1] = LSB(i);
+    h->len = (uint16_t)(MQTTNOX_LENGTH_BYTE_LEN + i);
 
-/**@brief Connects to an MQTT Broker
+    return MQTTNOX_SUCCESS;
+}
+
+/**@brief MQTT Publish to a topic handle
 *
-* @note This macro will delay concatenation until the expressions have been resolved
+* @note The fixed header, the pre-encoded topic and the packet identifier
+*       are copied into one small buffer and queued together with the
+*       payload. Nothing about the topic is measured or checked per call.
 *
-* @param[in]   c     MQTTNox Client
-* @param[in]   conf  MQTT Client Configuration
+* @param[in]   c           MQTTNox Client object
+* @param[in]   qos         Quality of Service for Delivery \see mqttnox_qos_t
+* @param[in]   retain      retain to send to future subscribers
+* @param[in]   dup         Indicates this is the first sending of data (0) or a duplicate (1)
+* @param[in]   h           topic prepared by mqttnox_topic_handle_init
+* @param[in]   payload     payload, may be NULL when payload_len is 0
+* @param[in]   payload_len payload length
 */
-mqttnox_rc_t mqttnox_connect(mqttnox_client_t * c, mqttnox_client_conf_t * conf, uint16_t keepalive)
+mqttnox_rc_t mqttnox_publish_handle(mqttnox_client_t* c,
+                                    mqttnox_qos_t qos,
+                                    uint8_t retain,
+                                    uint8_t dup,
+                                    const mqttnox_topic_handle_t* h,
+                                    const void* payload,
+                                    uint32_t payload_len)
 {
     mqttnox_rc_t rc = MQTTNOX_RC_ERROR;
-    mqttnox_hdr_t hdr;
-    mqttnox_connect_var_hdr_t var_hdr;
-    uint16_t pkt_len = 0;
-    int irc;
+    mqttnox_publish_item_t item;
+    mqttnox_iovec_t iov[2];
+    uint8_t iov_cnt = 0;
+    uint8_t hdr_buf[MQTTNOX_FIXED_HDR_MAX_LEN + sizeof(h->encoded) + MQTTNOX_PACKET_IDENT_BYTE_LEN];
+    uint32_t remain_len;
+    uint32_t hdr_len;
+    uint16_t ident = 0;
+    int remain_bytes;
 
     do
     {
-        if(c->flag_initialized != MQTTNOX_INIT_FLAG) {
+        if (c->flag_initialized != MQTTNOX_INIT_FLAG) {
             rc = MQTTNOX_RC_ERROR_NOT_INIT;
             break;
         }
 
-        MEMZERO_S(hdr);
-        MEMZERO_S(var_hdr);
+        if (payload == NULL && payload_len > 0) {
+            break;
+        }
 
-        if (conf->callback != NULL) {
-            c->callback = conf->callback;
+        if (payload_len > MQTTNOX_REMAIN_LEN_MAX) {
+            break;
         }
 
+        if (mqttnox_offline_active(c)) {
+            /* The handle holds the topic after its 2 byte length */
+            MEMZERO_S(item);
+            item.topic = (const char*)&h->encoded[MQTTNOX_LENGTH_BYTE_LEN];
+            item.payload = payload;
+            item.payload_len = payload_len;
+            item.qos = qos;
+            item.retain = retain;
+
+            rc = mqttnox_offline_queue(c, &item, h->len - MQTTNOX_LENGTH_BYTE_LEN);
+            mqttnox_offline_drain(c);
+            break;
+        }
 
-        hdr.type = MQTTNOX_CTRL_PKT_TYPE_CONNECT;
+        rc = mqttnox_tx_admit(c);
+        if (rc != MQTTNOX_SUCCESS) {
+            break;
+        }
+        rc = MQTTNOX_RC_ERROR;
 
-        /* Initialize variable header */
+        remain_len = h->len + payload_len;
+        if (qos == MQTTNOX_QOS1_AT_LEAST_ONCE_DELIV || qos == MQTTNOX_QOS2_EXACTLY_ONCE_DELIV) {
+            remain_len += MQTTNOX_PACKET_IDENT_BYTE_LEN;
+        }
 
-        var_hdr.name_len_msb = MSB(MQTT_CONN_PROTOCOL_NAME_LEN);
-        var_hdr.name_len_lsb = LSB(MQTT_CONN_PROTOCOL_NAME_LEN);
-        memcpy(var_hdr.name_val, MQTT_CONN_PROTOCOL_NAME, MQTT_CONN_PROTOCOL_NAME_LEN);
+        hdr_buf[0] = MQTTNOX_HDR_BYTE(MQTTNOX_CTRL_PKT_TYPE_PUBLISH,
+                                      ((dup & 1) << 3) | ((qos & 0x03) << 1) | (retain & 1));
 
-        /* Support for v3.1.1 Version of protocol ONLY */
-        var_hdr.level_val = MQTT_PROTO_LVL_VERSION_V3_1_1;
+        remain_bytes = mqttnox_encode_remain_len(&hdr_buf[1], remain_len);
+        if (remain_bytes <= 0) {
+            break;
+        }
+        hdr_len = 1 + remain_bytes;
 
-        c->keepalive = keepalive;
-        var_hdr.keepalive_msb = MSB(keepalive);
-        var_hdr.keepalive_lsb = LSB(keepalive);
+        memcpy(&hdr_buf[hdr_len], h->encoded, h->len);
+        hdr_len += h->len;
 
-        /* Password flag must be set to 0 if user is not present in payload*/
-        var_hdr.flag_user_name = 0;
-        var_hdr.flag_password = 0;
+        if (qos == MQTTNOX_QOS1_AT_LEAST_ONCE_DELIV || qos == MQTTNOX_QOS2_EXACTLY_ONCE_DELIV) {
+            ident = mqttnox_inflight_ident(c, qos, NULL, 0);
+            if (ident == 0) {
+                rc = MQTTNOX_RC_ERROR_INFLIGHT_FULL;
+                break;
+            }
 
-        if (conf->auth.username != NULL && strlen(conf->auth.username)) {
-            var_hdr.flag_user_name = 1;
+            hdr_buf[hdr_len++] = MSB(ident);
+            hdr_buf[hdr_len++] = LSB(ident);
+        }
 
-            if (conf->auth.password != NULL && strlen(conf->auth.password)) {
-                var_hdr.flag_password = 1;
+        iov[iov_cnt].data = hdr_buf;
+        iov[iov_cnt].len = hdr_len;
+        iov_cnt++;
+
+        if (payload_len > 0) {
+            iov[iov_cnt].data = (const uint8_t*)payload;
+            iov[iov_cnt].len = payload_len;
+            iov_cnt++;
+        }
+
+        if (ident != 0) {
+            rc = mqttnox_session_append(c, ident, qos, iov, iov_cnt);
+            if (rc != MQTTNOX_SUCCESS) {
+                mqttnox_inflight_drop(c, ident);
+                break;
             }
         }
 
-        var_hdr.flag_clean_session = 0;
-        if (conf->clean_session) {
-            var_hdr.flag_clean_session = 1;
+        /* Send the publish packet, response is received async */
+        rc = mqttnox_tx_sendv(c, iov, iov_cnt);
+        if (rc != MQTTNOX_SUCCESS && ident != 0) {
+            mqttnox_inflight_drop(c, ident);
         }
+    } while (0);
 
-        /* If either msg or topic are specified, then we need both msg and topic */
-        if (conf->will_topic.msg == NULL && conf->will_topic.topic == NULL) {
-            var_hdr.flag_will = 0;
-            var_hdr.flag_will_retain = 0;
-            var_hdr.flag_will_qos = 0;
+    return rc;
+}
+
+/**@brief Measures one batch item
+*
+* @param[in]   item        message to publish
+* @param[out]  topic       topic of the item
+* @param[out]  remain_len  remaining length of its PUBLISH
+*
+* @return      upper bound of the packet length, 0 if the item is invalid
+*/
+static uint32_t mqttnox_publish_item_len(const mqttnox_publish_item_t* item,
+                                         mqttnox_str_t* topic,
+                                         uint32_t* remain_len)
+{
+    *topic = mqttnox_str(item->topic);
+    if (topic->len == 0 || topic->len > 0xFFFF || item->payload_len > MQTTNOX_REMAIN_LEN_MAX) {
+        return 0;
+    }
+
+    *remain_len = MQTTNOX_LENGTH_BYTE_LEN + topic->len + item->payload_len;
+    if (item->qos == MQTTNOX_QOS1_AT_LEAST_ONCE_DELIV || item->qos == MQTTNOX_QOS2_EXACTLY_ONCE_DELIV) {
+        *remain_len += MQTTNOX_PACKET_IDENT_BYTE_LEN;
+    }
+
+    /* Upper bound, the remaining length may take fewer bytes */
+    return MQTTNOX_FIXED_HDR_MAX_LEN + *remain_len;
+}
+
+/**@brief Sends a publish batch, \see mqttnox_publish_batch
+*
+* @note Encodes the PUBLISH packets back to back straight into the outbound
+*       queue, reserving space once per MQTTNOX_TXQ_FRAME_MAX bytes of
+*       packets, and sends them with as few TAL calls as the queue allows.
+*       A message too large to queue is sent by itself without being
+*       copied.
+*
+*       Packet identifiers are written back to each QoS 1 and 2 item. They
+*       increase in item order, but other threads publishing at the same
+*       time may take identifiers in between.
+*
+*       The high watermark is checked once, when it has been reached the
+*       whole batch is refused with MQTTNOX_RC_ERROR_WOULD_BLOCK. Room in
+*       the in-flight window is taken for all QoS 1 and 2 items up front,
+*       MQTTNOX_RC_ERROR_INFLIGHT_FULL refuses the batch when it is short.
+*       Each item's user_ctx comes back with its MQTTNOX_EVT_PUBLISHED.
+*
+* @param[in]     c        MQTTNox Client object
+* @param[in,out] items    messages to publish \see mqttnox_publish_item_t
+* @param[in]     item_cnt number of items
+*
+* @return MQTTNOX_SUCCESS when every item was sent. On error the items
+*         before the failing one may already have been sent.
+*/
+static mqttnox_rc_t mqttnox_publish_batch_send(mqttnox_client_t* c,
+                                               mqttnox_publish_item_t* items,
+                                               uint16_t item_cnt)
+{
+    mqttnox_rc_t rc = MQTTNOX_RC_ERROR;
+    mqttnox_publish_item_t* item;
+    mqttnox_txq_res_t res;
+    mqttnox_iovec_t stored;
+    mqttnox_str_t topic;
+    uint8_t* data;
+    uint32_t group_len;
+    uint32_t remain_len;
+    uint32_t pkt_len;
+    uint32_t pos;
+    uint32_t start;
+    uint16_t ident;
+    uint16_t end;
+    uint16_t reserved = 0;
+    uint16_t i = 0;
+
+    do
+    {
+        /* Checked once, a batch is either refused or queued whole */
+        rc = mqttnox_tx_admit(c);
+        if (rc != MQTTNOX_SUCCESS) {
+            break;
         }
-        else
-        {
-            if (conf->will_topic.msg != NULL && (strlen(conf->will_topic.msg) > 0) ||
-                conf->will_topic.topic != NULL && (strlen(conf->will_topic.topic) > 0)) {
 
-                var_hdr.flag_will = 1;
-                var_hdr.flag_will_qos = (conf->will_topic.qos & 0x03);
-                var_hdr.flag_will_retain = (conf->will_topic.retain & 0x01);                
+        for (end = 0; end < item_cnt; end++) {
+            if (items[end].qos == MQTTNOX_QOS1_AT_LEAST_ONCE_DELIV || items[end].qos == MQTTNOX_QOS2_EXACTLY_ONCE_DELIV) {
+                reserved++;
             }
         }
 
-        /* While the specification allows zero length client id, we don't to reduce conflicts */
-        if (mqttnoxlib_validate_device_id(conf->client_identifier) != 0)
-        {
-            rc = MQTTNOX_RC_ERROR_BAD_CLIENT_IDENT;
+        if (reserved > 0 && !mqttnox_inflight_reserve(&c->inflight, reserved)) {
+            reserved = 0;
+            rc = MQTTNOX_RC_ERROR_INFLIGHT_FULL;
             break;
         }
+        rc = MQTTNOX_RC_ERROR;
 
-        int rc_i = mqttnox_tcp_init(c, mqttnox_tcp_rcv_func);
-        rc_i = mqttnox_tcp_connect(conf->server.addr, conf->server.port);
+        while (i < item_cnt)
+        {
+            /* Group the items that fit one queue frame */
+            group_len = 0;
+            for (end = i; end < item_cnt; end++) {
+                pkt_len = mqttnox_publish_item_len(&items[end], &topic, &remain_len);
+                if (pkt_len == 0 || pkt_len > MQTTNOX_TXQ_FRAME_MAX - group_len) {
+                    break;
+                }
+                group_len += pkt_len;
+            }
 
-        if (rc_i != 0) {
-            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "Connect failed");
-            break;
-        }
+            if (end == i) {
+                item = &items[i];
+
+                pkt_len = mqttnox_publish_item_len(item, &topic, &remain_len);
+                if (pkt_len == 0) {
+                    break;
+                }
 
-        MEMZERO(mqttnox_tx_buf);
+                /* The item's room in the window goes with it */
+                if (item->qos == MQTTNOX_QOS1_AT_LEAST_ONCE_DELIV || item->qos == MQTTNOX_QOS2_EXACTLY_ONCE_DELIV) {
+                    reserved--;
+                }
 
-        /* Copy Fixed Header */
-        memcpy(mqttnox_tx_buf, (void *)&hdr, sizeof(hdr));
-        pkt_len += sizeof(hdr);
+                rc = mqttnox_publish_sendv(c, item->qos, item->retain, 0, topic,
+                                           (const uint8_t*)item->payload, item->payload_len,
+                                           item->user_ctx, 1, &item->packet_ident);
+                if (rc != MQTTNOX_SUCCESS) {
+                    break;
+                }
+                rc = MQTTNOX_RC_ERROR;
 
-        /* Skip Remaining length for now - updated later */
-        pkt_len += 1;
+                i++;
+                continue;
+            }
 
-        /* Copy Variable Header*/
-        memcpy(&mqttnox_tx_buf[pkt_len], (void*)&var_hdr, sizeof(var_hdr));
-        pkt_len += sizeof(var_hdr);
+            data = mqttnox_tx_reserve(c, group_len, &res);
+            pos = 0;
 
-        irc = mqttnox_append_utf8_string(&mqttnox_tx_buf[pkt_len], conf->client_identifier, 1);
-        if (irc > 0) {
-            pkt_len += irc;
-        }
+            for (; i < end; i++)
+            {
+                item = &items[i];
+
+                ident = 0;
+                if (item->qos == MQTTNOX_QOS1_AT_LEAST_ONCE_DELIV || item->qos == MQTTNOX_QOS2_EXACTLY_ONCE_DELIV) {
+                    ident = mqttnox_inflight_ident(c, item->qos, item->user_ctx, 1);
+                    if (ident == 0) {
+                        /* Every identifier is held, the items before go out */
+                        break;
+                    }
+                    reserved--;
+                    item->packet_ident = ident;
+                }
 
-        if (var_hdr.flag_will) {
+                mqttnox_publish_item_len(item, &topic, &remain_len);
+                start = pos;
+                pos += mqttnox_publish_hdr(&data[pos], item->qos, item->retain, 0,
+                                           remain_len, (uint16_t)topic.len);
 
-            irc = mqttnox_append_utf8_string(&mqttnox_tx_buf[pkt_len], conf->will_topic.topic, 1);
-            if (irc > 0) {
-                pkt_len += irc;
-            }
+                memcpy(&data[pos], topic.data, topic.len);
+                pos += topic.len;
 
-            irc = mqttnox_append_utf8_string(&mqttnox_tx_buf[pkt_len], conf->will_topic.msg, 1);
-            if (irc > 0) {
-                pkt_len += irc;
-            }
-        }
+                if (ident != 0) {
+                    data[pos++] = MSB(ident);
+                    data[pos++] = LSB(ident);
+                }
 
-        if (var_hdr.flag_user_name) {
+                if (item->payload_len > 0) {
+                    memcpy(&data[pos], item->payload, item->payload_len);
+                    pos += item->payload_len;
+                }
 
-            irc = mqttnox_append_utf8_string(&mqttnox_tx_buf[pkt_len], conf->auth.username, 1);
-            if (irc > 0) {
-                pkt_len += irc;
+                if (ident != 0) {
+                    stored.data = &data[start];
+                    stored.len = pos - start;
+
+                    if (mqttnox_session_append(c, ident, item->qos, &stored, 1) != MQTTNOX_SUCCESS) {
+                        mqttnox_inflight_drop(c, ident);
+                        item->packet_ident = 0;
+                        pos = start;
+                        rc = MQTTNOX_RC_ERROR_STORE;
+                        break;
+                    }
+                }
             }
 
-            if (var_hdr.flag_password) {
+            mqttnox_txq_commit(&c->txq, &res, data, pos);
 
-                irc = mqttnox_append_utf8_string(&mqttnox_tx_buf[pkt_len], conf->auth.password, 1);
-                if (irc > 0) {
-                    pkt_len += irc;
-                }
+            if (i < end) {
+                break;
             }
         }
 
-        mqttnox_tx_buf[MQTT_LENGTH_FIELD_OFFSET] = pkt_len - 2;
-
-        /* Send the connect packet, response is received async */
-        rc_i = mqttnox_tcp_send(mqttnox_tx_buf, pkt_len);
+        /* Items queued before a failing one still go out */
+        if (mqttnox_tx_flush(c) != MQTTNOX_SUCCESS) {
+            break;
+        }
 
+        if (i < item_cnt) {
+            break;
+        }
 
         rc = MQTTNOX_SUCCESS;
-    } while(0);
+    } while (0);
+
+    /* Room taken for items that were never sent */
+    if (reserved > 0) {
+        mqttnox_inflight_unreserve(&c->inflight, reserved);
+    }
 
     return rc;
 }
 
-#define MAX_REMAIN_LEN_BYTES (4)
-
-/**@brief MQTT Publish
+/**@brief MQTT Publish Batch
 *
-* @note This must be called when client has successfully connected
+* @note Sends the batch as one run of PUBLISH packets, \see
+*       mqttnox_publish_batch_send. While the client is offline the items
+*       are queued instead, each with its own ttl_ms, and their
+*       packet_ident is set to 0 as identifiers are only taken when they
+*       are sent. Their user_ctx still comes back with MQTTNOX_EVT_PUBLISHED.
 *
-* @param[in]   c      MQTTNox Client object
-* @param[in]   qos    Quality of Service for Delivery \see mqttnox_qos_t
-* @param[in]   retain retain to send to future subscribers
-* @param[in]   dup    Indicates this is the first sending of data (0) or a duplicate (1)
+* @param[in]     c        MQTTNox Client object
+* @param[in,out] items    messages to publish \see mqttnox_publish_item_t
+* @param[in]     item_cnt number of items
+*
+* @return MQTTNOX_SUCCESS when every item was sent or queued.
+*         MQTTNOX_RC_ERROR_QUEUE_FULL when the offline queue ran out of
+*         room, the items before the failing one stay queued.
 */
-mqttnox_rc_t mqttnox_publish(mqttnox_client_t * c, 
-                             mqttnox_qos_t qos, 
-                             uint8_t retain, 
-                             uint8_t dup, 
-                             char * topic,
-                             char * msg)
+mqttnox_rc_t mqttnox_publish_batch(mqttnox_client_t* c,
+                                   mqttnox_publish_item_t* items,
+                                   uint16_t item_cnt)
 {
     mqttnox_rc_t rc = MQTTNOX_RC_ERROR;
-    mqttnox_hdr_t hdr;
-    mqttnox_connect_var_hdr_t var_hdr;
-    uint16_t pkt_len = 0;
-    uint8_t remain_bytes = 0;
-    int irc;
+    uint16_t i;
 
-    /* We start at an offset because length is determined later.
-       Leave enough space for max remaining length bytes and header */
-    uint16_t offset = MAX_REMAIN_LEN_BYTES + sizeof(hdr);
-    
     do
     {
         if (c->flag_initialized != MQTTNOX_INIT_FLAG) {
@@ -744,52 +2721,72 @@ mqttnox_rc_t mqttnox_publish(mqttnox_client_t * c,
             break;
         }
 
-        MEMZERO_S(hdr);
-        MEMZERO_S(var_hdr);
-
-        /* Initialize fixed header */
-        hdr.type = MQTTNOX_CTRL_PKT_TYPE_PUBLISH;
-        hdr.dup = dup & 1;
-        hdr.qos = qos & 0x03;
-        hdr.retain = retain;
-
-        MEMZERO(mqttnox_tx_buf);
-                
-        /* Setup Variable Header*/
-        irc = mqttnox_append_utf8_string(&mqttnox_tx_buf[pkt_len + offset], topic, 1);
-        if (irc > 0) {
-            pkt_len += irc;
+        if (!mqttnox_offline_active(c)) {
+            rc = mqttnox_publish_batch_send(c, items, item_cnt);
+            break;
         }
 
-        if (qos == MQTTNOX_QOS1_AT_LEAST_ONCE_DELIV || qos == MQTTNOX_QOS2_EXACTLY_ONCE_DELIV) {
-            /* Add packet identifier */
-            mqttnox_tx_buf[pkt_len + offset] = MSB(c->packet_ident);
-            pkt_len++;
-            mqttnox_tx_buf[pkt_len + offset] = LSB(c->packet_ident);
-            pkt_len++;
-            c->packet_ident++;
+        rc = MQTTNOX_SUCCESS;
+        for (i = 0; i < item_cnt && rc == MQTTNOX_SUCCESS; i++) {
+            items[i].packet_ident = 0;
+            rc = mqttnox_offline_queue(c, &items[i], mqttnox_str(items[i].topic).len);
         }
 
-        /* Msg does not have length */
-        irc = mqttnox_append_utf8_string(&mqttnox_tx_buf[pkt_len + offset], msg, 0);
-        if (irc > 0) {
-            pkt_len += irc;
+        mqttnox_offline_drain(c);
+
+    } while (0);
+
+    return rc;
+}
+
+/**@brief Sends one SUBSCRIBE for the topics, \see mqttnox_subscribe */
+static mqttnox_rc_t mqttnox_subscribe_send(mqttnox_client_t* c,
+                                           mqttnox_topic_sub_t* topics,
+                                           uint8_t topic_cnt)
+{
+    mqttnox_rc_t rc = MQTTNOX_RC_ERROR;
+    mqttnox_txq_res_t res;
+    mqttnox_wr_t w;
+    uint8_t* data;
+    uint8_t* pkt;
+    uint32_t pkt_len = 0;
+    uint16_t ident;
+    size_t i = 0;
+
+    do
+    {
+        /* Held until the SUBACK / UNSUBACK */
+        ident = mqttnox_sub_ident(c);
+        if (ident == 0) {
+            break;
         }
 
-        /* Set length backwards behind the data */
-        remain_bytes = mqttnox_set_remain_len(&mqttnox_tx_buf[sizeof(hdr)], pkt_len);
+        data = mqttnox_tx_reserve(c, MQTTNOX_TX_BUF_SIZE, &res);
+        mqttnox_wr_init(&w, data, MQTTNOX_TX_BUF_SIZE);
 
-        pkt_len += remain_bytes;
+        /* Add packet identifier */
+        mqttnox_wr_u16(&w, ident);
 
-        /* Copy Fixed Header */
-        memcpy(&mqttnox_tx_buf[offset - remain_bytes - 1], (void*)&hdr, sizeof(hdr));
-        pkt_len += sizeof(hdr);
+        for (i = 0; i < topic_cnt; i++) {
+            mqttnox_wr_str(&w, mqttnox_str(topics[i].topic));
 
-        /* Send the connect packet, response is received async */
-        irc = mqttnox_tcp_send(&mqttnox_tx_buf[offset - remain_bytes - 1], pkt_len);
+            /* Add qos */
+            mqttnox_wr_u8(&w, topics[i].qos & 0x03);
+        }
 
+        /* Reserved flags must be 0010 [MQTT-3.8.1-1] */
+        pkt = mqttnox_wr_finish(&w, MQTTNOX_HDR_BYTE(MQTTNOX_CTRL_PKT_TYPE_SUBSCRIBE, 0x2), &pkt_len);
+        if (pkt == NULL) {
+            mqttnox_txq_commit(&c->txq, &res, data, 0);
+            mqttnox_sub_release(c, ident);
+            break;
+        }
 
-        rc = MQTTNOX_SUCCESS;
+        /* Send the subscribe packet, response is received async */
+        rc = mqttnox_tx_commit(c, &res, pkt, pkt_len);
+        if (rc != MQTTNOX_SUCCESS) {
+            mqttnox_sub_release(c, ident);
+        }
     } while (0);
 
     return rc;
@@ -797,26 +2794,23 @@ mqttnox_rc_t mqttnox_publish(mqttnox_client_t * c,
 
 /**@brief MQTT Subscribe
 *
-* @note This function can subscribe to one or more topics
+* @note This function can subscribe to one or more topics. With automatic
+*       reconnect the filters are kept and subscribed to again after a
+*       reconnect, until they are unsubscribed.
 *
-* @param[in]   lhs   Left hand side in concatenation
-* @param[in]   rhs   Right hand side in concatenation
+* @param[in]   c          MQTTNox Client object
+* @param[in]   topics     filters and their QoS \see mqttnox_topic_sub_t
+* @param[in]   topic_cnt  number of filters
+*
+* @return MQTTNOX_RC_ERROR_SUB_FULL when the SUBSCRIBE was sent but a
+*         filter cannot be kept for a reconnect
 */
 mqttnox_rc_t mqttnox_subscribe(mqttnox_client_t * c,
                                mqttnox_topic_sub_t * topics,
                                uint8_t topic_cnt)
 {
     mqttnox_rc_t rc = MQTTNOX_RC_ERROR;
-    mqttnox_hdr_t hdr;
-    mqttnox_connect_var_hdr_t var_hdr;
-    uint16_t pkt_len = 0;
-    size_t i = 0;
-    uint8_t remain_bytes = 0;
-    int irc;
-
-    /* We start at an offset because length is determined later.
-       Leave enough space for max remaining length bytes and header */
-    uint16_t offset = MAX_REMAIN_LEN_BYTES + sizeof(hdr);
+    uint8_t i;
 
     do
     {
@@ -825,92 +2819,79 @@ mqttnox_rc_t mqttnox_subscribe(mqttnox_client_t * c,
             break;
         }
 
-        MEMZERO_S(hdr);
-        MEMZERO_S(var_hdr);
-        MEMZERO(mqttnox_tx_buf);
-
-        /* Initialize fixed header */
-        hdr.type = MQTTNOX_CTRL_PKT_TYPE_SUBSCRIBE;
- 
-        /* Add packet identifier */
-        mqttnox_tx_buf[pkt_len + offset] = MSB(c->packet_ident);
-        pkt_len++;
-        mqttnox_tx_buf[pkt_len + offset] = LSB(c->packet_ident);
-        pkt_len++;
-        c->packet_ident++;
+        rc = mqttnox_subscribe_send(c, topics, topic_cnt);
+        if (rc != MQTTNOX_SUCCESS || !c->reconnect.enabled) {
+            break;
+        }
 
         for (i = 0; i < topic_cnt; i++) {
-            irc = mqttnox_append_utf8_string(&mqttnox_tx_buf[pkt_len + offset], topics[i].topic, 1);
-            if (irc > 0) {
-                pkt_len += irc;
+            if (!mqttnox_reconnect_sub_add(&c->reconnect, topics[i].topic, topics[i].qos & 0x03)) {
+                rc = MQTTNOX_RC_ERROR_SUB_FULL;
             }
-
-            /* Add qos */
-            mqttnox_tx_buf[pkt_len + offset] = topics[i].qos & 0x03;
-            pkt_len++;
         }
+    } while (0);
 
-        /* Set length backwards behind the data */
-        remain_bytes = mqttnox_set_remain_len(&mqttnox_tx_buf[sizeof(hdr)], pkt_len);
-        pkt_len += remain_bytes;
-
-        /* Copy Fixed Header */
-        memcpy(&mqttnox_tx_buf[offset - remain_bytes - 1], (void*)&hdr, sizeof(hdr));
-        mqttnox_tx_buf[offset - remain_bytes - 1] |= 0x2; /* Required */
-        pkt_len += sizeof(hdr);
+    return rc;
+}
 
-        /* Send the connect packet, response is received async */
-        irc = mqttnox_tcp_send(&mqttnox_tx_buf[offset - remain_bytes - 1], pkt_len);
+/**@brief Encodes a remaining length
+*
+* @param[out]  buffer  at least MAX_REMAIN_LEN_BYTES bytes, written from the start
+* @param[in]   len     remaining length
+*
+* @return      number of bytes written, 0 if len is too large
+*/
+int mqttnox_encode_remain_len(uint8_t* buffer, uint32_t len)
+{
+    int i = 0;
 
+    if (len > MQTTNOX_REMAIN_LEN_MAX) {
+        return 0;
+    }
 
-        rc = MQTTNOX_SUCCESS;
-    } while (0);
+    do
+    {
+        buffer[i] = (uint8_t)(len & 0x7F);
+        len >>= 7;
+        if (len > 0) {
+            buffer[i] |= 0x80;
+        }
+        i++;
+    } while (len > 0);
 
-    return rc;
+    return i;
 }
 
+/**@brief Encodes a remaining length aligned to the end of a 4 byte buffer
+*
+* @return      number of bytes used at the end of buffer, 0 if len is too large
+*/
 int mqttnox_set_remain_len(uint8_t * buffer, uint32_t len)
-{        
-    if (len <= 127) {
-        buffer[3] = (len & 0x0000007F);
-        return 1;
-    }
-    else if (len <= 16383) {
-        buffer[2] = (len & 0x0000007F) | (1 << 7);
-        buffer[3] = (len & 0x00007FF0) >> 7;
-        return 2;
-    }
-    else if (len <= 2097151) {
-        buffer[1] = (len & 0x0000007F) | (1 << 7);
-        buffer[2] = ((len & 0x00007FF0) >> 7) | (1 << 7);
-        buffer[3] = (len & 0x007FF000) >> 14;
-        return 3;
-    }
-    else if (len <= 268435455) {
-        buffer[0] = (len & 0x0000007F) | (1 << 7);
-        buffer[1] = ((len & 0x00007FF0) >> 7) | (1 << 7);
-        buffer[2] = ((len & 0x007FF000) >> 14) | (1 << 7);
-        buffer[3] = ((len & 0x7FF00000) >> 21);
-        return 4;
-    }
+{
+    uint8_t len_buf[MAX_REMAIN_LEN_BYTES];
+    int len_bytes = mqttnox_encode_remain_len(len_buf, len);
 
-    return 0;
+    memcpy(&buffer[MAX_REMAIN_LEN_BYTES - len_bytes], len_buf, len_bytes);
+
+    return len_bytes;
 }
+
 int mqttnox_decode_remain_len(uint8_t* buffer, uint32_t * len)
 {
     uint8_t byte;
     uint32_t multiplier = 1;
     uint32_t value = 0;
     size_t index = 0;
-    uint8_t byte_cnt = 0;
     do
     {
+        /* At most four bytes, the last one without continuation */
+        if (index == MAX_REMAIN_LEN_BYTES) {
+            return -1;
+        }
+
         byte = buffer[index++];
         value += (byte & 127) * multiplier;
         multiplier *= 128;
-        if (multiplier > 128 * 128 * 128) {
-            return -1;
-        }
 
     } while ((byte & 128) != 0);
 
@@ -934,11 +2915,13 @@ mqttnox_rc_t mqttnox_unsubscribe(mqttnox_client_t* c,
                                uint8_t topic_cnt)
 {
     mqttnox_rc_t rc = MQTTNOX_RC_ERROR;
-    mqttnox_hdr_t hdr;
-    mqttnox_connect_var_hdr_t var_hdr;
-    uint16_t pkt_len = 0;
+    mqttnox_txq_res_t res;
+    mqttnox_wr_t w;
+    uint8_t* data;
+    uint8_t* pkt;
+    uint32_t pkt_len = 0;
+    uint16_t ident;
     size_t i = 0;
-    int irc;
 
     do
     {
@@ -947,282 +2930,170 @@ mqttnox_rc_t mqttnox_unsubscribe(mqttnox_client_t* c,
             break;
         }
 
-        MEMZERO_S(hdr);
-        MEMZERO_S(var_hdr);
-
-        /* Initialize fixed header */
-        hdr.type = MQTTNOX_CTRL_PKT_TYPE_UNSUBSCRIBE;
-
-
-        MEMZERO(mqttnox_tx_buf);
-
-        /* Copy Fixed Header */
-        memcpy(mqttnox_tx_buf, (void*)&hdr, sizeof(hdr));
-        mqttnox_tx_buf[0] |= 0x2; /* Required */
-        pkt_len += sizeof(hdr);
+        /* Held until the SUBACK / UNSUBACK */
+        ident = mqttnox_sub_ident(c);
+        if (ident == 0) {
+            break;
+        }
 
-        /* Skip Remaining length for now - updated later */
-        pkt_len += 1;
+        data = mqttnox_tx_reserve(c, MQTTNOX_TX_BUF_SIZE, &res);
+        mqttnox_wr_init(&w, data, MQTTNOX_TX_BUF_SIZE);
 
         /* Add packet identifier */
-        mqttnox_tx_buf[pkt_len++] = MSB(c->packet_ident);
-        mqttnox_tx_buf[pkt_len++] = LSB(c->packet_ident);
-        c->packet_ident++;
+        mqttnox_wr_u16(&w, ident);
 
         for (i = 0; i < topic_cnt; i++) {
-            irc = mqttnox_append_utf8_string(&mqttnox_tx_buf[pkt_len], topics[i].topic, 1);
-            if (irc > 0) {
-                pkt_len += irc;
-            }
+            mqttnox_wr_str(&w, mqttnox_str(topics[i].topic));
         }
 
-        mqttnox_tx_buf[MQTT_LENGTH_FIELD_OFFSET] = pkt_len - 2;
-
-        /* Send the connect packet, response is received async */
-        irc = mqttnox_tcp_send(mqttnox_tx_buf, pkt_len);
+        /* Reserved flags must be 0010 [MQTT-3.10.1-1] */
+        pkt = mqttnox_wr_finish(&w, MQTTNOX_HDR_BYTE(MQTTNOX_CTRL_PKT_TYPE_UNSUBSCRIBE, 0x2), &pkt_len);
+        if (pkt == NULL) {
+            mqttnox_txq_commit(&c->txq, &res, data, 0);
+            mqttnox_sub_release(c, ident);
+            break;
+        }
 
+        /* Send the unsubscribe packet, response is received async */
+        rc = mqttnox_tx_commit(c, &res, pkt, pkt_len);
+        if (rc != MQTTNOX_SUCCESS) {
+            mqttnox_sub_release(c, ident);
+            break;
+        }
 
-        rc = MQTTNOX_SUCCESS;
+        for (i = 0; i < topic_cnt; i++) {
+            mqttnox_reconnect_sub_remove(&c->reconnect, topics[i].topic);
+        }
     } while (0);
 
     return rc;
 }
 
-/**@brief MQTT PubAck
-*
-* @note This function sends Pub Ack
+/* PUBACK, PUBREC, PUBREL and PUBCOMP frames, only the identifier is patched in */
+static const uint8_t mqttnox_ack_tmpl_puback[MQTTNOX_ACK_LEN] =
+    { MQTTNOX_HDR_BYTE(MQTTNOX_CTRL_PKT_TYPE_PUBACK, 0), MQTTNOX_PACKET_IDENT_BYTE_LEN, 0, 0 };
+static const uint8_t mqttnox_ack_tmpl_pubrec[MQTTNOX_ACK_LEN] =
+    { MQTTNOX_HDR_BYTE(MQTTNOX_CTRL_PKT_TYPE_PUBREC, 0), MQTTNOX_PACKET_IDENT_BYTE_LEN, 0, 0 };
+/* Reserved flags must be 0010 [MQTT-3.6.1-1] */
+static const uint8_t mqttnox_ack_tmpl_pubrel[MQTTNOX_ACK_LEN] =
+    { MQTTNOX_HDR_BYTE(MQTTNOX_CTRL_PKT_TYPE_PUBREL, 0x2), MQTTNOX_PACKET_IDENT_BYTE_LEN, 0, 0 };
+static const uint8_t mqttnox_ack_tmpl_pubcomp[MQTTNOX_ACK_LEN] =
+    { MQTTNOX_HDR_BYTE(MQTTNOX_CTRL_PKT_TYPE_PUBCOMP, 0), MQTTNOX_PACKET_IDENT_BYTE_LEN, 0, 0 };
+
+/**@brief Sends the acks held back while processing received data
 *
-* @param[in]   lhs   Left hand side in concatenation
-* @param[in]   rhs   Right hand side in concatenation
+* @param[in]   c   mqttnox object \see mqttnox_client_t
 */
-static mqttnox_rc_t mqttnox_puback(mqttnox_client_t* c,
-                            uint16_t identifier)
+static mqttnox_rc_t mqttnox_ack_flush(mqttnox_client_t* c)
 {
-    mqttnox_rc_t rc = MQTTNOX_RC_ERROR;
-    mqttnox_hdr_t hdr;
-    mqttnox_connect_var_hdr_t var_hdr;
-    uint16_t pkt_len = 0;    
-    uint8_t remain_bytes = 0;
-    int irc;
+    mqttnox_iovec_t iov;
 
-    /* We start at an offset because length is determined later.
-       Leave enough space for max remaining length bytes and header */
-    uint16_t offset = MAX_REMAIN_LEN_BYTES + sizeof(hdr);
+    if (c->ack_len == 0) {
+        return MQTTNOX_SUCCESS;
+    }
 
-    do
-    {
-        if (c->flag_initialized != MQTTNOX_INIT_FLAG) {
-            rc = MQTTNOX_RC_ERROR_NOT_INIT;
-            break;
-        }
+    iov.data = c->ack_buf;
+    iov.len = c->ack_len;
+    c->ack_len = 0;
 
-        MEMZERO_S(hdr);
-        MEMZERO_S(var_hdr);
-        MEMZERO(mqttnox_tx_buf);
+    return mqttnox_tx_sendv(c, &iov, 1);
+}
+
+/**@brief Sends an ack from its template
+*
+* @note While mqttnox_tcp_rcv_func runs, acks are collected in ack_buf and
+*       sent together when it returns, one send per receive call instead
+*       of one per packet. Acks otherwise go out straight away.
+*
+* @param[in]   c          mqttnox object \see mqttnox_client_t
+* @param[in]   tmpl       ack frame to send
+* @param[in]   identifier packet identifier
+*/
+static mqttnox_rc_t mqttnox_send_ident_pkt(mqttnox_client_t* c, const uint8_t* tmpl, uint16_t identifier)
+{
+    uint8_t pkt[MQTTNOX_ACK_LEN];
+    mqttnox_iovec_t iov;
 
-        /* Initialize fixed header */
-        hdr.type = MQTTNOX_CTRL_PKT_TYPE_PUBACK;
+    if (c->flag_initialized != MQTTNOX_INIT_FLAG) {
+        return MQTTNOX_RC_ERROR_NOT_INIT;
+    }
 
-        /* Add packet identifier */
-        mqttnox_tx_buf[pkt_len + offset] = MSB(identifier);
-        pkt_len++;
-        mqttnox_tx_buf[pkt_len + offset] = LSB(identifier);
-        pkt_len++;
+    if (c->ack_defer) {
+        if ((uint32_t)c->ack_len + MQTTNOX_ACK_LEN > sizeof(c->ack_buf) && mqttnox_ack_flush(c) != MQTTNOX_SUCCESS) {
+            return MQTTNOX_RC_ERROR;
+        }
 
-        /* Set length backwards behind the data */
-        remain_bytes = mqttnox_set_remain_len(&mqttnox_tx_buf[sizeof(hdr)], pkt_len);
-        pkt_len += remain_bytes;
+        memcpy(&c->ack_buf[c->ack_len], tmpl, MQTTNOX_ACK_LEN);
+        c->ack_buf[c->ack_len + 2] = MSB(identifier);
+        c->ack_buf[c->ack_len + 3] = LSB(identifier);
+        c->ack_len += MQTTNOX_ACK_LEN;
 
-        /* Copy Fixed Header */
-        memcpy(&mqttnox_tx_buf[offset - remain_bytes - 1], (void*)&hdr, sizeof(hdr));        
-        pkt_len += sizeof(hdr);
+        return MQTTNOX_SUCCESS;
+    }
 
-        /* Send the connect packet, response is received async */
-        irc = mqttnox_tcp_send(&mqttnox_tx_buf[offset - remain_bytes - 1], pkt_len);
+    memcpy(pkt, tmpl, MQTTNOX_ACK_LEN);
+    pkt[2] = MSB(identifier);
+    pkt[3] = LSB(identifier);
 
+    iov.data = pkt;
+    iov.len = sizeof(pkt);
 
-        rc = MQTTNOX_SUCCESS;
-    } while (0);
+    return mqttnox_tx_sendv(c, &iov, 1);
+}
 
-    return rc;
+/**@brief MQTT PubAck
+*
+* @note This function sends Pub Ack
+*
+* @param[in]   c          mqttnox object \see mqttnox_client_t
+* @param[in]   identifier packet identifier of the PUBLISH
+*/
+static mqttnox_rc_t mqttnox_puback(mqttnox_client_t* c,
+                            uint16_t identifier)
+{
+    return mqttnox_send_ident_pkt(c, mqttnox_ack_tmpl_puback, identifier);
 }
 
 /**@brief MQTT PubRec
 *
 * @note This function sends Pub Rec
 *
-* @param[in]   c   Left hand side in concatenation
-* @param[in]   rhs   Right hand side in concatenation
+* @param[in]   c          mqttnox object \see mqttnox_client_t
+* @param[in]   identifier packet identifier of the PUBLISH
 */
 static mqttnox_rc_t mqttnox_pubrec(mqttnox_client_t* c, uint16_t identifier)
 {
-    mqttnox_rc_t rc = MQTTNOX_RC_ERROR;
-    mqttnox_hdr_t hdr;
-    mqttnox_connect_var_hdr_t var_hdr;
-    uint16_t pkt_len = 0;
-    uint8_t remain_bytes = 0;
-    int irc;
-
     mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "Sending Pub Rec\n");
 
-    /* We start at an offset because length is determined later.
-       Leave enough space for max remaining length bytes and header */
-    uint16_t offset = MAX_REMAIN_LEN_BYTES + sizeof(hdr);
-
-    do
-    {
-        if (c->flag_initialized != MQTTNOX_INIT_FLAG) {
-            rc = MQTTNOX_RC_ERROR_NOT_INIT;
-            break;
-        }
-
-        MEMZERO_S(hdr);
-        MEMZERO_S(var_hdr);
-        MEMZERO(mqttnox_tx_buf);
-
-        /* Initialize fixed header */
-        hdr.type = MQTTNOX_CTRL_PKT_TYPE_PUBREC;
-
-        /* Add packet identifier */
-        mqttnox_tx_buf[pkt_len + offset] = MSB(identifier);
-        pkt_len++;
-        mqttnox_tx_buf[pkt_len + offset] = LSB(identifier);
-        pkt_len++;
-
-        /* Set length backwards behind the data */
-        remain_bytes = mqttnox_set_remain_len(&mqttnox_tx_buf[sizeof(hdr)], pkt_len);
-        pkt_len += remain_bytes;
-
-        /* Copy Fixed Header */
-        memcpy(&mqttnox_tx_buf[offset - remain_bytes - 1], (void*)&hdr, sizeof(hdr));        
-        pkt_len += sizeof(hdr);
-
-        /* Send the connect packet, response is received async */
-        irc = mqttnox_tcp_send(&mqttnox_tx_buf[offset - remain_bytes - 1], pkt_len);
-
-        rc = MQTTNOX_SUCCESS;
-    } while (0);
-
-    return rc;
+    return mqttnox_send_ident_pkt(c, mqttnox_ack_tmpl_pubrec, identifier);
 }
 
 /**@brief MQTT PubRel
 *
-* @note This function sends Pub Rec
+* @note This function sends Pub Rel
 *
-* @param[in]   c   Left hand side in concatenation
-* @param[in]   rhs   Right hand side in concatenation
+* @param[in]   c          mqttnox object \see mqttnox_client_t
+* @param[in]   identifier packet identifier of the PUBREC
 */
 static mqttnox_rc_t mqttnox_pubrel(mqttnox_client_t* c, uint16_t identifier)
 {
-    mqttnox_rc_t rc = MQTTNOX_RC_ERROR;
-    mqttnox_hdr_t hdr;
-    mqttnox_connect_var_hdr_t var_hdr;
-    uint16_t pkt_len = 0;
-    uint8_t remain_bytes = 0;
-    int irc;
-
     mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "Sending Pub Rel\n");
 
-    /* We start at an offset because length is determined later.
-       Leave enough space for max remaining length bytes and header */
-    uint16_t offset = MAX_REMAIN_LEN_BYTES + sizeof(hdr);
-
-    do
-    {
-        if (c->flag_initialized != MQTTNOX_INIT_FLAG) {
-            rc = MQTTNOX_RC_ERROR_NOT_INIT;
-            break;
-        }
-
-        MEMZERO_S(hdr);
-        MEMZERO_S(var_hdr);
-        MEMZERO(mqttnox_tx_buf);
-
-        /* Initialize fixed header */
-        hdr.type = MQTTNOX_CTRL_PKT_TYPE_PUBREL;
-
-        /* Add packet identifier */
-        mqttnox_tx_buf[pkt_len + offset] = LSB(identifier);
-        pkt_len++;
-        mqttnox_tx_buf[pkt_len + offset] = MSB(identifier);
-        pkt_len++;
-
-        /* Set length backwards behind the data */
-        remain_bytes = mqttnox_set_remain_len(&mqttnox_tx_buf[sizeof(hdr)], pkt_len);
-        pkt_len += remain_bytes;
-
-        /* Copy Fixed Header */
-        memcpy(&mqttnox_tx_buf[offset - remain_bytes - 1], (void*)&hdr, sizeof(hdr));
-        mqttnox_tx_buf[offset - remain_bytes - 1] |= 0x2; /* Required */
-        pkt_len += sizeof(hdr);
-
-        /* Send the connect packet, response is received async */
-        irc = mqttnox_tcp_send(&mqttnox_tx_buf[offset - remain_bytes - 1], pkt_len);
-
-        rc = MQTTNOX_SUCCESS;
-    } while (0);
-
-    return rc;
+    return mqttnox_send_ident_pkt(c, mqttnox_ack_tmpl_pubrel, identifier);
 }
 
 /**@brief MQTT PubComp
 *
-* @note This function sends Pub Rec
+* @note This function sends Pub Comp
 *
-* @param[in]   c   Left hand side in concatenation
-* @param[in]   rhs   Right hand side in concatenation
+* @param[in]   c          mqttnox object \see mqttnox_client_t
+* @param[in]   identifier packet identifier of the PUBREL
 */
 static mqttnox_rc_t mqttnox_pubcomp(mqttnox_client_t* c, uint16_t identifier)
 {
-    mqttnox_rc_t rc = MQTTNOX_RC_ERROR;
-    mqttnox_hdr_t hdr;
-    mqttnox_connect_var_hdr_t var_hdr;
-    uint16_t pkt_len = 0;
-    uint8_t remain_bytes = 0;
-    int irc;
-
     mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "Sending Pub Comp\n");
 
-    /* We start at an offset because length is determined later.
-       Leave enough space for max remaining length bytes and header */
-    uint16_t offset = MAX_REMAIN_LEN_BYTES + sizeof(hdr);
-
-    do
-    {
-        if (c->flag_initialized != MQTTNOX_INIT_FLAG) {
-            rc = MQTTNOX_RC_ERROR_NOT_INIT;
-            break;
-        }
-
-        MEMZERO_S(hdr);
-        MEMZERO_S(var_hdr);
-        MEMZERO(mqttnox_tx_buf);
-
-        /* Initialize fixed header */
-        hdr.type = MQTTNOX_CTRL_PKT_TYPE_PUBCOMP;
-
-        /* Add packet identifier */
-        mqttnox_tx_buf[pkt_len + offset] = LSB(identifier);
-        pkt_len++;
-        mqttnox_tx_buf[pkt_len + offset] = MSB(identifier);
-        pkt_len++;
-
-        /* Set length backwards behind the data */
-        remain_bytes = mqttnox_set_remain_len(&mqttnox_tx_buf[sizeof(hdr)], pkt_len);
-        pkt_len += remain_bytes;
-
-        /* Copy Fixed Header */
-        memcpy(&mqttnox_tx_buf[offset - remain_bytes - 1], (void*)&hdr, sizeof(hdr));        
-        pkt_len += sizeof(hdr);
-
-        /* Send the connect packet, response is received async */
-        irc = mqttnox_tcp_send(&mqttnox_tx_buf[offset - remain_bytes - 1], pkt_len);
-
-        rc = MQTTNOX_SUCCESS;
-    } while (0);
-
-    return rc;
+    return mqttnox_send_ident_pkt(c, mqttnox_ack_tmpl_pubcomp, identifier);
 }
 
 /**@brief MQTT Disconnect
@@ -1235,9 +3106,7 @@ static mqttnox_rc_t mqttnox_pubcomp(mqttnox_client_t* c, uint16_t identifier)
 mqttnox_rc_t mqttnox_disconnect(mqttnox_client_t * c)
 {
     mqttnox_rc_t rc = MQTTNOX_RC_ERROR;
-    mqttnox_hdr_t hdr;
-    mqttnox_connect_var_hdr_t var_hdr;
-    uint16_t pkt_len = 0;
+    uint8_t pkt[2];
     int irc;
 
     do
@@ -1247,31 +3116,30 @@ mqttnox_rc_t mqttnox_disconnect(mqttnox_client_t * c)
             break;
         }
 
-        MEMZERO_S(hdr);
-        MEMZERO_S(var_hdr);
-
-        /* Initialize fixed header */
-        hdr.type = MQTTNOX_CTRL_PKT_TYPE_DISCONNECT;
+        /* Closed on purpose, not a loss to reconnect from */
+        mqttnox_reconnect_cancel(&c->reconnect);
+        mqttnox_keepalive_stop(&c->ping);
 
+        /* Fixed header and zero remaining length */
+        pkt[0] = MQTTNOX_HDR_BYTE(MQTTNOX_CTRL_PKT_TYPE_DISCONNECT, 0);
+        pkt[1] = 0;
 
-        MEMZERO(mqttnox_tx_buf);
+        /* Queued packets go out first, nothing can follow DISCONNECT */
+        mqttnox_tx_writer_acquire(c);
 
-        /* Copy Fixed Header */
-        memcpy(mqttnox_tx_buf, (void*)&hdr, sizeof(hdr));        
-        pkt_len += sizeof(hdr);
+        mqttnox_tx_drain(c);
+        irc = mqttnox_tcp_send(c, pkt, sizeof(pkt));
+        if (irc == 0) {
+            /* Disconnect the TCP */
+            mqttnox_tcp_disconnect(c);
+        }
 
-        /* Zero remaining length */
-        mqttnox_tx_buf[pkt_len++] = 0;
+        mqttnox_tx_writer_release(c);
 
-        /* Send the connect packet, response is received async */
-        irc = mqttnox_tcp_send(mqttnox_tx_buf, pkt_len);
         if(irc != 0) {
             break;
         }
 
-        /* Disconnect the TCP */
-        mqttnox_tcp_disconnect();
-
         c->status.connected = 0;
 
         rc = MQTTNOX_SUCCESS;
@@ -1280,43 +3148,26 @@ mqttnox_rc_t mqttnox_disconnect(mqttnox_client_t * c)
     return rc;
 }
 
-/**@brief Appends UTF8 strings to buffer
+/**@brief MQTT PingReq
 *
-* @note Internal function
+* @note Sent by mqttnox_process when the keepalive interval passed with
+*       nothing else sent
 *
-* @param[in]   buffer    the buffer to which append the string
-* @param[in]   str    the string to append
-* @param[in]   add_len  indicates whether length should be prepended to string
-*
-* @return      length of string appended, or -1 if failed
+* @param[in]   c    mqttnox object \see mqttnox_client_t
 */
-static int mqttnox_append_utf8_string(uint8_t* buffer, const char* str, uint8_t add_len)
+static mqttnox_rc_t mqttnox_pingreq(mqttnox_client_t* c)
 {
-    uint16_t len = 0;
-    size_t str_len = 0;
-    size_t buf_offset = 0;
-
-    if (buffer != NULL) {
-        buf_offset = strlen((const char *)buffer);
-    }
-
-    if (str != NULL && (strlen(str) > 0) && buffer != NULL) {
-
-        str_len = strlen(str);
+    uint8_t pkt[2];
+    mqttnox_iovec_t iov;
 
-        if (add_len) {
-            buffer[buf_offset + len] = ((uint16_t)str_len & 0xFF00) >> 8;
-            len++;
-            buffer[buf_offset + len] = ((uint16_t)str_len & 0x00FF);
-            len++;
-        }
-
-        memcpy(&buffer[buf_offset + len], (void*)str, str_len);
+    /* Fixed header and zero remaining length */
+    pkt[0] = MQTTNOX_HDR_BYTE(MQTTNOX_CTRL_PKT_TYPE_PINGREQ, 0);
+    pkt[1] = 0;
 
-        return (uint16_t)str_len + len;
-    }
+    iov.data = pkt;
+    iov.len = sizeof(pkt);
 
-    return -1;
+    return mqttnox_tx_sendv(c, &iov, 1);
 }
 
 /**@brief MQTT check if connected
@@ -1340,6 +3191,144 @@ uint8_t mqttnox_is_connected(mqttnox_client_t* c)
     }
 }
 
+/**@brief Runs the client's timers
+*
+* @note Call from the application's event loop. Makes a reconnect attempt
+*       once it is due and gives it up when CONNACK does not come in time.
+*       The attempt is put off while the receive thread is still
+*       delivering, and is finished by the TAL on its own thread, except
+*       with a TAL that can only connect blocking. Sends
+*       PINGREQ on a connection idle for the keepalive interval and closes
+*       it when PINGRESP does not come in time.
+*       \see mqttnox_wheel_attach to have a timer wheel call it instead.
+*
+* @param[in]   c    mqttnox object \see mqttnox_client_t
+*
+* @return     milliseconds until it needs to run again, 0 to run again
+*             straight away, MQTTNOX_PROCESS_IDLE when nothing is scheduled
+*/
+uint32_t mqttnox_process(mqttnox_client_t* c)
+{
+    uint32_t wait = MQTTNOX_PROCESS_IDLE;
+    uint32_t ping_wait;
+    uint32_t now;
+
+    if (c == NULL || c->flag_initialized != MQTTNOX_INIT_FLAG) {
+        return wait;
+    }
+
+    now = mqttnox_hal_time_ms();
+
+    switch (mqttnox_keepalive_poll(&c->ping, now, &ping_wait))
+    {
+        case MQTTNOX_KEEPALIVE_ACT_PING:
+            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "Keepalive PINGREQ\n");
+            if (mqttnox_pingreq(c) != MQTTNOX_SUCCESS) {
+                mqttnox_tcp_disconnect(c);
+                mqttnox_connection_lost(c, MQTTNOX_DISCONNECT_PEER);
+                ping_wait = 0;
+            }
+            break;
+
+        case MQTTNOX_KEEPALIVE_ACT_TIMEOUT:
+            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "No PINGRESP, closing the connection\n");
+            mqttnox_tcp_disconnect(c);
+            mqttnox_connection_lost(c, MQTTNOX_DISCONNECT_KEEPALIVE);
+            ping_wait = 0;
+            break;
+
+        default:
+            break;
+    }
+
+    switch (mqttnox_reconnect_poll(&c->reconnect, now, &wait))
+    {
+        case MQTTNOX_RECONNECT_ACT_CONNECT:
+            wait = 0;
+            if (mqttnox_reconnect_attempt(c) != 0) {
+                /* The old connection is still being delivered or closed */
+                mqttnox_reconnect_defer(&c->reconnect, now + 1);
+                wait = 1;
+            }
+            break;
+
+        case MQTTNOX_RECONNECT_ACT_TIMEOUT:
+            mqttnox_debug_printf(c, MQTTNOX_DEBUG_LVL_DEBUG, "No CONNACK, dropping the attempt\n");
+            mqttnox_tcp_disconnect(c);
+            mqttnox_connection_lost(c, MQTTNOX_DISCONNECT_TIMEOUT);
+            wait = 0;
+            break;
+
+        default:
+            break;
+    }
+
+    return (ping_wait < wait) ? ping_wait : wait;
+}
+
+/**@brief Runs mqttnox_process for a client attached to a wheel
+*/
+static void mqttnox_wheel_expired(mqttnox_timer_t* t, void* arg)
+{
+    mqttnox_client_t* c = (mqttnox_client_t*)arg;
+    uint32_t wait;
+
+    if (c->wheel == NULL) {
+        return;
+    }
+
+    wait = mqttnox_process(c);
+    if (wait != MQTTNOX_PROCESS_IDLE) {
+        mqttnox_timer_start(c->wheel, t, wait);
+    }
+}
+
+/**@brief Brings the client's timer forward, a deadline may have moved up
+*
+* @note Called on the receive thread when CONNACK starts the keepalive or
+*       a lost connection schedules a reconnect. Deadlines pushed back,
+*       as by every packet sent, need nothing: the timer expires early and
+*       mqttnox_process arms it again.
+*/
+static void mqttnox_wheel_kick(mqttnox_client_t* c)
+{
+    if (c->wheel != NULL) {
+        mqttnox_timer_kick(c->wheel, &c->timer);
+    }
+}
+
+/**@brief Runs the client's timers on a timer wheel
+*
+* @note From then on the wheel calls mqttnox_process, the application does
+*       not. Call on the wheel's thread, before connecting, and detach
+*       before mqttnox_deinit. One wheel can serve any number of clients.
+*
+* @param[in]   c    mqttnox object \see mqttnox_client_t
+* @param[in]   w    wheel \see mqttnox_timer_wheel_init
+*/
+void mqttnox_wheel_attach(mqttnox_client_t* c, mqttnox_timer_wheel_t* w)
+{
+    mqttnox_timer_init(&c->timer, mqttnox_wheel_expired, c);
+    c->wheel = w;
+
+    mqttnox_timer_start(w, &c->timer, 0);
+}
+
+/**@brief Takes the client off its wheel
+*
+* @note Call on the wheel's thread once the connection is closed, no more
+*       kicks may arrive for it
+*/
+void mqttnox_wheel_detach(mqttnox_client_t* c)
+{
+    if (c->wheel == NULL) {
+        return;
+    }
+
+    mqttnox_timer_stop(c->wheel, &c->timer);
+    c->wheel = NULL;
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -44,9 +44,15 @@ extern "C" {
 #include "mqttnox_err.h"
 #include "mqttnoxlib.h"
 #include "mqttnox_version.h"
+#include "mqttnox_config.h"
+#include "mqttnox_atomic.h"
 
 #define MQTTNOX_PACKET_IDENT_BYTE_LEN (2)
 #define MQTTNOX_LENGTH_BYTE_LEN       (2)
+#define MQTTNOX_ACK_LEN               (4) /* PUBACK, PUBREC, PUBREL and PUBCOMP */
+#define MQTTNOX_PROCESS_IDLE          (0xFFFFFFFFUL) /* mqttnox_process has nothing scheduled */
+#define MQTTNOX_TIMER_IDLE            (0xFFFFFFFFUL) /* No timer armed on the wheel */
+#define MQTTNOX_TIMER_SLOTS           (1UL << MQTTNOX_TIMER_SLOT_BITS)
 
 /** MQTTNox QoS Levels */
 typedef enum
@@ -60,7 +66,7 @@ typedef enum
 typedef enum {
     MQTTNOX_EVT_CONNECT,        /* Connection */
     MQTTNOX_EVT_CONNECT_ERROR,  /* Connection Error */
-    MQTTNOX_EVT_PUBLISHED,      /* Published */
+    MQTTNOX_EVT_PUBLISHED,      /* QoS 1 or 2 message acknowledged, \see published_evt_t */
     MQTTNOX_EVT_RECEIVED,       /* Received Publish */
     MQTTNOX_EVT_SUBSCRIBED,
     MQTTNOX_EVT_UNSUBSCRIBED,
@@ -68,6 +74,9 @@ typedef enum {
     MQTTNOX_EVT_PUBREL,
     MQTTNOX_EVT_DISCONNECT,
     MQTTNOX_EVT_ERROR,
+    MQTTNOX_EVT_TX_PAUSE,       /* Outbound queue reached its high watermark, publishes fail until resumed */
+    MQTTNOX_EVT_TX_RESUME,      /* Outbound queue drained to its low watermark */
+    MQTTNOX_EVT_PUBLISH_FAILED, /* QoS 1 or 2 message dropped unacknowledged, \see published_evt_t */
 
 } mqttnox_evt_id_t;
 
@@ -92,6 +101,14 @@ typedef enum {
 
 } mqttnox_conn_err_reason_t;
 
+/** When the session store forces appended records to disk */
+typedef enum {
+    MQTTNOX_STORE_SYNC_NONE,      /* Leave it to the OS, survives a process crash only */
+    MQTTNOX_STORE_SYNC_INTERVAL,  /* Every session_sync_interval records */
+    MQTTNOX_STORE_SYNC_ALWAYS,    /* Every record before it is sent */
+
+} mqttnox_store_sync_t;
+
 typedef struct
 {
     uint8_t session_present;
@@ -104,20 +121,38 @@ typedef struct
 
 } connect_error_evt_t;
 
+/** A QoS 1 or 2 message completed, PUBACK or PUBCOMP received, or was
+    dropped without one, \see MQTTNOX_EVT_PUBLISH_FAILED */
 typedef struct
 {
     uint8_t packet_identified_msb;
     uint8_t packet_identified_lsb;
+    uint16_t packet_ident;
+    mqttnox_qos_t qos;
+    void* user_ctx;      /* \see mqttnox_publish_item_t */
 
 } published_evt_t;
 
+/** Position of a received payload chunk within its PUBLISH */
+typedef enum
+{
+    MQTTNOX_CHUNK_COMPLETE = 0, /* Whole payload in a single event */
+    MQTTNOX_CHUNK_FIRST    = 1, /* First part of a streamed payload */
+    MQTTNOX_CHUNK_MIDDLE   = 2,
+    MQTTNOX_CHUNK_LAST     = 3, /* Last part, the PUBLISH is acknowledged after it */
+
+} mqttnox_chunk_t;
+
 typedef struct
 {
     char* topic;    
     uint16_t topic_len;
     uint16_t packet_identifier;
     char* payload;
-    uint16_t payload_len;
+    uint32_t payload_len;     /* Length of this chunk */
+    uint32_t payload_offset;  /* Offset of this chunk within the whole payload */
+    uint32_t payload_total;   /* Length of the whole payload */
+    mqttnox_chunk_t chunk;
 
 } received_evt_t;
 
@@ -146,12 +181,30 @@ typedef struct
 
 } pubrel_evt_t;
 
+/** Why a connection ended, \see disconnect_evt_t */
+typedef enum {
+    MQTTNOX_DISCONNECT_PEER,        /* Closed by the broker or the network */
+    MQTTNOX_DISCONNECT_PROTOCOL,    /* Malformed data from the broker */
+    MQTTNOX_DISCONNECT_REFUSED,     /* CONNACK refused the connection */
+    MQTTNOX_DISCONNECT_TIMEOUT,     /* No CONNACK in MQTTNOX_RECONNECT_CONNACK_MS */
+    MQTTNOX_DISCONNECT_KEEPALIVE,   /* No PINGRESP in MQTTNOX_PINGRESP_MS */
+
+} mqttnox_disconnect_reason_t;
+
 typedef struct
 {
-    uint8_t test;
+    mqttnox_disconnect_reason_t reason;
+    uint32_t reconnect_ms;  /* Delay before the next attempt, 0 without automatic reconnect */
 
 } disconnect_evt_t;
 
+/** Outbound flow control, \see MQTTNOX_EVT_TX_PAUSE */
+typedef struct
+{
+    uint32_t queued;  /* Bytes of the outbound queue in use */
+
+} tx_flow_evt_t;
+
 /** MQTTNox Event Data */
 typedef struct
 {
@@ -168,6 +221,7 @@ typedef struct
         pingresp_evt_t     pingresp_evt;
         pubrel_evt_t       pubrel_evt;
         disconnect_evt_t   disconnect_evt;
+        tx_flow_evt_t      tx_flow_evt;
     }evt;
 
 } mqttnox_evt_data_t;
@@ -176,6 +230,262 @@ typedef struct
 /* Callback */
 typedef void (*mqttnox_callback_t)(mqttnox_evt_data_t * evt_data);
 
+/** Receive decoder state, kept across TCP deliveries */
+typedef struct
+{
+    uint8_t state;         /* Decoder state */
+    uint8_t hdr;           /* Fixed header byte of the current packet */
+    uint8_t remain_shift;  /* Bit position of the next remaining length byte */
+    uint32_t remain_len;   /* Remaining length of the current packet */
+    uint32_t pkt_len;      /* Total length of the current packet, valid once the header is decoded */
+    uint32_t pkt_fill;     /* Bytes of the current packet consumed so far */
+    uint32_t vh_len;       /* Streamed PUBLISH: variable header length, 0 until known */
+    uint32_t payload_off;  /* Streamed PUBLISH: payload bytes delivered so far */
+    uint8_t dup;           /* Streamed PUBLISH: QoS 2 already delivered, chunks are dropped */
+
+} mqttnox_rx_decoder_t;
+
+/** Frame held in the outbound queue, indexed by its first slot */
+typedef struct
+{
+    uint32_t len;     /* Bytes to send, MQTTNOX_TXQ_PAD for a padding frame */
+    uint16_t slots;   /* Slots reserved for the frame */
+    uint8_t off;      /* Start of the frame within its first slot */
+
+} mqttnox_txq_frame_t;
+
+/** Lock-free multi-producer outbound queue, \see mqttnox_txq.c */
+typedef struct
+{
+    mqttnox_atomic_t enq_pos;  /* Next slot to reserve, advanced by producers */
+    uint8_t pad0[60];          /* Keep producers off the writer's cache line */
+    mqttnox_atomic_t writer;   /* Non-zero while a thread is sending */
+    mqttnox_atomic_t deq_pos;  /* Next slot to send, advanced by the writer */
+    uint8_t pad1[56];
+
+    mqttnox_atomic_t seq[MQTTNOX_TX_QUEUE_SLOTS];
+    mqttnox_txq_frame_t frame[MQTTNOX_TX_QUEUE_SLOTS];
+    uint8_t buf[MQTTNOX_TX_QUEUE_SLOTS * MQTTNOX_TX_QUEUE_SLOT_SIZE];
+
+} mqttnox_txq_t;
+
+/** Outbound QoS 1 or 2 message awaiting acknowledgement */
+typedef struct
+{
+    uint16_t ident;   /* Packet identifier, 0 for a free slot */
+    uint8_t qos;
+    uint8_t state;    /* \see mqttnox_inflight.h */
+    void* user_ctx;
+
+} mqttnox_inflight_entry_t;
+
+/** Outbound in-flight table, \see mqttnox_inflight.c */
+typedef struct
+{
+    mqttnox_atomic_t lock;
+    uint16_t count;    /* Messages in flight plus reserved room */
+    uint16_t window;   /* Most messages in flight at once */
+    mqttnox_inflight_entry_t entry[MQTTNOX_INFLIGHT_SLOTS];
+
+} mqttnox_inflight_t;
+
+/* One bit per packet identifier, 0 included so bit n is identifier n */
+#define MQTTNOX_PACKET_IDENT_WORDS  (65536 / 32)
+
+/** Packet identifier allocator, \see mqttnox_ident.c */
+typedef struct
+{
+    mqttnox_atomic_t next;  /* Identifier the next search starts from */
+    mqttnox_atomic_t used[MQTTNOX_PACKET_IDENT_WORDS];
+
+} mqttnox_ident_t;
+
+/** Identifiers of SUBSCRIBE and UNSUBSCRIBE packets not yet acknowledged */
+typedef struct
+{
+    mqttnox_atomic_t lock;
+    uint16_t ident[MQTTNOX_SUB_PENDING_MAX];  /* 0 for a free entry */
+
+} mqttnox_sub_pending_t;
+
+/** Location of a message in the session store */
+typedef struct
+{
+    uint16_t ident;   /* Packet identifier, 0 for a free slot */
+    uint32_t off;     /* Offset of its record in the segment */
+
+} mqttnox_store_slot_t;
+
+/** Memory-mapped session store, \see mqttnox_store.c */
+typedef struct
+{
+    mqttnox_atomic_t lock;
+    uint8_t* base;          /* Mapped segment, NULL while no store is open */
+    int fd;
+    uint32_t size;          /* Segment size in bytes */
+    uint32_t tail;          /* End of the last record */
+    uint32_t live;          /* Records awaiting acknowledgement */
+    uint8_t sync;           /* \see mqttnox_store_sync_t */
+    uint32_t sync_interval;
+    uint32_t unsynced;      /* Records appended since the last sync */
+    uint32_t compactions;
+    uint8_t pinned;         /* Walks that hold the mapping, compaction waits */
+    char path[MQTTNOX_STORE_PATH_MAX];
+    mqttnox_store_slot_t index[MQTTNOX_INFLIGHT_SLOTS];
+
+} mqttnox_store_t;
+
+/** One tier of the offline queue, a ring of records */
+typedef struct
+{
+    uint8_t* base;          /* NULL when the tier is not in use */
+    uint32_t size;
+    uint32_t head;          /* Oldest record */
+    uint32_t tail;          /* Where the next record goes */
+    uint32_t used;          /* Bytes held, padding at the end included */
+
+} mqttnox_offline_ring_t;
+
+/** Publishes held while the client is not connected, \see mqttnox_offline.c */
+typedef struct
+{
+    mqttnox_atomic_t lock;
+    mqttnox_atomic_t draining;  /* Held by the thread sending or expiring messages */
+    mqttnox_atomic_t count;     /* Messages queued */
+    uint32_t ttl_ms;            /* \see mqttnox_client_conf_t */
+    uint32_t expired;           /* Messages dropped by their TTL */
+    mqttnox_offline_ring_t mem;
+    mqttnox_offline_ring_t spill;
+    uint64_t mem_buf[MQTTNOX_OFFLINE_MEM_SIZE / 8];
+
+} mqttnox_offline_t;
+
+/** Subscription made again after a reconnect */
+typedef struct
+{
+    uint8_t qos;
+    uint8_t len;            /* Bytes in topic, 0 for a free entry */
+    char topic[MQTTNOX_RESUB_TOPIC_MAX];
+
+} mqttnox_resub_t;
+
+/** Reconnect times, \see mqttnox_reconnect_t */
+typedef struct
+{
+    uint32_t disconnects;   /* Connections lost */
+    uint32_t attempts;      /* Connections tried since */
+    uint32_t reconnects;    /* Connections restored */
+    uint32_t last_ms;       /* Loss to accepted CONNACK, for the last reconnect */
+    uint32_t max_ms;
+    uint64_t total_ms;      /* Sum over all reconnects, total_ms / reconnects is the mean */
+
+} mqttnox_reconnect_stats_t;
+
+/** Automatic reconnect, \see mqttnox_reconnect.c */
+typedef struct
+{
+    mqttnox_atomic_t lock;
+    uint8_t enabled;
+    uint8_t linked;         /* TCP connection up, its loss not yet handled */
+    uint8_t state;          /* \see mqttnox_reconnect.h */
+    uint8_t clean_session;
+    uint16_t attempt;       /* Failed attempts since the connection was lost */
+    uint32_t min_ms;
+    uint32_t max_ms;
+    uint32_t due_ms;        /* Next attempt, or end of the wait for CONNACK */
+    uint32_t lost_ms;       /* When the connection was lost */
+    uint32_t rand;          /* Jitter generator state */
+    char* addr;             /* \see mqttnox_client_conf_t */
+    uint16_t port;
+    uint16_t connect_len;
+    uint8_t connect_pkt[MQTTNOX_TX_BUF_SIZE];  /* CONNECT, encoded once */
+    mqttnox_resub_t subs[MQTTNOX_RESUB_MAX];
+    mqttnox_reconnect_stats_t stats;
+
+} mqttnox_reconnect_t;
+
+/** Keepalive, \see mqttnox_keepalive.c */
+typedef struct
+{
+    mqttnox_atomic_t active;      /* Connected with a non-zero keepalive */
+    mqttnox_atomic_t last_tx_ms;  /* When a packet last went out */
+    mqttnox_atomic_t pending;     /* PINGREQ sent, PINGRESP not yet received */
+    uint32_t interval_ms;
+    uint32_t resp_ms;             /* Wait for PINGRESP */
+    uint32_t sent_ms;             /* When the last PINGREQ went out */
+    uint32_t rtt_ms;              /* PINGREQ to PINGRESP, for the last ping answered */
+    uint32_t pings;               /* PINGREQs sent */
+    uint32_t timeouts;            /* Connections ended for want of a PINGRESP */
+
+} mqttnox_keepalive_t;
+
+typedef struct mqttnox_timer_s mqttnox_timer_t;
+
+/** Called on the wheel's thread when a timer expires, it may arm timers again */
+typedef void (*mqttnox_timer_cb_t)(mqttnox_timer_t* t, void* arg);
+
+/** Timer on a mqttnox_timer_wheel_t, \see mqttnox_timer.c */
+struct mqttnox_timer_s
+{
+    mqttnox_timer_t* next;
+    mqttnox_timer_t** pprev;    /* Link pointing at this timer, NULL while not armed */
+    uint64_t expires;           /* Wheel tick it expires on */
+    mqttnox_timer_cb_t cb;
+    void* arg;
+    mqttnox_timer_t* kick_next; /* \see mqttnox_timer_kick */
+    mqttnox_atomic_t kicked;
+};
+
+/** Hashed hierarchical timer wheel, \see mqttnox_timer.c */
+typedef struct
+{
+    uint64_t now;               /* Last tick expired, one tick per ms */
+    uint32_t clock;             /* mqttnox_hal_time_ms at that tick */
+    uint32_t count;             /* Timers armed */
+    uint64_t occupied[MQTTNOX_TIMER_LEVELS];  /* One bit per slot holding timers */
+    mqttnox_timer_t* slot[MQTTNOX_TIMER_LEVELS][MQTTNOX_TIMER_SLOTS];
+    mqttnox_atomic_t kick_lock;
+    mqttnox_timer_t* kicks;     /* Timers to expire on the next run */
+    void (*wake)(void* ctx);    /* Wakes the wheel's thread for a kick, may be NULL */
+    void* wake_ctx;
+
+} mqttnox_timer_wheel_t;
+
+typedef struct mqttnox_route_s mqttnox_route_t;
+
+/** One level of the filters in a router */
+typedef struct
+{
+    uint32_t parent;            /* Node index, the root is 0 */
+    uint32_t chain;             /* Next node in the hash bucket or free list, 0 ends it */
+    uint32_t plus;              /* '+' child, 0 if none */
+    uint32_t refs;              /* Children and routes, freed when it drops to 0 */
+    uint32_t hash;
+    mqttnox_route_t* exact;     /* Routes whose filter ends on this level */
+    mqttnox_route_t* multi;     /* Routes whose filter ends on this level with '#' */
+    uint8_t len;
+    char level[MQTTNOX_ROUTE_LEVEL_MAX];
+
+} mqttnox_route_node_t;
+
+/** Topic-filter trie, \see mqttnox_router.c */
+typedef struct
+{
+    mqttnox_atomic_t lock;
+    mqttnox_route_node_t* node; /* node[0] is the root */
+    uint32_t node_cnt;
+    uint32_t node_used;
+    uint32_t free_node;         /* First freed node, 0 if none */
+    uint32_t* bucket;           /* Levels hashed on their parent and name */
+    uint32_t bucket_mask;
+    uint32_t overflows;         /* Handlers skipped past MQTTNOX_ROUTE_MATCH_MAX */
+
+} mqttnox_router_t;
+
+/** Bytes of memory a router of the given number of nodes needs, at most
+    one node per level of every filter added */
+#define MQTTNOX_ROUTER_MEM_SIZE(nodes) ((nodes) * (sizeof(mqttnox_route_node_t) + 2 * sizeof(uint32_t)))
+
 typedef struct
 {
     uint32_t flag_initialized; /** Inidiates the client object is successfully initialized */
@@ -185,14 +495,41 @@ typedef struct
     } status;
 
     mqttnox_callback_t callback;
-    uint16_t packet_ident;
     uint16_t keepalive;
 
     mqttnox_debug_lvl_t debug_lvl;
 
-    uint8_t* rcv_buf;
-    uint16_t rcv_offset;
-    uint16_t rcv_buf_size;
+    uint8_t* rcv_buf;      /* Start of the receive window, moves around rcv_ring when mapped */
+    uint32_t rcv_offset;   /* Bytes of a partial packet held in rcv_buf */
+    uint32_t rcv_buf_size;
+    uint8_t* rcv_ring;     /* Mirrored receive ring, NULL when receiving into rx_buf */
+    mqttnox_rx_decoder_t rx;
+    mqttnox_atomic_t rx_gate;  /* \see mqttnox_rx_gate_t, keeps the timer thread off the decoder */
+    uint32_t stream_threshold; /* \see mqttnox_client_conf_t */
+    uint8_t ack_defer;     /* Set while mqttnox_tcp_rcv_func runs, acks are collected in ack_buf */
+    uint16_t ack_len;
+    uint8_t ack_buf[MQTTNOX_ACK_COALESCE_MAX * MQTTNOX_ACK_LEN];
+    uint32_t qos2_rcvd[MQTTNOX_PACKET_IDENT_WORDS];  /* QoS 2 PUBLISH delivered, awaiting PUBREL */
+
+    void* tal_ctx; /* Per-connection state owned by the TAL */
+
+    uint32_t tx_high_watermark;  /* \see mqttnox_client_conf_t */
+    uint32_t tx_low_watermark;
+    mqttnox_atomic_t tx_paused;  /* Set from MQTTNOX_EVT_TX_PAUSE until MQTTNOX_EVT_TX_RESUME */
+
+    /* Per-client buffers so independent clients never share state */
+    mqttnox_ident_t packet_ident;  /* Identifiers held by unacknowledged packets */
+    mqttnox_inflight_t inflight;
+    mqttnox_sub_pending_t sub_pending;  /* Only these identifiers are released by SUBACK / UNSUBACK */
+    mqttnox_store_t store;
+    mqttnox_offline_t offline;
+    mqttnox_reconnect_t reconnect;
+    mqttnox_keepalive_t ping;
+    mqttnox_timer_wheel_t* wheel;  /* Runs mqttnox_process when set, \see mqttnox_wheel_attach */
+    mqttnox_timer_t timer;
+    mqttnox_router_t* router;      /* \see mqttnox_client_conf_t */
+    mqttnox_txq_t txq;
+    uint8_t rx_buf[MQTTNOX_RX_BUF_SIZE];
 
 } mqttnox_client_t;
 
@@ -221,6 +558,63 @@ typedef struct
 
     char* client_identifier; /* Unique Client Identifier - Usually up to 23 characters */
 
+    /** PUBLISH packets with a remaining length above this, or too large for the
+        receive buffer, are delivered as a series of MQTTNOX_EVT_RECEIVED chunks
+        (\see mqttnox_chunk_t) without being buffered. 0 disables streaming and
+        packets that do not fit the receive buffer are dropped */
+    uint32_t stream_threshold;
+
+    /** Outbound queue use, in bytes, at which publishes start failing with
+        MQTTNOX_RC_ERROR_WOULD_BLOCK and MQTTNOX_EVT_TX_PAUSE is sent, and at
+        which MQTTNOX_EVT_TX_RESUME is sent once it drains. 0 selects
+        MQTTNOX_TX_HIGH_WATERMARK and MQTTNOX_TX_LOW_WATERMARK */
+    uint32_t tx_high_watermark;
+    uint32_t tx_low_watermark;
+
+    /** Most QoS 1 and 2 messages awaiting PUBACK or PUBCOMP at once. Publishes
+        beyond it fail with MQTTNOX_RC_ERROR_INFLIGHT_FULL until a message
+        completes. 0 selects MQTTNOX_MAX_INFLIGHT */
+    uint16_t max_inflight;
+
+    /** Session store: a file recording every unacknowledged QoS 1 and 2
+        message, so they survive a restart. Connecting with clean_session 0
+        resends them with DUP set, clean_session 1 discards them. NULL runs
+        without a store. session_size 0 selects MQTTNOX_STORE_SIZE and
+        session_sync_interval 0 selects MQTTNOX_STORE_SYNC_EVERY */
+    const char* session_path;
+    uint32_t session_size;
+    mqttnox_store_sync_t session_sync;
+    uint32_t session_sync_interval;
+
+    /** Offline queue: while the client is not connected, publishes are
+        queued instead of sent and go out in order once CONNACK arrives.
+        The first offline_mem_size bytes (at most MQTTNOX_OFFLINE_MEM_SIZE)
+        are held in memory, the rest in offline_spill_path, a file of
+        offline_spill_size bytes removed as soon as it is mapped.
+        offline_ttl_ms drops messages queued for longer, 0 keeps them.
+        offline_mem_size 0 disables the queue. Set up by the first connect
+        that enables it */
+    uint32_t offline_mem_size;
+    const char* offline_spill_path;
+    uint32_t offline_spill_size;
+    uint32_t offline_ttl_ms;
+
+    /** Automatic reconnect: once a connection made by mqttnox_connect is
+        lost, mqttnox_process reconnects with the same CONNECT after a
+        random delay between 0 and reconnect_min_ms, doubled per failed
+        attempt up to reconnect_max_ms (0 selects MQTTNOX_RECONNECT_MIN_MS
+        and MQTTNOX_RECONNECT_MAX_MS). Subscriptions are made again unless
+        the broker kept the session, and the session store is resent.
+        server.addr must stay valid while it is enabled */
+    uint8_t reconnect;
+    uint32_t reconnect_min_ms;
+    uint32_t reconnect_max_ms;
+
+    /** Topic router: a received message whose topic matches routes added to
+        it goes to their handlers instead of callback, which gets the rest.
+        One router can serve several clients, NULL for none */
+    mqttnox_router_t* router;
+
     /** Callback used for async event handling. Note that this callback is called in the context
         of the mqttnox thread, so care must be taken to avoid a stack overflow by either increasing
         the mqttnox thread's stack, or by minimizing stack usage and passing event data to a task
@@ -238,9 +632,46 @@ typedef struct
 
 } mqttnox_topic_sub_t;
 
+/** Called on the receive thread for a message matching the route, once
+    per chunk of a message delivered in chunks */
+typedef void (*mqttnox_route_cb_t)(mqttnox_client_t* c, const received_evt_t* msg, void* arg);
+
+/** Handler for a topic filter, \see mqttnox_router_add */
+struct mqttnox_route_s
+{
+    mqttnox_route_t* next;
+    mqttnox_route_t** pprev;    /* NULL while not added */
+    uint32_t node;
+    mqttnox_route_cb_t handler;
+    void* arg;
+};
+
+/** Publish topic validated and encoded once, \see mqttnox_topic_handle_init */
+typedef struct
+{
+    uint16_t len;   /* Bytes in encoded, length prefix included */
+    uint8_t encoded[MQTTNOX_LENGTH_BYTE_LEN + MQTTNOX_TOPIC_HANDLE_MAX_LEN];
+
+} mqttnox_topic_handle_t;
+
+/** One message of a publish batch, \see mqttnox_publish_batch */
+typedef struct
+{
+    const char* topic;
+    const void* payload;
+    uint32_t payload_len;
+    mqttnox_qos_t qos;
+    uint8_t retain;
+    uint16_t packet_ident;  /* Set by the library for QoS 1 and 2 */
+    void* user_ctx;         /* Returned with the MQTTNOX_EVT_PUBLISHED of a QoS 1 or 2 item */
+    uint32_t ttl_ms;        /* Dropped after this long in the offline queue, 0 for offline_ttl_ms */
+
+} mqttnox_publish_item_t;
+
 
 
 extern mqttnox_rc_t mqttnox_init(mqttnox_client_t * c, mqttnox_debug_lvl_t lvl);
+extern mqttnox_rc_t mqttnox_deinit(mqttnox_client_t * c);
 extern mqttnox_rc_t mqttnox_connect(mqttnox_client_t* c, mqttnox_client_conf_t* conf, uint16_t keepalive);
 extern mqttnox_rc_t mqttnox_publish(mqttnox_client_t* c,
                                     mqttnox_qos_t qos,
@@ -248,6 +679,24 @@ extern mqttnox_rc_t mqttnox_publish(mqttnox_client_t* c,
                                     uint8_t dup,
                                     char* topic,
                                     char* msg);
+extern mqttnox_rc_t mqttnox_publish_bin(mqttnox_client_t* c,
+                                        mqttnox_qos_t qos,
+                                        uint8_t retain,
+                                        uint8_t dup,
+                                        const char* topic,
+                                        const void* payload,
+                                        uint32_t payload_len);
+extern mqttnox_rc_t mqttnox_publish_batch(mqttnox_client_t* c,
+                                          mqttnox_publish_item_t* items,
+                                          uint16_t item_cnt);
+extern mqttnox_rc_t mqttnox_topic_handle_init(mqttnox_topic_handle_t* h, const char* topic);
+extern mqttnox_rc_t mqttnox_publish_handle(mqttnox_client_t* c,
+                                           mqttnox_qos_t qos,
+                                           uint8_t retain,
+                                           uint8_t dup,
+                                           const mqttnox_topic_handle_t* h,
+                                           const void* payload,
+                                           uint32_t payload_len);
 extern mqttnox_rc_t mqttnox_subscribe(mqttnox_client_t* c,
                                 mqttnox_topic_sub_t* topics,
                                 uint8_t topic_cnt);
@@ -257,6 +706,9 @@ extern mqttnox_rc_t mqttnox_unsubscribe(mqttnox_client_t* c,
 
 extern mqttnox_rc_t mqttnox_disconnect(mqttnox_client_t * c);
 extern uint8_t mqttnox_is_connected(mqttnox_client_t* c);
+extern uint32_t mqttnox_process(mqttnox_client_t* c);
+extern void mqttnox_wheel_attach(mqttnox_client_t* c, mqttnox_timer_wheel_t* w);
+extern void mqttnox_wheel_detach(mqttnox_client_t* c);
 
 #ifdef __cplusplus
 }
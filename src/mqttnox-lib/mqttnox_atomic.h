@@ -0,0 +1,177 @@
+/*****************************************************************************
+* Copyright (c) [2024] Argenox Technologies LLC
+* All rights reserved.
+*
+*
+*
+* NOTICE:  All information contained herein, source code, binaries and
+* derived works is, and remains the property of Argenox and its suppliers,
+* if any.  The intellectual and technical concepts contained
+* herein are proprietary to Argenox and its suppliers and may be covered
+* by U.S. and Foreign Patents, patents in process, and are protected by
+* trade secret or copyright law.
+*
+* Licensing of this software can be found in LICENSE
+*
+* THIS SOFTWARE IS PROVIDED BY ARGENOX "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ARGENOX LLC BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* CONTACT: info@argenox.com
+*
+* File:    mqttnox_atomic.h
+* Summary: MQTTNox Atomic Operations
+*
+* Note: Only what the outbound queue needs: 32-bit load-acquire,
+*       store-release, compare-and-swap, fetch-add and a full fence, plus
+*       a spin hint. With MQTTNOX_THREAD_SAFE set to 0, or on compilers
+*       without atomics, these are plain volatile accesses, which is only
+*       correct when a single thread uses the client.
+*
+*/
+
+#ifndef _MQTTNOX_ATOMIC_H_
+#define _MQTTNOX_ATOMIC_H_
+
+#include <stdint.h>
+#include "mqttnox_config.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if MQTTNOX_THREAD_SAFE && defined(_MSC_VER)
+
+#include <intrin.h>
+
+typedef volatile long mqttnox_atomic_t;
+
+/* Interlocked operations are full barriers on every MSVC target */
+static __inline uint32_t mqttnox_atomic_load(mqttnox_atomic_t* a)
+{
+    return (uint32_t)_InterlockedCompareExchange(a, 0, 0);
+}
+
+static __inline void mqttnox_atomic_store(mqttnox_atomic_t* a, uint32_t val)
+{
+    _InterlockedExchange(a, (long)val);
+}
+
+static __inline int mqttnox_atomic_cas(mqttnox_atomic_t* a, uint32_t expected, uint32_t desired)
+{
+    return (uint32_t)_InterlockedCompareExchange(a, (long)desired, (long)expected) == expected;
+}
+
+static __inline uint32_t mqttnox_atomic_fetch_add(mqttnox_atomic_t* a, uint32_t val)
+{
+    return (uint32_t)_InterlockedExchangeAdd(a, (long)val);
+}
+
+static __inline void mqttnox_atomic_fence(void)
+{
+    long barrier = 0;
+
+    _InterlockedExchange(&barrier, 1);
+}
+
+static __inline void mqttnox_atomic_relax(void)
+{
+#if defined(_M_IX86) || defined(_M_X64)
+    _mm_pause();
+#elif defined(_M_ARM) || defined(_M_ARM64)
+    __yield();
+#endif
+}
+
+#elif MQTTNOX_THREAD_SAFE && defined(__GNUC__)
+
+typedef volatile uint32_t mqttnox_atomic_t;
+
+static inline uint32_t mqttnox_atomic_load(mqttnox_atomic_t* a)
+{
+    return __atomic_load_n(a, __ATOMIC_ACQUIRE);
+}
+
+static inline void mqttnox_atomic_store(mqttnox_atomic_t* a, uint32_t val)
+{
+    __atomic_store_n(a, val, __ATOMIC_RELEASE);
+}
+
+static inline int mqttnox_atomic_cas(mqttnox_atomic_t* a, uint32_t expected, uint32_t desired)
+{
+    return __atomic_compare_exchange_n(a, &expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static inline uint32_t mqttnox_atomic_fetch_add(mqttnox_atomic_t* a, uint32_t val)
+{
+    return __atomic_fetch_add(a, val, __ATOMIC_SEQ_CST);
+}
+
+static inline void mqttnox_atomic_fence(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline void mqttnox_atomic_relax(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+#else
+
+/* Single threaded use only */
+typedef volatile uint32_t mqttnox_atomic_t;
+
+static inline uint32_t mqttnox_atomic_load(mqttnox_atomic_t* a)
+{
+    return *a;
+}
+
+static inline void mqttnox_atomic_store(mqttnox_atomic_t* a, uint32_t val)
+{
+    *a = val;
+}
+
+static inline int mqttnox_atomic_cas(mqttnox_atomic_t* a, uint32_t expected, uint32_t desired)
+{
+    if (*a != expected) {
+        return 0;
+    }
+    *a = desired;
+    return 1;
+}
+
+static inline uint32_t mqttnox_atomic_fetch_add(mqttnox_atomic_t* a, uint32_t val)
+{
+    uint32_t old = *a;
+
+    *a = old + val;
+    return old;
+}
+
+static inline void mqttnox_atomic_fence(void)
+{
+}
+
+static inline void mqttnox_atomic_relax(void)
+{
+}
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _MQTTNOX_ATOMIC_H_ */
@@ -41,9 +41,129 @@
 extern "C" {
 #endif
 
-/* Size of the buffer used for sending data - impacts MQTTNOX RAM allocation */
+/* Every client holds its buffers in mqttnox_client_t, the library never
+   allocates. With the defaults below sizeof(mqttnox_client_t) is about
+   55 KB: 16 KB offline queue, 10 KB outbound queue, 8 KB of packet
+   identifiers in use, 8 KB of QoS 2 identifiers received (one bit for each
+   of the 65536), 4 KB in flight table and 4 KB receive buffer. The receive
+   ring adds RX_RING_SIZE bytes per client, mapped twice so it takes twice
+   that in address space. Sizes wrapped in #ifndef below can be set on the
+   compiler command line to fit many clients in one process, e.g.
+   -DMQTTNOX_RX_RING_ENABLE=0 -DMQTTNOX_OFFLINE_MEM_SIZE=2048 */
+
+/* Largest CONNECT, SUBSCRIBE or UNSUBSCRIBE packet. These are encoded
+   straight into the outbound queue and must fit in half of it */
 #define MQTTNOX_TX_BUF_SIZE         256
 
+/* Size of the buffer used for receiving data - impacts MQTTNOX RAM allocation.
+   Unused while the receive ring is mapped */
+#ifndef MQTTNOX_RX_BUF_SIZE
+#define MQTTNOX_RX_BUF_SIZE         4096
+#endif
+
+/* Outbound queue. Every thread encodes its packets into the queue without
+   locking and whichever thread finds no one sending becomes the writer and
+   sends for everyone. Packets larger than half the queue are sent directly
+   by the writer instead. Slots must be a power of two.
+   Impacts MQTTNOX RAM allocation: SLOTS * (SLOT_SIZE + 12) bytes */
+#ifndef MQTTNOX_TX_QUEUE_SLOTS
+#define MQTTNOX_TX_QUEUE_SLOTS      128
+#endif
+#ifndef MQTTNOX_TX_QUEUE_SLOT_SIZE
+#define MQTTNOX_TX_QUEUE_SLOT_SIZE  64
+#endif
+
+/* Default outbound queue watermarks in bytes, \see mqttnox_client_conf_t.
+   Publishes fail fast once HIGH bytes are queued instead of waiting for
+   space, and resume when the queue drains to LOW */
+#define MQTTNOX_TX_HIGH_WATERMARK   (MQTTNOX_TX_QUEUE_SLOTS * MQTTNOX_TX_QUEUE_SLOT_SIZE * 3 / 4)
+#define MQTTNOX_TX_LOW_WATERMARK    (MQTTNOX_TX_QUEUE_SLOTS * MQTTNOX_TX_QUEUE_SLOT_SIZE / 4)
+
+/* Allow several threads to publish on one client. Set to 0 when a single
+   thread uses each client to drop the atomic operations from every send */
+#ifndef MQTTNOX_THREAD_SAFE
+#define MQTTNOX_THREAD_SAFE         1
+#endif
+
+/* QoS 1 and 2 messages awaiting acknowledgement. MAX_INFLIGHT is the
+   default window, \see mqttnox_client_conf_t; the table holds SLOTS
+   entries (power of two) and the window is limited to half of it.
+   Impacts MQTTNOX RAM allocation: SLOTS * 16 bytes */
+#define MQTTNOX_MAX_INFLIGHT        32
+#define MQTTNOX_INFLIGHT_SLOTS      256
+
+/* SUBSCRIBE and UNSUBSCRIBE packets awaiting SUBACK or UNSUBACK; more
+   fail until one is acknowledged. Covers a resubscribe of RESUB_MAX
+   filters - impacts MQTTNOX RAM allocation, 2 bytes each */
+#ifndef MQTTNOX_SUB_PENDING_MAX
+#define MQTTNOX_SUB_PENDING_MAX     32
+#endif
+
+/* Acks generated while handling one receive call are sent together, in
+   one send per this many acks - impacts MQTTNOX RAM allocation, 4 bytes each */
+#define MQTTNOX_ACK_COALESCE_MAX    64
+
+/* Longest topic a mqttnox_topic_handle_t can hold - every handle reserves
+   this much */
+#define MQTTNOX_TOPIC_HANDLE_MAX_LEN 126
+
+/* Receive into a ring mapped twice back to back, so packets that wrap the
+   end are still contiguous and partial packets are never moved. Linux only,
+   other platforms (or a failed mapping) fall back to the linear buffer above */
+#ifndef MQTTNOX_RX_RING_ENABLE
+#define MQTTNOX_RX_RING_ENABLE      1
+#endif
+
+/* Size of the receive ring - power of two and a multiple of the page size.
+   Each client maps twice this much address space */
+#ifndef MQTTNOX_RX_RING_SIZE
+#define MQTTNOX_RX_RING_SIZE        32768
+#endif
+
+/* Session store, \see mqttnox_client_conf_t. A memory-mapped file of
+   unacknowledged messages, compacted once full. Linux only, elsewhere
+   enabling a store fails with MQTTNOX_RC_ERROR_STORE. SIZE is the default
+   file size and SYNC_EVERY the default records between syncs */
+#define MQTTNOX_STORE_SIZE          (4UL * 1024 * 1024)
+#define MQTTNOX_STORE_SYNC_EVERY    64
+#define MQTTNOX_STORE_PATH_MAX      128
+
+/* Offline queue, \see mqttnox_client_conf_t. MEM_SIZE is the most memory
+   a client can hold queued messages in - impacts MQTTNOX RAM allocation.
+   Queued messages are sent DRAIN_BATCH at a time, \see mqttnox_publish_batch */
+#ifndef MQTTNOX_OFFLINE_MEM_SIZE
+#define MQTTNOX_OFFLINE_MEM_SIZE    16384
+#endif
+#define MQTTNOX_OFFLINE_DRAIN_BATCH 32
+
+/* Automatic reconnect, \see mqttnox_client_conf_t. Each attempt waits a
+   random time of up to MIN_MS, doubled per failed attempt and capped at
+   MAX_MS, and gives up on a CONNACK after CONNACK_MS. Up to RESUB_MAX
+   filters of RESUB_TOPIC_MAX bytes are subscribed to again after a
+   reconnect - impacts MQTTNOX RAM allocation */
+#define MQTTNOX_RECONNECT_MIN_MS     1000
+#define MQTTNOX_RECONNECT_MAX_MS     120000
+#define MQTTNOX_RECONNECT_CONNACK_MS 10000
+#define MQTTNOX_RESUB_MAX            16
+#define MQTTNOX_RESUB_TOPIC_MAX      126
+
+/* Keepalive, \see mqttnox_connect. A PINGREQ with no PINGRESP within
+   PINGRESP_MS, or the keepalive interval if shorter, ends the connection */
+#define MQTTNOX_PINGRESP_MS          10000
+
+/* Timer wheel, \see mqttnox_timer.c. Each level has 2^SLOT_BITS slots,
+   each 2^SLOT_BITS times as long as the slots of the level below, starting
+   from 1 ms. 5 levels cover delays of up to 2^30 ms, over 12 days. Slots
+   are tracked in 64-bit words, so SLOT_BITS must stay at most 6 */
+#define MQTTNOX_TIMER_SLOT_BITS      6
+#define MQTTNOX_TIMER_LEVELS         5
+
+/* Topic router, \see mqttnox_router.c. Each trie node holds one filter
+   level of up to ROUTE_LEVEL_MAX bytes - impacts router memory. A message
+   goes to at most ROUTE_MATCH_MAX handlers */
+#define MQTTNOX_ROUTE_LEVEL_MAX      40
+#define MQTTNOX_ROUTE_MATCH_MAX      16
+
 
 #ifdef __cplusplus
 }
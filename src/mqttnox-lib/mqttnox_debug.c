@@ -81,7 +81,7 @@ static const mqttnox_item_desc_t mqtt_packet_type[] =
 */
 char * get_mqtt_packet_type_str(int32_t code)
 {
-    int i = 0;
+    uint32_t i = 0;
     for(i = 0; i < ARRAY_LEN(mqtt_packet_type); i++)
     {
         if(mqtt_packet_type[i].code == code){
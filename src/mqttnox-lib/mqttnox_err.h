@@ -48,6 +48,13 @@ typedef enum
     MQTTNOX_RC_ERROR_INTERNAL         = ERROR_BASE + 2,
     MQTTNOX_RC_ERROR_NOT_INIT         = ERROR_BASE + 3, /* Library object not initialized */
     MQTTNOX_RC_ERROR_BAD_CLIENT_IDENT = ERROR_BASE + 4, /* Device ID not specified specified or length / characters of ID wrong */
+    MQTTNOX_RC_ERROR_BAD_TOPIC        = ERROR_BASE + 5, /* Topic empty, too long or contains wildcards */
+    MQTTNOX_RC_ERROR_WOULD_BLOCK      = ERROR_BASE + 6, /* Outbound queue above its high watermark, retry after MQTTNOX_EVT_TX_RESUME */
+    MQTTNOX_RC_ERROR_INFLIGHT_FULL    = ERROR_BASE + 7, /* max_inflight QoS 1/2 messages unacknowledged, retry after MQTTNOX_EVT_PUBLISHED */
+    MQTTNOX_RC_ERROR_STORE            = ERROR_BASE + 8, /* Session store or offline spill file could not be opened, or the store has no room for the message */
+    MQTTNOX_RC_ERROR_QUEUE_FULL       = ERROR_BASE + 9, /* Offline queue has no room for the message */
+    MQTTNOX_RC_ERROR_SUB_FULL         = ERROR_BASE + 10, /* SUBSCRIBE sent, but a filter will not be restored after a reconnect: MQTTNOX_RESUB_MAX reached or longer than MQTTNOX_RESUB_TOPIC_MAX */
+    MQTTNOX_RC_ERROR_ROUTER_FULL      = ERROR_BASE + 11, /* Router memory has no node left for the filter */
 
 } mqttnox_rc_t;
 
@@ -0,0 +1,173 @@
+/*****************************************************************************
+* Copyright (c) [2024] Argenox Technologies LLC
+* All rights reserved.
+*
+*
+*
+* NOTICE:  All information contained herein, source code, binaries and
+* derived works is, and remains the property of Argenox and its suppliers,
+* if any.  The intellectual and technical concepts contained
+* herein are proprietary to Argenox and its suppliers and may be covered
+* by U.S. and Foreign Patents, patents in process, and are protected by
+* trade secret or copyright law.
+*
+* Licensing of this software can be found in LICENSE
+*
+* THIS SOFTWARE IS PROVIDED BY ARGENOX "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ARGENOX LLC BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* CONTACT: info@argenox.com
+*
+* File:    mqttnox_ident.c
+* Summary: MQTTNox Packet Identifier Allocator
+*
+* Note: A bitmap with one bit per identifier, set while the identifier is
+*       held. Allocation resumes after the last identifier handed out and
+*       takes the first clear bit of a word with a count-trailing-zeros,
+*       so identifiers are reused as late as possible and a search only
+*       touches more than one word when whole words are held. Bits are set
+*       and cleared with a CAS on their word, so any thread may allocate
+*       or release.
+*
+*       Bit 0 is set for good, 0 is not a valid identifier [MQTT-2.3.1-1].
+*
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* System Includes */
+#include <stdint.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+/* Library Includes */
+#include "mqttnox_ident.h"
+
+#define IDENT_MASK  (MQTTNOX_PACKET_IDENT_WORDS - 1)
+
+/**@brief Returns the index of the lowest set bit, bits must not be 0
+*/
+static uint32_t ident_ctz(uint32_t bits)
+{
+#if defined(__GNUC__)
+    return (uint32_t)__builtin_ctz(bits);
+#elif defined(_MSC_VER)
+    unsigned long idx;
+
+    _BitScanForward(&idx, bits);
+    return (uint32_t)idx;
+#else
+    uint32_t idx = 0;
+
+    while ((bits & 1) == 0) {
+        bits >>= 1;
+        idx++;
+    }
+    return idx;
+#endif
+}
+
+/**@brief Marks every identifier free
+*
+* @note Not thread safe, call only while no other thread uses the client
+*/
+void mqttnox_ident_init(mqttnox_ident_t* a)
+{
+    uint32_t i;
+
+    for (i = 0; i < MQTTNOX_PACKET_IDENT_WORDS; i++) {
+        mqttnox_atomic_store(&a->used[i], 0);
+    }
+
+    mqttnox_atomic_store(&a->used[0], 1);
+    mqttnox_atomic_store(&a->next, 1);
+}
+
+/**@brief Takes a free identifier
+*
+* @return      identifier in 1..65535, 0 if every identifier is held
+*/
+uint16_t mqttnox_ident_alloc(mqttnox_ident_t* a)
+{
+    uint32_t start = mqttnox_atomic_load(&a->next) & 0xFFFF;
+    uint32_t word = start >> 5;
+    uint32_t mask = 0xFFFFFFFFUL << (start & 31);
+    uint32_t bits;
+    uint32_t free_bits;
+    uint32_t ident;
+    uint32_t n;
+
+    /* One extra word covers the bits below start in its own word */
+    for (n = 0; n <= MQTTNOX_PACKET_IDENT_WORDS; n++)
+    {
+        bits = mqttnox_atomic_load(&a->used[word]);
+        free_bits = ~bits & mask;
+
+        while (free_bits != 0)
+        {
+            ident = (word << 5) | ident_ctz(free_bits);
+
+            if (mqttnox_atomic_cas(&a->used[word], bits, bits | (1UL << (ident & 31)))) {
+                /* Only a search hint, a racing store does no harm */
+                mqttnox_atomic_store(&a->next, ident + 1);
+                return (uint16_t)ident;
+            }
+
+            bits = mqttnox_atomic_load(&a->used[word]);
+            free_bits = ~bits & mask;
+        }
+
+        mask = 0xFFFFFFFFUL;
+        word = (word + 1) & IDENT_MASK;
+    }
+
+    return 0;
+}
+
+/**@brief Holds a given identifier, used to restore a stored session
+*/
+void mqttnox_ident_take(mqttnox_ident_t* a, uint16_t ident)
+{
+    uint32_t word = ident >> 5;
+    uint32_t bit = 1UL << (ident & 31);
+    uint32_t bits;
+
+    do
+    {
+        bits = mqttnox_atomic_load(&a->used[word]);
+    } while (!mqttnox_atomic_cas(&a->used[word], bits, bits | bit));
+}
+
+/**@brief Gives an identifier back once its packet is acknowledged
+*/
+void mqttnox_ident_release(mqttnox_ident_t* a, uint16_t ident)
+{
+    uint32_t word = ident >> 5;
+    uint32_t bit = 1UL << (ident & 31);
+    uint32_t bits;
+
+    if (ident == 0) {
+        return;
+    }
+
+    do
+    {
+        bits = mqttnox_atomic_load(&a->used[word]);
+    } while (!mqttnox_atomic_cas(&a->used[word], bits, bits & ~bit));
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,332 @@
+/*****************************************************************************
+* Copyright (c) [2024] Argenox Technologies LLC
+* All rights reserved.
+*
+*
+*
+* NOTICE:  All information contained herein, source code, binaries and
+* derived works is, and remains the property of Argenox and its suppliers,
+* if any.  The intellectual and technical concepts contained
+* herein are proprietary to Argenox and its suppliers and may be covered
+* by U.S. and Foreign Patents, patents in process, and are protected by
+* trade secret or copyright law.
+*
+* Licensing of this software can be found in LICENSE
+*
+* THIS SOFTWARE IS PROVIDED BY ARGENOX "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ARGENOX LLC BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* CONTACT: info@argenox.com
+*
+* File:    mqttnox_inflight.c
+* Summary: MQTTNox Outbound In-Flight Table
+*
+* Note: Open-addressed map from packet identifier to message state. The
+*       home slot is the identifier masked to the table size, which spreads
+*       consecutive identifiers perfectly; collisions probe linearly and
+*       removal shifts the following entries back, so lookups never cross
+*       tombstones. The window is enforced by reserving room before an
+*       identifier is assigned, so a publish never blocks on the table.
+*
+*       Publishers and the receive thread share the table under a spin
+*       lock held for a handful of instructions.
+*
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* System Includes */
+#include <stdint.h>
+#include <string.h>
+
+/* Library Includes */
+#include "mqttnox_inflight.h"
+
+#define INFLIGHT_MASK  (MQTTNOX_INFLIGHT_SLOTS - 1)
+
+static void inflight_lock(mqttnox_inflight_t* t)
+{
+    while (!mqttnox_atomic_cas(&t->lock, 0, 1)) {
+        mqttnox_atomic_relax();
+    }
+}
+
+static void inflight_unlock(mqttnox_inflight_t* t)
+{
+    mqttnox_atomic_store(&t->lock, 0);
+}
+
+/**@brief Finds the slot holding ident
+*
+* @return      slot index, or -1 if ident is not in flight
+*/
+static int32_t inflight_find(mqttnox_inflight_t* t, uint16_t ident)
+{
+    uint32_t idx = ident & INFLIGHT_MASK;
+
+    while (t->entry[idx].ident != 0)
+    {
+        if (t->entry[idx].ident == ident) {
+            return (int32_t)idx;
+        }
+        idx = (idx + 1) & INFLIGHT_MASK;
+    }
+
+    return -1;
+}
+
+/**@brief Empties the table
+*
+* @note Not thread safe, call only while no other thread uses the client
+*
+* @param[in]   t       table
+* @param[in]   window  most messages in flight, clamped to
+*                      MQTTNOX_INFLIGHT_WINDOW_MAX
+*/
+void mqttnox_inflight_init(mqttnox_inflight_t* t, uint16_t window)
+{
+    memset(t->entry, 0, sizeof(t->entry));
+
+    if (window == 0 || window > MQTTNOX_INFLIGHT_WINDOW_MAX) {
+        window = MQTTNOX_INFLIGHT_WINDOW_MAX;
+    }
+
+    t->window = window;
+    t->count = 0;
+    mqttnox_atomic_store(&t->lock, 0);
+}
+
+/**@brief Changes the window, keeping the messages in flight
+*
+* @note A window smaller than the messages in flight refuses new ones
+*       until enough complete.
+*/
+void mqttnox_inflight_set_window(mqttnox_inflight_t* t, uint16_t window)
+{
+    if (window == 0 || window > MQTTNOX_INFLIGHT_WINDOW_MAX) {
+        window = MQTTNOX_INFLIGHT_WINDOW_MAX;
+    }
+
+    inflight_lock(t);
+    t->window = window;
+    inflight_unlock(t);
+}
+
+/**@brief Reserves room in the window for cnt messages
+*
+* @return      non-zero if the room was reserved, 0 if the window is full
+*/
+int mqttnox_inflight_reserve(mqttnox_inflight_t* t, uint16_t cnt)
+{
+    int ok = 0;
+
+    inflight_lock(t);
+
+    if ((uint32_t)t->count + cnt <= t->window) {
+        t->count += cnt;
+        ok = 1;
+    }
+
+    inflight_unlock(t);
+
+    return ok;
+}
+
+/**@brief Hands back reserved room that was not used
+*/
+void mqttnox_inflight_unreserve(mqttnox_inflight_t* t, uint16_t cnt)
+{
+    inflight_lock(t);
+    t->count -= cnt;
+    inflight_unlock(t);
+}
+
+/**@brief Records a message
+*
+* @note A single message takes its room in the window here, under the same
+*       lock, so the common publish path locks the table once.
+*
+* @param[in]   t         table
+* @param[in]   ident     packet identifier, not 0
+* @param[in]   qos       1 or 2
+* @param[in]   user_ctx  returned with the completion event
+* @param[in]   reserved  non-zero if the room was taken by mqttnox_inflight_reserve
+*
+* @return      1 on success, 0 if ident is already in flight, -1 if the
+*              window is full
+*/
+int mqttnox_inflight_insert(mqttnox_inflight_t* t, uint16_t ident, uint8_t qos, void* user_ctx, uint8_t reserved)
+{
+    uint32_t idx = ident & INFLIGHT_MASK;
+    int ok = 1;
+
+    inflight_lock(t);
+
+    if (!reserved && t->count >= t->window) {
+        inflight_unlock(t);
+        return -1;
+    }
+
+    while (t->entry[idx].ident != 0)
+    {
+        if (t->entry[idx].ident == ident) {
+            ok = 0;
+            break;
+        }
+        idx = (idx + 1) & INFLIGHT_MASK;
+    }
+
+    if (ok) {
+        t->entry[idx].ident = ident;
+        t->entry[idx].qos = qos;
+        t->entry[idx].state = MQTTNOX_INFLIGHT_PUBLISHED;
+        t->entry[idx].user_ctx = user_ctx;
+
+        if (!reserved) {
+            t->count++;
+        }
+    }
+
+    inflight_unlock(t);
+
+    return ok;
+}
+
+/**@brief Moves a QoS 2 message on to awaiting PUBCOMP
+*
+* @return      non-zero if ident is a QoS 2 message in flight
+*/
+int mqttnox_inflight_release(mqttnox_inflight_t* t, uint16_t ident)
+{
+    int32_t idx;
+    int ok = 0;
+
+    inflight_lock(t);
+
+    idx = inflight_find(t, ident);
+    if (idx >= 0 && t->entry[idx].qos == MQTTNOX_QOS2_EXACTLY_ONCE_DELIV) {
+        t->entry[idx].state = MQTTNOX_INFLIGHT_RELEASED;
+        ok = 1;
+    }
+
+    inflight_unlock(t);
+
+    return ok;
+}
+
+/**@brief Empties a slot and frees its room in the window
+*
+* @note must be called with the lock held
+*/
+static void inflight_delete(mqttnox_inflight_t* t, uint32_t hole)
+{
+    uint32_t idx = (hole + 1) & INFLIGHT_MASK;
+    uint32_t home;
+
+    /* Shift back every following entry whose home is at or before the hole */
+    while (t->entry[idx].ident != 0)
+    {
+        home = t->entry[idx].ident & INFLIGHT_MASK;
+
+        if (((idx - home) & INFLIGHT_MASK) >= ((idx - hole) & INFLIGHT_MASK)) {
+            t->entry[hole] = t->entry[idx];
+            hole = idx;
+        }
+        idx = (idx + 1) & INFLIGHT_MASK;
+    }
+
+    t->entry[hole].ident = 0;
+    t->count--;
+}
+
+/**@brief Completes a message and frees its room in the window
+*
+* @note With qos 1 the message must be a QoS 1 one (PUBACK), with qos 2 a
+*       QoS 2 one whose PUBREL was sent (PUBCOMP). 0 removes any message.
+*
+* @param[in]   t      table
+* @param[in]   ident  packet identifier
+* @param[in]   qos    acknowledgement received, 0 to remove unconditionally
+* @param[out]  entry  the removed message, may be NULL
+*
+* @return      non-zero if the message was removed
+*/
+int mqttnox_inflight_remove(mqttnox_inflight_t* t, uint16_t ident, uint8_t qos, mqttnox_inflight_entry_t* entry)
+{
+    int32_t found;
+
+    inflight_lock(t);
+
+    found = inflight_find(t, ident);
+    if (found < 0 ||
+        (qos != 0 && t->entry[found].qos != qos) ||
+        (qos == MQTTNOX_QOS2_EXACTLY_ONCE_DELIV && t->entry[found].state != MQTTNOX_INFLIGHT_RELEASED)) {
+        inflight_unlock(t);
+        return 0;
+    }
+
+    if (entry != NULL) {
+        *entry = t->entry[found];
+    }
+
+    inflight_delete(t, (uint32_t)found);
+
+    inflight_unlock(t);
+
+    return 1;
+}
+
+/**@brief Removes any one message, as when the session is dropped
+*
+* @param[in]   t      table
+* @param[out]  entry  the removed message
+*
+* @return      non-zero if a message was removed, 0 once none is left
+*/
+int mqttnox_inflight_pop(mqttnox_inflight_t* t, mqttnox_inflight_entry_t* entry)
+{
+    uint32_t idx;
+
+    inflight_lock(t);
+
+    for (idx = 0; idx < MQTTNOX_INFLIGHT_SLOTS; idx++)
+    {
+        if (t->entry[idx].ident != 0) {
+            *entry = t->entry[idx];
+            inflight_delete(t, idx);
+            inflight_unlock(t);
+            return 1;
+        }
+    }
+
+    inflight_unlock(t);
+
+    return 0;
+}
+
+/**@brief Returns the messages in flight, reservations included
+*/
+uint16_t mqttnox_inflight_count(mqttnox_inflight_t* t)
+{
+    uint16_t count;
+
+    inflight_lock(t);
+    count = t->count;
+    inflight_unlock(t);
+
+    return count;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,75 @@
+/*****************************************************************************
+* Copyright (c) [2024] Argenox Technologies LLC
+* All rights reserved.
+*
+*
+*
+* NOTICE:  All information contained herein, source code, binaries and
+* derived works is, and remains the property of Argenox and its suppliers,
+* if any.  The intellectual and technical concepts contained
+* herein are proprietary to Argenox and its suppliers and may be covered
+* by U.S. and Foreign Patents, patents in process, and are protected by
+* trade secret or copyright law.
+*
+* Licensing of this software can be found in LICENSE
+*
+* THIS SOFTWARE IS PROVIDED BY ARGENOX "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ARGENOX LLC BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* CONTACT: info@argenox.com
+*
+* File:    mqttnox_inflight.h
+* Summary: MQTTNox Outbound In-Flight Table
+*
+* Note: Internal to the library. Tracks QoS 1 and 2 messages from the time
+*       their packet identifier is assigned until PUBACK or PUBCOMP, and
+*       limits how many may be outstanding at once.
+*
+*/
+
+#ifndef _MQTTNOX_INFLIGHT_H_
+#define _MQTTNOX_INFLIGHT_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "mqttnox.h"
+
+#if (MQTTNOX_INFLIGHT_SLOTS & (MQTTNOX_INFLIGHT_SLOTS - 1)) != 0
+#error "MQTTNOX_INFLIGHT_SLOTS must be a power of two"
+#endif
+
+/* Largest window, keeps the table at most half full */
+#define MQTTNOX_INFLIGHT_WINDOW_MAX  (MQTTNOX_INFLIGHT_SLOTS / 2)
+
+/* Message states */
+#define MQTTNOX_INFLIGHT_PUBLISHED   1  /* Awaiting PUBACK or PUBREC */
+#define MQTTNOX_INFLIGHT_RELEASED    2  /* QoS 2, PUBREL sent, awaiting PUBCOMP */
+
+
+extern void mqttnox_inflight_init(mqttnox_inflight_t* t, uint16_t window);
+extern void mqttnox_inflight_set_window(mqttnox_inflight_t* t, uint16_t window);
+extern int mqttnox_inflight_reserve(mqttnox_inflight_t* t, uint16_t cnt);
+extern void mqttnox_inflight_unreserve(mqttnox_inflight_t* t, uint16_t cnt);
+extern int mqttnox_inflight_insert(mqttnox_inflight_t* t, uint16_t ident, uint8_t qos, void* user_ctx, uint8_t reserved);
+extern int mqttnox_inflight_release(mqttnox_inflight_t* t, uint16_t ident);
+extern int mqttnox_inflight_remove(mqttnox_inflight_t* t, uint16_t ident, uint8_t qos, mqttnox_inflight_entry_t* entry);
+extern int mqttnox_inflight_pop(mqttnox_inflight_t* t, mqttnox_inflight_entry_t* entry);
+extern uint16_t mqttnox_inflight_count(mqttnox_inflight_t* t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _MQTTNOX_INFLIGHT_H_ */
@@ -0,0 +1,138 @@
+/*****************************************************************************
+* Copyright (c) [2024] Argenox Technologies LLC
+* All rights reserved.
+*
+*
+*
+* NOTICE:  All information contained herein, source code, binaries and
+* derived works is, and remains the property of Argenox and its suppliers,
+* if any.  The intellectual and technical concepts contained
+* herein are proprietary to Argenox and its suppliers and may be covered
+* by U.S. and Foreign Patents, patents in process, and are protected by
+* trade secret or copyright law.
+*
+* Licensing of this software can be found in LICENSE
+*
+* THIS SOFTWARE IS PROVIDED BY ARGENOX "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ARGENOX LLC BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* CONTACT: info@argenox.com
+*
+* File:    mqttnox_keepalive.c
+* Summary: MQTTNox Keepalive
+*
+* Note: Any packet sent restarts the keepalive interval, so PINGREQ only
+*       goes out on a connection that has been quiet for a whole interval
+*       [MQTT-3.1.2-23]. Once sent, PINGRESP is expected within
+*       MQTTNOX_PINGRESP_MS or the interval, whichever is shorter.
+*
+*       Senders record their time from any thread and the receive thread
+*       reports PINGRESP, the application's thread calls mqttnox_process;
+*       the fields they share are atomics, so no lock is taken.
+*
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* System Includes */
+#include <stdint.h>
+
+/* Library Includes */
+#include "mqttnox_keepalive.h"
+
+/**@brief Starts the keepalive of a connection accepted by the broker
+*
+* @param[in]   k          keepalive state
+* @param[in]   keepalive  interval in seconds, 0 disables it
+* @param[in]   now        mqttnox_hal_time_ms, CONNECT went out just before
+*/
+void mqttnox_keepalive_start(mqttnox_keepalive_t* k, uint16_t keepalive, uint32_t now)
+{
+    k->interval_ms = (uint32_t)keepalive * 1000;
+    k->resp_ms = (k->interval_ms < MQTTNOX_PINGRESP_MS) ? k->interval_ms : MQTTNOX_PINGRESP_MS;
+
+    mqttnox_atomic_store(&k->last_tx_ms, now);
+    mqttnox_atomic_store(&k->pending, 0);
+    mqttnox_atomic_store(&k->active, (keepalive != 0) ? 1 : 0);
+}
+
+/**@brief Stops the keepalive, the connection is gone */
+void mqttnox_keepalive_stop(mqttnox_keepalive_t* k)
+{
+    mqttnox_atomic_store(&k->active, 0);
+    mqttnox_atomic_store(&k->pending, 0);
+}
+
+/**@brief Records that a packet went out */
+void mqttnox_keepalive_sent(mqttnox_keepalive_t* k, uint32_t now)
+{
+    mqttnox_atomic_store(&k->last_tx_ms, now);
+}
+
+/**@brief Handles a PINGRESP, timing the round trip of the PINGREQ */
+void mqttnox_keepalive_pong(mqttnox_keepalive_t* k, uint32_t now)
+{
+    if (mqttnox_atomic_cas(&k->pending, 1, 0)) {
+        k->rtt_ms = now - k->sent_ms;
+    }
+}
+
+/**@brief Checks whether a PINGREQ is due or its PINGRESP is late
+*
+* @note A PINGREQ that is due is counted as sent: the caller must send it.
+*
+* @param[in]   k     keepalive state
+* @param[in]   now   mqttnox_hal_time_ms
+* @param[out]  wait  time until the next deadline, MQTTNOX_PROCESS_IDLE if none
+*
+* @return      MQTTNOX_KEEPALIVE_ACT_NONE, _PING or _TIMEOUT
+*/
+int mqttnox_keepalive_poll(mqttnox_keepalive_t* k, uint32_t now, uint32_t* wait)
+{
+    int32_t left;
+
+    *wait = MQTTNOX_PROCESS_IDLE;
+
+    if (!mqttnox_atomic_load(&k->active)) {
+        return MQTTNOX_KEEPALIVE_ACT_NONE;
+    }
+
+    if (mqttnox_atomic_load(&k->pending))
+    {
+        left = (int32_t)(k->sent_ms + k->resp_ms - now);
+        if (left <= 0) {
+            k->timeouts++;
+            return MQTTNOX_KEEPALIVE_ACT_TIMEOUT;
+        }
+
+        *wait = (uint32_t)left;
+        return MQTTNOX_KEEPALIVE_ACT_NONE;
+    }
+
+    left = (int32_t)(mqttnox_atomic_load(&k->last_tx_ms) + k->interval_ms - now);
+    if (left > 0) {
+        *wait = (uint32_t)left;
+        return MQTTNOX_KEEPALIVE_ACT_NONE;
+    }
+
+    k->sent_ms = now;
+    k->pings++;
+    mqttnox_atomic_store(&k->pending, 1);
+
+    *wait = k->resp_ms;
+    return MQTTNOX_KEEPALIVE_ACT_PING;
+}
+
+#ifdef __cplusplus
+}
+#endif
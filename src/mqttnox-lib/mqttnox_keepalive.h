@@ -0,0 +1,64 @@
+/*****************************************************************************
+* Copyright (c) [2024] Argenox Technologies LLC
+* All rights reserved.
+*
+*
+*
+* NOTICE:  All information contained herein, source code, binaries and
+* derived works is, and remains the property of Argenox and its suppliers,
+* if any.  The intellectual and technical concepts contained
+* herein are proprietary to Argenox and its suppliers and may be covered
+* by U.S. and Foreign Patents, patents in process, and are protected by
+* trade secret or copyright law.
+*
+* Licensing of this software can be found in LICENSE
+*
+* THIS SOFTWARE IS PROVIDED BY ARGENOX "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ARGENOX LLC BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* CONTACT: info@argenox.com
+*
+* File:    mqttnox_keepalive.h
+* Summary: MQTTNox Keepalive
+*
+* Note: Internal to the library. Decides when a PINGREQ is due and when
+*       the broker has taken too long to answer one.
+*
+*/
+
+#ifndef _MQTTNOX_KEEPALIVE_H_
+#define _MQTTNOX_KEEPALIVE_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "mqttnox.h"
+
+/* What mqttnox_keepalive_poll asks for */
+#define MQTTNOX_KEEPALIVE_ACT_NONE    0
+#define MQTTNOX_KEEPALIVE_ACT_PING    1  /* Send PINGREQ now */
+#define MQTTNOX_KEEPALIVE_ACT_TIMEOUT 2  /* No PINGRESP, the connection is dead */
+
+
+extern void mqttnox_keepalive_start(mqttnox_keepalive_t* k, uint16_t keepalive, uint32_t now);
+extern void mqttnox_keepalive_stop(mqttnox_keepalive_t* k);
+extern void mqttnox_keepalive_sent(mqttnox_keepalive_t* k, uint32_t now);
+extern void mqttnox_keepalive_pong(mqttnox_keepalive_t* k, uint32_t now);
+extern int mqttnox_keepalive_poll(mqttnox_keepalive_t* k, uint32_t now, uint32_t* wait);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _MQTTNOX_KEEPALIVE_H_ */
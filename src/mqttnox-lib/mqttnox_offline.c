@@ -0,0 +1,497 @@
+/*****************************************************************************
+* Copyright (c) [2024] Argenox Technologies LLC
+* All rights reserved.
+*
+*
+*
+* NOTICE:  All information contained herein, source code, binaries and
+* derived works is, and remains the property of Argenox and its suppliers,
+* if any.  The intellectual and technical concepts contained
+* herein are proprietary to Argenox and its suppliers and may be covered
+* by U.S. and Foreign Patents, patents in process, and are protected by
+* trade secret or copyright law.
+*
+* Licensing of this software can be found in LICENSE
+*
+* THIS SOFTWARE IS PROVIDED BY ARGENOX "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ARGENOX LLC BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* CONTACT: info@argenox.com
+*
+* File:    mqttnox_offline.c
+* Summary: MQTTNox Offline Publish Queue
+*
+* Note: A FIFO of messages in two rings of records: one in the client's
+*       memory and one in a memory-mapped spill file. A message goes to
+*       memory while the spill ring is empty and it fits, to the spill
+*       ring otherwise, so the rings always hold the oldest messages in
+*       memory and the queue stays in order. Records never wrap: one that
+*       does not fit the end of a ring leaves a pad and starts over at the
+*       front, so queued topics and payloads can be sent in place.
+*
+*       Publishing threads push under a spin lock. Only the thread holding
+*       the draining flag takes records off, so the records it is sending
+*       stay put until it pops them.
+*
+*/
+
+#if defined(__linux__)
+#define _GNU_SOURCE /* O_CLOEXEC, ftruncate */
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* System Includes */
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+/* Library Includes */
+#include "mqttnox_offline.h"
+
+#define OFFLINE_PAD          0xFFFFFFFFUL  /* Record length of the pad before a ring wraps */
+#define OFFLINE_ALIGN(len)   (((len) + 7) & ~(uint32_t)7)
+
+typedef struct
+{
+    uint32_t len;           /* Whole record, 8 byte aligned, or OFFLINE_PAD */
+    uint32_t expiry;        /* mqttnox_hal_time_ms deadline, 0 for none */
+    void* user_ctx;
+    uint32_t payload_len;
+    uint16_t topic_len;
+    uint8_t qos;
+    uint8_t retain;
+
+} offline_rec_t;
+
+/* A record is followed by the topic, its terminating zero and the payload */
+#define OFFLINE_REC_SIZE(topic_len, payload_len) \
+    OFFLINE_ALIGN((uint32_t)sizeof(offline_rec_t) + (topic_len) + 1 + (payload_len))
+
+static void offline_lock(mqttnox_offline_t* q)
+{
+    while (!mqttnox_atomic_cas(&q->lock, 0, 1)) {
+        mqttnox_atomic_relax();
+    }
+}
+
+static void offline_unlock(mqttnox_offline_t* q)
+{
+    mqttnox_atomic_store(&q->lock, 0);
+}
+
+static offline_rec_t* offline_rec(mqttnox_offline_ring_t* r, uint32_t off)
+{
+    return (offline_rec_t*)(void*)(r->base + off);
+}
+
+static int offline_expired(const offline_rec_t* rec, uint32_t now)
+{
+    return rec->expiry != 0 && (int32_t)(now - rec->expiry) >= 0;
+}
+
+/**@brief Takes room for a record at the tail of a ring
+*
+* @return      offset of the record, -1 if it does not fit
+*/
+static int32_t offline_ring_alloc(mqttnox_offline_ring_t* r, uint32_t size)
+{
+    uint32_t pad = 0;
+    int32_t off;
+
+    if (r->base == NULL) {
+        return -1;
+    }
+
+    if (r->used == 0) {
+        r->head = 0;
+        r->tail = 0;
+    }
+
+    if (r->tail + size > r->size) {
+        pad = r->size - r->tail;
+    }
+
+    if ((uint64_t)r->used + pad + size > r->size) {
+        return -1;
+    }
+
+    if (pad != 0) {
+        offline_rec(r, r->tail)->len = OFFLINE_PAD;
+        r->used += pad;
+        r->tail = 0;
+    }
+
+    off = (int32_t)r->tail;
+    r->tail += size;
+    if (r->tail == r->size) {
+        r->tail = 0;
+    }
+    r->used += size;
+
+    return off;
+}
+
+/**@brief Returns the offset of the oldest record, skipping a pad
+*/
+static uint32_t offline_ring_head(mqttnox_offline_ring_t* r)
+{
+    if (offline_rec(r, r->head)->len == OFFLINE_PAD) {
+        r->used -= r->size - r->head;
+        r->head = 0;
+    }
+
+    return r->head;
+}
+
+static void offline_ring_pop(mqttnox_offline_ring_t* r)
+{
+    uint32_t off = offline_ring_head(r);
+
+    r->used -= offline_rec(r, off)->len;
+    r->head = off + offline_rec(r, off)->len;
+    if (r->head == r->size) {
+        r->head = 0;
+    }
+}
+
+/**@brief Returns the oldest ring holding records, NULL when the queue is empty
+*/
+static mqttnox_offline_ring_t* offline_front(mqttnox_offline_t* q)
+{
+    if (q->mem.used != 0) {
+        return &q->mem;
+    }
+
+    if (q->spill.base != NULL && q->spill.used != 0) {
+        return &q->spill;
+    }
+
+    return NULL;
+}
+
+/**@brief Drops expired messages from the front of the queue
+*
+* @note Caller holds the lock and the draining flag
+*/
+static void offline_expire(mqttnox_offline_t* q, uint32_t now)
+{
+    mqttnox_offline_ring_t* r;
+
+    while ((r = offline_front(q)) != NULL && offline_expired(offline_rec(r, offline_ring_head(r)), now))
+    {
+        offline_ring_pop(r);
+        mqttnox_atomic_fetch_add(&q->count, (uint32_t)-1);
+        q->expired++;
+    }
+}
+
+/**@brief Maps a spill file of size bytes and removes its name
+*
+* @return      base of the mapping, NULL on failure or where files cannot
+*              be mapped
+*/
+static uint8_t* offline_spill_map(const char* path, uint32_t size)
+{
+#if defined(__linux__)
+    uint8_t* base;
+    int fd;
+
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    if (ftruncate(fd, size) != 0) {
+        close(fd);
+        unlink(path);
+        return NULL;
+    }
+
+    base = (uint8_t*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    /* The mapping keeps the file alive, nothing is left behind on exit */
+    close(fd);
+    unlink(path);
+
+    return (base == (uint8_t*)MAP_FAILED) ? NULL : base;
+#else
+    (void)path;
+    (void)size;
+    return NULL;
+#endif
+}
+
+/**@brief Sets up the queue
+*
+* @note Not thread safe, call only while no other thread uses the client.
+*       Only the TTL changes once the queue is set up.
+*
+* @param[in]   q           queue
+* @param[in]   mem_size    bytes held in memory, at most MQTTNOX_OFFLINE_MEM_SIZE
+* @param[in]   spill_path  spill file, NULL to queue in memory only
+* @param[in]   spill_size  size of the spill file
+* @param[in]   ttl_ms      default time a message may stay queued, 0 for ever
+*
+* @return      non-zero on success, 0 if the spill file cannot be mapped
+*/
+int mqttnox_offline_configure(mqttnox_offline_t* q, uint32_t mem_size, const char* spill_path, uint32_t spill_size, uint32_t ttl_ms)
+{
+    q->ttl_ms = ttl_ms;
+
+    if (q->mem.base != NULL || mem_size == 0) {
+        return 1;
+    }
+
+    if (spill_path != NULL && spill_size > 0) {
+        q->spill.size = spill_size & ~(uint32_t)7;
+        q->spill.base = offline_spill_map(spill_path, q->spill.size);
+        if (q->spill.base == NULL) {
+            q->spill.size = 0;
+            return 0;
+        }
+    }
+
+    if (mem_size > sizeof(q->mem_buf)) {
+        mem_size = sizeof(q->mem_buf);
+    }
+
+    q->mem.base = (uint8_t*)q->mem_buf;
+    q->mem.size = mem_size & ~(uint32_t)7;
+
+    return 1;
+}
+
+/**@brief Unmaps the spill file and disables the queue, queued messages
+*        are dropped
+*/
+void mqttnox_offline_close(mqttnox_offline_t* q)
+{
+#if defined(__linux__)
+    if (q->spill.base != NULL) {
+        munmap(q->spill.base, q->spill.size);
+    }
+#endif
+
+    memset(&q->mem, 0, sizeof(q->mem));
+    memset(&q->spill, 0, sizeof(q->spill));
+    mqttnox_atomic_store(&q->count, 0);
+}
+
+/**@brief Queues a message
+*
+* @note Expired messages are dropped to make room, unless another thread is
+*       sending from the queue.
+*
+* @param[in]   q          queue
+* @param[in]   item       message, its ttl_ms 0 selects the queue's TTL
+* @param[in]   topic_len  length of item->topic
+* @param[in]   now        mqttnox_hal_time_ms
+*
+* @return      non-zero on success, 0 if the queue is full
+*/
+int mqttnox_offline_push(mqttnox_offline_t* q, const mqttnox_publish_item_t* item, uint32_t topic_len, uint32_t now)
+{
+    mqttnox_offline_ring_t* r;
+    offline_rec_t* rec;
+    uint32_t ttl = (item->ttl_ms != 0) ? item->ttl_ms : q->ttl_ms;
+    uint32_t size;
+    int32_t off = -1;
+    uint8_t* data;
+    int retry;
+
+    if (topic_len > 0xFFFF || item->payload_len > 0xFFFFFFFFUL - sizeof(offline_rec_t) - topic_len - 8) {
+        return 0;
+    }
+
+    size = OFFLINE_REC_SIZE(topic_len, item->payload_len);
+
+    offline_lock(q);
+
+    for (retry = 0; retry < 2 && off < 0; retry++)
+    {
+        /* Memory takes the message only while nothing is waiting in the spill file */
+        r = &q->mem;
+        if (q->spill.used == 0) {
+            off = offline_ring_alloc(r, size);
+        }
+
+        if (off < 0) {
+            r = &q->spill;
+            off = offline_ring_alloc(r, size);
+        }
+
+        if (off < 0 && retry == 0) {
+            if (!mqttnox_atomic_cas(&q->draining, 0, 1)) {
+                break;
+            }
+            offline_expire(q, now);
+            mqttnox_atomic_store(&q->draining, 0);
+        }
+    }
+
+    if (off < 0) {
+        offline_unlock(q);
+        return 0;
+    }
+
+    rec = offline_rec(r, (uint32_t)off);
+    rec->len = size;
+    rec->expiry = 0;
+    if (ttl != 0) {
+        /* 0 means no expiry, a deadline landing on it moves on by 1 ms */
+        rec->expiry = (now + ttl != 0) ? now + ttl : 1;
+    }
+    rec->user_ctx = item->user_ctx;
+    rec->payload_len = item->payload_len;
+    rec->topic_len = (uint16_t)topic_len;
+    rec->qos = (uint8_t)item->qos;
+    rec->retain = item->retain;
+
+    data = (uint8_t*)(rec + 1);
+    memcpy(data, item->topic, topic_len);
+    data[topic_len] = 0;
+
+    if (item->payload_len > 0) {
+        memcpy(data + topic_len + 1, item->payload, item->payload_len);
+    }
+
+    mqttnox_atomic_fetch_add(&q->count, 1);
+
+    offline_unlock(q);
+
+    return 1;
+}
+
+/**@brief Describes the oldest messages as batch items, without removing them
+*
+* @note Caller holds the draining flag. The items point into the queue and
+*       stay valid until mqttnox_offline_pop. Expired messages at the front
+*       are dropped first, one further back ends the batch.
+*
+* @param[in]   q          queue
+* @param[out]  items      the messages
+* @param[in]   max        most items to return
+* @param[in]   max_acked  most QoS 1 and 2 items to return
+* @param[in]   now        mqttnox_hal_time_ms
+*
+* @return      number of items
+*/
+uint16_t mqttnox_offline_peek(mqttnox_offline_t* q, mqttnox_publish_item_t* items, uint16_t max, uint16_t max_acked, uint32_t now)
+{
+    mqttnox_offline_ring_t* r;
+    offline_rec_t* rec;
+    uint32_t off = 0;
+    uint32_t left = 0;
+    uint16_t n = 0;
+    uint8_t* data;
+
+    offline_lock(q);
+
+    offline_expire(q, now);
+
+    r = offline_front(q);
+    if (r != NULL) {
+        off = offline_ring_head(r);
+        left = r->used;
+    }
+
+    while (r != NULL && n < max)
+    {
+        rec = offline_rec(r, off);
+
+        if (rec->len == OFFLINE_PAD) {
+            left -= r->size - off;
+            off = 0;
+            continue;
+        }
+
+        if (offline_expired(rec, now)) {
+            break;
+        }
+
+        if (rec->qos != MQTTNOX_QOS0_AT_MOST_ONCE_DELIV) {
+            if (max_acked == 0) {
+                break;
+            }
+            max_acked--;
+        }
+
+        data = (uint8_t*)(rec + 1);
+
+        items[n].topic = (const char*)data;
+        items[n].payload = data + rec->topic_len + 1;
+        items[n].payload_len = rec->payload_len;
+        items[n].qos = (mqttnox_qos_t)rec->qos;
+        items[n].retain = rec->retain;
+        items[n].packet_ident = 0;
+        items[n].user_ctx = rec->user_ctx;
+        items[n].ttl_ms = 0;
+        n++;
+
+        left -= rec->len;
+        off += rec->len;
+        if (off == r->size) {
+            off = 0;
+        }
+
+        if (left == 0) {
+            /* On from memory to the spill file */
+            r = (r == &q->mem && q->spill.base != NULL && q->spill.used != 0) ? &q->spill : NULL;
+            if (r != NULL) {
+                off = offline_ring_head(r);
+                left = r->used;
+            }
+        }
+    }
+
+    offline_unlock(q);
+
+    return n;
+}
+
+/**@brief Removes the cnt oldest messages, once they have been sent
+*
+* @note Caller holds the draining flag
+*/
+void mqttnox_offline_pop(mqttnox_offline_t* q, uint16_t cnt)
+{
+    mqttnox_offline_ring_t* r;
+
+    offline_lock(q);
+
+    while (cnt > 0 && (r = offline_front(q)) != NULL)
+    {
+        offline_ring_pop(r);
+        mqttnox_atomic_fetch_add(&q->count, (uint32_t)-1);
+        cnt--;
+    }
+
+    offline_unlock(q);
+}
+
+/**@brief Returns the messages queued
+*/
+uint32_t mqttnox_offline_count(mqttnox_offline_t* q)
+{
+    return mqttnox_atomic_load(&q->count);
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,60 @@
+/*****************************************************************************
+* Copyright (c) [2024] Argenox Technologies LLC
+* All rights reserved.
+*
+*
+*
+* NOTICE:  All information contained herein, source code, binaries and
+* derived works is, and remains the property of Argenox and its suppliers,
+* if any.  The intellectual and technical concepts contained
+* herein are proprietary to Argenox and its suppliers and may be covered
+* by U.S. and Foreign Patents, patents in process, and are protected by
+* trade secret or copyright law.
+*
+* Licensing of this software can be found in LICENSE
+*
+* THIS SOFTWARE IS PROVIDED BY ARGENOX "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ARGENOX LLC BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* CONTACT: info@argenox.com
+*
+* File:    mqttnox_offline.h
+* Summary: MQTTNox Offline Publish Queue
+*
+* Note: Internal to the library. Holds publishes made while the client is
+*       not connected until they can be sent.
+*
+*/
+
+#ifndef _MQTTNOX_OFFLINE_H_
+#define _MQTTNOX_OFFLINE_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "mqttnox.h"
+
+
+extern int mqttnox_offline_configure(mqttnox_offline_t* q, uint32_t mem_size, const char* spill_path, uint32_t spill_size, uint32_t ttl_ms);
+extern void mqttnox_offline_close(mqttnox_offline_t* q);
+extern int mqttnox_offline_push(mqttnox_offline_t* q, const mqttnox_publish_item_t* item, uint32_t topic_len, uint32_t now);
+extern uint16_t mqttnox_offline_peek(mqttnox_offline_t* q, mqttnox_publish_item_t* items, uint16_t max, uint16_t max_acked, uint32_t now);
+extern void mqttnox_offline_pop(mqttnox_offline_t* q, uint16_t cnt);
+extern uint32_t mqttnox_offline_count(mqttnox_offline_t* q);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _MQTTNOX_OFFLINE_H_ */
@@ -0,0 +1,437 @@
+/*****************************************************************************
+* Copyright (c) [2024] Argenox Technologies LLC
+* All rights reserved.
+*
+*
+*
+* NOTICE:  All information contained herein, source code, binaries and
+* derived works is, and remains the property of Argenox and its suppliers,
+* if any.  The intellectual and technical concepts contained
+* herein are proprietary to Argenox and its suppliers and may be covered
+* by U.S. and Foreign Patents, patents in process, and are protected by
+* trade secret or copyright law.
+*
+* Licensing of this software can be found in LICENSE
+*
+* THIS SOFTWARE IS PROVIDED BY ARGENOX "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ARGENOX LLC BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* CONTACT: info@argenox.com
+*
+* File:    mqttnox_reconnect.c
+* Summary: MQTTNox Automatic Reconnect
+*
+* Note: Attempts are spread with full jitter: each waits a uniformly
+*       random time between 0 and min_ms * 2^attempt, capped at max_ms, so
+*       a fleet that loses its broker at once comes back spread over the
+*       whole window instead of in waves. Every client seeds its generator
+*       from its identifier and the clock.
+*
+*       The receive thread reports losses and CONNACK, the application's
+*       thread calls mqttnox_process; the state is kept under a spin lock.
+*
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* System Includes */
+#include <stdint.h>
+#include <string.h>
+
+/* Library Includes */
+#include "mqttnox_reconnect.h"
+
+static void reconnect_lock(mqttnox_reconnect_t* r)
+{
+    while (!mqttnox_atomic_cas(&r->lock, 0, 1)) {
+        mqttnox_atomic_relax();
+    }
+}
+
+static void reconnect_unlock(mqttnox_reconnect_t* r)
+{
+    mqttnox_atomic_store(&r->lock, 0);
+}
+
+/**@brief Next value of the jitter generator, xorshift32 */
+static uint32_t reconnect_rand(mqttnox_reconnect_t* r)
+{
+    uint32_t x = r->rand;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    r->rand = x;
+
+    return x;
+}
+
+/**@brief Schedules the next attempt, caller holds the lock
+*
+* @return      the wait, at least 1 ms as 0 stands for no attempt
+*/
+static uint32_t reconnect_schedule(mqttnox_reconnect_t* r, uint32_t now)
+{
+    uint32_t delay = mqttnox_reconnect_backoff(r);
+
+    if (delay == 0) {
+        delay = 1;
+    }
+
+    r->state = MQTTNOX_RECONNECT_WAITING;
+    r->due_ms = now + delay;
+
+    return delay;
+}
+
+/**@brief Sets up reconnecting for a connection made by mqttnox_connect
+*
+* @note Statistics and subscriptions are kept
+*
+* @param[in]   r          reconnect state
+* @param[in]   enabled    non-zero to reconnect automatically
+* @param[in]   min_ms     longest wait before the first attempt
+* @param[in]   max_ms     longest wait before any attempt
+* @param[in]   client_id  seeds the jitter so clients spread apart
+* @param[in]   now        mqttnox_hal_time_ms
+*/
+void mqttnox_reconnect_configure(mqttnox_reconnect_t* r, uint8_t enabled, uint32_t min_ms, uint32_t max_ms, const char* client_id, uint32_t now)
+{
+    /* FNV-1a of the identifier */
+    uint32_t seed = 2166136261UL;
+
+    while (client_id != NULL && *client_id != '\0') {
+        seed = (seed ^ (uint8_t)*client_id++) * 16777619UL;
+    }
+
+    reconnect_lock(r);
+
+    r->enabled = enabled;
+    r->linked = 0;
+    r->state = MQTTNOX_RECONNECT_IDLE;
+    r->attempt = 0;
+    r->min_ms = (min_ms != 0) ? min_ms : MQTTNOX_RECONNECT_MIN_MS;
+    r->max_ms = (max_ms != 0) ? max_ms : MQTTNOX_RECONNECT_MAX_MS;
+    if (r->max_ms < r->min_ms) {
+        r->max_ms = r->min_ms;
+    }
+
+    r->rand = seed ^ now;
+    if (r->rand == 0) {
+        r->rand = 1;
+    }
+
+    reconnect_unlock(r);
+}
+
+/**@brief Records that the TCP connection is up, so its loss is handled */
+void mqttnox_reconnect_linked(mqttnox_reconnect_t* r)
+{
+    reconnect_lock(r);
+    r->linked = 1;
+    reconnect_unlock(r);
+}
+
+/**@brief Handles a lost connection or a failed attempt
+*
+* @note The first loss of a connection starts the clock for the time to
+*       reconnect. Reported again for the same connection, or while not
+*       reconnecting, nothing changes.
+*
+* @param[in]   r      reconnect state
+* @param[in]   now    mqttnox_hal_time_ms
+* @param[out]  delay  wait before the next attempt, 0 if none is scheduled
+*
+* @return      non-zero if a connection was up, so its loss is reported
+*/
+int mqttnox_reconnect_lost(mqttnox_reconnect_t* r, uint32_t now, uint32_t* delay)
+{
+    int was_linked;
+
+    *delay = 0;
+
+    reconnect_lock(r);
+
+    was_linked = r->linked;
+    r->linked = 0;
+
+    if (r->enabled && (was_linked || r->state == MQTTNOX_RECONNECT_CONNECTING))
+    {
+        if (r->state == MQTTNOX_RECONNECT_IDLE) {
+            r->stats.disconnects++;
+            r->lost_ms = now;
+            r->attempt = 0;
+        }
+
+        *delay = reconnect_schedule(r, now);
+    }
+
+    reconnect_unlock(r);
+
+    return was_linked;
+}
+
+/**@brief Hands back an attempt mqttnox_reconnect_poll asked for but that
+*        could not be started
+*
+* @note Nothing changes if the connection was lost again meanwhile, that
+*       already scheduled the next attempt
+*
+* @param[in]   r       reconnect state
+* @param[in]   due_ms  when to ask for it again, mqttnox_hal_time_ms based
+*/
+void mqttnox_reconnect_defer(mqttnox_reconnect_t* r, uint32_t due_ms)
+{
+    reconnect_lock(r);
+
+    if (r->state == MQTTNOX_RECONNECT_CONNECTING) {
+        r->state = MQTTNOX_RECONNECT_WAITING;
+        r->due_ms = due_ms;
+        r->stats.attempts--;
+    }
+
+    reconnect_unlock(r);
+}
+
+/**@brief Handles an accepted CONNACK
+*
+* @return      non-zero if it ends a reconnect, whose time is recorded
+*/
+int mqttnox_reconnect_done(mqttnox_reconnect_t* r, uint32_t now)
+{
+    uint32_t elapsed;
+    int reconnected = 0;
+
+    reconnect_lock(r);
+
+    if (r->state == MQTTNOX_RECONNECT_CONNECTING)
+    {
+        elapsed = now - r->lost_ms;
+
+        r->stats.reconnects++;
+        r->stats.last_ms = elapsed;
+        r->stats.total_ms += elapsed;
+        if (elapsed > r->stats.max_ms) {
+            r->stats.max_ms = elapsed;
+        }
+        reconnected = 1;
+    }
+
+    r->state = MQTTNOX_RECONNECT_IDLE;
+    r->attempt = 0;
+
+    reconnect_unlock(r);
+
+    return reconnected;
+}
+
+/**@brief Stops reconnecting, the application closed the connection */
+void mqttnox_reconnect_cancel(mqttnox_reconnect_t* r)
+{
+    reconnect_lock(r);
+    r->linked = 0;
+    r->state = MQTTNOX_RECONNECT_IDLE;
+    reconnect_unlock(r);
+}
+
+/**@brief Checks whether an attempt is due or has timed out
+*
+* @note An attempt that is due is started: the state moves on to waiting
+*       for CONNACK for MQTTNOX_RECONNECT_CONNACK_MS.
+*
+* @param[in]   r     reconnect state
+* @param[in]   now   mqttnox_hal_time_ms
+* @param[out]  wait  time until the next deadline, MQTTNOX_PROCESS_IDLE if none
+*
+* @return      MQTTNOX_RECONNECT_ACT_NONE, _CONNECT or _TIMEOUT
+*/
+int mqttnox_reconnect_poll(mqttnox_reconnect_t* r, uint32_t now, uint32_t* wait)
+{
+    int act = MQTTNOX_RECONNECT_ACT_NONE;
+    int32_t left;
+
+    *wait = MQTTNOX_PROCESS_IDLE;
+
+    reconnect_lock(r);
+
+    if (r->state != MQTTNOX_RECONNECT_IDLE)
+    {
+        left = (int32_t)(r->due_ms - now);
+
+        if (left > 0) {
+            *wait = (uint32_t)left;
+        }
+        else if (r->state == MQTTNOX_RECONNECT_WAITING) {
+            r->state = MQTTNOX_RECONNECT_CONNECTING;
+            r->due_ms = now + MQTTNOX_RECONNECT_CONNACK_MS;
+            r->stats.attempts++;
+            act = MQTTNOX_RECONNECT_ACT_CONNECT;
+        }
+        else {
+            act = MQTTNOX_RECONNECT_ACT_TIMEOUT;
+        }
+    }
+
+    reconnect_unlock(r);
+
+    return act;
+}
+
+/**@brief Wait before the next attempt, with full jitter
+*
+* @note Caller holds the lock, or owns the state
+*
+* @return      uniformly random between 0 and min_ms * 2^attempt, at most max_ms
+*/
+uint32_t mqttnox_reconnect_backoff(mqttnox_reconnect_t* r)
+{
+    uint64_t cap = (uint64_t)r->min_ms << ((r->attempt < 31) ? r->attempt : 31);
+
+    if (cap > r->max_ms) {
+        cap = r->max_ms;
+    }
+
+    if (r->attempt < 0xFFFF) {
+        r->attempt++;
+    }
+
+    /* Scaled rather than taken modulo, keeps the spread uniform */
+    return (uint32_t)(((uint64_t)reconnect_rand(r) * (cap + 1)) >> 32);
+}
+
+/**@brief Keeps a filter to subscribe to again after a reconnect
+*
+* @note A filter already kept has its QoS updated
+*
+* @return      non-zero on success, 0 if it is too long or no entry is free
+*/
+int mqttnox_reconnect_sub_add(mqttnox_reconnect_t* r, const char* topic, uint8_t qos)
+{
+    mqttnox_resub_t* free_sub = NULL;
+    size_t len = strlen(topic);
+    int ok = 0;
+    uint8_t i;
+
+    if (len == 0 || len > MQTTNOX_RESUB_TOPIC_MAX) {
+        return 0;
+    }
+
+    reconnect_lock(r);
+
+    for (i = 0; i < MQTTNOX_RESUB_MAX; i++)
+    {
+        if (r->subs[i].len == 0) {
+            if (free_sub == NULL) {
+                free_sub = &r->subs[i];
+            }
+        }
+        else if (r->subs[i].len == len && memcmp(r->subs[i].topic, topic, len) == 0) {
+            r->subs[i].qos = qos;
+            ok = 1;
+            break;
+        }
+    }
+
+    if (!ok && free_sub != NULL) {
+        memcpy(free_sub->topic, topic, len);
+        free_sub->len = (uint8_t)len;
+        free_sub->qos = qos;
+        ok = 1;
+    }
+
+    reconnect_unlock(r);
+
+    return ok;
+}
+
+/**@brief Forgets a filter, after an unsubscribe */
+void mqttnox_reconnect_sub_remove(mqttnox_reconnect_t* r, const char* topic)
+{
+    size_t len = strlen(topic);
+    uint8_t i;
+
+    reconnect_lock(r);
+
+    for (i = 0; i < MQTTNOX_RESUB_MAX; i++)
+    {
+        if (r->subs[i].len == len && memcmp(r->subs[i].topic, topic, len) == 0) {
+            r->subs[i].len = 0;
+            break;
+        }
+    }
+
+    reconnect_unlock(r);
+}
+
+/**@brief Forgets every filter, the broker starts a clean session */
+void mqttnox_reconnect_sub_clear(mqttnox_reconnect_t* r)
+{
+    uint8_t i;
+
+    reconnect_lock(r);
+
+    for (i = 0; i < MQTTNOX_RESUB_MAX; i++) {
+        r->subs[i].len = 0;
+    }
+
+    reconnect_unlock(r);
+}
+
+/**@brief Copies out the kept filters that fit one SUBSCRIBE
+*
+* @param[in]     r       reconnect state
+* @param[in,out] pos     entry to start from, 0 at first, advanced past the copied ones
+* @param[out]    topics  at least MQTTNOX_RESUB_MAX entries, pointing into buf
+* @param[out]    buf     at least MQTTNOX_TX_BUF_SIZE bytes for the topics
+*
+* @return      number of filters copied, 0 once all have been
+*/
+uint8_t mqttnox_reconnect_sub_copy(mqttnox_reconnect_t* r, uint8_t* pos, mqttnox_topic_sub_t* topics, char* buf)
+{
+    /* Packet identifier, then a length, the topic and the QoS per filter */
+    uint32_t body = MQTTNOX_PACKET_IDENT_BYTE_LEN;
+    uint32_t off = 0;
+    uint8_t n = 0;
+    uint8_t len;
+
+    reconnect_lock(r);
+
+    for (; *pos < MQTTNOX_RESUB_MAX; (*pos)++)
+    {
+        len = r->subs[*pos].len;
+        if (len == 0) {
+            continue;
+        }
+
+        if (body + MQTTNOX_LENGTH_BYTE_LEN + len + 1 > MQTTNOX_TX_BUF_SIZE - MQTTNOX_FIXED_HDR_MAX_LEN) {
+            break;
+        }
+        body += MQTTNOX_LENGTH_BYTE_LEN + len + 1;
+
+        memcpy(&buf[off], r->subs[*pos].topic, len);
+        buf[off + len] = '\0';
+
+        topics[n].topic = &buf[off];
+        topics[n].qos = (mqttnox_qos_t)r->subs[*pos].qos;
+        off += len + 1;
+        n++;
+    }
+
+    reconnect_unlock(r);
+
+    return n;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,76 @@
+/*****************************************************************************
+* Copyright (c) [2024] Argenox Technologies LLC
+* All rights reserved.
+*
+*
+*
+* NOTICE:  All information contained herein, source code, binaries and
+* derived works is, and remains the property of Argenox and its suppliers,
+* if any.  The intellectual and technical concepts contained
+* herein are proprietary to Argenox and its suppliers and may be covered
+* by U.S. and Foreign Patents, patents in process, and are protected by
+* trade secret or copyright law.
+*
+* Licensing of this software can be found in LICENSE
+*
+* THIS SOFTWARE IS PROVIDED BY ARGENOX "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ARGENOX LLC BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* CONTACT: info@argenox.com
+*
+* File:    mqttnox_reconnect.h
+* Summary: MQTTNox Automatic Reconnect
+*
+* Note: Internal to the library. Schedules reconnect attempts, keeps the
+*       subscriptions to restore and times how long reconnecting takes.
+*
+*/
+
+#ifndef _MQTTNOX_RECONNECT_H_
+#define _MQTTNOX_RECONNECT_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "mqttnox.h"
+
+/* States */
+#define MQTTNOX_RECONNECT_IDLE        0  /* Connected, or not reconnecting */
+#define MQTTNOX_RECONNECT_WAITING     1  /* Connection lost, next attempt at due_ms */
+#define MQTTNOX_RECONNECT_CONNECTING  2  /* Attempt made, CONNACK expected by due_ms */
+
+/* What mqttnox_reconnect_poll asks for */
+#define MQTTNOX_RECONNECT_ACT_NONE    0
+#define MQTTNOX_RECONNECT_ACT_CONNECT 1  /* Make an attempt now */
+#define MQTTNOX_RECONNECT_ACT_TIMEOUT 2  /* No CONNACK, give the attempt up */
+
+
+extern void mqttnox_reconnect_configure(mqttnox_reconnect_t* r, uint8_t enabled, uint32_t min_ms, uint32_t max_ms, const char* client_id, uint32_t now);
+extern void mqttnox_reconnect_linked(mqttnox_reconnect_t* r);
+extern int mqttnox_reconnect_lost(mqttnox_reconnect_t* r, uint32_t now, uint32_t* delay);
+extern void mqttnox_reconnect_defer(mqttnox_reconnect_t* r, uint32_t due_ms);
+extern int mqttnox_reconnect_done(mqttnox_reconnect_t* r, uint32_t now);
+extern void mqttnox_reconnect_cancel(mqttnox_reconnect_t* r);
+extern int mqttnox_reconnect_poll(mqttnox_reconnect_t* r, uint32_t now, uint32_t* wait);
+extern uint32_t mqttnox_reconnect_backoff(mqttnox_reconnect_t* r);
+extern int mqttnox_reconnect_sub_add(mqttnox_reconnect_t* r, const char* topic, uint8_t qos);
+extern void mqttnox_reconnect_sub_remove(mqttnox_reconnect_t* r, const char* topic);
+extern void mqttnox_reconnect_sub_clear(mqttnox_reconnect_t* r);
+extern uint8_t mqttnox_reconnect_sub_copy(mqttnox_reconnect_t* r, uint8_t* pos, mqttnox_topic_sub_t* topics, char* buf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _MQTTNOX_RECONNECT_H_ */
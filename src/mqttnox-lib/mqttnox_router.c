@@ -0,0 +1,452 @@
+/*****************************************************************************
+* Copyright (c) [2024] Argenox Technologies LLC
+* All rights reserved.
+*
+*
+*
+* NOTICE:  All information contained herein, source code, binaries and
+* derived works is, and remains the property of Argenox and its suppliers,
+* if any.  The intellectual and technical concepts contained
+* herein are proprietary to Argenox and its suppliers and may be covered
+* by U.S. and Foreign Patents, patents in process, and are protected by
+* trade secret or copyright law.
+*
+* Licensing of this software can be found in LICENSE
+*
+* THIS SOFTWARE IS PROVIDED BY ARGENOX "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ARGENOX LLC BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* CONTACT: info@argenox.com
+*
+* File:    mqttnox_router.c
+* Summary: MQTTNox Topic Router
+*
+* Note: A trie with one node per filter level. Named children are found
+*       through a hash table keyed on the parent node and the level, and
+*       each node links its '+' child directly, so matching a topic costs
+*       one lookup per level and path followed, however many filters are
+*       added. Routes ending in '#' hang off the node before it.
+*
+*       Topics are matched where they lie in the receive buffer, level by
+*       level, without being copied or terminated. Nodes come from memory
+*       given to mqttnox_router_init; routes are the caller's.
+*
+*       Routes are added and removed from any thread under a spin lock,
+*       which matching takes too. Handlers are called once it is released,
+*       so they may add and remove routes themselves.
+*
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* System Includes */
+#include <stdint.h>
+#include <string.h>
+
+/* Library Includes */
+#include "mqttnox_router.h"
+
+/* Routes collected for one message */
+typedef struct
+{
+    const char* topic;
+    uint32_t len;
+    uint8_t dollar;     /* Topic starts with '$', not matched by a leading wildcard [MQTT-4.7.2-1] */
+    uint32_t cnt;
+    mqttnox_route_cb_t handler[MQTTNOX_ROUTE_MATCH_MAX];
+    void* arg[MQTTNOX_ROUTE_MATCH_MAX];
+
+} router_match_t;
+
+static void router_lock(mqttnox_router_t* r)
+{
+    while (!mqttnox_atomic_cas(&r->lock, 0, 1)) {
+        mqttnox_atomic_relax();
+    }
+}
+
+static void router_unlock(mqttnox_router_t* r)
+{
+    mqttnox_atomic_store(&r->lock, 0);
+}
+
+/**@brief FNV-1a of a level, seeded with its parent */
+static uint32_t router_hash(uint32_t parent, const char* level, uint32_t len)
+{
+    uint32_t hash = 2166136261UL ^ (parent * 2654435761UL);
+    uint32_t i;
+
+    for (i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t)level[i]) * 16777619UL;
+    }
+
+    return hash;
+}
+
+/**@brief Finds the named child of a node
+*
+* @return      node index, 0 if there is none
+*/
+static uint32_t router_find(mqttnox_router_t* r, uint32_t parent, const char* level, uint32_t len, uint32_t hash)
+{
+    mqttnox_route_node_t* n;
+    uint32_t idx = r->bucket[hash & r->bucket_mask];
+
+    while (idx != 0)
+    {
+        n = &r->node[idx];
+        if (n->hash == hash && n->parent == parent && n->len == len && memcmp(n->level, level, len) == 0) {
+            return idx;
+        }
+        idx = n->chain;
+    }
+
+    return 0;
+}
+
+/**@brief Finds the child of a node for a filter level, adding it if needed
+*
+* @return      node index, 0 if no node is left
+*/
+static uint32_t router_child(mqttnox_router_t* r, uint32_t parent, const char* level, uint32_t len)
+{
+    mqttnox_route_node_t* n;
+    uint32_t hash = 0;
+    uint32_t idx;
+    uint8_t plus = (len == 1 && level[0] == '+');
+
+    if (plus) {
+        idx = r->node[parent].plus;
+    }
+    else {
+        hash = router_hash(parent, level, len);
+        idx = router_find(r, parent, level, len, hash);
+    }
+
+    if (idx != 0) {
+        return idx;
+    }
+
+    if (r->free_node != 0) {
+        idx = r->free_node;
+        r->free_node = r->node[idx].chain;
+    }
+    else if (r->node_used < r->node_cnt) {
+        idx = r->node_used++;
+    }
+    else {
+        return 0;
+    }
+
+    n = &r->node[idx];
+    memset(n, 0, sizeof(*n));
+    n->parent = parent;
+    n->hash = hash;
+    n->len = (uint8_t)len;
+    memcpy(n->level, level, len);
+
+    if (plus) {
+        r->node[parent].plus = idx;
+    }
+    else {
+        n->chain = r->bucket[hash & r->bucket_mask];
+        r->bucket[hash & r->bucket_mask] = idx;
+    }
+
+    r->node[parent].refs++;
+
+    return idx;
+}
+
+/**@brief Frees a node left with no children or routes, and its parents
+*        left the same way
+*/
+static void router_release(mqttnox_router_t* r, uint32_t idx)
+{
+    mqttnox_route_node_t* n;
+    uint32_t* link;
+    uint32_t parent;
+
+    while (idx != 0 && r->node[idx].refs == 0)
+    {
+        n = &r->node[idx];
+        parent = n->parent;
+
+        if (r->node[parent].plus == idx) {
+            r->node[parent].plus = 0;
+        }
+        else {
+            link = &r->bucket[n->hash & r->bucket_mask];
+            while (*link != idx) {
+                link = &r->node[*link].chain;
+            }
+            *link = n->chain;
+        }
+
+        n->chain = r->free_node;
+        r->free_node = idx;
+
+        r->node[parent].refs--;
+        idx = parent;
+    }
+}
+
+/**@brief Takes the handlers of a list of routes
+*/
+static void router_collect(mqttnox_router_t* r, mqttnox_route_t* route, router_match_t* m)
+{
+    for (; route != NULL; route = route->next)
+    {
+        if (m->cnt == MQTTNOX_ROUTE_MATCH_MAX) {
+            r->overflows++;
+            continue;
+        }
+
+        m->handler[m->cnt] = route->handler;
+        m->arg[m->cnt] = route->arg;
+        m->cnt++;
+    }
+}
+
+/**@brief Matches the topic from pos on against the filters below a node
+*
+* @param[in]   idx  node matched by the levels before pos
+* @param[in]   pos  start of the next level, past the end when none is left
+*/
+static void router_match(mqttnox_router_t* r, uint32_t idx, uint32_t pos, router_match_t* m)
+{
+    mqttnox_route_node_t* n = &r->node[idx];
+    const char* level;
+    const char* end;
+    uint32_t len;
+    uint32_t child;
+    uint8_t wild = !(idx == 0 && m->dollar);
+
+    /* '#' also matches the level before it [MQTT-4.7.1-2] */
+    if (wild && n->multi != NULL) {
+        router_collect(r, n->multi, m);
+    }
+
+    if (pos > m->len) {
+        router_collect(r, n->exact, m);
+        return;
+    }
+
+    level = &m->topic[pos];
+    end = (const char*)memchr(level, '/', m->len - pos);
+    len = (end != NULL) ? (uint32_t)(end - level) : m->len - pos;
+
+    if (len <= MQTTNOX_ROUTE_LEVEL_MAX) {
+        child = router_find(r, idx, level, len, router_hash(idx, level, len));
+        if (child != 0) {
+            router_match(r, child, pos + len + 1, m);
+        }
+    }
+
+    if (wild && n->plus != 0) {
+        router_match(r, n->plus, pos + len + 1, m);
+    }
+}
+
+/**@brief Sets up an empty router in the given memory
+*
+* @note MQTTNOX_ROUTER_MEM_SIZE gives the size for a number of nodes. The
+*       memory must stay valid and pointer aligned while the router is used.
+*
+* @return      MQTTNOX_RC_ERROR if size does not fit a single filter level
+*/
+mqttnox_rc_t mqttnox_router_init(mqttnox_router_t* r, void* mem, uint32_t size)
+{
+    uint32_t nodes = size / (uint32_t)(sizeof(mqttnox_route_node_t) + 2 * sizeof(uint32_t));
+    uint32_t buckets = 1;
+
+    memset(r, 0, sizeof(*r));
+
+    if (nodes < 2) {
+        return MQTTNOX_RC_ERROR;
+    }
+
+    /* At least a bucket per node keeps chains short once the nodes are out of cache */
+    while (buckets < nodes) {
+        buckets *= 2;
+    }
+
+    r->node = (mqttnox_route_node_t*)mem;
+    r->node_cnt = (size - buckets * (uint32_t)sizeof(uint32_t)) / (uint32_t)sizeof(mqttnox_route_node_t);
+    r->bucket = (uint32_t*)&r->node[r->node_cnt];
+    r->bucket_mask = buckets - 1;
+
+    memset(r->node, 0, sizeof(mqttnox_route_node_t));
+    memset(r->bucket, 0, buckets * sizeof(uint32_t));
+    r->node_used = 1;
+
+    mqttnox_atomic_store(&r->lock, 0);
+
+    return MQTTNOX_SUCCESS;
+}
+
+/**@brief Adds a route for a topic filter
+*
+* @note Several routes may share a filter, and a message is passed to every
+*       route matching it. Routes are matched against message topics only,
+*       the subscription is still made with mqttnox_subscribe.
+*
+* @param[in]   r        router
+* @param[in]   route    kept by the router until removed
+* @param[in]   filter   topic filter, '+' and '#' allowed
+* @param[in]   handler  called for matching messages
+* @param[in]   arg      passed to handler
+*
+* @return      MQTTNOX_RC_ERROR_BAD_TOPIC for an invalid filter or a level
+*              longer than MQTTNOX_ROUTE_LEVEL_MAX,
+*              MQTTNOX_RC_ERROR_ROUTER_FULL if no node is left
+*/
+mqttnox_rc_t mqttnox_router_add(mqttnox_router_t* r, mqttnox_route_t* route, const char* filter,
+                                mqttnox_route_cb_t handler, void* arg)
+{
+    mqttnox_route_t** list;
+    const char* level = filter;
+    const char* end;
+    uint32_t len;
+    uint32_t idx = 0;
+    uint32_t child;
+    uint8_t multi = 0;
+
+    if (route == NULL || handler == NULL || filter == NULL || filter[0] == '\0' || route->pprev != NULL) {
+        return MQTTNOX_RC_ERROR_BAD_TOPIC;
+    }
+
+    /* Check every level before the trie is touched */
+    for (;;)
+    {
+        end = strchr(level, '/');
+        len = (end != NULL) ? (uint32_t)(end - level) : (uint32_t)strlen(level);
+
+        if (memchr(level, '#', len) != NULL) {
+            if (len != 1 || end != NULL) {
+                return MQTTNOX_RC_ERROR_BAD_TOPIC;
+            }
+            multi = 1;
+        }
+        else if (memchr(level, '+', len) != NULL && len != 1) {
+            return MQTTNOX_RC_ERROR_BAD_TOPIC;
+        }
+        else if (len > MQTTNOX_ROUTE_LEVEL_MAX) {
+            return MQTTNOX_RC_ERROR_BAD_TOPIC;
+        }
+
+        if (end == NULL) {
+            break;
+        }
+        level = end + 1;
+    }
+
+    router_lock(r);
+
+    for (level = filter; ; level = end + 1)
+    {
+        end = strchr(level, '/');
+        len = (end != NULL) ? (uint32_t)(end - level) : (uint32_t)strlen(level);
+
+        if (multi && end == NULL) {
+            break;
+        }
+
+        child = router_child(r, idx, level, len);
+        if (child == 0) {
+            router_release(r, idx);
+            router_unlock(r);
+            return MQTTNOX_RC_ERROR_ROUTER_FULL;
+        }
+        idx = child;
+
+        if (end == NULL) {
+            break;
+        }
+    }
+
+    list = multi ? &r->node[idx].multi : &r->node[idx].exact;
+
+    route->handler = handler;
+    route->arg = arg;
+    route->node = idx;
+    route->next = *list;
+    if (route->next != NULL) {
+        route->next->pprev = &route->next;
+    }
+    *list = route;
+    route->pprev = list;
+
+    r->node[idx].refs++;
+
+    router_unlock(r);
+
+    return MQTTNOX_SUCCESS;
+}
+
+/**@brief Removes a route, freeing the levels no other route needs
+*
+* @note A message matched on another thread just before may still reach
+*       the handler once
+*/
+void mqttnox_router_remove(mqttnox_router_t* r, mqttnox_route_t* route)
+{
+    router_lock(r);
+
+    if (route->pprev != NULL)
+    {
+        *route->pprev = route->next;
+        if (route->next != NULL) {
+            route->next->pprev = route->pprev;
+        }
+        route->pprev = NULL;
+
+        r->node[route->node].refs--;
+        router_release(r, route->node);
+    }
+
+    router_unlock(r);
+}
+
+/**@brief Passes a received message to the handlers of the routes it matches
+*
+* @return      number of handlers called
+*/
+uint32_t mqttnox_router_dispatch(mqttnox_router_t* r, mqttnox_client_t* c, const received_evt_t* msg)
+{
+    router_match_t m;
+    uint32_t i;
+
+    if (msg->topic_len == 0) {
+        return 0;
+    }
+
+    m.topic = msg->topic;
+    m.len = msg->topic_len;
+    m.dollar = (msg->topic[0] == '$');
+    m.cnt = 0;
+
+    router_lock(r);
+    router_match(r, 0, 0, &m);
+    router_unlock(r);
+
+    for (i = 0; i < m.cnt; i++) {
+        m.handler[i](c, msg, m.arg[i]);
+    }
+
+    return m.cnt;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,60 @@
+/*****************************************************************************
+* Copyright (c) [2024] Argenox Technologies LLC
+* All rights reserved.
+*
+*
+*
+* NOTICE:  All information contained herein, source code, binaries and
+* derived works is, and remains the property of Argenox and its suppliers,
+* if any.  The intellectual and technical concepts contained
+* herein are proprietary to Argenox and its suppliers and may be covered
+* by U.S. and Foreign Patents, patents in process, and are protected by
+* trade secret or copyright law.
+*
+* Licensing of this software can be found in LICENSE
+*
+* THIS SOFTWARE IS PROVIDED BY ARGENOX "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ARGENOX LLC BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* CONTACT: info@argenox.com
+*
+* File:    mqttnox_router.h
+* Summary: MQTTNox Topic Router
+*
+* Note: Routes received messages to handlers by topic filter. Set up by
+*       the application and passed to the clients it serves in
+*       mqttnox_client_conf_t.
+*
+*/
+
+#ifndef _MQTTNOX_ROUTER_H_
+#define _MQTTNOX_ROUTER_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "mqttnox.h"
+
+
+extern mqttnox_rc_t mqttnox_router_init(mqttnox_router_t* r, void* mem, uint32_t size);
+extern mqttnox_rc_t mqttnox_router_add(mqttnox_router_t* r, mqttnox_route_t* route, const char* filter,
+                                       mqttnox_route_cb_t handler, void* arg);
+extern void mqttnox_router_remove(mqttnox_router_t* r, mqttnox_route_t* route);
+extern uint32_t mqttnox_router_dispatch(mqttnox_router_t* r, mqttnox_client_t* c, const received_evt_t* msg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _MQTTNOX_ROUTER_H_ */
@@ -0,0 +1,669 @@
+/*****************************************************************************
+* Copyright (c) [2024] Argenox Technologies LLC
+* All rights reserved.
+*
+*
+*
+* NOTICE:  All information contained herein, source code, binaries and
+* derived works is, and remains the property of Argenox and its suppliers,
+* if any.  The intellectual and technical concepts contained
+* herein are proprietary to Argenox and its suppliers and may be covered
+* by U.S. and Foreign Patents, patents in process, and are protected by
+* trade secret or copyright law.
+*
+* Licensing of this software can be found in LICENSE
+*
+* THIS SOFTWARE IS PROVIDED BY ARGENOX "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ARGENOX LLC BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* CONTACT: info@argenox.com
+*
+* File:    mqttnox_store.c
+* Summary: MQTTNox Session Store
+*
+* Note: The store is one file mapped into memory. Messages are appended as
+*       records holding the encoded PUBLISH, and only a record's state
+*       byte changes afterwards, when the message is released or
+*       acknowledged. Records are 8 byte aligned and the length is written
+*       last; the file beyond the last record is all zeros, so opening it
+*       again walks the records until a zero length. A small map from
+*       packet identifier to record offset finds a record on each ack.
+*
+*       Once the file is full the live records are copied to a new file
+*       which is renamed over the old one, so a crash during compaction
+*       leaves one complete file or the other.
+*
+*       Appends and acks share the store under a spin lock. With
+*       MQTTNOX_STORE_SYNC_ALWAYS the record is synced while holding it,
+*       other publishers wait for the disk.
+*
+*/
+
+#if defined(__linux__)
+#define _GNU_SOURCE /* O_CLOEXEC, ftruncate */
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* System Includes */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* Library Includes */
+#include "mqttnox_store.h"
+#include "mqttnox_inflight.h"
+
+#define STORE_MAGIC     0x534E514DUL    /* "MQNS" */
+#define STORE_VERSION   1
+#define STORE_DATA_OFF  64              /* First record */
+#define STORE_SIZE_MIN  4096
+#define STORE_MASK      (MQTTNOX_INFLIGHT_SLOTS - 1)
+
+#define STORE_REC_SIZE(len)  ((sizeof(store_rec_t) + (len) + 7) & ~(uint32_t)7)
+
+/* MQTT PUBLISH control packet type */
+#define STORE_PKT_PUBLISH    3
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+
+} store_hdr_t;
+
+typedef struct
+{
+    uint32_t len;       /* Packet length, written last, 0 ends the records */
+    uint16_t ident;
+    uint8_t qos;
+    uint8_t state;      /* MQTTNOX_INFLIGHT_PUBLISHED or _RELEASED, 0 once acknowledged */
+
+} store_rec_t;
+
+static void store_lock(mqttnox_store_t* s)
+{
+    while (!mqttnox_atomic_cas(&s->lock, 0, 1)) {
+        mqttnox_atomic_relax();
+    }
+}
+
+static void store_unlock(mqttnox_store_t* s)
+{
+    mqttnox_atomic_store(&s->lock, 0);
+}
+
+static store_rec_t* store_rec(uint8_t* base, uint32_t off)
+{
+    return (store_rec_t*)(void*)(base + off);
+}
+
+/**@brief Maps path, creating it or growing it to size
+*
+* @param[in,out] size   wanted size, set to the size mapped
+* @param[out]    fd     descriptor of the file
+*
+* @return      base of the mapping, NULL on failure or where files cannot
+*              be mapped
+*/
+static uint8_t* store_map(const char* path, uint32_t* size, int* fd)
+{
+#if defined(__linux__)
+    struct stat st;
+    uint8_t* base;
+
+    *fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (*fd < 0) {
+        return NULL;
+    }
+
+    /* A larger existing file keeps its size, it may be full of records */
+    if (fstat(*fd, &st) != 0 || st.st_size > 0xFFFFFFFFLL ||
+        ((uint64_t)st.st_size < *size && ftruncate(*fd, *size) != 0)) {
+        close(*fd);
+        return NULL;
+    }
+
+    if ((uint64_t)st.st_size > *size) {
+        *size = (uint32_t)st.st_size;
+    }
+
+    base = (uint8_t*)mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+    if (base == (uint8_t*)MAP_FAILED) {
+        close(*fd);
+        return NULL;
+    }
+
+    return base;
+#else
+    (void)path;
+    (void)size;
+    *fd = -1;
+    return NULL;
+#endif
+}
+
+static void store_unmap(uint8_t* base, uint32_t size, int fd)
+{
+#if defined(__linux__)
+    munmap(base, size);
+    close(fd);
+#else
+    (void)base;
+    (void)size;
+    (void)fd;
+#endif
+}
+
+/**@brief Writes len bytes at off in the mapping to the file and waits
+*/
+static void store_flush(uint8_t* base, uint32_t off, uint32_t len)
+{
+#if defined(__linux__)
+    uint32_t page = (uint32_t)sysconf(_SC_PAGESIZE);
+    uint32_t start = off & ~(page - 1);
+
+    msync(base + start, (off - start) + len, MS_SYNC);
+#else
+    (void)base;
+    (void)off;
+    (void)len;
+#endif
+}
+
+/**@brief Applies the sync policy after the record at off was written
+*/
+static void store_sync(mqttnox_store_t* s, uint32_t off, uint32_t len)
+{
+    if (s->sync == MQTTNOX_STORE_SYNC_ALWAYS) {
+        store_flush(s->base, off, len);
+    }
+    else if (s->sync == MQTTNOX_STORE_SYNC_INTERVAL && ++s->unsynced >= s->sync_interval) {
+        /* Only dirty pages are written */
+        store_flush(s->base, 0, s->tail);
+        s->unsynced = 0;
+    }
+}
+
+/**@brief Finds the index slot of ident, same scheme as the in-flight table
+*
+* @return      slot index, or -1 if ident has no live record
+*/
+static int32_t store_find(mqttnox_store_t* s, uint16_t ident)
+{
+    uint32_t idx = ident & STORE_MASK;
+
+    while (s->index[idx].ident != 0)
+    {
+        if (s->index[idx].ident == ident) {
+            return (int32_t)idx;
+        }
+        idx = (idx + 1) & STORE_MASK;
+    }
+
+    return -1;
+}
+
+/**@brief Indexes the record of ident at off, replacing an older one
+*
+* @return      non-zero on success, 0 if the index is full
+*/
+static int store_index(mqttnox_store_t* s, uint16_t ident, uint32_t off)
+{
+    uint32_t idx = ident & STORE_MASK;
+
+    while (s->index[idx].ident != 0)
+    {
+        if (s->index[idx].ident == ident) {
+            /* Never acknowledged, the identifier now carries a new message */
+            store_rec(s->base, s->index[idx].off)->state = 0;
+            s->index[idx].off = off;
+            return 1;
+        }
+        idx = (idx + 1) & STORE_MASK;
+    }
+
+    if (s->live >= MQTTNOX_INFLIGHT_WINDOW_MAX) {
+        return 0;
+    }
+
+    s->index[idx].ident = ident;
+    s->index[idx].off = off;
+    s->live++;
+
+    return 1;
+}
+
+static void store_unindex(mqttnox_store_t* s, uint32_t found)
+{
+    uint32_t hole = found;
+    uint32_t idx = (hole + 1) & STORE_MASK;
+    uint32_t home;
+
+    while (s->index[idx].ident != 0)
+    {
+        home = s->index[idx].ident & STORE_MASK;
+
+        if (((idx - home) & STORE_MASK) >= ((idx - hole) & STORE_MASK)) {
+            s->index[hole] = s->index[idx];
+            hole = idx;
+        }
+        idx = (idx + 1) & STORE_MASK;
+    }
+
+    s->index[hole].ident = 0;
+    s->live--;
+}
+
+/**@brief Checks that a record read back from the file is complete
+*/
+static int store_rec_valid(mqttnox_store_t* s, uint32_t off)
+{
+    store_rec_t* rec = store_rec(s->base, off);
+
+    return rec->len >= 2 &&
+           rec->len <= s->size - off - sizeof(store_rec_t) &&
+           rec->ident != 0 &&
+           (rec->qos == MQTTNOX_QOS1_AT_LEAST_ONCE_DELIV || rec->qos == MQTTNOX_QOS2_EXACTLY_ONCE_DELIV) &&
+           rec->state <= MQTTNOX_INFLIGHT_RELEASED &&
+           (s->base[off + sizeof(store_rec_t)] >> 4) == STORE_PKT_PUBLISH;
+}
+
+/**@brief Copies the live records to a new file and swaps it in
+*
+* @note Refused while the store is pinned, \see mqttnox_store_pin
+*
+* @return      non-zero on success
+*/
+static int store_compact(mqttnox_store_t* s)
+{
+#if defined(__linux__)
+    char tmp[MQTTNOX_STORE_PATH_MAX + 4];
+    store_rec_t* rec;
+    uint8_t* base;
+    uint32_t size = s->size;
+    uint32_t pos = STORE_DATA_OFF;
+    uint32_t off;
+    uint32_t rec_size;
+    int32_t idx;
+    int fd;
+
+    if (s->pinned != 0) {
+        return 0;
+    }
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", s->path);
+    unlink(tmp);
+
+    base = store_map(tmp, &size, &fd);
+    if (base == NULL) {
+        return 0;
+    }
+
+    memcpy(base, s->base, STORE_DATA_OFF);
+
+    for (off = STORE_DATA_OFF; off < s->tail; off += rec_size)
+    {
+        rec = store_rec(s->base, off);
+        rec_size = STORE_REC_SIZE(rec->len);
+
+        if (rec->state != 0) {
+            memcpy(base + pos, rec, rec_size);
+            pos += rec_size;
+        }
+    }
+
+    if (s->sync != MQTTNOX_STORE_SYNC_NONE) {
+        store_flush(base, 0, pos);
+    }
+
+    if (rename(tmp, s->path) != 0) {
+        store_unmap(base, size, fd);
+        unlink(tmp);
+        return 0;
+    }
+
+    /* Point the index at the records' new places */
+    for (off = STORE_DATA_OFF; off < pos; off += STORE_REC_SIZE(rec->len))
+    {
+        rec = store_rec(base, off);
+
+        idx = store_find(s, rec->ident);
+        if (idx >= 0) {
+            s->index[idx].off = off;
+        }
+    }
+
+    store_unmap(s->base, s->size, s->fd);
+
+    s->base = base;
+    s->fd = fd;
+    s->tail = pos;
+    s->unsynced = 0;
+    s->compactions++;
+
+    return 1;
+#else
+    (void)s;
+    return 0;
+#endif
+}
+
+/**@brief Opens the store at path, creating it if needed
+*
+* @note Not thread safe, call only while no other thread uses the client.
+*       The records found stay live until released or completed.
+*
+* @param[in]   s              store, closed
+* @param[in]   path           file, at most MQTTNOX_STORE_PATH_MAX - 1 characters
+* @param[in]   size           file size, an existing larger file keeps its size
+* @param[in]   sync           \see mqttnox_store_sync_t
+* @param[in]   sync_interval  records between syncs with MQTTNOX_STORE_SYNC_INTERVAL
+*
+* @return      non-zero on success, 0 if the file cannot be mapped or is
+*              not a store
+*/
+int mqttnox_store_open(mqttnox_store_t* s, const char* path, uint32_t size, mqttnox_store_sync_t sync, uint32_t sync_interval)
+{
+    store_hdr_t* hdr;
+    store_rec_t* rec;
+    uint32_t off;
+    size_t path_len = strlen(path);
+
+    if (path_len == 0 || path_len >= sizeof(s->path)) {
+        return 0;
+    }
+
+    memset(s, 0, sizeof(*s));
+    memcpy(s->path, path, path_len + 1);
+
+    s->size = (size < STORE_SIZE_MIN) ? STORE_SIZE_MIN : (size & ~(uint32_t)7);
+    s->sync = (uint8_t)sync;
+    s->sync_interval = (sync_interval == 0) ? 1 : sync_interval;
+
+    s->base = store_map(path, &s->size, &s->fd);
+    if (s->base == NULL) {
+        return 0;
+    }
+
+    hdr = (store_hdr_t*)(void*)s->base;
+
+    if (hdr->magic == 0) {
+        hdr->magic = STORE_MAGIC;
+        hdr->version = STORE_VERSION;
+    }
+    else if (hdr->magic != STORE_MAGIC || hdr->version != STORE_VERSION) {
+        mqttnox_store_close(s);
+        return 0;
+    }
+
+    for (off = STORE_DATA_OFF; off + sizeof(store_rec_t) <= s->size; off += STORE_REC_SIZE(rec->len))
+    {
+        rec = store_rec(s->base, off);
+
+        if (rec->len == 0 || !store_rec_valid(s, off)) {
+            break;
+        }
+
+        if (rec->state != 0 && !store_index(s, rec->ident, off)) {
+            /* Written with a larger in-flight table */
+            mqttnox_store_close(s);
+            return 0;
+        }
+    }
+
+    s->tail = off;
+
+    /* A record torn by a crash is dropped, nothing after it may look valid */
+    if (s->tail + sizeof(store_rec_t) <= s->size && store_rec(s->base, s->tail)->len != 0) {
+        memset(s->base + s->tail, 0, s->size - s->tail);
+    }
+
+    return 1;
+}
+
+/**@brief Changes the sync policy of an open store
+*/
+void mqttnox_store_set_sync(mqttnox_store_t* s, mqttnox_store_sync_t sync, uint32_t sync_interval)
+{
+    store_lock(s);
+    s->sync = (uint8_t)sync;
+    s->sync_interval = (sync_interval == 0) ? 1 : sync_interval;
+    s->unsynced = 0;
+    store_unlock(s);
+}
+
+/**@brief Unmaps the store, the records stay in the file
+*/
+void mqttnox_store_close(mqttnox_store_t* s)
+{
+    if (s->base == NULL) {
+        return;
+    }
+
+    if (s->sync != MQTTNOX_STORE_SYNC_NONE) {
+        store_flush(s->base, 0, s->tail);
+    }
+
+    store_unmap(s->base, s->size, s->fd);
+    s->base = NULL;
+    s->fd = -1;
+}
+
+/**@brief Drops every record, for a clean session
+*
+* @note Not thread safe, call only while no other thread uses the client
+*/
+void mqttnox_store_reset(mqttnox_store_t* s)
+{
+    if (s->base == NULL) {
+        return;
+    }
+
+    memset(s->base + STORE_DATA_OFF, 0, s->tail - STORE_DATA_OFF);
+    memset(s->index, 0, sizeof(s->index));
+
+    s->tail = STORE_DATA_OFF;
+    s->live = 0;
+
+    if (s->sync != MQTTNOX_STORE_SYNC_NONE) {
+        store_flush(s->base, 0, s->size);
+    }
+    s->unsynced = 0;
+}
+
+/**@brief Records a message before it is sent
+*
+* @note Compacts the file when the record does not fit.
+*
+* @param[in]   s        store
+* @param[in]   ident    packet identifier of the message
+* @param[in]   qos      1 or 2
+* @param[in]   iov      the encoded PUBLISH packet
+* @param[in]   iov_cnt  number of pieces
+*
+* @return      non-zero on success, 0 if the store is closed or full
+*/
+int mqttnox_store_append(mqttnox_store_t* s, uint16_t ident, uint8_t qos, const mqttnox_iovec_t* iov, uint8_t iov_cnt)
+{
+    store_rec_t* rec;
+    uint32_t len = 0;
+    uint32_t off;
+    uint32_t pos;
+    uint8_t i;
+
+    for (i = 0; i < iov_cnt; i++) {
+        len += iov[i].len;
+    }
+
+    store_lock(s);
+
+    if (s->base == NULL || len > s->size - STORE_DATA_OFF - sizeof(store_rec_t)) {
+        store_unlock(s);
+        return 0;
+    }
+
+    if (STORE_REC_SIZE(len) > s->size - s->tail &&
+        (!store_compact(s) || STORE_REC_SIZE(len) > s->size - s->tail)) {
+        store_unlock(s);
+        return 0;
+    }
+
+    off = s->tail;
+    if (!store_index(s, ident, off)) {
+        store_unlock(s);
+        return 0;
+    }
+
+    rec = store_rec(s->base, off);
+    rec->ident = ident;
+    rec->qos = qos;
+    rec->state = MQTTNOX_INFLIGHT_PUBLISHED;
+
+    pos = off + sizeof(store_rec_t);
+    for (i = 0; i < iov_cnt; i++) {
+        memcpy(s->base + pos, iov[i].data, iov[i].len);
+        pos += iov[i].len;
+    }
+
+    /* The length makes the record visible, it goes in last */
+    mqttnox_atomic_fence();
+    ((volatile store_rec_t*)rec)->len = len;
+
+    s->tail = off + STORE_REC_SIZE(len);
+    store_sync(s, off, sizeof(store_rec_t) + len);
+
+    store_unlock(s);
+
+    return 1;
+}
+
+/**@brief Notes that PUBREL is being sent for a QoS 2 message
+*/
+void mqttnox_store_release(mqttnox_store_t* s, uint16_t ident)
+{
+    store_rec_t* rec;
+    int32_t idx;
+
+    store_lock(s);
+
+    idx = (s->base != NULL) ? store_find(s, ident) : -1;
+    if (idx >= 0) {
+        rec = store_rec(s->base, s->index[idx].off);
+        rec->state = MQTTNOX_INFLIGHT_RELEASED;
+        store_sync(s, s->index[idx].off, sizeof(store_rec_t));
+    }
+
+    store_unlock(s);
+}
+
+/**@brief Marks a message acknowledged or abandoned, its record is dropped
+*        at the next compaction
+*/
+void mqttnox_store_complete(mqttnox_store_t* s, uint16_t ident)
+{
+    uint32_t off;
+    int32_t idx;
+
+    store_lock(s);
+
+    idx = (s->base != NULL) ? store_find(s, ident) : -1;
+    if (idx >= 0) {
+        off = s->index[idx].off;
+        store_rec(s->base, off)->state = 0;
+        store_unindex(s, (uint32_t)idx);
+        store_sync(s, off, sizeof(store_rec_t));
+    }
+
+    store_unlock(s);
+}
+
+/**@brief Keeps the mapping and the record positions in place
+*
+* @note Until the matching mqttnox_store_unpin no compaction runs, an append
+*       that does not fit in the space left fails instead.
+*/
+void mqttnox_store_pin(mqttnox_store_t* s)
+{
+    store_lock(s);
+    s->pinned++;
+    store_unlock(s);
+}
+
+/**@brief Ends a mqttnox_store_pin
+*/
+void mqttnox_store_unpin(mqttnox_store_t* s)
+{
+    store_lock(s);
+    s->pinned--;
+    store_unlock(s);
+}
+
+/**@brief Walks the live records in the order they were appended
+*
+* @note rec->pkt points into the mapping and stays valid until the next
+*       append, which may compact the file. Pin the store to walk it while
+*       other threads append. The record is shared, write it only through
+*       the store.
+*
+* @param[in]   s     store
+* @param[in]   pos   0 for the first record, then the value returned for
+*                    the previous one
+* @param[out]  rec   the record
+*
+* @return      position to pass for the next record, 0 when there are no more
+*/
+uint32_t mqttnox_store_next(mqttnox_store_t* s, uint32_t pos, mqttnox_store_rec_t* rec)
+{
+    store_rec_t* r;
+    uint32_t next = 0;
+
+    store_lock(s);
+
+    if (s->base != NULL)
+    {
+        if (pos < STORE_DATA_OFF) {
+            pos = STORE_DATA_OFF;
+        }
+
+        for (; pos < s->tail; pos += STORE_REC_SIZE(r->len))
+        {
+            r = store_rec(s->base, pos);
+
+            if (r->state != 0) {
+                rec->ident = r->ident;
+                rec->qos = r->qos;
+                rec->state = r->state;
+                rec->len = r->len;
+                rec->pkt = s->base + pos + sizeof(store_rec_t);
+                next = pos + STORE_REC_SIZE(r->len);
+                break;
+            }
+        }
+    }
+
+    store_unlock(s);
+
+    return next;
+}
+
+#ifdef __cplusplus
+}
+#endif
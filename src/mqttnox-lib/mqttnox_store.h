@@ -0,0 +1,76 @@
+/*****************************************************************************
+* Copyright (c) [2024] Argenox Technologies LLC
+* All rights reserved.
+*
+*
+*
+* NOTICE:  All information contained herein, source code, binaries and
+* derived works is, and remains the property of Argenox and its suppliers,
+* if any.  The intellectual and technical concepts contained
+* herein are proprietary to Argenox and its suppliers and may be covered
+* by U.S. and Foreign Patents, patents in process, and are protected by
+* trade secret or copyright law.
+*
+* Licensing of this software can be found in LICENSE
+*
+* THIS SOFTWARE IS PROVIDED BY ARGENOX "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ARGENOX LLC BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* CONTACT: info@argenox.com
+*
+* File:    mqttnox_store.h
+* Summary: MQTTNox Session Store
+*
+* Note: Internal to the library. Keeps the QoS 1 and 2 messages awaiting
+*       acknowledgement in a file, so a restarted client can resend them.
+*
+*/
+
+#ifndef _MQTTNOX_STORE_H_
+#define _MQTTNOX_STORE_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "mqttnox.h"
+#include "mqttnox_tal.h"
+
+/* A stored message, \see mqttnox_store_next */
+typedef struct
+{
+    uint16_t ident;
+    uint8_t qos;
+    uint8_t state;      /* MQTTNOX_INFLIGHT_PUBLISHED or MQTTNOX_INFLIGHT_RELEASED */
+    uint32_t len;
+    uint8_t* pkt;       /* The PUBLISH packet, inside the mapping */
+
+} mqttnox_store_rec_t;
+
+
+extern int mqttnox_store_open(mqttnox_store_t* s, const char* path, uint32_t size, mqttnox_store_sync_t sync, uint32_t sync_interval);
+extern void mqttnox_store_set_sync(mqttnox_store_t* s, mqttnox_store_sync_t sync, uint32_t sync_interval);
+extern void mqttnox_store_close(mqttnox_store_t* s);
+extern void mqttnox_store_reset(mqttnox_store_t* s);
+extern int mqttnox_store_append(mqttnox_store_t* s, uint16_t ident, uint8_t qos, const mqttnox_iovec_t* iov, uint8_t iov_cnt);
+extern void mqttnox_store_release(mqttnox_store_t* s, uint16_t ident);
+extern void mqttnox_store_complete(mqttnox_store_t* s, uint16_t ident);
+extern void mqttnox_store_pin(mqttnox_store_t* s);
+extern void mqttnox_store_unpin(mqttnox_store_t* s);
+extern uint32_t mqttnox_store_next(mqttnox_store_t* s, uint32_t pos, mqttnox_store_rec_t* rec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _MQTTNOX_STORE_H_ */
@@ -45,16 +45,88 @@ extern "C" {
 
 /* APIs which must be implemented by the target platform */
 
-typedef void (*mqttnox_tcp_rcv_t)(mqttnox_client_t* c, uint8_t * data, uint16_t len);
+/* Version of the TAL contract below. Every call carries the client it acts
+   on, and any per-connection state the TAL needs is kept in c->tal_ctx,
+   so a TAL must not rely on globals for a connection.
+
+   Version 1: single connection per process, no client handle
+   Version 2: client handle passed to every connection call
+   Version 3: adds mqttnox_tcp_sendv for scatter-gather sends
+   Version 4: the receive callback is given only the newly received bytes
+   Version 5: 32-bit lengths for send and receive
+   Version 6: adds mqttnox_hal_time_ms, a monotonic clock
+   Version 7: the TAL reports connections closed by the peer
+   Version 8: adds mqttnox_tcp_deinit, releasing c->tal_ctx
+   Version 9: adds mqttnox_tcp_connect_async for reconnects */
+#define MQTTNOX_TAL_API_VERSION 9
+
+/* Maximum number of segments the library passes to mqttnox_tcp_sendv */
+#define MQTTNOX_TCP_IOV_MAX     8
+
+/** One segment of a scatter-gather send */
+typedef struct
+{
+    const uint8_t* data;
+    uint32_t len;
+
+} mqttnox_iovec_t;
+
+/* Receive callback. data/len are the bytes received since the last call;
+   the library keeps any partial packet itself. Receiving directly into
+   c->rcv_buf + c->rcv_offset (up to c->rcv_buf_size) lets the library
+   resume a partial packet without copying it. */
+typedef void (*mqttnox_tcp_rcv_t)(mqttnox_client_t* c, uint8_t * data, uint32_t len);
 
 
 extern int mqttnox_tcp_init(mqttnox_client_t* c, mqttnox_tcp_rcv_t rcv_cback);
-extern int mqttnox_tcp_connect(char* addr, int port);
-extern int mqttnox_tcp_send(uint8_t * data, uint16_t len);
+extern int mqttnox_tcp_connect(mqttnox_client_t* c, char* addr, int port);
+
+/* Results of mqttnox_tcp_connect_async besides 0, connected, and -1, failed */
+#define MQTTNOX_TCP_CONNECT_PENDING  1  /* Completes with mqttnox_tcp_connected */
+#define MQTTNOX_TCP_CONNECT_BUSY     2  /* The last connection is still closing */
+
+/* Connect made for a reconnect on the timer thread, which serves other
+   clients too and must not wait on the network. A TAL with its own thread
+   starts the connect and returns MQTTNOX_TCP_CONNECT_PENDING; that thread
+   then calls mqttnox_tcp_connected, unless mqttnox_tcp_disconnect
+   abandoned the connect first. Any other TAL may connect as
+   mqttnox_tcp_connect does and return its result */
+extern int mqttnox_tcp_connect_async(mqttnox_client_t* c, char* addr, int port);
+extern int mqttnox_tcp_send(mqttnox_client_t* c, uint8_t * data, uint32_t len);
+extern int mqttnox_tcp_sendv(mqttnox_client_t* c, const mqttnox_iovec_t* iov, uint8_t iov_cnt);
 extern int mqttnox_tcp_receive_thread(void* ptr);
-extern int mqttnox_tcp_disconnect(void);
-extern void mqttnox_wait_thread(void);
+extern void mqttnox_wait_thread(mqttnox_client_t* c);
+
+/* Also called from the timer thread, \see mqttnox_process, while the
+   receive thread may be delivering. A TAL with its own receive thread
+   hands the close to that thread rather than closing the socket under it,
+   and mqttnox_tcp_connect waits for a close still in progress */
+extern int mqttnox_tcp_disconnect(mqttnox_client_t* c);
+
+/* Called from mqttnox_deinit. Closes the connection if it is still open,
+   waits for it and frees c->tal_ctx, which mqttnox_tcp_init allocates
+   again on the next use */
+extern void mqttnox_tcp_deinit(mqttnox_client_t* c);
 extern void mqttnox_hal_debug_printf(const char* str);
+
+/* Milliseconds from any fixed point, never going backwards. Wraps after
+   49 days, the library only compares differences */
+extern uint32_t mqttnox_hal_time_ms(void);
+
+/* Library receive entry point, the callback the library passes to
+   mqttnox_tcp_init. Exposed so benchmarks can drive the decoder directly */
+extern void mqttnox_tcp_rcv_func(mqttnox_client_t* c, uint8_t * data, uint32_t len);
+
+/* Library entry point the TAL calls once a connection has been closed by
+   the peer or has failed, but not after mqttnox_tcp_disconnect. The
+   connection is already closed, so the library may connect again */
+extern void mqttnox_tcp_closed(mqttnox_client_t* c);
+
+/* Library entry point the TAL calls once a connect that returned
+   MQTTNOX_TCP_CONNECT_PENDING is up, ok non-zero, or has failed. The
+   library sends on the connection from the TAL's thread */
+extern void mqttnox_tcp_connected(mqttnox_client_t* c, int ok);
+
 #ifdef __cplusplus
 }
 #endif
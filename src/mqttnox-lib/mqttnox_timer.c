@@ -0,0 +1,452 @@
+/*****************************************************************************
+* Copyright (c) [2024] Argenox Technologies LLC
+* All rights reserved.
+*
+*
+*
+* NOTICE:  All information contained herein, source code, binaries and
+* derived works is, and remains the property of Argenox and its suppliers,
+* if any.  The intellectual and technical concepts contained
+* herein are proprietary to Argenox and its suppliers and may be covered
+* by U.S. and Foreign Patents, patents in process, and are protected by
+* trade secret or copyright law.
+*
+* Licensing of this software can be found in LICENSE
+*
+* THIS SOFTWARE IS PROVIDED BY ARGENOX "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ARGENOX LLC BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* CONTACT: info@argenox.com
+*
+* File:    mqttnox_timer.c
+* Summary: MQTTNox Timer Wheel
+*
+* Note: Hashed hierarchical wheel [Varghese & Lauck]. A timer goes into the
+*       level whose slots are the coarsest that still tell its expiry
+*       apart from now, hashed on the matching bits of its expiry, and
+*       each slot is a doubly linked list, so arming and stopping are O(1).
+*       When the wheel reaches a slot of an upper level its timers are
+*       spread over the levels below, at most once per level, so expiring
+*       is O(1) per timer too.
+*
+*       The wheel is tickless: a bitmap of the slots holding timers gives
+*       the next tick anything happens on, runs jump straight to it and
+*       return how long the caller may sleep. A sleep may end early on a
+*       tick where an upper slot is spread, never late.
+*
+*       Everything but mqttnox_timer_kick must be called on the wheel's
+*       thread. Kicks come from any thread, under a spin lock.
+*
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* System Includes */
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+/* Library Includes */
+#include "mqttnox_timer.h"
+
+#define TIMER_MASK  (MQTTNOX_TIMER_SLOTS - 1)
+
+/**@brief Returns the index of the lowest set bit, bits must not be 0
+*/
+static uint32_t timer_ctz(uint64_t bits)
+{
+#if defined(__GNUC__)
+    return (uint32_t)__builtin_ctzll(bits);
+#elif defined(_MSC_VER)
+    unsigned long idx;
+
+    if ((uint32_t)bits != 0) {
+        _BitScanForward(&idx, (uint32_t)bits);
+        return (uint32_t)idx;
+    }
+
+    _BitScanForward(&idx, (uint32_t)(bits >> 32));
+    return (uint32_t)idx + 32;
+#else
+    uint32_t idx = 0;
+
+    while ((bits & 1) == 0) {
+        bits >>= 1;
+        idx++;
+    }
+    return idx;
+#endif
+}
+
+static void timer_kick_lock(mqttnox_timer_wheel_t* w)
+{
+    while (!mqttnox_atomic_cas(&w->kick_lock, 0, 1)) {
+        mqttnox_atomic_relax();
+    }
+}
+
+static void timer_kick_unlock(mqttnox_timer_wheel_t* w)
+{
+    mqttnox_atomic_store(&w->kick_lock, 0);
+}
+
+/**@brief Adds a timer to the slot its expiry hashes to on the wheel's level
+*
+* @note An expiry of now goes into the current slot of level 0, which is
+*       only done while spreading the slot expiring on this tick
+*/
+static void timer_link(mqttnox_timer_wheel_t* w, mqttnox_timer_t* t)
+{
+    uint64_t delta = t->expires - w->now;
+    uint32_t level = 0;
+    uint32_t idx;
+    mqttnox_timer_t** head;
+
+    while (level < MQTTNOX_TIMER_LEVELS - 1 &&
+           delta >= (1ULL << (MQTTNOX_TIMER_SLOT_BITS * (level + 1)))) {
+        level++;
+    }
+
+    idx = (uint32_t)(t->expires >> (MQTTNOX_TIMER_SLOT_BITS * level)) & TIMER_MASK;
+    head = &w->slot[level][idx];
+
+    t->next = *head;
+    if (t->next != NULL) {
+        t->next->pprev = &t->next;
+    }
+    *head = t;
+    t->pprev = head;
+
+    w->occupied[level] |= 1ULL << idx;
+}
+
+/**@brief Takes a timer off its list, clearing the slot's bit if it empties
+*/
+static void timer_unlink(mqttnox_timer_wheel_t* w, mqttnox_timer_t* t)
+{
+    mqttnox_timer_t** first = &w->slot[0][0];
+    mqttnox_timer_t** pprev = t->pprev;
+    size_t pos;
+
+    *pprev = t->next;
+    if (t->next != NULL) {
+        t->next->pprev = pprev;
+    }
+    t->pprev = NULL;
+
+    /* Only the first timer of a slot points back into the wheel */
+    if (*pprev == NULL && pprev >= first && pprev < first + MQTTNOX_TIMER_LEVELS * MQTTNOX_TIMER_SLOTS) {
+        pos = (size_t)(pprev - first);
+        w->occupied[pos / MQTTNOX_TIMER_SLOTS] &= ~(1ULL << (pos % MQTTNOX_TIMER_SLOTS));
+    }
+}
+
+/**@brief Moves the timers of a slot onto a list of the caller's
+*/
+static void timer_take_slot(mqttnox_timer_wheel_t* w, uint32_t level, uint32_t idx, mqttnox_timer_t** list)
+{
+    *list = w->slot[level][idx];
+    w->slot[level][idx] = NULL;
+    w->occupied[level] &= ~(1ULL << idx);
+
+    if (*list != NULL) {
+        (*list)->pprev = list;
+    }
+}
+
+/**@brief Finds the next tick after now that a slot holding timers is reached
+*
+* @return      0 if no timer is armed
+*/
+static uint64_t timer_next_tick(mqttnox_timer_wheel_t* w)
+{
+    uint64_t next = 0;
+    uint64_t tick;
+    uint64_t bits;
+    uint32_t shift;
+    uint32_t cur;
+    uint32_t level;
+
+    for (level = 0; level < MQTTNOX_TIMER_LEVELS; level++)
+    {
+        bits = w->occupied[level];
+        if (bits == 0) {
+            continue;
+        }
+
+        shift = MQTTNOX_TIMER_SLOT_BITS * level;
+        cur = (uint32_t)((w->now >> shift) + 1) & TIMER_MASK;
+
+        /* Slots from the one after now's, wrapping round to now's own */
+        bits = (bits >> cur) | (bits << ((MQTTNOX_TIMER_SLOTS - cur) & TIMER_MASK));
+#if MQTTNOX_TIMER_SLOT_BITS < 6
+        bits &= (1ULL << MQTTNOX_TIMER_SLOTS) - 1;
+#endif
+
+        tick = ((w->now >> shift) + 1 + timer_ctz(bits)) << shift;
+        if (next == 0 || tick < next) {
+            next = tick;
+        }
+    }
+
+    return next;
+}
+
+/**@brief Expires the timers on a list, each taken off it before its callback
+*
+* @note A callback may stop timers still on the list, or arm any timer
+*/
+static void timer_expire(mqttnox_timer_wheel_t* w, mqttnox_timer_t** list)
+{
+    mqttnox_timer_t* t;
+
+    while ((t = *list) != NULL)
+    {
+        timer_unlink(w, t);
+        w->count--;
+
+        t->cb(t, t->arg);
+    }
+}
+
+/**@brief Expires the timers kicked since the last run
+*/
+static void timer_run_kicks(mqttnox_timer_wheel_t* w)
+{
+    mqttnox_timer_t* list = NULL;
+    mqttnox_timer_t* t;
+
+    timer_kick_lock(w);
+
+    while ((t = w->kicks) != NULL)
+    {
+        w->kicks = t->kick_next;
+        mqttnox_atomic_store(&t->kicked, 0);
+
+        if (t->pprev != NULL) {
+            timer_unlink(w, t);
+        }
+        else {
+            w->count++;
+        }
+
+        t->next = list;
+        if (list != NULL) {
+            list->pprev = &t->next;
+        }
+        list = t;
+        t->pprev = &list;
+    }
+
+    timer_kick_unlock(w);
+
+    timer_expire(w, &list);
+}
+
+/**@brief Sets up a wheel
+*
+* @param[in]   w    wheel
+* @param[in]   now  mqttnox_hal_time_ms, or any millisecond clock used for
+*                   every run
+*/
+void mqttnox_timer_wheel_init(mqttnox_timer_wheel_t* w, uint32_t now)
+{
+    memset(w, 0, sizeof(*w));
+
+    w->clock = now;
+    mqttnox_atomic_store(&w->kick_lock, 0);
+}
+
+/**@brief Sets the function that wakes the wheel's thread for a kick
+*
+* @note Called from the kicking thread when the first kick since the last
+*       run arrives, so a loop sleeping in a tickless wait can run early
+*/
+void mqttnox_timer_wheel_set_wake(mqttnox_timer_wheel_t* w, void (*wake)(void* ctx), void* ctx)
+{
+    w->wake = wake;
+    w->wake_ctx = ctx;
+}
+
+/**@brief Expires every timer due by now
+*
+* @note Called every tick, or tickless, again after the time it returns.
+*       Timers armed by a callback count their delay from the tick being
+*       expired.
+*
+* @param[in]   w    wheel
+* @param[in]   now  same clock as mqttnox_timer_wheel_init
+*
+* @return      milliseconds until the next run is needed, 0 to run again
+*              straight away, MQTTNOX_TIMER_IDLE when no timer is armed
+*/
+uint32_t mqttnox_timer_wheel_run(mqttnox_timer_wheel_t* w, uint32_t now)
+{
+    mqttnox_timer_t* list;
+    mqttnox_timer_t* t;
+    uint64_t target = w->now + (uint32_t)(now - w->clock);
+    uint64_t tick;
+    uint32_t shift;
+    uint32_t level;
+    int kicked;
+
+    w->clock = now;
+
+    timer_run_kicks(w);
+
+    while (w->count != 0 && (tick = timer_next_tick(w)) <= target)
+    {
+        w->now = tick;
+
+        /* Spread the upper slots reached on this tick, top down, so their
+           timers land in the slots below before those are reached */
+        for (level = MQTTNOX_TIMER_LEVELS - 1; level > 0; level--)
+        {
+            shift = MQTTNOX_TIMER_SLOT_BITS * level;
+            if ((tick & ((1ULL << shift) - 1)) != 0) {
+                continue;
+            }
+
+            timer_take_slot(w, level, (uint32_t)(tick >> shift) & TIMER_MASK, &list);
+            while ((t = list) != NULL) {
+                timer_unlink(w, t);
+                timer_link(w, t);
+            }
+        }
+
+        timer_take_slot(w, 0, (uint32_t)tick & TIMER_MASK, &list);
+        timer_expire(w, &list);
+    }
+
+    w->now = target;
+
+    /* Kicked from another thread while the timers ran */
+    timer_kick_lock(w);
+    kicked = (w->kicks != NULL);
+    timer_kick_unlock(w);
+
+    if (kicked) {
+        return 0;
+    }
+
+    if (w->count == 0) {
+        return MQTTNOX_TIMER_IDLE;
+    }
+
+    tick = timer_next_tick(w) - target;
+
+    return (tick < MQTTNOX_TIMER_IDLE) ? (uint32_t)tick : MQTTNOX_TIMER_IDLE - 1;
+}
+
+/**@brief Sets up a timer, not armed
+*/
+void mqttnox_timer_init(mqttnox_timer_t* t, mqttnox_timer_cb_t cb, void* arg)
+{
+    memset(t, 0, sizeof(*t));
+
+    t->cb = cb;
+    t->arg = arg;
+}
+
+/**@brief Arms a timer, or moves it if armed already
+*
+* @param[in]   w         wheel
+* @param[in]   t         timer
+* @param[in]   delay_ms  counted from the last run, 0 expires on the next
+*                        tick and delays over MQTTNOX_TIMER_MAX_MS are cut
+*/
+void mqttnox_timer_start(mqttnox_timer_wheel_t* w, mqttnox_timer_t* t, uint32_t delay_ms)
+{
+    if (t->pprev != NULL) {
+        timer_unlink(w, t);
+    }
+    else {
+        w->count++;
+    }
+
+    if (delay_ms == 0) {
+        delay_ms = 1;
+    }
+    else if (delay_ms > MQTTNOX_TIMER_MAX_MS) {
+        delay_ms = MQTTNOX_TIMER_MAX_MS;
+    }
+
+    t->expires = w->now + delay_ms;
+    timer_link(w, t);
+}
+
+/**@brief Disarms a timer, dropping a kick not yet run
+*/
+void mqttnox_timer_stop(mqttnox_timer_wheel_t* w, mqttnox_timer_t* t)
+{
+    mqttnox_timer_t** link;
+
+    if (t->pprev != NULL) {
+        timer_unlink(w, t);
+        w->count--;
+    }
+
+    if (mqttnox_atomic_load(&t->kicked))
+    {
+        timer_kick_lock(w);
+
+        for (link = &w->kicks; *link != NULL; link = &(*link)->kick_next)
+        {
+            if (*link == t) {
+                *link = t->kick_next;
+                mqttnox_atomic_store(&t->kicked, 0);
+                break;
+            }
+        }
+
+        timer_kick_unlock(w);
+    }
+}
+
+/**@brief Returns non-zero while the timer is armed */
+int mqttnox_timer_armed(const mqttnox_timer_t* t)
+{
+    return t->pprev != NULL;
+}
+
+/**@brief Expires a timer on the next run, from any thread
+*
+* @note Whether armed or not. Kicking a timer already kicked does nothing.
+*/
+void mqttnox_timer_kick(mqttnox_timer_wheel_t* w, mqttnox_timer_t* t)
+{
+    int first = 0;
+
+    timer_kick_lock(w);
+
+    if (!mqttnox_atomic_load(&t->kicked)) {
+        mqttnox_atomic_store(&t->kicked, 1);
+        t->kick_next = w->kicks;
+        w->kicks = t;
+        first = (t->kick_next == NULL);
+    }
+
+    timer_kick_unlock(w);
+
+    if (first && w->wake != NULL) {
+        w->wake(w->wake_ctx);
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,67 @@
+/*****************************************************************************
+* Copyright (c) [2024] Argenox Technologies LLC
+* All rights reserved.
+*
+*
+*
+* NOTICE:  All information contained herein, source code, binaries and
+* derived works is, and remains the property of Argenox and its suppliers,
+* if any.  The intellectual and technical concepts contained
+* herein are proprietary to Argenox and its suppliers and may be covered
+* by U.S. and Foreign Patents, patents in process, and are protected by
+* trade secret or copyright law.
+*
+* Licensing of this software can be found in LICENSE
+*
+* THIS SOFTWARE IS PROVIDED BY ARGENOX "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ARGENOX LLC BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* CONTACT: info@argenox.com
+*
+* File:    mqttnox_timer.h
+* Summary: MQTTNox Timer Wheel
+*
+* Note: A wheel is run by one thread, usually the application's event
+*       loop, and shared by every client attached to it with
+*       mqttnox_wheel_attach. The application may arm its own timers on
+*       it as well.
+*
+*/
+
+#ifndef _MQTTNOX_TIMER_H_
+#define _MQTTNOX_TIMER_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "mqttnox.h"
+
+/* Longest delay, longer ones are cut to it */
+#define MQTTNOX_TIMER_MAX_MS  ((uint32_t)((1ULL << (MQTTNOX_TIMER_SLOT_BITS * MQTTNOX_TIMER_LEVELS)) - 1))
+
+
+extern void mqttnox_timer_wheel_init(mqttnox_timer_wheel_t* w, uint32_t now);
+extern void mqttnox_timer_wheel_set_wake(mqttnox_timer_wheel_t* w, void (*wake)(void* ctx), void* ctx);
+extern uint32_t mqttnox_timer_wheel_run(mqttnox_timer_wheel_t* w, uint32_t now);
+extern void mqttnox_timer_init(mqttnox_timer_t* t, mqttnox_timer_cb_t cb, void* arg);
+extern void mqttnox_timer_start(mqttnox_timer_wheel_t* w, mqttnox_timer_t* t, uint32_t delay_ms);
+extern void mqttnox_timer_stop(mqttnox_timer_wheel_t* w, mqttnox_timer_t* t);
+extern int mqttnox_timer_armed(const mqttnox_timer_t* t);
+extern void mqttnox_timer_kick(mqttnox_timer_wheel_t* w, mqttnox_timer_t* t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _MQTTNOX_TIMER_H_ */
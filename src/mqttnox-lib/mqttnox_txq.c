@@ -0,0 +1,282 @@
+/*****************************************************************************
+* Copyright (c) [2024] Argenox Technologies LLC
+* All rights reserved.
+*
+*
+*
+* NOTICE:  All information contained herein, source code, binaries and
+* derived works is, and remains the property of Argenox and its suppliers,
+* if any.  The intellectual and technical concepts contained
+* herein are proprietary to Argenox and its suppliers and may be covered
+* by U.S. and Foreign Patents, patents in process, and are protected by
+* trade secret or copyright law.
+*
+* Licensing of this software can be found in LICENSE
+*
+* THIS SOFTWARE IS PROVIDED BY ARGENOX "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ARGENOX LLC BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* CONTACT: info@argenox.com
+*
+* File:    mqttnox_txq.c
+* Summary: MQTTNox Lock-Free Outbound Queue
+*
+* Note: Bounded multi-producer single-consumer queue of encoded packets.
+*
+*       The buffer is split into fixed slots, each with a sequence number.
+*       A slot at position pos is free when seq == pos. A producer claims
+*       a run of slots by moving enq_pos forward with a CAS, writes the
+*       packet and then stores seq = pos + 1 on the first slot. The writer
+*       sends frames whose first slot reads pos + 1 and frees every slot by
+*       storing pos + MQTTNOX_TX_QUEUE_SLOTS. Slots are freed in order, so
+*       a producer only has to check the last slot of the run it wants.
+*
+*       Frames never wrap: when a run would cross the end of the buffer the
+*       slots up to the end are claimed as well and committed as padding.
+*
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* System Includes */
+#include <stdint.h>
+#include <string.h>
+
+/* Library Includes */
+#include "mqttnox_txq.h"
+
+#define TXQ_MASK   (MQTTNOX_TX_QUEUE_SLOTS - 1)
+
+/**@brief Empties the queue
+*
+* @note Not thread safe, call only while no other thread uses the client
+*
+* @param[in]   q   queue
+*/
+void mqttnox_txq_init(mqttnox_txq_t* q)
+{
+    uint32_t i;
+
+    for (i = 0; i < MQTTNOX_TX_QUEUE_SLOTS; i++) {
+        mqttnox_atomic_store(&q->seq[i], i);
+    }
+
+    mqttnox_atomic_store(&q->deq_pos, 0);
+    mqttnox_atomic_store(&q->enq_pos, 0);
+    mqttnox_atomic_store(&q->writer, 0);
+}
+
+/**@brief Reserves contiguous space for one frame
+*
+* @note Safe to call from any number of threads. The space must be handed
+*       back with mqttnox_txq_commit, frames behind it are held until then.
+*
+* @param[in]   q     queue
+* @param[in]   size  bytes needed, at most MQTTNOX_TXQ_FRAME_MAX
+* @param[out]  res   reservation to pass to mqttnox_txq_commit
+*
+* @return      start of the reserved space, NULL if the queue is full or
+*              size is too large
+*/
+uint8_t* mqttnox_txq_reserve(mqttnox_txq_t* q, uint32_t size, mqttnox_txq_res_t* res)
+{
+    uint32_t slots = (size + MQTTNOX_TX_QUEUE_SLOT_SIZE - 1) / MQTTNOX_TX_QUEUE_SLOT_SIZE;
+    uint32_t pos;
+    uint32_t idx;
+    uint32_t pad;
+    uint32_t last;
+    int32_t diff;
+
+    if (slots == 0 || slots > MQTTNOX_TXQ_FRAME_MAX_SLOTS) {
+        return NULL;
+    }
+
+    for (;;)
+    {
+        pos = mqttnox_atomic_load(&q->enq_pos);
+        idx = pos & TXQ_MASK;
+        pad = (idx + slots > MQTTNOX_TX_QUEUE_SLOTS) ? MQTTNOX_TX_QUEUE_SLOTS - idx : 0;
+        last = pos + pad + slots - 1;
+
+        diff = (int32_t)(mqttnox_atomic_load(&q->seq[last & TXQ_MASK]) - last);
+        if (diff < 0) {
+            /* Last slot still holds a frame from the previous lap */
+            return NULL;
+        }
+
+        /* diff > 0: another producer moved enq_pos since it was read */
+        if (diff == 0 && mqttnox_atomic_cas(&q->enq_pos, pos, pos + pad + slots)) {
+            break;
+        }
+    }
+
+    if (pad > 0) {
+        q->frame[idx].len = MQTTNOX_TXQ_PAD;
+        q->frame[idx].slots = (uint16_t)pad;
+        q->frame[idx].off = 0;
+        mqttnox_atomic_store(&q->seq[idx], pos + 1);
+
+        pos += pad;
+        idx = 0;
+    }
+
+    res->pos = pos;
+    res->slots = slots;
+
+    return &q->buf[idx * MQTTNOX_TX_QUEUE_SLOT_SIZE];
+}
+
+/**@brief Makes a reserved frame available to the writer
+*
+* @param[in]   q      queue
+* @param[in]   res    reservation from mqttnox_txq_reserve
+* @param[in]   start  first byte to send, inside the reserved space
+* @param[in]   len    bytes to send, 0 to give the space back unused
+*/
+void mqttnox_txq_commit(mqttnox_txq_t* q, const mqttnox_txq_res_t* res, const uint8_t* start, uint32_t len)
+{
+    uint32_t idx = res->pos & TXQ_MASK;
+
+    q->frame[idx].len = len;
+    q->frame[idx].slots = (uint16_t)res->slots;
+    q->frame[idx].off = (uint8_t)(start - &q->buf[idx * MQTTNOX_TX_QUEUE_SLOT_SIZE]);
+
+    mqttnox_atomic_store(&q->seq[idx], res->pos + 1);
+
+    /* Pairs with the fence in mqttnox_txq_writer_release: either this
+       thread becomes the writer or the old writer sees the frame */
+    mqttnox_atomic_fence();
+}
+
+/**@brief Tries to become the queue's writer
+*
+* @return      non-zero if the caller is now the only thread sending
+*/
+int mqttnox_txq_writer_try(mqttnox_txq_t* q)
+{
+    return mqttnox_atomic_cas(&q->writer, 0, 1);
+}
+
+/**@brief Gives up the writer role
+*
+* @note Check mqttnox_txq_ready afterwards, a frame committed while the
+*       role was held may have found no writer to send it
+*/
+void mqttnox_txq_writer_release(mqttnox_txq_t* q)
+{
+    mqttnox_atomic_store(&q->writer, 0);
+    mqttnox_atomic_fence();
+}
+
+/**@brief Checks whether the next frame is committed
+*/
+int mqttnox_txq_ready(mqttnox_txq_t* q)
+{
+    uint32_t pos = mqttnox_atomic_load(&q->deq_pos);
+
+    return mqttnox_atomic_load(&q->seq[pos & TXQ_MASK]) == pos + 1;
+}
+
+/**@brief Returns the position after the last reserved slot
+*
+* @note Frames reserved before this call are sent once
+*       mqttnox_txq_sent reports this position
+*/
+uint32_t mqttnox_txq_tail(mqttnox_txq_t* q)
+{
+    return mqttnox_atomic_load(&q->enq_pos);
+}
+
+/**@brief Checks whether every frame before pos has been released
+*
+* @note Writer only
+*/
+int mqttnox_txq_sent(mqttnox_txq_t* q, uint32_t pos)
+{
+    return (int32_t)(mqttnox_atomic_load(&q->deq_pos) - pos) >= 0;
+}
+
+/**@brief Returns the bytes of queue space in use
+*
+* @note Counts whole slots, reserved and committed frames alike. Safe from
+*       any thread, the value may be stale by the time it is used.
+*/
+uint32_t mqttnox_txq_used(mqttnox_txq_t* q)
+{
+    uint32_t deq = mqttnox_atomic_load(&q->deq_pos);
+
+    return (mqttnox_atomic_load(&q->enq_pos) - deq) * MQTTNOX_TX_QUEUE_SLOT_SIZE;
+}
+
+/**@brief Collects committed frames for one send
+*
+* @note Writer only. Frames stay queued until mqttnox_txq_release.
+*
+* @param[in]   q        queue
+* @param[out]  iov      one segment per frame
+* @param[in]   iov_max  number of entries in iov
+* @param[out]  slots    slots covered by the collected frames, 0 if none
+*
+* @return      number of segments filled
+*/
+uint8_t mqttnox_txq_peek(mqttnox_txq_t* q, mqttnox_iovec_t* iov, uint8_t iov_max, uint32_t* slots)
+{
+    uint32_t pos = mqttnox_atomic_load(&q->deq_pos);
+    uint32_t idx;
+    uint8_t cnt = 0;
+    mqttnox_txq_frame_t* f;
+
+    while (cnt < iov_max)
+    {
+        idx = pos & TXQ_MASK;
+        if (mqttnox_atomic_load(&q->seq[idx]) != pos + 1) {
+            break;
+        }
+
+        f = &q->frame[idx];
+        if (f->len != MQTTNOX_TXQ_PAD && f->len > 0) {
+            iov[cnt].data = &q->buf[idx * MQTTNOX_TX_QUEUE_SLOT_SIZE + f->off];
+            iov[cnt].len = f->len;
+            cnt++;
+        }
+
+        pos += f->slots;
+    }
+
+    *slots = pos - mqttnox_atomic_load(&q->deq_pos);
+
+    return cnt;
+}
+
+/**@brief Frees the slots of frames that have been sent
+*
+* @note Writer only
+*
+* @param[in]   q      queue
+* @param[in]   slots  slots reported by mqttnox_txq_peek
+*/
+void mqttnox_txq_release(mqttnox_txq_t* q, uint32_t slots)
+{
+    uint32_t pos = mqttnox_atomic_load(&q->deq_pos);
+    uint32_t i;
+
+    for (i = 0; i < slots; i++) {
+        mqttnox_atomic_store(&q->seq[(pos + i) & TXQ_MASK], pos + i + MQTTNOX_TX_QUEUE_SLOTS);
+    }
+
+    mqttnox_atomic_store(&q->deq_pos, pos + slots);
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,89 @@
+/*****************************************************************************
+* Copyright (c) [2024] Argenox Technologies LLC
+* All rights reserved.
+*
+*
+*
+* NOTICE:  All information contained herein, source code, binaries and
+* derived works is, and remains the property of Argenox and its suppliers,
+* if any.  The intellectual and technical concepts contained
+* herein are proprietary to Argenox and its suppliers and may be covered
+* by U.S. and Foreign Patents, patents in process, and are protected by
+* trade secret or copyright law.
+*
+* Licensing of this software can be found in LICENSE
+*
+* THIS SOFTWARE IS PROVIDED BY ARGENOX "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL ARGENOX LLC BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* CONTACT: info@argenox.com
+*
+* File:    mqttnox_txq.h
+* Summary: MQTTNox Outbound Queue
+*
+* Note: Internal to the library. Producers reserve slots with a CAS on
+*       enq_pos, encode straight into them and commit by publishing the
+*       first slot's sequence number. A single writer at a time, elected
+*       with mqttnox_txq_writer_try, sends committed frames in order and
+*       hands their slots back.
+*
+*/
+
+#ifndef _MQTTNOX_TXQ_H_
+#define _MQTTNOX_TXQ_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "mqttnox.h"
+#include "mqttnox_tal.h"
+
+/* Frames may use at most half the queue so a reservation that has to skip
+   the end of the buffer still fits */
+#define MQTTNOX_TXQ_FRAME_MAX_SLOTS  (MQTTNOX_TX_QUEUE_SLOTS / 2)
+#define MQTTNOX_TXQ_FRAME_MAX        (MQTTNOX_TXQ_FRAME_MAX_SLOTS * MQTTNOX_TX_QUEUE_SLOT_SIZE)
+
+/* Frame length marking the unused slots at the end of the buffer */
+#define MQTTNOX_TXQ_PAD              0xFFFFFFFFUL
+
+#if (MQTTNOX_TX_QUEUE_SLOTS & (MQTTNOX_TX_QUEUE_SLOTS - 1)) != 0
+#error "MQTTNOX_TX_QUEUE_SLOTS must be a power of two"
+#endif
+
+/** Slots reserved by a producer, \see mqttnox_txq_reserve */
+typedef struct
+{
+    uint32_t pos;
+    uint32_t slots;
+
+} mqttnox_txq_res_t;
+
+
+extern void mqttnox_txq_init(mqttnox_txq_t* q);
+extern uint8_t* mqttnox_txq_reserve(mqttnox_txq_t* q, uint32_t size, mqttnox_txq_res_t* res);
+extern void mqttnox_txq_commit(mqttnox_txq_t* q, const mqttnox_txq_res_t* res, const uint8_t* start, uint32_t len);
+extern int mqttnox_txq_writer_try(mqttnox_txq_t* q);
+extern void mqttnox_txq_writer_release(mqttnox_txq_t* q);
+extern int mqttnox_txq_ready(mqttnox_txq_t* q);
+extern uint32_t mqttnox_txq_tail(mqttnox_txq_t* q);
+extern int mqttnox_txq_sent(mqttnox_txq_t* q, uint32_t pos);
+extern uint32_t mqttnox_txq_used(mqttnox_txq_t* q);
+extern uint8_t mqttnox_txq_peek(mqttnox_txq_t* q, mqttnox_iovec_t* iov, uint8_t iov_max, uint32_t* slots);
+extern void mqttnox_txq_release(mqttnox_txq_t* q, uint32_t slots);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _MQTTNOX_TXQ_H_ */
@@ -31,8 +31,17 @@
 *
 */
 
+#if defined(__linux__)
+#define _GNU_SOURCE /* memfd_create */
+#endif
+
 #include <string.h>
 
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
 #include "mqttnoxlib.h"
 
 /**@brief Validates Device ID
@@ -48,12 +57,16 @@ int mqttnoxlib_validate_device_id(const char * str)
 {
 	int i = 0;
 
-	if (str == NULL || strlen(str) >= MQTT_MAX_DEVICE_ID_LEN) {
+	if (str == NULL) {
 		return -1;
 	}
 
-	for (i = 0; i < strlen(str); i++)
+	for (i = 0; str[i] != '\0'; i++)
 	{
+		if (i + 1 >= MQTT_MAX_DEVICE_ID_LEN) {
+			return -1;
+		}
+
 		/* [MQTT-3.1.3-5] */
 		if (!((str[i] >= '0' && str[i] <= '9') ||
 			  (str[i] >= 'A' && str[i] <= 'Z') ||
@@ -65,3 +78,76 @@ int mqttnoxlib_validate_device_id(const char * str)
 
 	return 0;
 }
+
+/**@brief Creates a mirrored receive ring
+*
+* @note The same pages are mapped twice back to back, so any span of up to
+*       size bytes starting inside the first mapping is contiguous. Only
+*       available on Linux.
+*
+* @param[in]   size   ring size, a power of two and a multiple of the page size
+*
+* @return     base of the ring, NULL if it could not be created
+*/
+uint8_t* mqttnoxlib_rx_ring_create(uint32_t size)
+{
+#if defined(__linux__)
+	uint8_t* base;
+	long page = sysconf(_SC_PAGESIZE);
+	int fd;
+
+	if (size == 0 || (size & (size - 1)) != 0 || page <= 0 || (size % (uint32_t)page) != 0) {
+		return NULL;
+	}
+
+	fd = memfd_create("mqttnox_rx", MFD_CLOEXEC);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	if (ftruncate(fd, size) != 0) {
+		close(fd);
+		return NULL;
+	}
+
+	/* Reserve both halves first so the two mappings are adjacent */
+	base = (uint8_t*)mmap(NULL, 2 * (size_t)size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == (uint8_t*)MAP_FAILED) {
+		close(fd);
+		return NULL;
+	}
+
+	if (mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+		mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+	{
+		munmap(base, 2 * (size_t)size);
+		close(fd);
+		return NULL;
+	}
+
+	/* The mappings keep the memory alive */
+	close(fd);
+
+	return base;
+#else
+	(void)size;
+	return NULL;
+#endif
+}
+
+/**@brief Releases a ring created by mqttnoxlib_rx_ring_create
+*
+* @param[in]   ring   base of the ring, may be NULL
+* @param[in]   size   size the ring was created with
+*/
+void mqttnoxlib_rx_ring_release(uint8_t* ring, uint32_t size)
+{
+#if defined(__linux__)
+	if (ring != NULL) {
+		munmap(ring, 2 * (size_t)size);
+	}
+#else
+	(void)ring;
+	(void)size;
+#endif
+}
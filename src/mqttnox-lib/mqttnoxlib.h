@@ -41,6 +41,7 @@ extern "C" {
 #endif
 
 #include <stdint.h>
+#include <string.h>
 #include "mqttnox_err.h"
 #include "common.h"
 
@@ -55,6 +56,15 @@ extern "C" {
 #define MAX_STR_LEN                   64
 #define MQTT_LENGTH_FIELD_OFFSET      1
 
+/* Largest remaining length that fits in four bytes */
+#define MQTTNOX_REMAIN_LEN_MAX        268435455
+
+/* Fixed header byte plus the longest remaining length */
+#define MQTTNOX_FIXED_HDR_MAX_LEN     (1 + 4)
+
+/* First byte of the fixed header */
+#define MQTTNOX_HDR_BYTE(type, flags) ((uint8_t)(((type) << 4) | ((flags) & 0x0F)))
+
 typedef enum
 {
     MQTTNOX_CONNECTION_RC_ACCEPTED                = 0x00,
@@ -219,10 +229,165 @@ typedef struct
 
 #pragma pack(pop)
 
+/** Receive decoder states, \see mqttnox_rx_decoder_t */
+typedef enum {
+
+    MQTTNOX_RX_STATE_FIXED_HDR  = 0, /* Waiting for the first byte of a packet */
+    MQTTNOX_RX_STATE_REMAIN_LEN = 1, /* Decoding the remaining length */
+    MQTTNOX_RX_STATE_BODY       = 2, /* Consuming the variable header and payload */
+    MQTTNOX_RX_STATE_DISCARD    = 3, /* Skipping a packet that cannot be buffered */
+    MQTTNOX_RX_STATE_STREAM_HDR = 4, /* Staging the variable header of a streamed PUBLISH */
+    MQTTNOX_RX_STATE_STREAM_PAYLOAD = 5, /* Delivering a streamed PUBLISH payload */
+
+} mqttnox_rx_state_t;
+
+/** Who may touch the receive decoder, \see mqttnox_client_t rx_gate */
+typedef enum {
+
+    MQTTNOX_RX_GATE_OPEN   = 0, /* Free, the next delivery takes it */
+    MQTTNOX_RX_GATE_BUSY   = 1, /* mqttnox_tcp_rcv_func is decoding */
+    MQTTNOX_RX_GATE_CLOSED = 2, /* A reconnect is resetting the decoder, deliveries are dropped */
+
+} mqttnox_rx_gate_t;
+
+
+
+/** String view, the length is carried instead of scanned for */
+typedef struct
+{
+    const char* data;
+    uint32_t len;
+
+} mqttnox_str_t;
+
+/** Bounds-checked packet write cursor
+ *
+ * The body is written from MQTTNOX_FIXED_HDR_MAX_LEN onwards so the fixed
+ * header and remaining length can be placed in front of it once the body
+ * length is known. Writes past the end are dropped and set err, which is
+ * checked once in mqttnox_wr_finish.
+ */
+typedef struct
+{
+    uint8_t* buf;
+    uint32_t size;
+    uint32_t pos;
+    uint8_t err;
+
+} mqttnox_wr_t;
 
 
 extern int mqttnoxlib_validate_device_id(const char* str);
 
+/* Packet codec, used by mqttnox.c and the benchmarks */
+extern int mqttnox_encode_remain_len(uint8_t* buffer, uint32_t len);
+extern int mqttnox_set_remain_len(uint8_t* buffer, uint32_t len);
+extern int mqttnox_decode_remain_len(uint8_t* buffer, uint32_t* len);
+extern uint8_t* mqttnoxlib_rx_ring_create(uint32_t size);
+extern void mqttnoxlib_rx_ring_release(uint8_t* ring, uint32_t size);
+
+
+/**@brief Makes a string view of a null terminated string, NULL gives an empty view */
+static inline mqttnox_str_t mqttnox_str(const char* str)
+{
+    mqttnox_str_t s;
+
+    s.data = str;
+    s.len = (str != NULL) ? (uint32_t)strlen(str) : 0;
+
+    return s;
+}
+
+/**@brief Starts a packet in buf, leaving room for the fixed header */
+static inline void mqttnox_wr_init(mqttnox_wr_t* w, uint8_t* buf, uint32_t size)
+{
+    w->buf = buf;
+    w->size = size;
+    w->pos = MQTTNOX_FIXED_HDR_MAX_LEN;
+    w->err = (size < MQTTNOX_FIXED_HDR_MAX_LEN);
+}
+
+static inline void mqttnox_wr_u8(mqttnox_wr_t* w, uint8_t val)
+{
+    if (w->pos < w->size) {
+        w->buf[w->pos++] = val;
+    }
+    else {
+        w->err = 1;
+    }
+}
+
+/**@brief Writes a 16-bit value in network order */
+static inline void mqttnox_wr_u16(mqttnox_wr_t* w, uint16_t val)
+{
+    if (w->size - w->pos >= 2) {
+        w->buf[w->pos] = MSB(val);
+        w->buf[w->pos + 1] = LSB(val);
+        w->pos += 2;
+    }
+    else {
+        w->err = 1;
+    }
+}
+
+static inline void mqttnox_wr_bytes(mqttnox_wr_t* w, const void* data, uint32_t len)
+{
+    if (w->size - w->pos >= len) {
+        memcpy(&w->buf[w->pos], data, len);
+        w->pos += len;
+    }
+    else {
+        w->err = 1;
+    }
+}
+
+/**@brief Writes a length prefixed UTF-8 string, \see [MQTT-1.5.3] */
+static inline void mqttnox_wr_str(mqttnox_wr_t* w, mqttnox_str_t str)
+{
+    if (str.len > 0xFFFF || w->size - w->pos < 2 + str.len) {
+        w->err = 1;
+        return;
+    }
+
+    w->buf[w->pos] = MSB(str.len);
+    w->buf[w->pos + 1] = LSB(str.len);
+    memcpy(&w->buf[w->pos + 2], str.data, str.len);
+    w->pos += 2 + str.len;
+}
+
+/**@brief Completes a packet by placing the fixed header in front of the body
+ *
+ * @param[in]   w       write cursor
+ * @param[in]   hdr     first byte of the fixed header \see MQTTNOX_HDR_BYTE
+ * @param[out]  pkt_len length of the whole packet
+ *
+ * @return      start of the packet inside the buffer, NULL if a write overflowed
+ */
+static inline uint8_t* mqttnox_wr_finish(mqttnox_wr_t* w, uint8_t hdr, uint32_t* pkt_len)
+{
+    uint8_t len_buf[4];
+    uint32_t body_len = w->pos - MQTTNOX_FIXED_HDR_MAX_LEN;
+    int len_bytes;
+    uint8_t* start;
+
+    if (w->err) {
+        return NULL;
+    }
+
+    len_bytes = mqttnox_encode_remain_len(len_buf, body_len);
+    if (len_bytes <= 0) {
+        return NULL;
+    }
+
+    start = &w->buf[MQTTNOX_FIXED_HDR_MAX_LEN - len_bytes - 1];
+    start[0] = hdr;
+    memcpy(&start[1], len_buf, len_bytes);
+
+    *pkt_len = body_len + len_bytes + 1;
+
+    return start;
+}
+
 
 #ifdef __cplusplus
 }